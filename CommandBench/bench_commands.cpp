@@ -0,0 +1,326 @@
+/*! \file bench_commands.cpp
+ * \brief Command line user interface for checking and timing the logger's command dispatch on a host.
+ *
+ * This runs the same command parsing and table lookup as the logger firmware against the logger's own
+ * table of verbs (which the firmware checks its handlers against at compile time), checks that every verb
+ * is found (and nothing else), and times dispatch of a mix of commands against the chain of prefix
+ * comparisons that it replaced.  It also checks that batches of commands are split as they should be (and
+ * that free text, such as certificates and passwords, isn't), and that the line reader used for serial
+ * input assembles long lines from blocks of any size, and times it.
+ *
+ */
+/// Copyright 2024 Center for Coastal and Ocean Mapping & NOAA-UNH Joint
+/// Hydrographic Center, University of New Hampshire.
+///
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights to use,
+/// copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+/// and to permit persons to whom the Software is furnished to do so, subject to
+/// the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+/// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+/// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+/// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+/// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+/// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+/// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+/// OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdio.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "CommandVerbs.h"
+
+typedef cmd::Verb Entry;                         ///< Entry in the firmware's command table
+static constexpr Entry const (&commands)[cmd::VerbCount] = cmd::Verbs;  ///< Firmware's command table
+const size_t CommandCount = cmd::VerbCount;     ///< Number of verbs in the table
+
+/// Typical mix of commands, as sent by the web interface and automation (mostly status polling, with
+/// some configuration).
+
+static const char *mix[] = {
+    "status", "filecount", "heap", "sizes", "version", "configure on live 192.168.4.255 40182",
+    "uniqueid", "upload", "webserver", "wireless on", "transfer 12", "setup {\"version\": {\"commandproc\": \"1.5.0\"}}"
+};
+
+const size_t MixCount = sizeof(mix)/sizeof(mix[0]);    ///< Number of commands in the mix
+
+/// Monotonic nanosecond clock for timing.
+///
+/// \return Current monotonic time (ns)
+
+uint64_t monotonic_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec)*1000000000 + ts.tv_nsec;
+}
+
+/// Dispatch a single command through the table, as the firmware does, without running anything.
+///
+/// \param line Command to dispatch
+/// \return Entry for the command, or nullptr if it isn't recognised (or has the wrong form)
+
+Entry const *table_dispatch(cmd::Token const& line)
+{
+    cmd::Command command;
+    command.Parse(line);
+    Entry const *entry = cmd::Lookup(commands, command.verb);
+    if (entry == nullptr) return nullptr;
+    if (command.rest.Empty() && entry->report) return entry;
+    return entry->configure ? entry : nullptr;
+}
+
+/// Dispatch a single command by comparing its start with each verb in turn, and copying out the arguments,
+/// as the firmware used to before the table.
+///
+/// \param line Command to dispatch
+/// \param args (Out) Arguments of the command
+/// \return Entry for the command, or nullptr if it isn't recognised
+
+Entry const *chain_dispatch(std::string const& line, std::string& args)
+{
+    for (size_t n = 0; n < CommandCount; ++n) {
+        size_t length = strlen(commands[n].verb);
+        if (line.compare(0, length, commands[n].verb) == 0) {
+            args = line.length() > length ? line.substr(length + 1) : std::string();
+            return commands + n;
+        }
+    }
+    return nullptr;
+}
+
+/// Check that every verb in the table is found (with and without arguments, as allowed), and that
+/// near-misses are not.
+///
+/// \return True if all of the checks pass, otherwise False
+
+bool check_table(void)
+{
+    bool ok = true;
+    for (size_t n = 0; n < CommandCount; ++n) {
+        std::string with_args = std::string(commands[n].verb) + " x";
+        std::string longer = std::string(commands[n].verb) + "x";
+        cmd::Token bare(commands[n].verb, strlen(commands[n].verb));
+        cmd::Token with(with_args.c_str(), with_args.length());
+        cmd::Token miss(longer.c_str(), longer.length());
+        if ((table_dispatch(bare) == commands + n) != (commands[n].report || commands[n].configure) ||
+            (table_dispatch(with) == commands + n) != commands[n].configure ||
+            table_dispatch(miss) != nullptr) {
+            std::cerr << "error: dispatch of \"" << commands[n].verb << "\" is not as expected.\n";
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+/// Check that batches of commands are split at semicolons (but not inside JSON), that line ends never split
+/// commands, and that commands taking free text get the rest of the request, as the web interface and the
+/// desktop tools rely on (e.g., for "auth cert" with a multi-line PEM certificate).
+///
+/// \return True if all of the checks pass, otherwise False
+
+bool check_batches(void)
+{
+    const std::string pem = "-----BEGIN CERTIFICATE-----\nMIIBszCCAVmgAwIBAgIUJ5r;\r\nQkZ0x+/abc==\n-----END CERTIFICATE-----";
+    struct Case {
+        std::string                 batch;      ///< Request as sent
+        std::vector<std::string>    commands;   ///< Commands that it should be split into
+    } cases[] = {
+        { "status; heap;;filecount", { "status", "heap", "filecount" } },
+        { "status\r\n;\n heap", { "status", "heap" } },
+        { "setup {\"a\": \"b;c\", \"d\": [1;2]}; status", { "setup {\"a\": \"b;c\", \"d\": [1;2]}", "status" } },
+        { "lab defaults {\n  \"a\": \"b\"\n}\n", { "lab defaults {\n  \"a\": \"b\"\n}" } },
+        { "auth cert " + pem + "\n", { "auth cert " + pem } },
+        { "password station abc;def", { "password station abc;def" } },
+        { "status; ssid station my;network", { "status", "ssid station my;network" } },
+        { "shipname A ship; with a semicolon", { "shipname A ship; with a semicolon" } },
+        { "auth token abc;def\n", { "auth token abc;def" } }
+    };
+    bool ok = true;
+    for (size_t n = 0; n < sizeof(cases)/sizeof(cases[0]); ++n) {
+        const char *text = cases[n].batch.c_str(), *end = text + cases[n].batch.length();
+        cmd::Token line;
+        std::vector<std::string> commands;
+        while (cmd::NextCommand(text, end, line, cmd::FreeText)) {
+            commands.push_back(std::string(line.text, line.length));
+            if (table_dispatch(line) == nullptr) {
+                std::cerr << "error: command \"" << commands.back() << "\" is not recognised.\n";
+                ok = false;
+            }
+        }
+        if (commands != cases[n].commands) {
+            std::cerr << "error: batch \"" << cases[n].batch << "\" split into " << commands.size()
+                << " command(s), expected " << cases[n].commands.size() << ".\n";
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+/// Feed text to a line reader in blocks of the size given (as it would arrive from the serial port), and
+/// collect the lines that come out.
+///
+/// \param reader  Line reader to use
+/// \param text    Text to feed in
+/// \param block   Size of the blocks to feed in
+/// \param lines   (Out) Lines assembled (or "!" followed by the length, for lines that overflowed)
+
+void read_lines(cmd::LineReader& reader, std::string const& text, size_t block, std::vector<std::string>& lines)
+{
+    lines.clear();
+    for (size_t start = 0; start < text.length(); start += block) {
+        size_t end = std::min(start + block, text.length()), used = start;
+        while (used < end) {
+            used += reader.Append(text.c_str() + used, end - used);
+            if (reader.Complete()) {
+                if (reader.Overflowed()) {
+                    lines.push_back("!" + std::to_string(reader.Dropped()));
+                } else {
+                    lines.push_back(std::string(reader.Line().text, reader.Line().length));
+                }
+                reader.Clear();
+            }
+        }
+    }
+}
+
+/// Check that the line reader assembles short and long lines from blocks of various sizes, deals with
+/// backspaces, and discards lines that are too long.
+///
+/// \return True if all of the checks pass, otherwise False
+
+bool check_reader(void)
+{
+    std::string setup = "setup {\"data\": \"" + std::string(10000, 'x') + "\"}";
+    std::string text = "status\n" + setup + "\nhx\bexx\b\bap\n\n" + std::string(20000, 'y') + "\nversion\n";
+    std::vector<std::string> expected = { "status", setup, "heap", "", "!20000", "version" };
+    const size_t blocks[] = { 1, 7, 64, 256, 100000 };
+    bool ok = true;
+    for (size_t b = 0; b < sizeof(blocks)/sizeof(blocks[0]); ++b) {
+        cmd::LineReader reader(128, 16384);
+        std::vector<std::string> lines;
+        read_lines(reader, text, blocks[b], lines);
+        if (lines != expected) {
+            std::cerr << "error: line reader with " << blocks[b] << " B blocks did not assemble the lines expected.\n";
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+/// Report the syntax of the programme for the user.  Since the code is designed to be very
+/// simple, there is only basic processing (rather than something like Boost.program_options).
+
+void syntax(void)
+{
+    std::cout << "syntax: bench_commands [-n <iterations>] [-c <commands>]\n";
+}
+
+/// Check the command line options are appropriate, and pick out the configuration options
+/// as required.
+///
+/// \param argc         Count of the number of arguments on the command line
+/// \param argv         Vector of the arguments making up the command line
+/// \param iterations   (Out) Reference for the number of passes over the command mix
+/// \param batch        (Out) Reference for a batch of commands to split and dispatch (if any)
+/// \return True if the parse worked, otherwise false.
+
+bool check_options(int argc, char **argv, uint32_t& iterations, std::string& batch)
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "n:c:")) != -1) {
+        switch (ch) {
+            case 'n':
+                iterations = strtoul(optarg, nullptr, 0);
+                break;
+            case 'c':
+                batch = std::string(optarg);
+                break;
+            case '?':
+            default:
+                syntax();
+                return false;
+                break;
+        }
+    }
+    if (iterations == 0) {
+        syntax();
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t iterations = 100000;
+    std::string batch;
+    if (!check_options(argc, argv, iterations, batch))
+        return 1;
+
+    if (!batch.empty()) {
+        const char *text = batch.c_str(), *end = text + batch.length();
+        cmd::Token line;
+        while (cmd::NextCommand(text, end, line, cmd::FreeText)) {
+            Entry const *entry = table_dispatch(line);
+            printf("\"%.*s\" -> %s\n", static_cast<int>(line.length), line.text, entry ? entry->verb : "not recognised");
+        }
+        return 0;
+    }
+
+    if (!check_table() || !check_batches() || !check_reader())
+        return 2;
+    printf("table: %zu verbs, checks pass; batch and line reader checks pass\n", CommandCount);
+
+    cmd::Token tokens[MixCount];
+    std::string strings[MixCount];
+    for (size_t n = 0; n < MixCount; ++n) {
+        tokens[n] = cmd::Token(mix[n], strlen(mix[n]));
+        strings[n] = mix[n];
+    }
+    size_t found = 0;
+    uint64_t start = monotonic_clock();
+    for (uint32_t i = 0; i < iterations; ++i) {
+        for (size_t n = 0; n < MixCount; ++n) {
+            if (table_dispatch(tokens[n]) != nullptr) ++found;
+        }
+    }
+    uint64_t table_time = monotonic_clock() - start;
+    std::string args;
+    start = monotonic_clock();
+    for (uint32_t i = 0; i < iterations; ++i) {
+        for (size_t n = 0; n < MixCount; ++n) {
+            if (chain_dispatch(strings[n], args) != nullptr) ++found;
+        }
+    }
+    uint64_t chain_time = monotonic_clock() - start;
+
+    std::string long_line = "setup {\"data\": \"" + std::string(8000, 'x') + "\"}\n";
+    cmd::LineReader reader(128, 16384);
+    std::vector<std::string> lines;
+    uint32_t passes = std::max<uint32_t>(iterations / 100, 1);
+    start = monotonic_clock();
+    for (uint32_t i = 0; i < passes; ++i) {
+        read_lines(reader, long_line, 256, lines);
+    }
+    uint64_t reader_time = monotonic_clock() - start;
+
+    double commands_run = static_cast<double>(iterations) * MixCount;
+    printf("%-8s %12s\n", "method", "ns/command");
+    printf("%-8s %12.1f\n", "table", table_time / commands_run);
+    printf("%-8s %12.1f\n", "chain", chain_time / commands_run);
+    printf("line reader: %.1f ns/byte for a %zu B line in 256 B blocks\n",
+        static_cast<double>(reader_time) / (static_cast<double>(passes) * long_line.length()), long_line.length());
+    return found == 2 * iterations * MixCount ? 0 : 2;
+}
@@ -133,7 +133,8 @@ enum PayloadID {
     Pkt_NMEA0183Filter = 15,    ///< List of packets to record from NMEA0183 inputs (by default all)
     Pkt_SensorScales = 16,      ///< Scale factors to apply to RawIMU values (and other sensors)
     Pkt_RawIMU = 17,            ///< Raw measurements from local IMU (needs scaling factors applied)
-    Pkt_Setup = 18              ///< JSON-format string with the active configuration when the file was started
+    Pkt_Setup = 18,             ///< JSON-format string with the active configuration when the file was started
+    Pkt_Metrics = 19            ///< JSON-format string with performance metrics for the logger
 };
 
 /// \class Serialiser
@@ -0,0 +1,128 @@
+/*! \file ArchiveStream.h
+ *  \brief Incremental, resumable generation of a tar archive of the log files
+ *
+ * Downloading all of the log files as a single archive used to mean compressing the whole of the
+ * log directory inside the web-server's request handler, which stopped logging until it was done,
+ * and had to start again from the beginning if the connection dropped.  This module generates the
+ * archive in slices from the scheduler instead, following a manifest of the files (and their sizes)
+ * that's written when the download starts, so that the archive contents are deterministic and a
+ * client can resume an interrupted download from any offset.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __ARCHIVE_STREAM_H__
+#define __ARCHIVE_STREAM_H__
+
+#include <stdint.h>
+#include <Arduino.h>
+#include "FS.h"
+
+namespace logger {
+
+const char * const ArchiveManifestFile = "/archive.mft";   ///< Manifest for the current archive (outside the log directory)
+const size_t ArchiveBlockSize = 512;                        ///< Size of a tar block (headers, and padding of file data)
+const size_t ArchiveChunkSize = 2048;                       ///< Maximum number of bytes generated for each write to the client
+
+/// \class ArchiveStream
+/// \brief Generate a tar archive of the files in a directory, in slices, from a manifest
+///
+/// \a Prepare() lists the files in the directory, in name order, with their sizes and modification times,
+/// into a manifest file, and computes an identifier for the manifest (a hash of its contents) and the
+/// total length of the archive.  Since each file is archived as a 512 B header followed by exactly the
+/// number of bytes listed in the manifest (padded to a whole block), the archive is completely determined by
+/// the manifest: the log file that's currently being written can be included (since only the part written
+/// when the manifest was made is archived), and the archive can be regenerated from any offset as long as
+/// the files still exist.  A client can therefore resume a download by asking for the rest of the archive
+/// with the same identifier.
+///     \a Start() sets up the output from a given offset, and \a Step() then writes the archive to the output
+/// until the scheduler's time slice expires, or the output can't take any more without waiting, returning
+/// True while there's more to do.  The output may take only part of what's offered (or nothing); the rest is
+/// kept and offered again on the next \a Step(), so a slow client never holds up the loop.  Memory use is a
+/// single \a ArchiveChunkSize buffer, regardless of the number of files.  The archive is not compressed,
+/// since compression can't be resumed part-way through, and takes more time than logging can spare.
+
+class ArchiveStream {
+public:
+    /// \brief Default constructor
+    ArchiveStream(void);
+    /// \brief Default destructor
+    ~ArchiveStream(void);
+
+    /// \brief Make a new manifest for the files in the directory given
+    bool Prepare(fs::FS& filesystem, const char *path);
+    /// \brief Read back the manifest from the last archive (if any)
+    bool Load(fs::FS& filesystem);
+
+    /// \brief Identifier for the current manifest
+    uint32_t Id(void) const { return m_id; }
+    /// \brief Total length (bytes) of the archive for the current manifest
+    uint64_t Length(void) const { return m_length; }
+
+    /// \brief Start writing the archive to the output given, from the offset given
+    bool Start(Print *output, uint64_t offset);
+    /// \brief Write a slice of the archive, returning True if there is more to do
+    bool Step(void);
+    /// \brief Abandon the archive being written (if any)
+    void Stop(void);
+    /// \brief Determine whether an archive is being written
+    bool Active(void) const { return m_output != nullptr; }
+    /// \brief Current offset (bytes) in the archive being written
+    uint64_t Offset(void) const { return m_offset; }
+    /// \brief Determine whether the whole of the archive has been written
+    bool Complete(void) const { return m_length > 0 && m_offset == m_length; }
+
+private:
+    /// \struct Entry
+    /// \brief Description of a single file in the archive
+    struct Entry {
+        String      name;   ///< Filename, relative to the file system root
+        uint32_t    size;   ///< Number of bytes of the file in the archive
+        uint32_t    mtime;  ///< Modification time of the file (s since epoch)
+        uint64_t    start;  ///< Offset of the file's header in the archive
+    };
+
+    fs::FS      *m_fs;          ///< File system being archived
+    File        m_manifest;     ///< Manifest being followed
+    uint32_t    m_id;           ///< Identifier for the manifest
+    uint32_t    m_count;        ///< Number of files in the manifest
+    uint64_t    m_length;       ///< Total length of the archive
+    Print       *m_output;      ///< Output for the archive, or nullptr if not active
+    uint64_t    m_offset;       ///< Current offset in the archive
+    uint64_t    m_next;         ///< Offset of the entry after the current one (or the trailer)
+    Entry       m_entry;        ///< Current file being archived
+    bool        m_haveEntry;    ///< Flag: True => \a m_entry is valid, False => end of manifest (trailer)
+    File        m_file;         ///< Current file being read
+    uint8_t     *m_buffer;      ///< Buffer for the output being generated
+    size_t      m_pending;      ///< Number of bytes generated into \a m_buffer
+    size_t      m_sent;         ///< Number of bytes of \a m_buffer taken by the output so far
+
+    /// \brief Read the next entry from the manifest
+    bool nextEntry(void);
+    /// \brief Generate up to a buffer-full of the archive at the current offset
+    size_t generate(void);
+    /// \brief Generate the tar header for the current entry
+    void header(uint8_t *block) const;
+    /// \brief Size of an entry in the archive, including header and padding
+    static uint64_t entrySize(uint32_t size);
+};
+
+}
+
+#endif
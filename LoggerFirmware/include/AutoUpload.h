@@ -28,32 +28,279 @@
  */
 
 #ifndef __AUTO_UPLOAD_H__
+#define __AUTO_UPLOAD_H__
 
+#include <vector>
+#include <map>
+#include <utility>
+
+#include "WiFiClientSecure.h"
+#include "HTTPClient.h"
+#include "StreamString.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
 #include "LogManager.h"
 #include "Configuration.h"
+#include "ArduinoJson.h"
 
 namespace net {
 
+const uint8_t MaxChunkFailures = 4;                 ///< Number of failed chunks before a resumable transfer is left for the next cycle
+const uint32_t DefaultConnectionLifetime = 300;     ///< Default maximum age (s) of a connection to the upload server before it's replaced
+const unsigned long MinReconnectBackoff = 1000;     ///< Delay (ms) before reconnecting after the first connection failure
+const unsigned long MaxReconnectBackoff = 60000;    ///< Longest delay (ms) before reconnecting after repeated failures
+const int UploadQueueLength = 8;                    ///< Number of events that can be waiting for the main loop
+const uint32_t UploadStackSize = 16384;             ///< Stack (bytes) for the upload task (which does the TLS handshakes)
+const int UploadCore = 0;                           ///< Core to run the upload task on (the loop runs on 1)
+const double BandwidthSmoothing = 0.25;             ///< Weight of the newest sample in the bandwidth estimate
+const uint32_t MinBandwidthSample = 4096;           ///< Smallest transfer (bytes) used to estimate bandwidth
+const double WindowMargin = 1.25;                   ///< Allowance for slower transfers when sizing the upload window
+const uint32_t MaxWindowFactor = 4;                 ///< Longest upload window, as a multiple of the configured duration
+const uint8_t MaxFileHoldoff = 32;                  ///< Most upload cycles that a failing file is skipped for
+
+/// \class UploadMetrics
+/// \brief Connection and throughput statistics for the automatic upload cycles
+///
+/// Each upload cycle counts the number of connections that had to be made (each of which costs a full TLS
+/// handshake), the number of requests that re-used a connection that was already open (each saving a
+/// handshake), the connection failures, and the number of bytes sent, so that the throughput of the cycle
+/// can be reported.  The statistics for the last complete cycle are kept for the status report, along with
+/// running totals.
+
+class UploadMetrics {
+public:
+    /// \brief Default constructor
+    UploadMetrics(void);
+
+    /// \brief Start the statistics for a new upload cycle
+    void BeginCycle(void);
+    /// \brief Count a request, and whether it needed a new connection
+    void Request(bool reused);
+    /// \brief Count a connection failure
+    void Failure(void);
+    /// \brief Count bytes sent to the server
+    void Sent(uint32_t bytes);
+    /// \brief Record the upload schedule for the current cycle
+    void Schedule(uint32_t bandwidth, unsigned long window, uint32_t deferred);
+    /// \brief Complete the statistics for the current upload cycle
+    void EndCycle(void);
+
+    /// \brief Generate a JSON summary of the statistics
+    DynamicJsonDocument Render(void) const;
+
+private:
+    /// \struct Cycle
+    /// \brief Statistics for a single upload cycle
+    struct Cycle {
+        uint32_t    handshakes; ///< Number of new connections made
+        uint32_t    reused;     ///< Number of requests sent on a connection that was already open
+        uint32_t    failures;   ///< Number of requests that failed to connect or send
+        uint32_t    bytes;      ///< Number of bytes sent to the server
+        uint32_t    elapsed;    ///< Duration (ms) of the cycle
+        uint32_t    bandwidth;  ///< Estimated bandwidth (bytes/s) at the end of the cycle
+        uint32_t    window;     ///< Upload window (ms) allowed for the cycle
+        uint32_t    deferred;   ///< Number of files held back or skipped in the cycle
+    };
+    Cycle           m_current;      ///< Statistics for the cycle in progress
+    Cycle           m_last;         ///< Statistics for the last complete cycle
+    bool            m_active;       ///< Flag: a cycle is in progress
+    unsigned long   m_start;        ///< Start time (ms) of the cycle in progress
+    uint32_t        m_cycles;       ///< Number of complete cycles
+    uint32_t        m_handshakes;   ///< Total number of new connections made
+    uint32_t        m_reused;       ///< Total number of requests that re-used a connection
+    mutable portMUX_TYPE m_lock;    ///< Lock, since the upload task counts while the loop reports
+};
+
+extern UploadMetrics UploadStats;   ///< Static parameter for upload statistics
+
+/// \class UploadScheduler
+/// \brief Choose the order in which log files are uploaded, and how long each upload cycle runs
+///
+/// At the start of each cycle, the closed log files are put into priority order (oldest, newest, or
+/// smallest first), and the length of the cycle (the upload window) is set from the amount of data
+/// waiting and an estimate of the bandwidth to the server, between the configured duration and a
+/// multiple of it.  The bandwidth is a moving average (EWMA) of the throughput of recent transfers,
+/// and carries over from cycle to cycle.  A file is only started if it can be sent in the time left
+/// in the window at the estimated bandwidth, so that the time isn't spent on a file that can't finish;
+/// if the server keeps partial uploads, though, the first file is started anyway when nothing fits,
+/// since the chunks it gets through aren't wasted.  A file that fails is skipped for a number of
+/// cycles that doubles with each consecutive failure (up to a limit), so that a file that the server
+/// won't take doesn't use up every window.
+///     The scheduler belongs to the upload task, and isn't locked.
+
+class UploadScheduler {
+public:
+    /// \enum Order
+    /// \brief Priority order for the files in each cycle
+    enum Order {
+        ORDER_OLDEST,   ///< Oldest files first (the default)
+        ORDER_NEWEST,   ///< Newest files first
+        ORDER_SMALLEST  ///< Smallest files first (for quick wins on short connections)
+    };
+
+    /// \brief Default constructor
+    UploadScheduler(void);
+
+    /// \brief Set the priority order from a configuration string
+    void SetOrder(String const& order);
+    /// \brief Set up the queue of files and the window for a new cycle
+    void Plan(std::vector<logger::Manager::LogSummary> const& files, unsigned long duration);
+    /// \brief Find the next file to upload that can finish in the time left
+    bool Next(unsigned long time_left, bool resumable, uint32_t& file_id);
+
+    /// \brief Add a transfer into the bandwidth estimate
+    void Sample(uint32_t bytes, uint32_t elapsed);
+    /// \brief Note the amount of a file that the server has
+    void Progress(uint32_t file_id, uint32_t received);
+    /// \brief Note that a file has been sent
+    void Succeeded(uint32_t file_id);
+    /// \brief Note that a file failed to send, and hold it back
+    void Failed(uint32_t file_id);
+
+    /// \brief Length (ms) of the upload window for the current cycle
+    unsigned long Window(void) const { return m_window; }
+    /// \brief Estimated bandwidth (bytes/s) to the server, or zero if not known yet
+    uint32_t Bandwidth(void) const { return static_cast<uint32_t>(m_bandwidth); }
+    /// \brief Number of files held back or skipped in the current cycle
+    uint32_t Deferred(void) const { return m_deferred; }
+
+private:
+    /// \struct FileState
+    /// \brief Upload history of a log file that hasn't been sent yet
+    struct FileState {
+        uint32_t    received;   ///< Bytes that the server had at the last report
+        uint8_t     failures;   ///< Number of consecutive failed attempts
+        uint8_t     holdoff;    ///< Number of cycles left before the file is tried again
+    };
+    Order           m_order;        ///< Priority order for the files
+    double          m_bandwidth;    ///< Estimated bandwidth (bytes/s) to the server (zero if unknown)
+    unsigned long   m_window;       ///< Length (ms) of the current upload window
+    uint32_t        m_deferred;     ///< Files held back or skipped in the current cycle
+    std::vector<logger::Manager::LogSummary> m_queue;   ///< Files to try in the current cycle, in priority order
+    std::map<uint32_t, FileState>           m_files;    ///< Upload history of files not sent yet, by number
+
+    uint32_t remaining(logger::Manager::LogSummary const& file) const;
+};
+
+/// \class UploadManager
+/// \brief Upload closed log files to the upload server, in a background task
+///
+/// The transfers to the server run in a low-priority task pinned to the core that the main loop isn't
+/// using, so that a slow server (or a slow TLS handshake) never holds up data ingest.  The main loop
+/// calls \a UploadCycle() each service slice, which starts a cycle in the task when the upload interval
+/// has elapsed, and collects the events that the task posts back (progress, files sent or failed, and
+/// the end of the cycle), so that only the main loop changes the log files and the inventory.  The task
+/// reads the list of closed log files from the log manager, which locks its inventory for each look-up.
+
 class UploadManager {
 public:
     UploadManager(logger::Manager *logManager);
     ~UploadManager();
 
-    void UploadCycle(void);
+    /// \brief Start the background upload task
+    bool Begin(void);
+    /// \brief Start upload cycles when due, and collect events from the upload task
+    bool UploadCycle(void);
+    /// \brief Stop reading log files as soon as possible, and start no more transfers (for power failure)
+    void Abort(void) { m_abort = true; }
 
 private:
+    /// \struct Job
+    /// \brief Request for the upload task to run a cycle
+    struct Job {
+        StreamString    *status;    ///< Status to check in with (assembled by the main loop; deleted by the task)
+    };
+    /// \enum EventType
+    /// \brief Events posted back to the main loop by the upload task
+    enum EventType {
+        UPLOAD_PROGRESS,    ///< Part of a file has been sent (value is the bytes the server has)
+        UPLOAD_COMPLETE,    ///< File has been sent to the server
+        UPLOAD_FAILED,      ///< File failed to transfer in this cycle
+        UPLOAD_CYCLE_END    ///< Upload cycle has finished (file is the number of files sent)
+    };
+    /// \struct Event
+    /// \brief Report from the upload task to the main loop
+    struct Event {
+        EventType   type;   ///< Type of the event
+        uint32_t    fileID; ///< Log file number that the event refers to
+        uint32_t    value;  ///< Event-specific value
+    };
+
     logger::Manager *m_logManager;      ///< Pointer for the LogManager to use for file information
     String          m_serverURL;        ///< Based URL for the server and port
 
     int32_t         m_timeout;          ///< Timeout for upload requests (ms)
     unsigned long   m_uploadInterval;   ///< Interval between upload events (ms)
-    unsigned long   m_uploadDuration;   ///< Maximum duration for a single upload cycle (ms)
+    unsigned long   m_uploadDuration;   ///< Configured duration for a single upload cycle (ms)
+    unsigned long   m_window;           ///< Duration of the current upload cycle, adapted to bandwidth (ms)
+    UploadScheduler m_scheduler;        ///< Order of files and length of window for each cycle
     
     unsigned long   m_lastUploadCycle;  ///< Timestamp for the last upload cycle (ms)
 
-    bool ReportStatus(void);
+    WiFiClientSecure    *m_wifi;        ///< TLS connection to the server (nullptr between cycles)
+    HTTPClient          m_http;         ///< HTTP client, re-using the connection for each request
+    String              m_cert;         ///< CA certificate for the server (must outlive the connection)
+    unsigned long       m_lifetime;     ///< Maximum age (ms) of a connection before it's replaced
+    unsigned long       m_connectedAt;  ///< Time (ms) at which the current connection was made
+    unsigned long       m_backoff;      ///< Current delay (ms) before reconnecting after a failure
+    unsigned long       m_retryAt;      ///< Time (ms) before which no new connection is attempted
+
+    String              m_authHeader;   ///< Authorisation header for requests (empty if there's no token)
+
+    QueueHandle_t       m_jobs;         ///< Upload cycles waiting for the task
+    QueueHandle_t       m_events;       ///< Events waiting to be collected by the main loop
+    TaskHandle_t        m_task;         ///< Background upload task
+    bool                m_cycleActive;  ///< Flag: an upload cycle is in progress in the task (main loop only)
+    volatile bool       m_abort;        ///< Flag: stop reading log files, and start no more transfers
+
+    /// \enum TransferState
+    /// \brief Outcome of a single step of a resumable transfer
+    enum TransferState {
+        TRANSFER_COMPLETE,      ///< File committed at the server
+        TRANSFER_CONTINUE,      ///< More chunks to send
+        TRANSFER_FAILED,        ///< Transfer abandoned for this cycle
+        TRANSFER_UNSUPPORTED    ///< Server doesn't provide resumable uploads
+    };
+
+    /// \struct Transfer
+    /// \brief State of a resumable transfer of a single file, in chunks
+    struct Transfer {
+        uint32_t    fileID;     ///< Log file number being sent
+        String      filename;   ///< Name of the file being sent (the compressed sibling, if there is one)
+        uint32_t    size;       ///< Size (bytes) of the file being sent
+        String      hash;       ///< MD5 hash of the file being sent
+        bool        compressed; ///< Flag: True => file is gzip-encoded
+        String      session;    ///< Server's identifier for the upload session (empty if not open)
+        uint32_t    chunk;      ///< Chunk size (bytes) requested by the server
+        uint8_t     failures;   ///< Number of chunks that have failed in this cycle
+        std::vector<std::pair<uint32_t,uint32_t>> missing; ///< Ranges [start, end) the server still needs
+    };
+    bool        m_resumable;    ///< Flag: server provides resumable uploads (checked each cycle)
+    Transfer    m_transfer;     ///< Resumable transfer in progress
+
+    HTTPClient *openRequest(String const& url);
+    void closeRequest(int http_rc);
+    void closeConnection(void);
+    bool backingOff(void) const;
+    bool cycleExpired(void) const;
+    unsigned long timeLeft(void) const;
+
+    static void worker(void *param);
+    void runCycle(Job const& job);
+    TransferState uploadFile(uint32_t file_id);
+    void post(EventType type, uint32_t file_id, uint32_t value, TickType_t wait);
+
+    bool ReportStatus(String const& status_json);
     bool TransferFile(fs::FS& controller, uint32_t file_id);
-    
+
+    TransferState ResumeTransfer(uint32_t file_id);
+    TransferState startSession(uint32_t file_id);
+    TransferState sendChunk(void);
+    TransferState commitSession(void);
+    int exchange(String const& url, Stream *body, size_t length, String const& digest, DynamicJsonDocument& response);
+    bool updateMissing(DynamicJsonDocument const& response);
+
 };
 
 }
@@ -0,0 +1,94 @@
+/*! \file BenchmarkRunner.h
+ *  \brief Run the storage benchmark on the logger's own storage, in the background
+ *
+ * This connects the portable storage benchmark to the logger's file system, and runs it in steps from
+ * the scheduler so that the logger keeps servicing its other tasks while the card is characterised.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __BENCHMARK_RUNNER_H__
+#define __BENCHMARK_RUNNER_H__
+
+#include <stdint.h>
+#include <Arduino.h>
+#include "FS.h"
+#include "ArduinoJson.h"
+#include "StorageBenchmark.h"
+
+namespace logger {
+
+const uint32_t BenchmarkStepBudget = 15000;     ///< Time (us) for each step of the benchmark from the scheduler
+const char * const BenchmarkScratchFile = "/benchmark.tmp"; ///< Scratch file used for the benchmark
+
+/// \class BenchmarkRunner
+/// \brief Run the storage benchmark against the logger's storage, and report the results
+///
+/// The benchmark is started by command with the parameters to use, and then stepped by the scheduler
+/// until it completes.  The scratch file is on the logging medium (but not in the log directory, so
+/// that it isn't mistaken for a log file), and is removed when the benchmark completes or is stopped.
+/// Since the benchmark competes with logging for the card, the results are only representative if
+/// the logger isn't also recording a lot of data.
+
+class BenchmarkRunner {
+public:
+    /// \brief Default constructor
+    BenchmarkRunner(void);
+    /// \brief Default destructor
+    ~BenchmarkRunner(void);
+
+    /// \brief Start a benchmark run on the file system given
+    bool Start(fs::FS& filesystem, bench::Parameters const& params);
+    /// \brief Run a step of the benchmark, returning True if there is more to do
+    bool Step(void);
+    /// \brief Abandon the benchmark run in progress, if any
+    void Stop(void);
+    /// \brief Report why the current (or last) run failed, if it did
+    String Error(void) const { return m_benchmark == nullptr ? String() : String(m_benchmark->Error().c_str()); }
+
+    /// \brief Generate a JSON summary of the benchmark state and results
+    DynamicJsonDocument Render(void) const;
+
+private:
+    /// \class FileMedium
+    /// \brief Adapter from the benchmark's scratch file interface to an Arduino file
+    class FileMedium : public bench::Medium {
+    public:
+        FileMedium(fs::FS& filesystem) : m_fs(filesystem) {}
+        bool Open(void) { m_file = m_fs.open(BenchmarkScratchFile, "w+"); return static_cast<bool>(m_file); }
+        void Close(void) { m_file.close(); }
+        void Remove(void) { m_fs.remove(BenchmarkScratchFile); }
+        bool Seek(uint32_t offset) { return m_file.seek(offset); }
+        size_t Write(const uint8_t *data, size_t n) { return m_file.write(data, n); }
+        size_t Read(uint8_t *data, size_t n) { return m_file.read(data, n); }
+        void Flush(void) { m_file.flush(); }
+    private:
+        fs::FS  &m_fs;      ///< File system on which to make the scratch file
+        File    m_file;     ///< Scratch file
+    };
+    FileMedium          *m_medium;      ///< Scratch file interface for the current run
+    bench::Benchmark    *m_benchmark;   ///< Benchmark for the current (or last) run
+    bool                m_reported;     ///< Flag: completion of the last run has been reported on the console
+};
+
+extern BenchmarkRunner Bench;   ///< Static parameter to use for running the storage benchmark
+
+}
+
+#endif
@@ -0,0 +1,331 @@
+/*! \file BlockTransfer.h
+ *  \brief Portable block-framed protocol for transferring log files over a serial link
+ *
+ * The original serial transfer sends the file as a raw byte stream, so a single corrupted or dropped
+ * byte is only detected by the MD5 check at the end, and the whole file has to be sent again.  This
+ * module provides a framed protocol in its place: the file is sent in blocks, each with a sequence
+ * number and CRC32, inside a sliding window that the receiver acknowledges (cumulatively, and
+ * selectively for blocks that arrive out of order), so that only damaged blocks are re-sent.  Frames
+ * start with a sync pattern, so anything else on the link (e.g., debug messages) is skipped.  The core
+ * is independent of the Arduino environment so that the same code can be used for the receiver on the
+ * host.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __BLOCK_TRANSFER_H__
+#define __BLOCK_TRANSFER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace xfer {
+
+const uint8_t FrameSync[2] = { 0xA5, 0x5A };    ///< Pattern at the start of each frame
+const size_t FrameHeaderSize = 10;              ///< Size (bytes) of the frame header (sync, type, flags, sequence, length)
+const size_t FrameTrailerSize = 4;              ///< Size (bytes) of the CRC32 at the end of each frame
+const uint32_t MaxBlockSize = 4096;             ///< Largest block (bytes) that can be sent in a frame
+const uint32_t MaxWindow = 32;                  ///< Largest number of blocks that can be unacknowledged
+const size_t HashSize = 16;                     ///< Size (bytes) of the file hash sent in the header (MD5)
+
+/// \enum FrameType
+/// \brief Types of frame used in the protocol
+
+enum FrameType {
+    FRAME_HEADER = 1,   ///< Sender -> receiver: file size, block size, window, and hash (sequence 0)
+    FRAME_DATA = 2,     ///< Sender -> receiver: one block of the file (sequence 1 for the first)
+    FRAME_END = 3,      ///< Sender -> receiver: CRC32 of the whole file (sequence one past the last block)
+    FRAME_ACK = 4,      ///< Receiver -> sender: next sequence expected, and mask of later blocks received
+    FRAME_ABORT = 5     ///< Either direction: abandon the transfer
+};
+
+/// \brief Compute (or continue) a CRC32 (IEEE 802.3, as used by zlib) over a block of data
+uint32_t CRC32(const uint8_t *data, size_t n, uint32_t crc = 0);
+
+/// \brief Function type for a monotonic clock in microseconds
+typedef uint64_t (*Clock)(void);
+
+/// \class Channel
+/// \brief Abstract interface to the serial link
+///
+/// \a Read() must not block: it returns whatever is available (possibly nothing).  \a Write() may block
+/// until there's space to buffer the data, but should return the number of bytes accepted.
+
+class Channel {
+public:
+    virtual ~Channel(void) {}
+    /// \brief Read up to \a n bytes that are available from the link, without blocking
+    virtual size_t Read(uint8_t *data, size_t n) = 0;
+    /// \brief Write a block of data to the link, returning the number of bytes accepted
+    virtual size_t Write(const uint8_t *data, size_t n) = 0;
+};
+
+/// \class Source
+/// \brief Abstract interface to the file being sent, which must allow blocks to be read again for re-sending
+
+class Source {
+public:
+    virtual ~Source(void) {}
+    /// \brief Read \a n bytes from the given offset in the file, returning the number of bytes read
+    virtual size_t Read(uint32_t offset, uint8_t *data, size_t n) = 0;
+};
+
+/// \class Sink
+/// \brief Abstract interface to the file being received, which is written in order
+
+class Sink {
+public:
+    virtual ~Sink(void) {}
+    /// \brief Append a block of data to the file, returning True if it was written
+    virtual bool Write(const uint8_t *data, size_t n) = 0;
+};
+
+/// \struct Parameters
+/// \brief Configuration for the sender
+
+struct Parameters {
+    uint32_t    blockSize;      ///< Size of each block (bytes), up to \a MaxBlockSize
+    uint32_t    window;         ///< Number of blocks that can be sent before an acknowledgement, up to \a MaxWindow
+    uint32_t    timeout;        ///< Time (us) without progress before unacknowledged blocks are re-sent
+    uint32_t    maxRetries;     ///< Number of time-outs in a row before the transfer is abandoned
+
+    Parameters(void)
+    : blockSize(1024), window(16), timeout(500000), maxRetries(10) {}
+};
+
+/// \struct Statistics
+/// \brief Counts for a transfer, for either end
+
+struct Statistics {
+    uint32_t    frames;         ///< Frames sent
+    uint32_t    retransmits;    ///< Data frames sent more than once
+    uint32_t    timeouts;       ///< Time-outs waiting for acknowledgement (sender) or data (receiver)
+    uint32_t    crcErrors;      ///< Frames received with a bad CRC
+    uint32_t    skipped;        ///< Bytes skipped looking for the start of a frame
+    uint64_t    bytes;          ///< File bytes delivered (receiver) or acknowledged (sender)
+    uint64_t    elapsed;        ///< Time (us) since the transfer started
+
+    Statistics(void)
+    : frames(0), retransmits(0), timeouts(0), crcErrors(0), skipped(0), bytes(0), elapsed(0) {}
+};
+
+/// \struct Frame
+/// \brief Decoded frame
+
+struct Frame {
+    FrameType               type;       ///< Type of the frame
+    uint32_t                sequence;   ///< Sequence number
+    std::vector<uint8_t>    payload;    ///< Payload (may be empty)
+};
+
+/// \class FrameParser
+/// \brief Find and check frames in the bytes read from a link
+///
+/// Bytes are accumulated until there's a complete frame after a sync pattern; frames with a bad CRC,
+/// or with an impossible length, are discarded, and the search starts again one byte after the sync
+/// pattern, so that a false sync in the data can't hide a real frame.  A frame that was cut short (or a
+/// false sync with a plausible length) would otherwise hold up parsing until enough bytes arrived to fill
+/// it, so while waiting for the rest of a frame, a complete valid frame further on shows that the one
+/// being waited for will never be completed.
+
+class FrameParser {
+public:
+    /// \brief Constructor, with the statistics to update for errors
+    FrameParser(Statistics *stats);
+
+    /// \brief Read what's available from the link, returning True if a frame is ready
+    bool Poll(Channel *link, Frame& frame);
+
+private:
+    std::vector<uint8_t>    m_buffer;   ///< Bytes read but not yet parsed
+    size_t                  m_start;    ///< Offset of the first unparsed byte in the buffer
+    Statistics              *m_stats;   ///< Statistics to update for errors
+
+    /// \brief Look for a frame in the buffer, returning True if one was found
+    bool extract(Frame& frame);
+    /// \brief Check whether there's a complete valid frame in the buffer at or after the offset given
+    bool validAfter(size_t offset) const;
+};
+
+/// \brief Write a frame to the link, returning True if it was all accepted
+bool SendFrame(Channel *link, FrameType type, uint32_t sequence, const uint8_t *payload, size_t n);
+
+/// \class Sender
+/// \brief Send a file over a link with the block protocol, in resumable steps
+///
+/// The header is sent (and re-sent on time-out) until acknowledged, and then the data blocks are sent
+/// while there are fewer than \a window unacknowledged.  Each acknowledgement gives the next block the
+/// receiver needs (all earlier blocks have arrived) and a mask of the blocks after that which it already
+/// has; any block in between that was sent before a block that has since arrived is assumed lost, and
+/// sent again straight away.  If nothing is acknowledged for \a timeout, every block in the window that the
+/// receiver hasn't reported having is sent again.  Once every block is acknowledged, the end frame (with the CRC32 of the whole file) is
+/// sent until it too is acknowledged.
+///     So that the transfer can run on the logger without stopping everything else, the work is done by
+/// \a Step(), which returns True while there is more to do.
+
+class Sender {
+public:
+    /// \brief Constructor, with the link and clock to use
+    Sender(Channel *link, Clock clock);
+
+    /// \brief Set up to send a file of the given size and hash
+    bool Start(Source *source, uint32_t size, const uint8_t *hash, Parameters const& params);
+    /// \brief Run the transfer for up to the given time (us), returning True if there is more to do
+    bool Step(uint32_t budget);
+    /// \brief Abandon the transfer, telling the receiver
+    void Stop(void);
+
+    /// \brief Determine whether a transfer is in progress
+    bool Running(void) const { return m_state != STATE_IDLE && m_state != STATE_DONE && m_state != STATE_FAILED; }
+    /// \brief Determine whether the last transfer completed
+    bool Complete(void) const { return m_state == STATE_DONE; }
+    /// \brief Description of the error that stopped the last transfer, if any
+    std::string const& Error(void) const { return m_error; }
+    /// \brief Counts for the current (or last) transfer
+    Statistics const& Stats(void) const { return m_stats; }
+    /// \brief Size of the file being sent (bytes)
+    uint32_t Size(void) const { return m_size; }
+
+private:
+    /// \enum State
+    /// \brief Stages of the transfer
+    enum State {
+        STATE_IDLE,         ///< No transfer has been started
+        STATE_HEADER,       ///< Waiting for the header to be acknowledged
+        STATE_DATA,         ///< Sending data blocks
+        STATE_END,          ///< Waiting for the end frame to be acknowledged
+        STATE_DONE,         ///< Transfer complete
+        STATE_FAILED        ///< Transfer abandoned
+    };
+    Channel                 *m_link;        ///< Serial link
+    Clock                   m_clock;        ///< Microsecond clock
+    Source                  *m_source;      ///< File being sent
+    Parameters              m_params;       ///< Parameters for the transfer
+    State                   m_state;        ///< Current stage of the transfer
+    uint32_t                m_size;         ///< Size of the file (bytes)
+    uint8_t                 m_hash[HashSize];   ///< Hash of the file
+    uint32_t                m_blocks;       ///< Number of data blocks
+    uint32_t                m_base;         ///< Sequence number of the oldest unacknowledged block
+    uint32_t                m_next;         ///< Sequence number of the next block to send for the first time
+    uint32_t                m_mask;         ///< Blocks after \a m_base the receiver has, from the last acknowledgement
+    uint32_t                m_stamp;        ///< Counter for the order in which blocks are sent
+    uint32_t                m_sent[MaxWindow];  ///< Send order stamp for each block in the window
+    uint32_t                m_fileCRC;      ///< CRC32 of the blocks sent for the first time so far
+    uint32_t                m_retries;      ///< Number of time-outs in a row
+    uint64_t                m_start;        ///< Time (us) at which the transfer started
+    uint64_t                m_lastProgress; ///< Time (us) of the last progress (or re-send)
+    std::vector<uint8_t>    m_buffer;       ///< Data block
+    FrameParser             m_parser;       ///< Parser for acknowledgements
+    Statistics              m_stats;        ///< Counts for the transfer
+    std::string             m_error;        ///< Description of the last error
+
+    /// \brief Send the header frame
+    bool sendHeader(void);
+    /// \brief Send a data block (for the first time, or again)
+    bool sendBlock(uint32_t sequence);
+    /// \brief Send again the blocks in the window that the receiver doesn't have
+    void resend(void);
+    /// \brief Send the end frame
+    bool sendEnd(void);
+    /// \brief Act on an acknowledgement from the receiver
+    void acknowledge(uint32_t next, uint32_t mask);
+    /// \brief Abandon the transfer with an error
+    void fail(const char *message, bool tell);
+};
+
+/// \class Receiver
+/// \brief Receive a file over a link with the block protocol, in resumable steps
+///
+/// Blocks that arrive in order are written to the sink straight away; blocks that arrive early (because
+/// an earlier one was lost) are held until the gap is filled.  Each frame received is acknowledged with
+/// the next block needed and a mask of the blocks held after that, which is all that the sender needs to
+/// re-send just what was lost.  The CRC32 of the whole file is checked against the end frame.
+
+class Receiver {
+public:
+    /// \brief Constructor, with the link, output, and clock to use
+    Receiver(Channel *link, Sink *sink, Clock clock);
+
+    /// \brief Run the transfer for up to the given time (us), returning True if there is more to do
+    bool Step(uint32_t budget);
+    /// \brief Abandon the transfer, telling the sender
+    void Stop(void);
+
+    /// \brief Determine whether the header has arrived (so that the size and hash are known)
+    bool Started(void) const { return m_state != STATE_WAITING; }
+    /// \brief Determine whether the transfer completed
+    bool Complete(void) const { return m_state == STATE_DONE || m_state == STATE_LINGER; }
+    /// \brief Description of the error that stopped the transfer, if any
+    std::string const& Error(void) const { return m_error; }
+    /// \brief Counts for the transfer
+    Statistics const& Stats(void) const { return m_stats; }
+    /// \brief Size of the file (bytes), from the header
+    uint32_t Size(void) const { return m_size; }
+    /// \brief Hash of the file, from the header
+    const uint8_t *Hash(void) const { return m_hash; }
+
+    /// \brief Time (us) without any frame before the receiver gives up
+    static const uint64_t IdleTimeout = 10000000;
+    /// \brief Time (us) to keep acknowledging the end frame in case the first acknowledgement was lost
+    static const uint64_t LingerTime = 2000000;
+
+private:
+    /// \enum State
+    /// \brief Stages of the transfer
+    enum State {
+        STATE_WAITING,      ///< Waiting for the header
+        STATE_DATA,         ///< Receiving data blocks
+        STATE_LINGER,       ///< Complete, but acknowledging any repeated end frames
+        STATE_DONE,         ///< Transfer complete
+        STATE_FAILED        ///< Transfer abandoned
+    };
+    Channel                 *m_link;        ///< Serial link
+    Sink                    *m_sink;        ///< Output for the file
+    Clock                   m_clock;        ///< Microsecond clock
+    State                   m_state;        ///< Current stage of the transfer
+    uint32_t                m_size;         ///< Size of the file (bytes)
+    uint8_t                 m_hash[HashSize];   ///< Hash of the file
+    uint32_t                m_blockSize;    ///< Size of each block (bytes)
+    uint32_t                m_window;       ///< Number of blocks that the sender can have unacknowledged
+    uint32_t                m_blocks;       ///< Number of data blocks
+    uint32_t                m_next;         ///< Sequence number of the next block needed
+    bool                    m_held[MaxWindow];  ///< Flags for blocks that have arrived early, by sequence number modulo \a MaxWindow
+    std::vector<uint8_t>    m_early[MaxWindow]; ///< Blocks that have arrived early, by sequence number modulo \a MaxWindow
+    uint32_t                m_fileCRC;      ///< CRC32 of the blocks written so far
+    uint64_t                m_start;        ///< Time (us) at which the header arrived
+    uint64_t                m_lastFrame;    ///< Time (us) at which the last frame arrived
+    FrameParser             m_parser;       ///< Parser for the sender's frames
+    Statistics              m_stats;        ///< Counts for the transfer
+    std::string             m_error;        ///< Description of the last error
+
+    /// \brief Act on a frame from the sender
+    void process(Frame const& frame);
+    /// \brief Accept a data block, writing it (and any held blocks that follow) if it's next
+    bool accept(uint32_t sequence, std::vector<uint8_t> const& data);
+    /// \brief Send an acknowledgement of the current state
+    void acknowledge(void);
+    /// \brief Abandon the transfer with an error
+    void fail(const char *message, bool tell);
+};
+
+}
+
+#endif
@@ -0,0 +1,165 @@
+/*! \file CommandTable.h
+ *  \brief Allocation-free parsing and table-driven dispatch of text commands
+ *
+ * Commands to the logger are a verb followed by arguments, and may come several at a time (separated by
+ * semicolons).  This splits them up, and finds the verb in a table sorted at compile time,
+ * all with pointers into the original text so that nothing is copied or allocated.  Lines of input are
+ * assembled from bulk reads by a \a LineReader, which grows geometrically for long lines (e.g., JSON
+ * configurations) rather than a character at a time.  There are no Arduino dependencies, so the same code
+ * can be built and checked on a host.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __COMMAND_TABLE_H__
+#define __COMMAND_TABLE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace cmd {
+
+const size_t MaxArguments = 8;  ///< Most arguments split out of a command (the rest are still in \a Command::rest)
+
+/// \struct Token
+/// \brief View of part of a command (not null-terminated, and not owning the text)
+
+struct Token {
+    const char  *text;      ///< Start of the text
+    size_t      length;     ///< Number of characters
+
+    Token(void) : text(""), length(0) {}
+    Token(const char *t, size_t n) : text(t), length(n) {}
+
+    /// \brief Determine whether the token is empty
+    bool Empty(void) const { return length == 0; }
+    /// \brief Determine whether the token is exactly the word given
+    bool Is(const char *word) const;
+    /// \brief Compare with a word, as for \a strcmp()
+    int Compare(const char *word) const;
+};
+
+/// \struct Command
+/// \brief A command split into its verb and arguments
+///
+/// The arguments are split at white space, but \a rest keeps everything after the verb (with the white
+/// space trimmed from the ends) for commands that take free text or JSON.
+
+struct Command {
+    Token   verb;                   ///< First word of the command
+    Token   rest;                   ///< Everything after the verb
+    Token   args[MaxArguments];     ///< Arguments, split at white space
+    size_t  count;                  ///< Number of arguments split out
+
+    Command(void) : count(0) {}
+
+    /// \brief Split a command into its verb and arguments
+    void Parse(Token const& line);
+    /// \brief Everything from the start of argument \a n to the end of the command
+    Token From(size_t n) const;
+};
+
+/// \brief Find the next command in a batch, moving the start of the text past it
+bool NextCommand(const char *&text, const char *end, Token& command, bool (*freeText)(Token const& verb) = nullptr);
+
+/// \class LineReader
+/// \brief Assemble lines of input from blocks of characters as they arrive
+///
+/// Input is added a block at a time (whatever is available from the port), and the reader takes up to
+/// the end of the first line, so that the caller can run it and then pass in the rest of the block.  The
+/// line buffer starts small and doubles as required up to a maximum, so long lines cost linear time and
+/// short ones don't hold memory; a line longer than the maximum is discarded (up to its end) and flagged.
+/// Backspaces remove the previous character, as they would on a terminal.
+
+class LineReader {
+public:
+    /// \brief Constructor, with initial and maximum line buffer sizes
+    LineReader(size_t initial, size_t maximum);
+    /// \brief Default destructor
+    ~LineReader(void);
+
+    /// \brief Add characters, up to and including the end of the first line in them
+    size_t Append(const char *data, size_t n);
+    /// \brief Determine whether a complete line is ready
+    bool Complete(void) const { return m_complete; }
+    /// \brief Determine whether the line was too long (and has been discarded)
+    bool Overflowed(void) const { return m_overflow; }
+    /// \brief Length of the line when it overflowed (i.e., what would have been needed)
+    size_t Dropped(void) const { return m_dropped; }
+    /// \brief Contents of the line (without the new-line, but null-terminated)
+    Token Line(void) const { return m_buffer == nullptr ? Token() : Token(m_buffer, m_length); }
+    /// \brief Start a new line, returning memory held for a long line
+    void Clear(void);
+
+private:
+    char    *m_buffer;      ///< Space to assemble the line (always null-terminated)
+    size_t  m_capacity;     ///< Current size of \a m_buffer
+    size_t  m_initial;      ///< Size of the buffer for a new line
+    size_t  m_maximum;      ///< Largest size the buffer is allowed to grow to
+    size_t  m_length;       ///< Number of characters in the line so far
+    size_t  m_dropped;      ///< Number of characters in the line when it overflowed
+    bool    m_complete;     ///< Flag: True => the end of the line has been seen
+    bool    m_overflow;     ///< Flag: True => the line was too long for the maximum buffer
+
+    /// \brief Make sure that there's space for \a n more characters (and a terminator)
+    bool reserve(size_t n);
+    /// \brief Add characters that contain no new-line
+    void add(const char *data, size_t n);
+};
+
+/// \brief Compile-time ordering of two words, as for \a strcmp() < 0
+constexpr bool Precedes(const char *a, const char *b)
+{
+    return *a != *b ? static_cast<unsigned char>(*a) < static_cast<unsigned char>(*b)
+                    : (*a != '\0' && Precedes(a + 1, b + 1));
+}
+
+/// \brief Compile-time check that a table is in strictly increasing order of its \a verb members
+template <typename Entry, size_t N>
+constexpr bool Sorted(Entry const (&table)[N], size_t i = 1)
+{
+    return i >= N || (Precedes(table[i - 1].verb, table[i].verb) && Sorted(table, i + 1));
+}
+
+/// Find a verb in a table sorted with \a Sorted() (by binary search).
+///
+/// \param table    Table of entries, each with a \a verb member
+/// \param verb     Verb to look for
+/// \return Pointer to the entry for the verb, or nullptr if it isn't in the table
+
+template <typename Entry, size_t N>
+Entry const *Lookup(Entry const (&table)[N], Token const& verb)
+{
+    size_t low = 0, high = N;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int c = verb.Compare(table[mid].verb);
+        if (c == 0) return table + mid;
+        if (c < 0) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return nullptr;
+}
+
+}
+
+#endif
@@ -0,0 +1,129 @@
+/*! \file CommandVerbs.h
+ *  \brief Verbs understood by the logger's command processor, and the forms that they take
+ *
+ * This is the single list of the logger's commands: the command processor checks its handler table against
+ * it at compile time, and the host tools use it to check parsing and dispatch, so the two can't drift apart.
+ * There are no Arduino dependencies, so it can be built on a host.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __COMMAND_VERBS_H__
+#define __COMMAND_VERBS_H__
+
+#include "CommandTable.h"
+
+namespace cmd {
+
+/// \enum Arguments
+/// \brief How the arguments of a command are delimited in a batch
+enum class Arguments {
+    Words,  ///< Words (or JSON), ending at a ';' outside JSON, so another command can follow
+    Text    ///< Free text (passwords, names, certificates): everything to the end of the request
+};
+
+/// \struct Verb
+/// \brief Description of a command: the verb, and whether it can be given without and with arguments
+struct Verb {
+    const char  *verb;      ///< First word of the command
+    bool        report;     ///< Flag: True => the command can be given on its own
+    bool        configure;  ///< Flag: True => the command can be given with arguments
+    Arguments   arguments;  ///< How the arguments are delimited
+};
+
+/// Commands understood by the logger, in strictly increasing order of verb.  Every entry here must have
+/// a matching entry in SerialCommand::dispatch(), with a handler wherever \a report or \a configure is set.
+
+static constexpr Verb Verbs[] = {
+    { "accept",      true,  true,  Arguments::Words },
+    { "algorithm",   true,  true,  Arguments::Text },
+    { "auth",        true,  true,  Arguments::Text },
+    { "benchmark",   true,  true,  Arguments::Words },
+    { "configure",   true,  true,  Arguments::Words },
+    { "echo",        false, true,  Arguments::Words },
+    { "erase",       false, true,  Arguments::Words },
+    { "filecount",   true,  false, Arguments::Words },
+    { "heap",        true,  true,  Arguments::Words },
+    { "help",        true,  false, Arguments::Words },
+    { "invert",      false, true,  Arguments::Words },
+    { "lab",         false, true,  Arguments::Words },
+    { "led",         false, true,  Arguments::Words },
+    { "log",         true,  false, Arguments::Words },
+    { "mdns",        true,  true,  Arguments::Text },
+    { "metadata",    true,  true,  Arguments::Text },
+    { "ota",         true,  false, Arguments::Words },
+    { "passthrough", true,  false, Arguments::Words },
+    { "password",    true,  true,  Arguments::Text },
+    { "profile",     true,  true,  Arguments::Words },
+    { "restart",     true,  false, Arguments::Words },
+    { "scales",      true,  false, Arguments::Words },
+    { "setup",       true,  true,  Arguments::Words },
+    { "shipname",    true,  true,  Arguments::Text },
+    { "sizes",       true,  false, Arguments::Words },
+    { "snapshot",    false, true,  Arguments::Words },
+    { "speed",       false, true,  Arguments::Words },
+    { "ssid",        true,  true,  Arguments::Text },
+    { "status",      true,  false, Arguments::Words },
+    { "steplog",     true,  false, Arguments::Words },
+    { "stop",        true,  false, Arguments::Words },
+    { "syntax",      true,  false, Arguments::Words },
+    { "trace",       true,  true,  Arguments::Words },
+    { "transfer",    false, true,  Arguments::Words },
+    { "uniqueid",    true,  true,  Arguments::Text },
+    { "upload",      true,  true,  Arguments::Words },
+    { "verbose",     false, true,  Arguments::Words },
+    { "version",     true,  false, Arguments::Words },
+    { "webserver",   true,  true,  Arguments::Words },
+    { "wireless",    false, true,  Arguments::Words }
+};
+static_assert(Sorted(Verbs), "command verbs must be in alphabetical order");
+
+/// \brief Number of commands understood by the logger
+constexpr size_t VerbCount = sizeof(Verbs)/sizeof(Verbs[0]);
+
+/// Determine whether a verb takes free text, so that the rest of the request belongs to it.
+///
+/// \param verb Verb to check
+/// \return True if the verb's arguments are free text, otherwise False
+
+inline bool FreeText(Token const& verb)
+{
+    Verb const *entry = Lookup(Verbs, verb);
+    return entry != nullptr && entry->arguments == Arguments::Text;
+}
+
+/// Compile-time check that a table of handlers matches the verbs, entry by entry: the same verbs in the
+/// same order, with a handler for each form that the verb allows (and none for those it doesn't).
+///
+/// \param table    Table of handlers, each with \a verb, \a report, and \a configure members
+/// \param i        Entry to start checking from
+/// \return True if the table matches \a Verbs, otherwise False
+
+template <typename Entry, size_t N>
+constexpr bool Matches(Entry const (&table)[N], size_t i = 0)
+{
+    return N == VerbCount && (i >= N ||
+        (!Precedes(table[i].verb, Verbs[i].verb) && !Precedes(Verbs[i].verb, table[i].verb) &&
+         (table[i].report != nullptr) == Verbs[i].report && (table[i].configure != nullptr) == Verbs[i].configure &&
+         Matches(table, i + 1)));
+}
+
+}
+
+#endif
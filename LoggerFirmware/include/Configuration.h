@@ -37,8 +37,8 @@ namespace logger {
 
 // Firmware software version (i.e., overall firmware, rather than components like Command Processor, etc.)
 const int firmware_major = 1;
-const int firmware_minor = 6;
-const int firmware_patch = 1;
+const int firmware_minor = 7;
+const int firmware_patch = 0;
 
 /// @brief Stringify the version information for the firmware itself
 String FirmwareVersion(void);
@@ -75,6 +75,10 @@ class Config {
             CONFIG_BRIDGE_B,        /* Binary: Bridge UDP broadcast packets to NMEA0183 */
             CONFIG_WEBSERVER_B,     /* Binary: Use web server interface to configure system */
             CONFIG_UPLOAD_B,        /* Binary: enable auto-upload when online */
+            CONFIG_METRICS_B,       /* Binary: record periodic performance metrics packets in the log files */
+            CONFIG_COMPRESS_B,      /* Binary: compress log files in the background when they are closed */
+            CONFIG_LIVE_B,          /* Binary: publish the live data stream over UDP when WiFi is up */
+            CONFIG_BRIDGE_COALESCE_B,/* Binary: only write whole sentences from the UDP bridge to NMEA0183 */
             CONFIG_MODULEID_S,      /* String: User-specified unique identifier for the module */
             CONFIG_SHIPNAME_S,      /* String: User-specific name for the ship hosting the WIBL */
             CONFIG_AP_SSID_S,       /* String: WiFi SSID for AP */
@@ -99,6 +103,11 @@ class Config {
             CONFIG_UPLOAD_INTERVAL_S,/* String: interval (seconds) between upload attempts */
             CONFIG_UPLOAD_DURATION_S,/* String: duration (seconds) for each upload event */
             CONFIG_UPLOAD_CERT_S,   /* String: certificate to pass to upload server for authentication */
+            CONFIG_UPLOAD_LIFETIME_S,/* String: maximum age (seconds) of a connection to the upload server */
+            CONFIG_UPLOAD_ORDER_S,  /* String: order in which files are uploaded ("oldest", "newest", "smallest") */
+            CONFIG_LIVE_ADDRESS_S,  /* String: UDP address (multicast group or broadcast) for the live data stream */
+            CONFIG_LIVE_PORT_S,     /* String: UDP port for the live data stream */
+            CONFIG_LIVE_FILTER_S,   /* String: comma-separated packet IDs for the live data stream (empty for all) */
             CONFIG_MDNS_NAME_S      /* String: recognition name for mDNS responder (hostname: name.local) */
         };
 
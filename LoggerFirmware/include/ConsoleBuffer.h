@@ -0,0 +1,119 @@
+/*! \file ConsoleBuffer.h
+ *  \brief Staging buffer for console log messages, with coalescing and rate limiting
+ *
+ * The console log is written by a number of sub-systems, some of which (e.g., the NMEA0183 assembler
+ * on a noisy or inverted input) can generate messages at a very high rate.  Rather than writing and
+ * flushing the console file for each message, messages are staged in RAM here and written in batches,
+ * with repeated messages coalesced into a count, and each source rate-limited so that one noisy
+ * source can't fill the buffer (or the card).
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CONSOLE_BUFFER_H__
+#define __CONSOLE_BUFFER_H__
+
+#include <stdint.h>
+#include <Arduino.h>
+#include "ArduinoJson.h"
+
+namespace logger {
+
+/// \enum ConsoleSource
+/// \brief Sources of console messages, for rate limiting
+
+enum ConsoleSource {
+    CONSOLE_SYSTEM = 0,     ///< Logger control and housekeeping
+    CONSOLE_NMEA0183_1,     ///< NMEA0183 channel 1 assembler
+    CONSOLE_NMEA0183_2,     ///< NMEA0183 channel 2 assembler
+    CONSOLE_NMEA2000,       ///< NMEA2000 message handlers
+    ConsoleSourceCount      ///< Number of sources (not a source)
+};
+
+const uint32_t ConsoleBufferSize = 8192;    ///< Size (bytes) of the RAM staging buffer
+const uint32_t ConsoleBatchSize = 2048;     ///< Pending data (bytes) that triggers a write to file
+const uint32_t ConsoleBatchInterval = 1000; ///< Longest time (ms) that a message is held before writing
+const uint32_t ConsoleRate = 5;             ///< Sustained rate (messages/s) allowed for each source
+const uint32_t ConsoleBurst = 20;           ///< Number of messages that a source can send in a burst
+
+/// \class ConsoleBuffer
+/// \brief Stage console messages in RAM for batched writing to the console file
+///
+/// Messages are added with \a Add(), which only copies the message into a ring buffer; \a Drain() then
+/// writes everything pending to the console file when \a Due() indicates that enough has built up, or
+/// that the oldest message has waited long enough.  A message that is the same as the last one (from
+/// the same source) is not stored again, but counted, and a "last message repeated N times" line is
+/// written when a different message arrives, or when the buffer is drained.  Each source has a token
+/// bucket allowing \a ConsoleBurst messages at once, refilled at \a ConsoleRate messages/s; messages
+/// beyond this are dropped, and a count of them is written when the source is next allowed a message.
+/// If the buffer fills before it can be drained, new messages are dropped and counted.
+///     The buffer is only used from the main loop task, so there's no locking.
+
+class ConsoleBuffer {
+public:
+    /// \brief Default constructor
+    ConsoleBuffer(void);
+    /// \brief Default destructor
+    ~ConsoleBuffer(void);
+
+    /// \brief Add a message from the given source
+    void Add(String const& message, ConsoleSource source);
+    /// \brief Determine whether pending messages should be written now
+    bool Due(void) const;
+    /// \brief Write all pending messages to the output, returning the number of bytes written
+    size_t Drain(Stream& output);
+
+    /// \brief Generate a JSON summary of the buffer statistics
+    DynamicJsonDocument Render(void) const;
+
+private:
+    /// \struct Bucket
+    /// \brief Token bucket for a single source
+    struct Bucket {
+        uint32_t    tokens;     ///< Tokens available (thousandths of a message)
+        uint32_t    refilled;   ///< Time (ms) of the last refill
+        uint32_t    suppressed; ///< Messages dropped since the source was last allowed a message
+    };
+    char            *m_buffer;      ///< Ring buffer for pending message text
+    uint32_t        m_head;         ///< Index at which the next byte is added
+    uint32_t        m_tail;         ///< Index of the next byte to write out
+    uint32_t        m_oldest;       ///< Time (ms) at which the oldest pending data was added
+    uint32_t        m_lastHash;     ///< Hash of the last message stored
+    ConsoleSource   m_lastSource;   ///< Source of the last message stored
+    uint32_t        m_repeats;      ///< Number of repeats of the last message not yet reported
+    Bucket          m_buckets[ConsoleSourceCount];  ///< Rate limits for each source
+    uint32_t        m_lost;         ///< Messages dropped because the buffer was full, not yet reported
+    uint32_t        m_written;      ///< Total bytes written to file
+    uint32_t        m_coalesced;    ///< Total messages coalesced as repeats
+    uint32_t        m_suppressed;   ///< Total messages dropped by rate limiting
+    uint32_t        m_dropped;      ///< Total messages dropped because the buffer was full
+
+    /// \brief Number of bytes pending in the ring
+    uint32_t pending(void) const { return (m_head + ConsoleBufferSize - m_tail) % ConsoleBufferSize; }
+    /// \brief Add a line of text to the ring, if there is space
+    bool append(const char *text, uint32_t length);
+    /// \brief Add the "repeated" line for the last message, if there were repeats
+    void closeRepeats(void);
+    /// \brief Take a token from the source's bucket, if one is available
+    bool allow(ConsoleSource source);
+};
+
+}
+
+#endif
@@ -50,6 +50,12 @@ enum DataObsType {
 const int MaximumDataObsRender = 256;
 const int MaximumRenderOverhead = 1024;
 
+const int IngestWindow = 10;            ///< Length (s) of the sliding window used for ingest rates
+const int MaxIngestPGNs = 32;           ///< Number of distinct NMEA2000 PGNs that are counted individually
+const int IngestChannels = 2;           ///< Number of NMEA0183 channels counted
+const uint32_t CANBitRate = 250000;     ///< NMEA2000 bus bit rate (bit/s)
+const uint32_t CANFrameBits = 140;      ///< Typical length (bits) of an extended frame with 8 data bytes, including bit-stuffing
+
 class DataObs {
 public:
     DataObs(void);
@@ -75,6 +81,31 @@ private:
     void Blank(void);
 };
 
+/// \class RateWindow
+/// \brief Event rate over a fixed-length sliding window of one-second slots
+///
+/// Events are added to the current slot, which is closed when the window is advanced (once a second);
+/// the rate is the mean over the slots that have been filled, so it starts reporting as soon as the
+/// first second has completed, and then tracks the last \a IngestWindow seconds.
+
+class RateWindow {
+public:
+    /// \brief Default constructor
+    RateWindow(void);
+    /// \brief Add events to the current slot
+    void Add(uint32_t n) { m_current += n; }
+    /// \brief Close the current slot, and any further seconds that have passed with no events
+    void Advance(uint32_t seconds);
+    /// \brief Mean rate (events/s) over the filled slots of the window
+    double Rate(void) const;
+
+private:
+    uint32_t    m_slots[IngestWindow];  ///< Event counts for each completed second
+    uint32_t    m_current;              ///< Event count for the current second
+    int         m_next;                 ///< Index of the next slot to fill
+    int         m_filled;               ///< Number of slots filled (up to the window length)
+};
+
 class DataMetrics {
 public:
     DataMetrics(void);
@@ -85,10 +116,63 @@ public:
     void SupplyVoltage(double voltage) { m_supplyVoltage = voltage; }
     double SupplyVoltage(void) const { return m_supplyVoltage; }
 
+    /// \brief Count an NMEA2000 message received, given its PGN and payload length
+    void CountPGN(uint32_t pgn, uint32_t length);
+    /// \brief Count an NMEA0183 sentence received on a channel (1 or 2)
+    void CountSentence(int channel);
+    /// \brief Count an NMEA0183 sentence on a channel (1 or 2) that failed validation
+    void CountChecksumFailure(int channel);
+    /// \brief Count an NMEA0183 sentence on a channel (1 or 2) dropped because the assembler ring was full
+    void CountRingDrop(int channel);
+    /// \brief Count a UART receive error on a channel (1 or 2), noting whether it was an overflow
+    void CountUARTError(int channel, bool overflow);
+    /// \brief Count a packet that the log writer failed to write
+    void CountWriterDrop(void) { ++m_writerDrops; }
+    /// \brief Check the CAN controller for overruns and errors
+    void SampleCAN(void);
+    /// \brief Advance the rate windows, if a second or more has passed
+    void Sample(void);
+    /// \brief Generate a JSON summary of the ingest counters, rates, and bus load
+    DynamicJsonDocument Ingest(void) const;
+
 private:
     DataObs m_nmea0183[3];
     DataObs m_nmea2000[3];
     double m_supplyVoltage;
+
+    /// \struct PGNCount
+    /// \brief Message count for a single NMEA2000 PGN
+    struct PGNCount {
+        uint32_t    pgn;    ///< Parameter group number
+        uint32_t    count;  ///< Number of messages received
+    };
+    /// \struct ChannelCounters
+    /// \brief Ingest counters for a single NMEA0183 channel
+    struct ChannelCounters {
+        uint32_t            sentences;  ///< Number of sentences assembled
+        uint32_t            checksum;   ///< Number of sentences that failed validation
+        uint32_t            dropped;    ///< Number of sentences dropped because the assembler ring was full
+        volatile uint32_t   overflows;  ///< Number of UART FIFO or receive buffer overflows
+        volatile uint32_t   errors;     ///< Number of other UART receive errors (framing, parity, break)
+        RateWindow          rate;       ///< Sentence rate
+    };
+    PGNCount        m_pgns[MaxIngestPGNs];      ///< Message counts for the first PGNs seen
+    int             m_nPGNs;                    ///< Number of PGNs being counted individually
+    uint32_t        m_otherPGNs;                ///< Messages with PGNs beyond those counted individually
+    uint32_t        m_messages;                 ///< Total NMEA2000 messages received
+    uint32_t        m_frames;                   ///< Estimated total CAN frames received
+    RateWindow      m_messageRate;              ///< NMEA2000 message rate
+    RateWindow      m_frameRate;                ///< Estimated CAN frame rate
+    uint32_t        m_canOverruns;              ///< Number of CAN controller receive overruns seen
+    uint32_t        m_canErrors;                ///< Sum of increases in the CAN controller error counters
+    uint32_t        m_canErrorLevel;            ///< Last sample of the sum of the CAN controller error counters
+    uint32_t        m_canBusOffs;               ///< Number of transitions to bus-off
+    bool            m_canBusOff;                ///< Flag: CAN controller was bus-off at the last sample
+    uint32_t        m_rxErrorCount;             ///< Last sample of the CAN receive error counter
+    uint32_t        m_txErrorCount;             ///< Last sample of the CAN transmit error counter
+    ChannelCounters m_channels[IngestChannels]; ///< Counters for each NMEA0183 channel
+    uint32_t        m_writerDrops;              ///< Number of packets the log writer failed to write
+    uint32_t        m_lastSample;               ///< Time (ms) at which the rate windows were last advanced
 };
 
 extern DataMetrics Metrics;
@@ -0,0 +1,119 @@
+/*! \file EventLoop.h
+ *  \brief Event notification for the main processing loop of the logger
+ *
+ * Rather than having the main loop of the logger poll every sub-system on every pass (which keeps
+ * the processor at 100% doing nothing useful), this module allows the sources of work for the logger
+ * (serial data, IMU interrupts, command input, and periodic timers) to post notifications to the
+ * loop task, which then blocks until there's something to do.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __EVENT_LOOP_H__
+#define __EVENT_LOOP_H__
+
+#include <stdint.h>
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "ArduinoJson.h"
+
+namespace logger {
+
+/// \enum EventSource
+/// \brief Bit-flags for the sources of work that can wake the main loop
+///
+/// These are used as the notification value for the loop task, so that multiple events posted before
+/// the loop gets to run are merged into a single wake-up with all of the corresponding bits set.
+
+enum EventSource {
+    EVT_CAN_RX      = 0x01, ///< NMEA2000 CAN bus service is due
+    EVT_UART_RX     = 0x02, ///< Data has arrived on one of the NMEA0183 serial ports
+    EVT_IMU_DRDY    = 0x04, ///< The IMU has signalled that data is ready
+    EVT_SERIAL_RX   = 0x08, ///< Data has arrived on the console (command) serial port
+    EVT_SERVICE     = 0x10, ///< Housekeeping tick (LEDs, WiFi server, upload manager)
+    EVT_SUPPLY      = 0x20, ///< Supply voltage check is due
+    EVT_RESUME      = 0x40  ///< A scheduled task yielded with work remaining
+};
+
+const int EventSourceCount = 7; ///< Number of distinct event sources in \a EventSource
+
+const uint32_t CANPollPeriod = 5;       ///< Period (ms) for servicing the CAN bus message stack
+const uint32_t ServicePeriod = 10;      ///< Period (ms) for the housekeeping tick
+const uint32_t SupplyPollPeriod = 100;  ///< Period (ms) for checking the supply voltage
+
+/// \class EventLoop
+/// \brief Collect notifications of work for the main loop, and block the loop until there is some
+///
+/// The main loop task registers itself with \a Begin(), after which any task (or interrupt service
+/// routine) can post events for it.  The loop calls \a Wait() to block until at least one event is
+/// pending, and then services the sub-systems indicated.  Sources that can't generate their own
+/// notifications (e.g., the CAN bus driver, which buffers frames internally, and the supply monitor)
+/// are serviced from periodic timers.  The object also keeps track of the fraction of time that the
+/// loop is idle and the worst-case latency between an event being posted and the loop waking to
+/// service it, so that these can be reported in the status information.
+
+class EventLoop {
+public:
+    /// \brief Default constructor
+    EventLoop(void);
+    /// \brief Default destructor
+    ~EventLoop(void);
+
+    /// \brief Register the calling task as the loop task, and start the periodic timers
+    bool Begin(void);
+
+    /// \brief Post one or more events to the loop task from task context
+    void Post(uint32_t events);
+    /// \brief Post one or more events to the loop task from an interrupt service routine
+    void PostFromISR(uint32_t events);
+
+    /// \brief Block until at least one event is pending, and return the set of pending events
+    uint32_t Wait(void);
+    /// \brief Return (and clear) the set of pending events without blocking
+    uint32_t Poll(void);
+
+    /// \brief Generate a JSON summary of the loop idle time and service latencies
+    DynamicJsonDocument Render(void) const;
+
+private:
+    TaskHandle_t    m_loopTask;                             ///< Handle for the task that runs the main loop
+    TimerHandle_t   m_canTimer;                             ///< Timer to trigger CAN bus service
+    TimerHandle_t   m_serviceTimer;                         ///< Timer to trigger housekeeping service
+    TimerHandle_t   m_supplyTimer;                          ///< Timer to trigger supply voltage checks
+    volatile uint32_t m_postTime[EventSourceCount];         ///< Time (us) of first un-serviced post for each source (0 => none)
+    uint32_t        m_maxLatency[EventSourceCount];         ///< Worst-case latency (us) from post to wake-up for each source
+    uint32_t        m_wakeups;                              ///< Count of times the loop has been woken
+    uint64_t        m_idleTime;                             ///< Total time (us) that the loop has been blocked waiting
+    uint64_t        m_startTime;                            ///< Time (us) when the loop was registered
+
+    /// \brief Record the time of the first post for each source in the event set
+    void markPosted(uint32_t events);
+    /// \brief Update the service latency for each source in the event set
+    void markServiced(uint32_t events, uint32_t now);
+    /// \brief Callback for the FreeRTOS timers, posting the event associated with the timer
+    static void timerCallback(TimerHandle_t timer);
+};
+
+extern EventLoop Events;    ///< Static parameter to use for the main loop event notification
+
+}
+
+#endif
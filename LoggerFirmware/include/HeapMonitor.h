@@ -30,6 +30,9 @@
 
 #include <stdint.h>
 #include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "ArduinoJson.h"
 
 namespace logger {
 
@@ -72,6 +75,98 @@ private:
     uint32_t previous_reported_size;    ///< Free space in heap at penultimate CurrentSize() call
 };
 
+const int MaxHeapTags = 32;             ///< Maximum number of sub-systems that can be tagged for heap attribution
+const int MaxHeapScopeDepth = 8;        ///< Maximum nesting of tagged scopes
+const int HeapHistoryLength = 60;       ///< Number of fragmentation samples to keep
+const uint32_t HeapSamplePeriod = 60000;///< Interval (ms) between fragmentation samples
+
+/// \class HeapTracker
+/// \brief Attribute heap usage to sub-systems, and track fragmentation over time
+///
+/// The heap in the logger can fragment slowly over days of operation, with NMEA0183 strings, JSON
+/// documents for status, serialisation buffers, and the WiFi stack all competing for space.  This object
+/// attributes changes in the heap to the sub-system that was running when they happened: code brackets
+/// the work for a sub-system with \a Push() and \a Pop() (the scheduler does this for every task, and
+/// some heavy users such as status generation add nested scopes), and the change in free heap across the
+/// scope (less that of any nested scopes) is charged to the scope's tag.  For each tag, this gives the
+/// live bytes retained, the peak, and the total bytes allocated (i.e., the sum of decreases in free heap),
+/// from which an allocation rate can be estimated.
+///     Only scopes on the task that called \a Begin() (i.e., the main loop) are tracked, since the free
+/// heap is a global quantity; allocations made concurrently by other tasks (e.g., the WiFi stack) will
+/// show up in whatever scope happens to be active, so the attribution is approximate.  Fragmentation is
+/// reported as 1 - (largest free block)/(total free), sampled periodically so that the trend is visible.
+
+class HeapTracker {
+public:
+    /// \brief Default constructor
+    HeapTracker(void);
+
+    /// \brief Register the calling task as the one whose scopes are tracked
+    void Begin(void);
+    /// \brief Register a named tag (or find an existing one), returning its index
+    int Tag(const char *name);
+
+    /// \brief Start a tagged scope
+    void Push(int tag);
+    /// \brief End the most recent tagged scope, charging the heap change to its tag
+    void Pop(void);
+
+    /// \brief Sample the fragmentation of the heap, if the sample period has expired
+    void Sample(void);
+
+    /// \brief Compute the current fragmentation index for the heap (0 = none, 1 = completely fragmented)
+    static double Fragmentation(void);
+
+    /// \brief Generate a JSON summary of heap state, fragmentation history, and per-tag usage
+    DynamicJsonDocument Render(void) const;
+
+private:
+    /// \struct TagStats
+    /// \brief Heap usage attributed to a single tag
+    struct TagStats {
+        const char  *name;      ///< Name of the tag, for reporting
+        int32_t     live;       ///< Net bytes retained by the tag
+        int32_t     peak;       ///< Maximum net bytes retained by the tag
+        uint64_t    allocated;  ///< Total bytes allocated (decreases in free heap) by the tag
+        uint32_t    scopes;     ///< Number of scopes charged to the tag
+    };
+    /// \struct Scope
+    /// \brief Book-keeping for an active tagged scope
+    struct Scope {
+        int         tag;        ///< Tag to charge for the scope
+        uint32_t    startFree;  ///< Free heap at the start of the scope
+        int32_t     nested;     ///< Heap change already charged to nested scopes
+    };
+    TaskHandle_t    m_owner;                        ///< Task whose scopes are being tracked
+    TagStats        m_tags[MaxHeapTags];            ///< Usage for each registered tag
+    int             m_nTags;                        ///< Number of registered tags
+    int             m_rejectedTags;                 ///< Number of tags refused because the table was full
+    Scope           m_stack[MaxHeapScopeDepth];     ///< Active scopes
+    int             m_depth;                        ///< Number of active scopes (may exceed stack if nested too deeply)
+    uint8_t         m_history[HeapHistoryLength];   ///< Fragmentation samples (percent), as a ring buffer
+    int             m_historyNext;                  ///< Index for the next fragmentation sample
+    int             m_historyCount;                 ///< Number of fragmentation samples taken (up to buffer length)
+    double          m_worstFragmentation;           ///< Worst fragmentation index seen
+    unsigned long   m_lastSample;                   ///< Time (ms) of last fragmentation sample
+    unsigned long   m_startTime;                    ///< Time (ms) when tracking started
+
+    /// \brief Determine whether the calling task is the one being tracked
+    bool tracking(void) const;
+};
+
+/// \class HeapScope
+/// \brief RAII helper to bracket a block of code with a tagged heap scope
+
+class HeapScope {
+public:
+    /// \brief Start a tagged scope for the lifetime of the object
+    HeapScope(int tag);
+    /// \brief End the tagged scope
+    ~HeapScope(void);
+};
+
+extern HeapTracker HeapTags;    ///< Static parameter to use for heap attribution
+
 }
 
 #endif
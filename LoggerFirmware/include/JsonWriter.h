@@ -0,0 +1,119 @@
+/*! \file JsonWriter.h
+ *  \brief Streaming JSON output in bounded memory
+ *
+ * Status reports and file lists can get large when there are many log files on the logger, and
+ * building them as a JSON document (and then serialising that to a string) needs several large
+ * contiguous blocks of heap.  This module provides a writer that emits the JSON incrementally,
+ * through a small fixed buffer, to any Arduino Print target (serial, a chunked HTTP response, or a
+ * file), so that the memory required is independent of the size of the output.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __JSON_WRITER_H__
+#define __JSON_WRITER_H__
+
+#include <stdint.h>
+#include <Arduino.h>
+#include "ArduinoJson.h"
+
+namespace logger {
+
+const size_t JsonWriterBufferSize = 512; ///< Size (bytes) of the output buffer for streaming JSON
+const int JsonWriterMaxDepth = 32;       ///< Maximum nesting depth of objects and arrays
+
+/// \class JsonWriter
+/// \brief Emit JSON incrementally to a Print target through a fixed-size buffer
+///
+/// Objects and arrays are opened and closed explicitly, and scalar values (or small JSON documents
+/// that are already built) are added as members.  Inside an object, each member needs a key; inside
+/// an array (or at the top level), the key should be nullptr.  The writer keeps track of the separators
+/// (and indentation, if pretty-printing), and buffers the output so that the target is written in blocks
+/// of up to \a JsonWriterBufferSize bytes (which, for a chunked HTTP response, is the chunk size).  The
+/// pretty-printed form matches that of serializeJsonPretty(), so that output is the same as it would be
+/// from a complete document.
+///     The writer is itself a Print target, which is how embedded documents are serialised; writing to it
+/// directly bypasses the separator book-keeping, and isn't generally useful.
+
+class JsonWriter : public Print {
+public:
+    /// \brief Constructor, specifying the output target and format
+    JsonWriter(Print& output, bool pretty = false);
+    /// \brief Default destructor, flushing any remaining output
+    ~JsonWriter(void);
+
+    /// \brief Open an object, as a member of the enclosing object (with key), or array (without)
+    void BeginObject(const char *key = nullptr);
+    /// \brief Close the innermost open object
+    void EndObject(void);
+    /// \brief Open an array, as a member of the enclosing object (with key), or array (without)
+    void BeginArray(const char *key = nullptr);
+    /// \brief Close the innermost open array
+    void EndArray(void);
+
+    /// \brief Add a string value
+    void Value(const char *key, const char *value);
+    /// \brief Add a string value
+    void Value(const char *key, String const& value) { Value(key, value.c_str()); }
+    /// \brief Add a numeric or boolean value (formatted as ArduinoJson would)
+    template<typename T>
+    void Value(const char *key, T value)
+    {
+        StaticJsonDocument<16> v;
+        v.set(value);
+        Document(key, v.as<JsonVariantConst>());
+    }
+    /// \brief Add an existing JSON document (or element of one)
+    void Document(const char *key, JsonVariantConst doc);
+
+    /// \brief Write any buffered output to the target
+    void Flush(void);
+    /// \brief Total number of bytes written (including any still buffered)
+    size_t Length(void) const { return m_total; }
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+
+private:
+    Print&      m_output;                       ///< Target for the JSON output
+    bool        m_pretty;                       ///< Flag: True => indent output as serializeJsonPretty()
+    bool        m_embedded;                     ///< Flag: True => currently serialising an embedded document
+    char        m_buffer[JsonWriterBufferSize]; ///< Output buffer
+    size_t      m_used;                         ///< Number of bytes in the output buffer
+    size_t      m_total;                        ///< Total number of bytes output
+    int         m_depth;                        ///< Current nesting depth
+    uint32_t    m_empty;                        ///< Bit-set: True => no members yet at the corresponding depth
+
+    /// \brief Add a single character to the output buffer
+    void put(char c);
+    /// \brief Add a string (with JSON escapes, and quotes) to the output buffer
+    void quoted(const char *s);
+    /// \brief Add a newline and indentation for the current depth (if pretty-printing)
+    void newline(void);
+    /// \brief Add the separator, indentation, and key (if any) before a new member
+    void member(const char *key);
+    /// \brief Open an object or array
+    void open(const char *key, char c);
+    /// \brief Close an object or array
+    void close(char c);
+};
+
+}
+
+#endif
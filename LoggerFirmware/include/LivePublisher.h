@@ -0,0 +1,135 @@
+/*! \file LivePublisher.h
+ *  \brief Publish the live data stream from the logger over UDP
+ *
+ * Applications on the same network as the logger (chart plotters, QA dashboards, etc.) often want
+ * to see the data as it arrives, rather than waiting for the log files.  This module takes a copy of
+ * each packet as it's written to the log file, batches them into UDP datagrams with a sequence number
+ * (so that receivers can detect loss), and sends them to a broadcast or multicast address from a
+ * background task.  The packets have the same format as in the log files, so the same readers apply.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __LIVE_PUBLISHER_H__
+#define __LIVE_PUBLISHER_H__
+
+#include <stdint.h>
+#include "Arduino.h"
+#include "AsyncUDP.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "ArduinoJson.h"
+#include "serialisation.h"
+
+namespace net {
+
+const uint16_t DefaultLivePort = 40182;         ///< Default UDP port for the live data stream
+const uint32_t LiveDatagramSize = 1400;         ///< Largest datagram (bytes) sent, to stay inside a typical MTU
+const int LiveBufferCount = 4;                  ///< Number of datagrams that can be waiting to be sent
+const unsigned long LiveFlushInterval = 100;    ///< Longest time (ms) that a packet waits for its datagram to fill
+const uint32_t LiveStackSize = 4096;            ///< Stack (bytes) for the sending task
+const int LiveCore = 0;                         ///< Core to run the sending task on (the loop runs on 1)
+
+/// \class LiveMetrics
+/// \brief Counts of packets and datagrams for the live data stream
+///
+/// Each count is only changed by one task (the main loop for packets, the sending task for datagrams), so
+/// they don't need a lock; the status report might see one count a packet behind another.
+
+class LiveMetrics {
+public:
+    /// \brief Default constructor
+    LiveMetrics(void);
+
+    uint32_t    packets;    ///< Packets added to datagrams
+    uint32_t    filtered;   ///< Packets left out by the packet-type filter
+    uint32_t    dropped;    ///< Packets dropped because all of the datagram buffers were waiting to be sent
+    uint32_t    oversize;   ///< Packets too big to fit in a datagram
+    uint32_t    datagrams;  ///< Datagrams sent
+    uint32_t    failures;   ///< Datagrams that failed to send
+    uint32_t    bytes;      ///< Bytes sent
+
+    /// \brief Generate a JSON summary of the counts
+    DynamicJsonDocument Render(void) const;
+};
+
+extern LiveMetrics LiveStats;   ///< Static parameter for live data statistics
+
+/// \class LivePublisher
+/// \brief Batch packets from the logger into UDP datagrams, and send them from a background task
+///
+/// Packets are added from the main loop with \a Publish() as they're written to the log file, into a
+/// datagram buffer that's sent when it's full, or (with \a Service()) when the oldest packet in it has
+/// waited for \a LiveFlushInterval.  Full buffers go into a queue for a low-priority task on the core that
+/// the loop isn't using, which sends them and returns them to the free pool.  There's a fixed number of
+/// buffers, so if the network can't keep up, packets are dropped (and counted) rather than holding up
+/// logging.
+///     Each datagram starts with a header: the four characters "WIBL", the serialiser major and minor
+/// version (one byte each), the number of packets (two bytes), and the datagram's sequence number (four
+/// bytes), all little-endian; the packets follow, each as its ID (four bytes), length (four bytes), and
+/// data, exactly as in the log files.  The address can be a multicast group or a broadcast address.  A
+/// filter can limit the stream to a list of packet IDs (IDs 1--31); otherwise everything is sent.
+
+class LivePublisher {
+public:
+    /// \brief Default constructor, with set-up from the configuration
+    LivePublisher(void);
+    /// \brief Default destructor
+    ~LivePublisher(void);
+
+    /// \brief Start the background task
+    bool Begin(void);
+    /// \brief Add a packet into the stream
+    void Publish(uint32_t pktID, Serialisable const& data);
+    /// \brief Send a part-filled datagram if its oldest packet has waited long enough
+    void Service(void);
+
+    /// \brief Convert a comma-separated list of packet IDs into a filter mask
+    static uint32_t ParseFilter(String const& filter);
+
+private:
+    /// \struct Datagram
+    /// \brief Buffer for a single datagram
+    struct Datagram {
+        uint16_t    count;      ///< Number of packets in the datagram
+        uint32_t    length;     ///< Number of bytes used in the buffer
+        uint8_t     data[LiveDatagramSize]; ///< Header and packets
+    };
+    AsyncUDP        m_udp;          ///< UDP interface for sending
+    IPAddress       m_address;      ///< Address to send to (multicast group or broadcast)
+    uint16_t        m_port;         ///< Port to send to
+    uint32_t        m_filter;       ///< Bit mask of packet IDs to send (zero for all)
+    Datagram        *m_buffers;     ///< Pool of datagram buffers
+    Datagram        *m_staging;     ///< Datagram being filled (nullptr if none)
+    unsigned long   m_stagedAt;     ///< Time (ms) at which the first packet was added to the datagram being filled
+    uint32_t        m_sequence;     ///< Sequence number for the next datagram
+    QueueHandle_t   m_free;         ///< Buffers available for filling
+    QueueHandle_t   m_ready;        ///< Buffers waiting to be sent
+    TaskHandle_t    m_task;         ///< Background sending task
+
+    /// \brief Pass the datagram being filled to the sending task
+    void flush(void);
+    /// \brief Entry point for the background task
+    static void worker(void *param);
+};
+
+}
+
+#endif
@@ -0,0 +1,120 @@
+/*! \file LogCompressor.h
+ *  \brief Background compression of log files once they have been closed
+ *
+ * Log files are written raw so that the logger never has to spend time compressing data while it's
+ * being ingested, but once a file has been closed it won't change again, and transfers (to a browser
+ * on the web server, or to the upload server) are much faster for the compressed version.  This module
+ * compresses closed log files into a gzip sibling on the second core, so that the main loop carries on
+ * logging while it happens, and reports back the size and MD5 hash of the result for the inventory.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __LOG_COMPRESSOR_H__
+#define __LOG_COMPRESSOR_H__
+
+#include <stdint.h>
+#include <Arduino.h>
+#include "FS.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "ArduinoJson.h"
+
+namespace logger {
+
+const char *const CompressedSuffix = ".gz";     ///< Suffix added to a log file's name for its compressed sibling
+const char *const PartialSuffix = ".tmp";       ///< Suffix for a compressed file that's still being written
+const int CompressorQueueLength = 4;            ///< Number of closed files that can be waiting for compression
+const uint32_t CompressorStackSize = 12288;     ///< Stack (bytes) for the compression task
+const int CompressorCore = 0;                   ///< Core to run the compression task on (the loop runs on 1)
+
+/// \class LogCompressor
+/// \brief Compress closed log files into gzip siblings in a background task
+///
+/// Files are queued with \a Submit() from the main loop when they're closed, and compressed one at a time
+/// by a low-priority task pinned to the core that the loop isn't using.  The compressed data is written to
+/// a partial file (so that a half-written file is never served), hashed as it's written, and then renamed
+/// to the file's name with \a CompressedSuffix.  The results are returned to the main loop through a second
+/// queue, and collected with \a Collect(), so that only the main loop updates the inventory.  The file
+/// system does its own locking, so the task can read and write files while the loop is logging.
+///     Files that don't get smaller are not kept, so that a transfer never gets larger for being compressed.
+
+class LogCompressor {
+public:
+    /// \struct Result
+    /// \brief Outcome of compressing a single log file
+    struct Result {
+        uint32_t    filenum;        ///< Log file number
+        bool        success;        ///< Flag: True => compressed sibling written
+        uint32_t    rawSize;        ///< Size (bytes) of the log file
+        uint32_t    compressedSize; ///< Size (bytes) of the compressed sibling
+        uint8_t     hash[16];       ///< MD5 hash of the compressed sibling
+        uint32_t    elapsed;        ///< Time (ms) taken to compress the file
+    };
+
+    /// \brief Constructor, with the file system on which the log files are stored
+    LogCompressor(fs::FS& filesystem);
+    /// \brief Default destructor
+    ~LogCompressor(void);
+
+    /// \brief Start the background task
+    bool Begin(void);
+    /// \brief Queue a closed log file for compression
+    bool Submit(uint32_t filenum, String const& filename);
+    /// \brief Collect the next completed result, if any
+    bool Collect(Result& result);
+    /// \brief Stop compressing as soon as possible, and take no more files (for power failure)
+    void Abort(void) { m_abort = true; }
+
+    /// \brief Generate a JSON summary of the compression statistics
+    DynamicJsonDocument Render(void) const;
+
+    /// \brief Generate the name of the compressed sibling for a log file
+    static String CompressedName(String const& filename) { return filename + CompressedSuffix; }
+
+private:
+    /// \struct Job
+    /// \brief Request to compress a single log file
+    struct Job {
+        uint32_t    filenum;        ///< Log file number
+        char        filename[32];   ///< Name of the log file
+    };
+    fs::FS          &m_fs;          ///< File system for the log files
+    QueueHandle_t   m_jobs;         ///< Files waiting to be compressed
+    QueueHandle_t   m_results;      ///< Results waiting to be collected by the main loop
+    TaskHandle_t    m_task;         ///< Background compression task
+    volatile bool   m_abort;        ///< Flag: True => stop writing, and take no more files
+    uint32_t        m_files;        ///< Number of files compressed
+    uint32_t        m_failures;     ///< Number of files that failed, or didn't get smaller
+    uint32_t        m_dropped;      ///< Number of files not queued because the queue was full
+    uint64_t        m_rawBytes;     ///< Total size (bytes) of the files compressed
+    uint64_t        m_compressedBytes; ///< Total size (bytes) of the compressed siblings
+    uint32_t        m_elapsed;      ///< Total time (ms) spent compressing
+    uint32_t        m_slowest;      ///< Longest time (ms) taken to compress a file
+
+    /// \brief Entry point for the background task
+    static void worker(void *param);
+    /// \brief Compress a single log file, filling in the result
+    void compress(Job const& job, Result& result);
+};
+
+}
+
+#endif
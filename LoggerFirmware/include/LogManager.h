@@ -28,12 +28,18 @@
 #define __LOG_MANAGER_H__
 
 #include <vector>
+#include <atomic>
+#include <functional>
 #include <stdint.h>
 #include <Arduino.h>
 #include "FS.h"
 #include "serialisation.h"
 #include "StatusLED.h"
 #include "MemController.h"
+#include "ArduinoJson.h"
+#include "ConsoleBuffer.h"
+#include "LogCompressor.h"
+#include "freertos/semphr.h"
 
 namespace logger {
 
@@ -66,6 +72,8 @@ public:
 
     /// \brief Close the current logfile (use judiciously!)
     void CloseLogfile(void);
+    /// \brief Stop recording and close the current logfile as fast as possible, for power failure
+    uint32_t EmergencyClose(void);
     
     /// \brief Remove a given log file from the SD card
     boolean RemoveLogFile(const uint32_t file_num);
@@ -77,6 +85,8 @@ public:
     uint32_t CountLogFiles(uint32_t filenumbers[MaxLogFiles]);
     /// \brief Count the number of log files on the system
     uint32_t CountLogFiles(void);
+    /// \brief Count the number of log files on the system, and their total size
+    uint32_t SummariseLogFiles(uint64_t& totalsize);
     
     class MD5Hash {
     public:
@@ -94,6 +104,28 @@ public:
     /// \brief Extract information on a single log file
     void EnumerateLogFile(uint32_t lognumber, String& filename, uint32_t& filesize, MD5Hash& filehash,
         uint16_t& uploadcount);
+    /// \brief Extract information on the compressed version of a single log file, if there is one
+    bool EnumerateCompressed(uint32_t lognumber, String& filename, uint32_t& filesize, MD5Hash& filehash);
+    /// \brief Look up the inventory hash for a log file (or its compressed sibling) by name
+    bool LookupDigest(String const& filename, MD5Hash& filehash);
+    /// \brief Look up the file to send for a closed log file (safe to call from another task)
+    bool UploadSource(uint32_t lognumber, String& filename, uint32_t& filesize, MD5Hash& filehash,
+        bool& compressed);
+
+    /// \struct LogSummary
+    /// \brief Summary of a closed log file, for choosing the order in which files are uploaded
+    struct LogSummary {
+        uint32_t    lognumber;  ///< Log file number
+        uint32_t    filesize;   ///< Size (bytes) of the file to send (the compressed sibling, if there is one)
+        uint32_t    sequence;   ///< Order in which the file was closed (higher is newer)
+    };
+    /// \brief Summarise the closed log files for upload (safe to call from another task)
+    uint32_t SummariseLogFiles(std::vector<LogSummary>& files);
+
+    /// \brief Call-back for a copy of each packet recorded (e.g., to publish the live data stream)
+    typedef std::function<void(uint32_t, Serialisable const&)> PacketTap;
+    /// \brief Set (or, with an empty call-back, clear) the tap on the packets recorded
+    void SetPacketTap(PacketTap tap) { m_tap = tap; }
     
     /// \enum PacketIDs
     /// \brief Symbolic definition for the packet IDs used to serialise the messages from NMEA2000
@@ -115,7 +147,8 @@ public:
         Pkt_NMEA0183ID = 15,    ///< Acceptable NMEA0183 sentence ID for filtering
         Pkt_SensorScales = 16,  ///< Scale factors for any sensors that will be recorded raw
         Pkt_RawIMU = 17,        ///< Raw store for logger's on-board IMU
-        Pkt_Setup = 18          ///< Setup JSON string for entire configuration
+        Pkt_Setup = 18,         ///< Setup JSON string for entire configuration
+        Pkt_Metrics = 19        ///< Performance metrics JSON string for the logger
     };
     
     /// \brief Write a packet into the current log file
@@ -126,7 +159,11 @@ public:
     fs::FS& FileSystem(void) { return m_storage->Controller(); }
     
     /// \brief Call to log on the console log
-    void Syslog(String const& message);
+    void Syslog(String const& message, ConsoleSource source = CONSOLE_SYSTEM);
+    /// \brief Write pending console messages to file (and rotate the file) if due
+    bool ServiceConsole(void);
+    /// \brief Generate a JSON summary of the console buffer statistics
+    DynamicJsonDocument ConsoleStatus(void) const { return m_console.Render(); }
     /// \brief Close the console file prior to shutdown
     void CloseConsole(void);
     /// \brief Dump console log to serial
@@ -137,9 +174,19 @@ public:
     void HashFile(uint32_t file_num, MD5Hash& hash);
     uint16_t IncrementUploadCount(uint32_t file_num);
     void AddInventory(bool verbose = false);
+    /// \brief Start compressing log files in the background when they are closed
+    void AddCompressor(void);
+    /// \brief Record the results of background compression in the inventory
+    bool ServiceCompression(void);
+    /// \brief Generate a JSON summary of the background compression statistics
+    DynamicJsonDocument CompressionStatus(void) const;
     void EmitNoDataReject(void);
+    /// \brief Write a performance metrics packet into the current log file
+    void RecordMetrics(DynamicJsonDocument const& metrics);
 
     bool WriteSnapshot(const char *name, String const& contents, String& url);
+    /// \brief Write a snapshot file, with the contents generated directly into the file
+    bool WriteSnapshot(const char *name, std::function<void(Print&)> generator, String& url);
 
 private:
     /// \class Inventory
@@ -161,10 +208,15 @@ private:
         void RemoveLogFile(uint32_t filenum);
         uint32_t CountLogFiles(uint32_t filenumbers[MaxLogFiles]);
         uint32_t CountLogFiles(void);
+        uint32_t Summarise(uint64_t& totalsize);
         uint32_t GetNextLogNumber(void);
         uint32_t Filesize(uint32_t filenum);
         uint16_t UploadCount(uint32_t filenum);
         uint16_t IncrementUploadCount(uint32_t filenum);
+        uint32_t Sequence(uint32_t filenum);
+        void TrackCompressed(void);
+        bool LookupCompressed(uint32_t filenum, uint32_t& filesize, MD5Hash& hash);
+        bool UpdateCompressed(uint32_t filenum, uint32_t filesize, MD5Hash const& hash);
 
         void SerialiseCache(Stream& stream);
 
@@ -174,14 +226,27 @@ private:
         std::vector<uint32_t>   m_filesize;
         std::vector<MD5Hash>    m_hashes;
         std::vector<uint16_t>   m_uploadCount;
+        std::vector<uint32_t>   m_compressedSize;
+        std::vector<MD5Hash>    m_compressedHash;
+        std::vector<uint32_t>   m_sequence;
+        uint32_t                m_nextSequence;
+        uint32_t                m_fileCount;    ///< Number of files with non-zero size in the inventory
+        uint64_t                m_totalSize;    ///< Total size of the files in the inventory (bytes)
+
+        void findCompressed(uint32_t filenum);
     };
     mem::MemController  *m_storage; ///< Controller for the storage to use
     File        m_consoleLog;       ///< File on which to write console information
+    ConsoleBuffer m_console;        ///< Staging buffer for console messages
     File        m_outputLog;        ///< Current output log file on the SD card
     uint32_t    m_currentFile;      ///< Filenumber of the currently open file
+    std::atomic<bool> m_logOpen;    ///< Flag: True => \a m_currentFile is open (for other tasks, instead of \a m_outputLog)
     Serialiser  *m_serialiser;      ///< Object to handle serialisation of data
     StatusLED   *m_led;             ///< Pointer for status (data event) handling
     Inventory   *m_inventory;       ///< Cache for file information, if available
+    LogCompressor *m_compressor;    ///< Background compression for closed log files, if enabled
+    SemaphoreHandle_t m_inventoryLock; ///< Lock on the inventory and current file number for other tasks
+    PacketTap   m_tap;              ///< Call-back for a copy of each packet recorded, if set
 
     bool m_noDataAlgEmitted;    ///< Flag for whether the "NoDataReject" algorithm packet has been emitted
     
@@ -197,8 +262,12 @@ private:
     void enumerate(uint32_t lognumber, String& filename, uint32_t& filesize);
     /// \brief Generate a hash for a given file 
     void hash(String const& filename, MD5Hash& hash);
+    /// \brief Remove the compressed sibling of a log file, if there is one
+    void removeCompressed(uint32_t lognum);
     /// \brief Rotate the console log files, if necessary
     void RotateConsoleLogs(void);
+    /// \brief Write all pending console messages to the console file
+    void WriteConsole(void);
     /// \brief Reset the indicators for dynamic algorithm requests
     void ResetDynamicAlgorithms(void);
 };
@@ -54,6 +54,10 @@ public:
     /// \brief Call-through for the file system abstract used by the memory controller
     fs::FS& Controller(void) { return get_interface(); }
     fs::FS *ControllerPtr(void) { return get_ptr_interface(); }
+    /// \brief Report the total capacity of the storage (bytes)
+    uint64_t TotalBytes(void) { return get_total_bytes(); }
+    /// \brief Report the space used on the storage (bytes)
+    uint64_t UsedBytes(void) { return get_used_bytes(); }
 
 private:
     /// \brief Implement the code to start the memory interface
@@ -64,6 +68,10 @@ private:
     virtual fs::FS& get_interface(void) = 0;
     /// \brief Return a pointer for the file system abstraction implemented by the memory sub-system
     virtual fs::FS *get_ptr_interface(void) = 0;
+    /// \brief Return the total capacity of the storage
+    virtual uint64_t get_total_bytes(void) = 0;
+    /// \brief Return the space used on the storage
+    virtual uint64_t get_used_bytes(void) = 0;
 };
 
 /// \class MemControllerFactory
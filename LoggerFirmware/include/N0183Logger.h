@@ -125,6 +125,10 @@ private:
     bool      m_debugAssembly;              ///< Flag for debug message construction
     int       m_badStartCount;              ///< Count of the number of bad start characters since last inversion reset
     int       m_lastInvertResetTime;        ///< Elapsed time when we last tried inverting the input to get good data
+
+    /// \brief Console log source for messages from this channel
+    logger::ConsoleSource consoleSource(void) const
+        { return m_channel == 2 ? logger::CONSOLE_NMEA0183_2 : logger::CONSOLE_NMEA0183_1; }
 };
 
 /// \class Logger
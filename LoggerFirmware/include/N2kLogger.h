@@ -106,6 +106,8 @@ private:
     unsigned long m_elapsedTimeAtDatum; ///< Internal clock elapsed time at last known datum
 };
 
+const int ProfiledPGNs = 10;    ///< Number of PGNs handled by the logger (and therefore profiled)
+
 /// \class Logger
 /// \brief Encapsulate N2K message handler
 ///
@@ -136,6 +138,7 @@ private:
     bool        m_verbose;          ///< Flag for verbose debug output
     Timestamp   m_timeReference;    ///< Time reference information for timestamping records
     logger::Manager *m_logManager;  ///< Handler for output log files
+    int         m_profileSection[ProfiledPGNs]; ///< Profiler sections for each handled PGN
     
     /// \brief Translate and serialise the real-time information from GNSS (or atomic clock)
     void HandleSystemTime(Timestamp::TimeDatum const& t, tN2kMsg const& msg);
@@ -5,7 +5,8 @@
  * strings on the WiFi, given a broadcast port, and send them to the NMEA0183 hardware
  * outputs (if available and enabled).  In this implementation, anything sent to the
  * configured port is echoed to the first NMEA0183 channel without checking --- the messages
- * must therefore be good as is!
+ * must therefore be good as is!  The packets are queued as they arrive, and written out from a
+ * background task at the rate the serial line can take, so that the network isn't held up.
  *
  * Copyright (c) 2021, University of New Hampshire, Center for Coastal and Ocean Mapping.
  *
@@ -30,12 +31,82 @@
 #define __POINT_BRIDGE_H__
 
 #include <stdint.h>
+#include <atomic>
 #include "Arduino.h"
 #include "AsyncUDP.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "ArduinoJson.h"
 
 namespace nmea {
 namespace N0183 {
 
+const uint16_t DefaultBridgePort = 40181;       ///< Default UDP port for the bridge
+const uint32_t BridgeRingSize = 4096;           ///< Size (bytes) of the queue between the network and the UART (power of two)
+const uint32_t BridgeChunkSize = 256;           ///< Largest write (bytes) to the UART, and the most credit that can build up
+const unsigned long BridgeHoldTime = 100;       ///< Longest time (ms) a partial sentence is held waiting for its end
+const uint32_t BridgeStackSize = 3072;          ///< Stack (bytes) for the UART drain task
+const int BridgeCore = 0;                       ///< Core to run the drain task on (the loop runs on 1)
+
+/// \class BridgeMetrics
+/// \brief Counts of data through the UDP to NMEA0183 bridge
+///
+/// The counts for data arriving are only changed by the network task, and those for data written by the
+/// drain task, so they don't need a lock; the status report might see one count a packet behind another.
+
+class BridgeMetrics {
+public:
+    /// \brief Default constructor
+    BridgeMetrics(void);
+
+    uint32_t    packets;    ///< UDP packets received
+    uint32_t    received;   ///< Bytes received
+    uint32_t    dropped;    ///< Sentences dropped because the queue was full
+    uint32_t    lost;       ///< Bytes dropped because the queue was full
+    uint32_t    highWater;  ///< Most bytes waiting in the queue
+    uint32_t    writes;     ///< Writes to the UART
+    uint32_t    written;    ///< Bytes written to the UART
+    uint32_t    fragments;  ///< Partial sentences written because their end didn't arrive in time
+
+    /// \brief Generate a JSON summary of the counts
+    DynamicJsonDocument Render(void) const;
+};
+
+extern BridgeMetrics BridgeStats;   ///< Static parameter for bridge statistics
+
+/// \class ByteRing
+/// \brief Lock-free queue of bytes between a single producer and a single consumer
+///
+/// The head is only moved by the producer and the tail by the consumer, and both count up without
+/// wrapping at the size of the buffer (which must be a power of two), so the amount used is always the
+/// difference between them.  The producer releases the head after copying data in, and the consumer
+/// releases the tail after copying data out, so neither ever sees a partial copy.
+
+class ByteRing {
+public:
+    /// \brief Constructor, with the size of the buffer to allocate
+    ByteRing(uint32_t size);
+    /// \brief Default destructor
+    ~ByteRing(void);
+
+    /// \brief Number of bytes waiting (either end)
+    uint32_t Used(void) const { return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire); }
+    /// \brief Number of bytes that can be added (producer)
+    uint32_t Free(void) const { return m_size - Used(); }
+    /// \brief Add all of a block of data, or none of it if there isn't room (producer)
+    bool Put(const uint8_t *data, uint32_t n);
+    /// \brief Copy out up to \a n bytes from the front of the queue without removing them (consumer)
+    uint32_t Peek(uint8_t *data, uint32_t n) const;
+    /// \brief Remove bytes from the front of the queue (consumer)
+    void Consume(uint32_t n) { m_tail.store(m_tail.load(std::memory_order_relaxed) + n, std::memory_order_release); }
+
+private:
+    uint8_t                 *m_buffer;  ///< Storage for the queue
+    uint32_t                m_size;     ///< Size of the buffer (bytes)
+    std::atomic<uint32_t>   m_head;     ///< Count of bytes added
+    std::atomic<uint32_t>   m_tail;     ///< Count of bytes removed
+};
+
 /// \class PointBridge
 /// \brief Use the asynchronous UDP facilities to capture broadcast packets in the background
 ///
@@ -44,6 +115,13 @@ namespace N0183 {
 /// so that the system can act as a network bridge (e.g., to provide data where a NMEA0183 feed
 /// isn't available, as on many research ships).  This object provides the means to run a thread
 /// in the background to do this, handling packets as they arrive.
+///     The UDP callback runs in the network task, so it only copies each sentence in the packet into a
+/// queue (dropping, and counting, any that don't fit), and wakes the drain task.  The drain task writes
+/// to the UART no faster than the baud rate allows, with credit for the time since the last write, so
+/// that it never waits long on the UART, and a burst from the network is spread out rather than lost.
+/// Writes end on a sentence boundary where possible.  With coalescing on, only whole sentences are
+/// written (as many as the credit covers, in one write), and a partial sentence is held until its end
+/// arrives, or for \a BridgeHoldTime; otherwise, data is written as soon as there's credit for it.
 
 class PointBridge {
 public:
@@ -55,11 +133,19 @@ public:
     /// \brief Set the verbosity of message reporting during capture on the bridge
     void SetVerbose(bool state);
 private:
-    AsyncUDP    *m_bridge;  ///< Pointer to the control object for the background capture thread
-    bool        m_verbose;  ///< Flag: True => print more information, False => quiet mode
+    AsyncUDP        *m_bridge;      ///< Pointer to the control object for the background capture thread
+    bool            m_verbose;      ///< Flag: True => print more information, False => quiet mode
+    bool            m_coalesce;     ///< Flag: True => only write whole sentences, False => write data as it arrives
+    uint32_t        m_baudRate;     ///< Configured baud rate for the first NMEA0183 channel
+    ByteRing        m_ring;         ///< Queue from the network task to the drain task
+    TaskHandle_t    m_task;         ///< Background UART drain task
 
-    /// \brief Call-back method to extract the NMEA strings from the UDP packet and write them to the transmitters
+    /// \brief Call-back method to queue the NMEA strings from the UDP packet for the transmitters
     void HandlePacket(AsyncUDPPacket& packet);
+    /// \brief Work out how much of the data at the front of the queue to write next
+    uint32_t nextWrite(const uint8_t *data, uint32_t n, uint32_t credit, bool flush, uint32_t& needed) const;
+    /// \brief Entry point for the background task
+    static void worker(void *param);
 };
 
 }
@@ -0,0 +1,104 @@
+/*! \file Profiler.h
+ *  \brief Lightweight latency profiling for the logger's main loop and message handlers
+ *
+ * In order to tune the logger for dense buses, it's necessary to know how long each part of the
+ * main loop takes, and how long it is between successive services of each sub-system (which
+ * determines, e.g., whether the CAN controller overflows).  This module provides a profiler based
+ * on the CPU cycle counter, which keeps log2-bucketed latency histograms for named sections of
+ * code, and has negligible overhead when it is disabled.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include <stdint.h>
+#include <Arduino.h>
+#include "ArduinoJson.h"
+
+namespace logger {
+
+const int ProfileBuckets = 32;      ///< Number of log2 buckets in each histogram (i.e., full range of 32-bit cycle count)
+const int MaxProfileSections = 32;  ///< Maximum number of named sections that can be profiled
+
+/// \class Profiler
+/// \brief Accumulate cycle-count latency histograms for named sections of code
+///
+/// Sections are registered by name (which must be a static string) and referred to by the index
+/// returned.  Code to be profiled is bracketed by \a Start() and \a Stop(); when the profiler is
+/// disabled, \a Start() costs a single test and \a Stop() returns immediately.  For each section,
+/// the profiler keeps a histogram of the number of CPU cycles taken, with bucket N covering
+/// [2^N, 2^(N+1)) cycles, along with the count, total and maximum, and the maximum gap between
+/// successive services of the section (so, e.g., the section wrapping the main loop's dispatch gives
+/// the maximum loop period).  Since the cycle counter wraps after about 18 s at 240 MHz, the gaps are
+/// timed with the microsecond timer instead.
+
+class Profiler {
+public:
+    /// \brief Default constructor
+    Profiler(void);
+
+    /// \brief Register a named section (or find an existing one), returning its index
+    int Section(const char *name);
+
+    /// \brief Turn profiling on or off
+    void Enable(bool on) { m_enabled = on; }
+    /// \brief Determine whether profiling is currently on
+    bool Enabled(void) const { return m_enabled; }
+    /// \brief Clear all of the accumulated statistics (but not the registered sections)
+    void Reset(void);
+
+    /// \brief Mark the start of a profiled section, returning the current cycle count (or zero if disabled)
+    inline uint32_t Start(void) const { return m_enabled ? ESP.getCycleCount() : 0; }
+    /// \brief Mark the end of a profiled section, given the result from \a Start()
+    inline void Stop(int section, uint32_t start) { if (m_enabled && start != 0) record(section, start); }
+
+    /// \brief Generate a JSON summary of the profile for each section
+    DynamicJsonDocument Render(void) const;
+
+private:
+    /// \struct Histogram
+    /// \brief Statistics for a single named section
+    struct Histogram {
+        const char  *name;                      ///< Name of the section, for reporting
+        uint32_t    buckets[ProfileBuckets];    ///< Counts of services in each log2 cycle-count bucket
+        uint32_t    count;                      ///< Total number of services
+        uint64_t    total;                      ///< Total cycles in all services
+        uint32_t    longest;                    ///< Longest service (cycles)
+        int64_t     lastService;                ///< Time (us) of the end of the last service
+        uint32_t    maxGap;                     ///< Longest gap (us) between successive services
+    };
+    Histogram   m_sections[MaxProfileSections]; ///< Statistics for each registered section
+    int         m_nSections;                    ///< Number of sections registered
+    bool        m_enabled;                      ///< Flag: profiling is on
+
+    /// \brief Add the cycles for a single service of a section into its statistics
+    void record(int section, uint32_t start);
+    /// \brief Clear the statistics for a single section
+    void clear(Histogram& h);
+    /// \brief Find the last non-zero bucket in a section's histogram
+    static int lastBucket(Histogram const& h);
+};
+
+extern Profiler Profile;    ///< Static parameter to use for profiling
+
+}
+
+#endif
@@ -0,0 +1,113 @@
+/*! \file Scheduler.h
+ *  \brief Cooperative scheduler for the sub-systems serviced by the main loop
+ *
+ * Each sub-system that needs service from the main loop registers as a task with a priority, a
+ * time budget for each invocation, and the set of events that make it runnable.  The scheduler then
+ * runs the tasks in priority order when their events arrive, accounting for the time that each
+ * uses, so that data ingest gets serviced regardless of what the network side of the logger is doing.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <stdint.h>
+#include <vector>
+#include <functional>
+#include <Arduino.h>
+#include "ArduinoJson.h"
+
+namespace logger {
+
+/// \enum TaskPriority
+/// \brief Priority classes for scheduled tasks (lower values are run first)
+
+enum TaskPriority {
+    PRIORITY_INGEST = 0,        ///< Data ingest (NMEA2000, NMEA0183, IMU)
+    PRIORITY_CONTROL = 1,       ///< Logger control (supply monitoring, LEDs, console commands)
+    PRIORITY_NETWORK = 2,       ///< Network service (WiFi server and commands)
+    PRIORITY_BACKGROUND = 3     ///< Background work (automatic upload)
+};
+
+/// \class Scheduler
+/// \brief Run registered tasks in priority order, within time budgets, as their events arrive
+///
+/// Tasks are registered with a priority, a time budget for each invocation, and a mask of the
+/// \a EventSource flags that make them runnable.  On each pass of the main loop, \a Dispatch() marks
+/// the tasks whose events have arrived, and then runs them in priority order, checking for new events
+/// between tasks so that higher-priority work that arrives in the meantime is run before any remaining
+/// lower-priority tasks.
+///     Each task is a function that returns True if it has more work to do.  Long operations should be
+/// written as resumable slices that check \a SliceExpired() and return (with True) when they have used
+/// their budget; the scheduler then runs them again on the next pass, after anything of higher priority.
+/// Invocations that run beyond their budget are counted as overruns for reporting.
+
+class Scheduler {
+public:
+    /// \brief Function type for a single slice of a task; returns True if more work remains
+    typedef std::function<bool(void)> Slice;
+
+    /// \brief Default constructor
+    Scheduler(void);
+    /// \brief Default destructor
+    ~Scheduler(void);
+
+    /// \brief Register a task with the scheduler
+    void Register(const char *name, TaskPriority priority, uint32_t budget, uint32_t events, Slice slice);
+
+    /// \brief Run all tasks made runnable by the given events (and any that arrive while running)
+    void Dispatch(uint32_t events);
+
+    /// \brief Determine whether the currently running task has used its time budget
+    bool SliceExpired(void) const;
+
+    /// \brief Generate a JSON summary of the task run-times and budget overruns
+    DynamicJsonDocument Render(void) const;
+
+private:
+    /// \struct Task
+    /// \brief Book-keeping for a single registered task
+    struct Task {
+        const char      *name;      ///< Name of the task, for reporting
+        TaskPriority    priority;   ///< Priority class for the task
+        uint32_t        budget;     ///< Time budget (us) for each invocation
+        uint32_t        events;     ///< Mask of events that make the task runnable
+        Slice           slice;      ///< Function to call for each invocation
+        bool            pending;    ///< Flag: task is runnable
+        bool            resume;     ///< Flag: task yielded with more work to do
+        uint32_t        runs;       ///< Number of invocations
+        uint32_t        overruns;   ///< Number of invocations that exceeded the budget
+        uint32_t        worst;      ///< Longest invocation (us)
+        int             section;    ///< Profiler section for the task
+        int             heapTag;    ///< Heap attribution tag for the task
+        uint16_t        traceName;  ///< Trace name index for the task
+    };
+    std::vector<Task>   m_tasks;    ///< Tasks, in priority order
+    int64_t             m_deadline; ///< Time (us) at which the current task's budget expires
+
+    /// \brief Mark all tasks that are runnable with the given events
+    void markPending(uint32_t events);
+};
+
+extern Scheduler Tasks; ///< Static parameter to use for scheduling the main loop
+
+}
+
+#endif
@@ -34,9 +34,10 @@
 #include "LogManager.h"
 #include "StatusLED.h"
 #include "WiFiAdapter.h"
-#include "IncrementalBuffer.h"
 #include "NVMFile.h"
 #include "AutoUpload.h"
+#include "LivePublisher.h"
+#include "CommandVerbs.h"
 
 /// \class SerialCommand
 /// \brief Implement a simple ASCII command language for the logger
@@ -49,8 +50,9 @@
 /// The code stores copies of the pointers for the logger and status LED controllers, but does
 /// not manage them.  The pointer for the BLE object is managed locally.
 ///
-/// Like most Arduino code, the \a ProcessCommand method needs to be called regularly to
-/// check for commands, and execute them.
+/// Like most Arduino code, the \a ProcessCommand, \a ProcessWireless, and \a ProcessUpload
+/// methods need to be called regularly to check for commands, and execute them; they are
+/// registered as tasks with the scheduler in setup().
 
 class SerialCommand {
 public:
@@ -60,11 +62,15 @@ public:
     /// \brief Default destructor
     ~SerialCommand();
     
-    /// \brief Poll for commands, and execute if they've been received.
-    void ProcessCommand(void);
+    /// \brief Poll for commands on the serial port, and execute if they've been received.
+    bool ProcessCommand(void);
+    /// \brief Service the WiFi interface, and execute any commands received.
+    bool ProcessWireless(void);
+    /// \brief Run a slice of the automatic upload cycle, if configured.
+    bool ProcessUpload(void);
 
     /// \brief Stop logging immediately for emergency power-down
-    void EmergencyStop(void);
+    void EmergencyStop(uint32_t latency = 0);
     
     /// \enum CommandSource
     /// \brief Identify the source of the command being processed
@@ -87,10 +93,16 @@ private:
     nmea::N0183::Logger *m_serialLogger;///< Pointer for the NMEA0183 message handler
     nmea::N0183::PointBridge *m_bridge; ///< Pointer for the WiFi/UDP -> NEMA0183 bridge
     net::UploadManager  *m_uploadManager; ///< Pointer to the auto-upload manager
+    net::LivePublisher  *m_live;        ///< Pointer to the live data stream publisher
     logger::Manager     *m_logManager;  ///< Object to write to SD files and console log
     StatusLED           *m_led;         ///< Pointer for the status LED controller
     WiFiAdapter         *m_wifi;        ///< Pointer for the WiFi interface, once it comes up
-    logger::IncBuffer   m_serialBuffer; ///< Space to assemble serial commands that doesn't block runtime
+    static const size_t SerialChunkSize = 256;  ///< Most characters read from the serial port at a time
+
+    cmd::LineReader     m_serialLine;   ///< Assembly of serial commands (including long ones) from bulk reads
+    char                m_serialChunk[SerialChunkSize]; ///< Characters read from serial, not yet assembled
+    size_t              m_chunkStart;   ///< Next character to assemble from \a m_serialChunk
+    size_t              m_chunkEnd;     ///< End of the characters read into \a m_serialChunk
     bool                m_echoOn;       ///< Flag: indicate that characters from serial should be echoed back
     bool                m_passThrough;  ///< Flag: indicate that strings should be passed through to NMEA0183 transmit
 
@@ -101,7 +113,7 @@ private:
     /// \brief Erase one or all of the data log files
     void EraseLogfile(String const& filenum, CommandSource src);
     /// \brief Set the state of the LEDs (primarily for testing)
-    void ModifyLEDState(String const& command);
+    void ModifyLEDState(String const& command, CommandSource src);
     /// \brief Report the logger's user-specified identification string
     void ReportIdentificationString(CommandSource src);
     /// \brief Set the logger's user-specified identification string
@@ -111,9 +123,25 @@ private:
     /// \brief Set the host ship's name
     void SetShipname(String const& name, CommandSource src);
     /// \brief Turn on/off verbose information on messages received
-    void SetVerboseMode(String const& mode);
+    void SetVerboseMode(String const& mode, CommandSource src);
     /// \brief Shut down logging for safe power removal
     void Shutdown(void);
+    /// \brief Shut down logging for safe power removal, by command
+    void StopLogging(CommandSource src);
+    /// \brief Close the current log file and start the next, by command
+    void StepLog(CommandSource src);
+    /// \brief Restart the logger, by command
+    void Restart(CommandSource src);
+    /// \brief Start an over-the-air firmware update, by command
+    void StartOTA(CommandSource src);
+    /// \brief Start passing serial input through to NMEA0183, by command
+    void StartPassthrough(CommandSource src);
+    /// \brief Run a complete line from the serial port
+    void runSerialLine(void);
+    /// \brief Start the live data stream, if configured
+    void startLive(void);
+    /// \brief Stop the live data stream, if running
+    void stopLive(void);
     /// \brief Set the WiFi SSID string
     void SetWiFiSSID(String const& params, CommandSource src);
     /// \brief Get the WiFi SSID string
@@ -128,6 +156,22 @@ private:
     void GetMDNSName(CommandSource src);
     /// \brief Turn the WiFi interface either on or off
     void ManageWireless(String const& command, CommandSource src);
+    /// \brief Report the detailed heap usage and fragmentation
+    void ReportHeapDetail(CommandSource src);
+    /// \brief Report details of the heap, as selected
+    void ConfigureHeap(String const& command, CommandSource src);
+    /// \brief Report the current latency profile
+    void ReportProfile(CommandSource src);
+    /// \brief Turn the latency profiler on/off, or reset it
+    void ConfigureProfile(String const& command, CommandSource src);
+    /// \brief Report the state of the binary event trace
+    void ReportTrace(CommandSource src);
+    /// \brief Turn the binary event trace on/off, clear it, or dump it
+    void ConfigureTrace(String const& command, CommandSource src);
+    /// \brief Report the state and results of the storage benchmark
+    void ReportBenchmark(CommandSource src);
+    /// \brief Start or stop the storage benchmark
+    void ConfigureBenchmark(String const& command, CommandSource src);
     /// \brief Send a log file to the client
     void TransferLogFile(String const& command, CommandSource src);
     /// \brief Set up receiver on UARTs for inverting input (to deal with polarity problems)
@@ -144,6 +188,8 @@ private:
     void ConfigureAlgRequest(String const& command, CommandSource src);
     /// \brief Report configuration parameters as a JSON structure
     void ReportConfigurationJSON(CommandSource src, bool secure = false);
+    /// \brief Report configuration parameters as a JSON structure, by command
+    void ReportSetup(CommandSource src);
     /// \brief Report configuration parameters for the logger
     void ReportConfiguration(CommandSource src);
     /// \brief Set up all configuration parameters from a JSON string
@@ -178,6 +224,8 @@ private:
     void SetLabDefaults(String const& spec, CommandSource src);
     /// \brief Reset the configuration to lab-default configuration JSON string
     void ResetLabDefaults(CommandSource src);
+    /// \brief Report, set, or reset to the lab-default configuration
+    void ConfigureLab(String const& command, CommandSource src);
     /// @brief Report the upload authorisation information
     void GetAuthorisation(CommandSource src);
     /// @brief Set the upload token used to authenticate transmissions
@@ -190,13 +238,25 @@ private:
     void ConfigureUpload(String const& command, CommandSource src);
     /// \brief Check for commands, and execute them if found
     void Execute(String const& command, CommandSource src);
+
+    /// \brief Handler for a command given without arguments
+    typedef void (SerialCommand::*ReportHandler)(CommandSource src);
+    /// \brief Handler for a command given with arguments
+    typedef void (SerialCommand::*ConfigureHandler)(String const& command, CommandSource src);
+    /// \struct CommandEntry
+    /// \brief Entry in the command table: the verb, and the handlers with and without arguments
+    struct CommandEntry {
+        const char          *verb;      ///< First word of the command
+        ReportHandler       report;     ///< Handler if there are no arguments (nullptr if they're needed)
+        ConfigureHandler    configure;  ///< Handler if there are arguments (nullptr if there can't be any)
+    };
+    /// \brief Look up a single command in the command table, and run its handler
+    void dispatch(cmd::Token const& line, CommandSource src);
     
     /// \brief Generate a string on the appropriate output stream
     void EmitMessage(String const& msg, CommandSource src);
     /// \brief Convert a stringified JSON into a document, with error reporting
     bool EmitJSON(String const& source, CommandSource src);
-    /// @brief Generate a list of files into a JSON document
-    DynamicJsonDocument GenerateFilelist(void);
     /// @brief Display a NMEA0183 filter ID list
     void DisplayNMEAFilter(logger::N0183IDStore& filter, CommandSource src);
     /// @brief Display an Algorithm Store list
@@ -2,8 +2,9 @@
  * \brief General commands to support status report generation
  *
  * The logger needs to generate status information to report to the user, and for
- * uploads when enabled.  The free functions here manage this process, and the
- * construction of DynamicJsonDocuments (without the memory hassles).
+ * uploads when enabled.  The free functions here manage this process, streaming the
+ * larger reports (status and file list) straight to their output, and constructing
+ * DynamicJsonDocuments for the rest (without the memory hassles).
  *
  * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
  *
@@ -26,18 +27,63 @@
 
 #include "ArduinoJson.h"
 #include "LogManager.h"
+#include "JsonWriter.h"
 
 namespace logger {
 namespace status {
 
-/// @brief Generate a JSON list of the set of files (and their metrics) currently on the logger
-DynamicJsonDocument GenerateFilelist(logger::Manager *m);
+/// @brief Write the set of files (and their metrics) currently on the logger into an open JSON object
+void WriteFilelist(logger::Manager *m, JsonWriter& out);
 
-/// @brief Generate a JSON document representing the current status of the logger
-DynamicJsonDocument CurrentStatus(logger::Manager *m);
+/// @brief Stream a JSON list of the set of files (and their metrics) currently on the logger
+void StreamFilelist(logger::Manager *m, Print& output, bool pretty = false);
+
+/// @brief Stream a JSON document representing the current status of the logger
+void StreamStatus(logger::Manager *m, Print& output, bool pretty = false);
+
+/// @brief Generate a JSON document with the performance metrics to record in the log file
+DynamicJsonDocument CurrentMetrics(void);
 
 /// @brief Generate a correctly-sized JSON document from a minified string
 DynamicJsonDocument GenerateJSON(String const& s);
 
+const unsigned long StatusPushInterval = 1000;  ///< Shortest time (ms) between status updates pushed to web clients
+const unsigned long StatusKeepAlive = 15000;    ///< Longest time (ms) without an update before a keep-alive is sent
+
+/// \class StatusFeed
+/// \brief Compact status summary for pushing to web clients, with updates only for what's changed
+///
+/// The web interface shows a small part of the status report (supply, web-server state, file count and
+/// size, latest data, and the performance summaries), and was polling for the whole report to get it.
+/// This renders the summary a section at a time into strings, and compares each with what was sent last,
+/// so that \a Refresh() can pre-serialise a Server-Sent Event with just the sections that have changed
+/// (and the elapsed time).  The same event is then written to every client, so the cost doesn't depend on
+/// how many are watching.  A client that has just subscribed is sent \a Snapshot(), which is assembled
+/// from the last sections rendered, rather than rendering them again.
+
+class StatusFeed {
+public:
+    /// \brief Constructor, with the log manager used to count the files
+    StatusFeed(logger::Manager *m);
+
+    /// \brief Render the summary, and build an event with the sections that have changed
+    bool Refresh(void);
+    /// \brief Pre-serialised event with the sections that changed at the last \a Refresh()
+    String const& Delta(void) const { return m_delta; }
+    /// \brief Generate an event with all of the sections, as last rendered
+    String Snapshot(void) const;
+
+private:
+    static const int SectionCount = 9;  ///< Number of sections in the summary
+    static const char *names[SectionCount]; ///< Keys for each section in the events
+    logger::Manager *m_logManager;      ///< Log manager used to count the files
+    String          m_sections[SectionCount];   ///< Serialised JSON for each section, as last rendered
+    unsigned long   m_elapsed;          ///< Time (ms) at the last \a Refresh()
+    String          m_delta;            ///< Event for the last \a Refresh()
+
+    /// \brief Render one section of the summary as JSON
+    String render(int section);
+};
+
 }
 }
@@ -0,0 +1,174 @@
+/*! \file StorageBenchmark.h
+ *  \brief Portable benchmark for qualifying the storage medium used for logging
+ *
+ * The quality of SD cards (and, to a lesser extent, eMMC modules) varies enormously, and a card that
+ * can't sustain the logger's write rate will lose data.  This module provides a benchmark that runs
+ * sequential and random write and read tests against a scratch file, with configurable block size and
+ * flush policy, and reports throughput and latency percentiles, with a pass/fail against the rate the
+ * logger requires.  The core is independent of the Arduino environment so that it can also be built on
+ * a POSIX host to provide a reference for comparison.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __STORAGE_BENCHMARK_H__
+#define __STORAGE_BENCHMARK_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+/// \class Medium
+/// \brief Abstract interface to the scratch file used for the benchmark
+///
+/// Implementations wrap the file system on the platform in use (e.g., an Arduino fs::File on the
+/// logger, or a POSIX file descriptor on a host).  The file is opened for reading and writing, and
+/// truncated, by \a Open(); \a Flush() should force data to the medium (e.g., fsync()) so that the
+/// cost is comparable to the logger's flush after each packet.
+
+class Medium {
+public:
+    virtual ~Medium(void) {}
+    /// \brief Create (or truncate) the scratch file, open for reading and writing
+    virtual bool Open(void) = 0;
+    /// \brief Close the scratch file
+    virtual void Close(void) = 0;
+    /// \brief Remove the scratch file from the medium
+    virtual void Remove(void) = 0;
+    /// \brief Set the file position for the next read or write
+    virtual bool Seek(uint32_t offset) = 0;
+    /// \brief Write a block of data at the current position, returning the number of bytes written
+    virtual size_t Write(const uint8_t *data, size_t n) = 0;
+    /// \brief Read a block of data from the current position, returning the number of bytes read
+    virtual size_t Read(uint8_t *data, size_t n) = 0;
+    /// \brief Force any buffered data to the medium
+    virtual void Flush(void) = 0;
+};
+
+/// \brief Function type for a monotonic clock in microseconds
+typedef uint64_t (*Clock)(void);
+
+/// \struct Parameters
+/// \brief Configuration for a benchmark run
+
+struct Parameters {
+    uint32_t    fileSize;       ///< Size of the scratch file (bytes)
+    uint32_t    blockSize;      ///< Size of each read or write (bytes)
+    uint32_t    flushEvery;     ///< Number of blocks written between flushes (0 => only at end of test)
+    uint32_t    requiredRate;   ///< Sustained write rate required to pass (bytes/s)
+
+    Parameters(void)
+    : fileSize(1024*1024), blockSize(4096), flushEvery(1), requiredRate(64*1024) {}
+};
+
+/// \struct Result
+/// \brief Outcome of a single test in the benchmark
+
+struct Result {
+    const char  *name;          ///< Name of the test
+    bool        write;          ///< Flag: test writes (and therefore is checked against the required rate)
+    uint64_t    bytes;          ///< Number of bytes transferred
+    uint64_t    elapsed;        ///< Time taken (us), including the final flush for write tests
+    double      rate;           ///< Throughput (bytes/s)
+    uint32_t    p50;            ///< Median block latency (us)
+    uint32_t    p90;            ///< 90th percentile block latency (us)
+    uint32_t    p99;            ///< 99th percentile block latency (us)
+    uint32_t    max;            ///< Maximum block latency (us)
+    bool        pass;           ///< Flag: test met the required rate (always true for read tests)
+};
+
+/// \class Benchmark
+/// \brief Run sequential and random write/read tests against a scratch file, in resumable steps
+///
+/// The benchmark runs four tests in order: sequential write (which also creates the file), sequential
+/// read, random write, and random read, each transferring the whole file size in blocks.  Random tests
+/// pick block-aligned offsets with a fixed-seed generator, so runs are repeatable.  For write tests, the
+/// medium is flushed every \a flushEvery blocks (and at the end of the test), and the flush time is
+/// included in the latency of the block that triggered it.
+///     So that the benchmark can run on the logger without stopping everything else, the work is done
+/// by \a Step(), which processes blocks until the time budget given has been used, and returns True
+/// while there is more to do.
+
+class Benchmark {
+public:
+    /// \brief Constructor, with the medium and clock to use
+    Benchmark(Medium *medium, Clock clock);
+
+    /// \brief Set up for a new run with the given parameters
+    bool Start(Parameters const& params);
+    /// \brief Run blocks for up to the given time (us), returning True if there is more to do
+    bool Step(uint32_t budget);
+    /// \brief Abandon the current run, removing the scratch file
+    void Stop(void);
+
+    /// \brief Determine whether a run is in progress
+    bool Running(void) const { return m_phase != PHASE_IDLE && m_phase != PHASE_DONE; }
+    /// \brief Determine whether the last run completed
+    bool Complete(void) const { return m_phase == PHASE_DONE; }
+    /// \brief Determine whether all of the tests in the last run passed
+    bool Passed(void) const;
+    /// \brief Description of the error that stopped the last run, if any
+    std::string const& Error(void) const { return m_error; }
+    /// \brief Parameters for the current (or last) run
+    Parameters const& Params(void) const { return m_params; }
+    /// \brief Results of the tests completed so far
+    std::vector<Result> const& Results(void) const { return m_results; }
+
+private:
+    /// \enum Phase
+    /// \brief Stages of the benchmark run
+    enum Phase {
+        PHASE_IDLE,         ///< No run has been started (or the last was stopped)
+        PHASE_SEQ_WRITE,    ///< Sequential write test
+        PHASE_SEQ_READ,     ///< Sequential read test
+        PHASE_RAND_WRITE,   ///< Random write test
+        PHASE_RAND_READ,    ///< Random read test
+        PHASE_DONE          ///< All tests complete
+    };
+    Medium                  *m_medium;      ///< Scratch file interface
+    Clock                   m_clock;        ///< Microsecond clock
+    Parameters              m_params;       ///< Parameters for the run
+    Phase                   m_phase;        ///< Current stage of the run
+    uint32_t                m_nBlocks;      ///< Number of blocks in the scratch file
+    uint32_t                m_block;        ///< Number of blocks done in the current test
+    uint32_t                m_seed;         ///< State of the random offset generator
+    uint64_t                m_testStart;    ///< Time (us) at the start of the current test
+    std::vector<uint8_t>    m_buffer;       ///< Data block for reads and writes
+    std::vector<uint32_t>   m_latency;      ///< Latency (us) of each block in the current test
+    std::vector<Result>     m_results;      ///< Results of completed tests
+    std::string             m_error;        ///< Description of the last error
+
+    /// \brief Start the test for the given phase
+    void beginPhase(Phase phase);
+    /// \brief Complete the current test, recording its result
+    void endPhase(void);
+    /// \brief Run a single block of the current test
+    bool runBlock(void);
+    /// \brief Abandon the run with an error
+    void fail(const char *message);
+    /// \brief Generate the next random block number
+    uint32_t nextRandom(void);
+};
+
+}
+
+#endif
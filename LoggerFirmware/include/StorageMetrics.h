@@ -0,0 +1,118 @@
+/*! \file StorageMetrics.h
+ *  \brief Telemetry for the logger's storage (SD card or eMMC) I/O
+ *
+ * The logger depends on its storage keeping up with the data rate, but until it fails there's no
+ * indication of how close to the limit the card is.  This module measures each class of storage
+ * operation (packet writes, flushes, log file open/close, console log writes, and file transfers),
+ * keeping latency histograms and byte/operation counts, the worst stall seen, and a projection of
+ * when the card will fill at the current write rate.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __STORAGE_METRICS_H__
+#define __STORAGE_METRICS_H__
+
+#include <stdint.h>
+#include <Arduino.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "ArduinoJson.h"
+#include "MemController.h"
+
+namespace logger {
+
+/// \enum StorageOp
+/// \brief Classes of storage operation that are measured separately
+
+enum StorageOp {
+    STORAGE_WRITE = 0,      ///< Write of a packet to the current log file (excluding flush)
+    STORAGE_FLUSH = 1,      ///< Flush of the current log file after a packet write
+    STORAGE_OPEN = 2,       ///< Open of a new log file
+    STORAGE_CLOSE = 3,      ///< Close of the current log file
+    STORAGE_SYSLOG = 4,     ///< Write (and flush) of a message to the console log
+    STORAGE_TRANSFER = 5,   ///< Transfer of a log file to a client or upload server
+    StorageOpCount = 6      ///< Number of classes of operation
+};
+
+const int StorageBuckets = 20;              ///< Number of log2 microsecond buckets in each histogram (last is open-ended)
+const uint32_t StorageSamplePeriod = 60;    ///< Period (s) between samples of rate and card usage (and metrics packets)
+
+/// \class StorageMonitor
+/// \brief Accumulate latency and throughput statistics for storage operations
+///
+/// Code performing a storage operation brackets it with \a Start() and \a Stop(), giving the class
+/// of operation and the number of bytes involved.  The cost is two reads of the microsecond timer and
+/// a few arithmetic operations, which is small compared to even the fastest card write.  For each class,
+/// the monitor keeps a histogram of latency (bucket N covering [2^N, 2^(N+1)) us), the count, bytes and
+/// total time, and the longest operation; the longest of all (the worst stall of the data path) is kept
+/// with the class and time at which it happened.
+///     Every \a StorageSamplePeriod seconds, \a Sample() computes the write rate and the percentage of time
+/// spent in storage operations over the period, and reads the space used on the card so that the time
+/// until it fills at the current write rate can be projected.
+
+class StorageMonitor {
+public:
+    /// \brief Default constructor
+    StorageMonitor(void);
+
+    /// \brief Set the storage to use for card capacity and usage
+    void Begin(mem::MemController *storage);
+
+    /// \brief Mark the start of a storage operation, returning the current time
+    inline uint32_t Start(void) const { return static_cast<uint32_t>(esp_timer_get_time()); }
+    /// \brief Mark the end of a storage operation, given the result from \a Start()
+    void Stop(StorageOp op, uint32_t start, uint32_t bytes = 0);
+
+    /// \brief Update the rate and card usage estimates, if the sample period has elapsed
+    bool Sample(void);
+
+    /// \brief Generate a JSON summary of the storage statistics
+    DynamicJsonDocument Render(void) const;
+
+private:
+    /// \struct OpStats
+    /// \brief Statistics for a single class of storage operation
+    struct OpStats {
+        uint32_t    count;                      ///< Number of operations
+        uint64_t    bytes;                      ///< Total bytes in all operations
+        uint64_t    total;                      ///< Total time (us) in all operations
+        uint32_t    worst;                      ///< Longest operation (us)
+        uint32_t    buckets[StorageBuckets];    ///< Counts of operations in each log2 microsecond bucket
+    };
+    OpStats             m_ops[StorageOpCount];  ///< Statistics for each class of operation
+    portMUX_TYPE        m_lock;                 ///< Spin-lock for updates to the statistics
+    uint32_t            m_stall;                ///< Longest operation of any class (us)
+    StorageOp           m_stallOp;              ///< Class of the longest operation
+    int64_t             m_stallTime;            ///< Time (us since boot) of the longest operation
+    mem::MemController  *m_storage;             ///< Storage to interrogate for capacity and usage
+    uint64_t            m_cardTotal;            ///< Capacity of the card (bytes) at last sample
+    uint64_t            m_cardUsed;             ///< Space used on the card (bytes) at last sample
+    int64_t             m_lastSample;           ///< Time (us since boot) of the last sample
+    uint64_t            m_lastBytes;            ///< Total bytes written at the last sample
+    uint64_t            m_lastBusy;             ///< Total time (us) in storage operations at the last sample
+    float               m_rate;                 ///< Write rate (bytes/s) over the last sample period
+    float               m_busy;                 ///< Percentage of time in storage operations over the last sample period
+};
+
+extern StorageMonitor StorageIO;    ///< Static parameter to use for storage telemetry
+
+}
+
+#endif
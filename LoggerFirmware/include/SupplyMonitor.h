@@ -28,10 +28,16 @@
 #define __SUPPLY_MONITOR_H__
 
 #include <stdint.h>
+#include <Arduino.h>
+#include "esp_timer.h"
+#include "esp_adc_cal.h"
 
 namespace logger {
 
 const uint8_t default_monitor_pin = GPIO_NUM_36;    ///< GPIO pin to use for monitoring the supply voltage
+const uint32_t SupplySamplePeriod = 5000;           ///< Period (us) for sampling the supply voltage
+const int SupplyFilterShift = 2;                    ///< Weight of each new sample in the supply filter (1/2^N)
+const int SupplyFilterFraction = 4;                 ///< Number of fractional bits in the filtered supply value
 
 /// \class SupplyMonitor
 /// \brief Object to check on supply voltage and indicate backup power startup
@@ -41,18 +47,42 @@ const uint8_t default_monitor_pin = GPIO_NUM_36;    ///< GPIO pin to use for mon
 /// and check whether it looks like something acceptable for running the system.  A "true" return from
 /// EmergencyPower() indicates that the module should start to shut down immediately, since there
 /// isn't a lot of time left.
+///     Rather than reading the ADC from the main loop, the pin is sampled from a periodic high-resolution
+/// timer, with the raw readings smoothed by a fixed-point exponential filter (so that a single noisy
+/// reading doesn't trigger a shutdown), and compared against the trigger threshold converted into raw
+/// ADC units once at start-up.  When the filtered value drops below the threshold, the emergency flag is
+/// set and the supply event posted to the main loop immediately, so the response time is set by the
+/// sample period and filter, rather than the supply polling period.  (The ESP32 doesn't have an analogue
+/// comparator that could be used to interrupt on the threshold directly.)
 
 class SupplyMonitor {
 public:
     /// \brief Default constructor, specifying the monitoring pin
     SupplyMonitor(uint8_t monitor_pin = default_monitor_pin);
+    /// \brief Default destructor
+    ~SupplyMonitor(void);
 
-    /// \brief Sample the voltage on the monitoring pin, and determine whether we're on emergency power
+    /// \brief Determine whether we're on emergency power (and update the reported supply voltage)
     bool EmergencyPower(void);
+    /// \brief Time (us) since the supply dropped below the threshold (zero if it hasn't)
+    uint32_t SinceTrip(void) const;
 
 private:
-    bool    m_monitorPower; ///< Flag: True => power monitoring is happening, False => we don't care about power
-    uint8_t m_monitorPin;   ///< GPIO pin being used to monitor the power.
+    bool                            m_monitorPower; ///< Flag: True => power monitoring is happening, False => we don't care about power
+    uint8_t                         m_monitorPin;   ///< GPIO pin being used to monitor the power.
+    esp_timer_handle_t              m_timer;        ///< Timer for sampling the supply voltage
+    esp_adc_cal_characteristics_t   m_adcCal;       ///< ADC calibration for converting raw readings to millivolts
+    uint32_t                        m_threshold;    ///< Trigger threshold in raw ADC units
+    volatile uint32_t               m_filtered;     ///< Filtered raw ADC reading (with fractional bits)
+    volatile bool                   m_emergency;    ///< Flag: filtered supply has dropped below the threshold
+    volatile int64_t                m_trippedAt;    ///< Time (us since boot) at which the threshold was crossed
+
+    /// \brief Timer callback to sample the supply voltage
+    static void sampleCallback(void *arg);
+    /// \brief Sample the supply voltage, update the filter, and check against the threshold
+    void sample(void);
+    /// \brief Convert a raw ADC reading into input supply voltage
+    double toVolts(uint32_t raw) const;
 };
 
 }
@@ -0,0 +1,138 @@
+/*! \file Trace.h
+ *  \brief Compact binary event trace for post-mortem timing analysis
+ *
+ * When data goes missing in the field, the console log is too coarse (and too expensive at high
+ * rates) to tell where the time went.  This module keeps a ring of fixed-size binary event records
+ * (timestamp, event ID, and two arguments) emitted from the key points in the data path, which can
+ * be dumped over serial or HTTP and converted on the host into a Chrome trace for visualisation.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "ArduinoJson.h"
+
+namespace logger {
+
+/// \enum TraceEvent
+/// \brief Identifiers for the events that can be recorded in the trace
+///
+/// Paired events (\a _BEGIN and \a _END) delimit a span of time on the host; the others are instants.
+/// The meaning of the arguments depends on the event, as noted.
+
+enum TraceEvent {
+    TRACE_PACKET_RX = 1,        ///< Packet received (arg0: \a TraceSource; arg1: PGN or byte count)
+    TRACE_HANDLER_BEGIN = 2,    ///< Start of NMEA2000 message handler (arg1: PGN)
+    TRACE_HANDLER_END = 3,      ///< End of NMEA2000 message handler (arg1: PGN)
+    TRACE_TASK_BEGIN = 4,       ///< Start of scheduled task slice (arg0: name index)
+    TRACE_TASK_END = 5,         ///< End of scheduled task slice (arg0: name index; arg1: 1 if more work remains)
+    TRACE_SD_WRITE_BEGIN = 6,   ///< Start of write to log file (arg0: packet ID; arg1: payload bytes)
+    TRACE_SD_WRITE_END = 7,     ///< End of write to log file (arg0: packet ID; arg1: payload bytes)
+    TRACE_WIFI_REQUEST = 8,     ///< HTTP request received by the web server (arg0: name index of endpoint)
+    TRACE_UPLOAD_BEGIN = 9,     ///< Start of upload chunk (arg0: file number; arg1: bytes)
+    TRACE_UPLOAD_END = 10       ///< End of upload chunk (arg0: file number; arg1: 1 if successful)
+};
+
+/// \enum TraceSource
+/// \brief Sources for the \a TRACE_PACKET_RX event
+
+enum TraceSource {
+    TRACE_SRC_NMEA2000 = 0,     ///< NMEA2000 message (arg1 is the PGN)
+    TRACE_SRC_NMEA0183_1 = 1,   ///< NMEA0183 sentence on first channel (arg1 is the sentence length)
+    TRACE_SRC_NMEA0183_2 = 2,   ///< NMEA0183 sentence on second channel (arg1 is the sentence length)
+    TRACE_SRC_IMU = 3           ///< IMU sample (arg1 is zero)
+};
+
+/// \struct TraceRecord
+/// \brief Single fixed-size event record in the trace ring (12 bytes, little-endian on dump)
+
+struct TraceRecord {
+    uint32_t    timestamp;  ///< Time of the event (us since boot, modulo 2^32)
+    uint16_t    event;      ///< Event identifier (\a TraceEvent)
+    uint16_t    arg0;       ///< First (short) argument
+    uint32_t    arg1;       ///< Second (long) argument
+};
+
+const uint16_t TraceFormatVersion = 1;  ///< Version of the binary dump format
+const uint32_t TraceRecordsRAM = 2048;  ///< Number of records in the ring when allocated in internal RAM
+const uint32_t TraceRecordsPSRAM = 32768; ///< Number of records in the ring when allocated in PSRAM
+const int MaxTraceNames = 48;           ///< Maximum number of names that can be registered for events
+
+/// \class Trace
+/// \brief Ring buffer of binary event records, with a name table for the host-side converter
+///
+/// The ring is allocated when tracing is first turned on (in PSRAM if the module has it, so that a
+/// much longer history can be kept), and records are then overwritten oldest-first.  \a Emit() is
+/// safe to call from any task, and costs a single test when tracing is off.  Since the records only
+/// have room for numbers, tasks and endpoints register their names with \a Name() and use the index
+/// returned as an argument; the name table is written at the start of each dump.
+///     The dump format is: "WTRC", uint16 format version, uint16 record size, uint32 number of names,
+/// then for each name a uint16 length and the characters, then uint32 number of records, uint32
+/// number of records lost to overwriting, and finally the records, oldest first.
+
+class Trace {
+public:
+    /// \brief Default constructor
+    Trace(void);
+    /// \brief Default destructor
+    ~Trace(void);
+
+    /// \brief Register a name (or find an existing one), returning its index
+    uint16_t Name(const char *name);
+
+    /// \brief Turn tracing on or off (allocating the ring on first use)
+    bool Enable(bool on);
+    /// \brief Determine whether tracing is currently on
+    bool Enabled(void) const { return m_enabled; }
+    /// \brief Discard all of the records in the ring
+    void Clear(void);
+
+    /// \brief Add an event to the ring, if tracing is on
+    inline void Emit(TraceEvent event, uint16_t arg0 = 0, uint32_t arg1 = 0)
+        { if (m_enabled) record(event, arg0, arg1); }
+
+    /// \brief Write the binary dump of the ring to the stream given
+    size_t Dump(Stream& output);
+
+    /// \brief Generate a JSON summary of the trace state
+    DynamicJsonDocument Render(void) const;
+
+private:
+    TraceRecord     *m_ring;                ///< Ring buffer for records (allocated on first use)
+    uint32_t        m_capacity;             ///< Number of records in the ring
+    uint32_t        m_count;                ///< Total number of records written since last cleared
+    bool            m_enabled;              ///< Flag: tracing is on
+    portMUX_TYPE    m_lock;                 ///< Spin-lock for updates to the ring
+    const char      *m_names[MaxTraceNames];///< Registered names for events
+    uint16_t        m_nNames;               ///< Number of registered names
+
+    /// \brief Add a record to the ring
+    void record(TraceEvent event, uint16_t arg0, uint32_t arg1);
+};
+
+extern Trace Tracer;    ///< Static parameter to use for event tracing
+
+}
+
+#endif
@@ -0,0 +1,105 @@
+/*! \file TransferRunner.h
+ *  \brief Send a log file over the serial port with the block transfer protocol, in the background
+ *
+ * This connects the portable block transfer sender to the logger's serial port and file system, and runs
+ * it in steps from the scheduler so that the logger keeps recording while a file is sent.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __TRANSFER_RUNNER_H__
+#define __TRANSFER_RUNNER_H__
+
+#include <stdint.h>
+#include <algorithm>
+#include <Arduino.h>
+#include "FS.h"
+#include "ArduinoJson.h"
+#include "BlockTransfer.h"
+
+namespace logger {
+
+const uint32_t TransferStepBudget = 20000;  ///< Time (us) for each step of the transfer from the scheduler
+
+/// \class TransferRunner
+/// \brief Send a log file over the serial port with the block protocol, and report the results
+///
+/// The transfer is started by command, and then stepped by the scheduler until it completes.  While it's
+/// running, the serial port belongs to the transfer: the command processor leaves the input alone, and
+/// anything else written to the port (debug messages, for example) is skipped by the receiver when it
+/// looks for the start of the next frame.
+
+class TransferRunner {
+public:
+    /// \brief Default constructor
+    TransferRunner(void);
+    /// \brief Default destructor
+    ~TransferRunner(void);
+
+    /// \brief Start sending a file from the file system given
+    bool Start(fs::FS& filesystem, String const& filename, uint32_t filesize, const uint8_t *hash);
+    /// \brief Run a step of the transfer, returning True if there is more to do
+    bool Step(void);
+    /// \brief Abandon the transfer in progress, if any
+    void Stop(void);
+    /// \brief Determine whether a transfer is in progress (and therefore owns the serial port)
+    bool Active(void) const { return m_sender.Running(); }
+
+    /// \brief Generate a JSON summary of the transfer state and counts
+    DynamicJsonDocument Render(void) const;
+
+private:
+    /// \class SerialLink
+    /// \brief Adapter from the transfer's link interface to the serial port
+    class SerialLink : public xfer::Channel {
+    public:
+        size_t Read(uint8_t *data, size_t n)
+        {
+            int available = Serial.available();
+            if (available <= 0) return 0;
+            return Serial.readBytes(data, std::min<size_t>(n, available));
+        }
+        size_t Write(const uint8_t *data, size_t n) { return Serial.write(data, n); }
+    };
+    /// \class FileSource
+    /// \brief Adapter from the transfer's source interface to an Arduino file
+    class FileSource : public xfer::Source {
+    public:
+        FileSource(File file) : m_file(file) {}
+        ~FileSource(void) { m_file.close(); }
+        size_t Read(uint32_t offset, uint8_t *data, size_t n)
+        {
+            if (m_file.position() != offset && !m_file.seek(offset)) return 0;
+            return m_file.read(data, n);
+        }
+    private:
+        File    m_file; ///< Log file being sent
+    };
+    SerialLink      m_link;     ///< Serial port interface
+    FileSource      *m_source;  ///< Log file interface for the current transfer
+    xfer::Sender    m_sender;   ///< Protocol state for the current (or last) transfer
+    String          m_filename; ///< Name of the file being (or last) sent
+    bool            m_reported; ///< Flag: completion of the last transfer has been reported on the console
+};
+
+extern TransferRunner Transfer; ///< Static parameter to use for block transfers over the serial port
+
+}
+
+#endif
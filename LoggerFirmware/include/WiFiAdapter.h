@@ -26,6 +26,7 @@
 #ifndef __WIFI_ADAPTER_H__
 #define __WIFI_ADAPTER_H__
 
+#include <functional>
 #include <WiFi.h>
 #include "ArduinoJson.h"
 #include "LogManager.h"
@@ -52,6 +53,8 @@ public:
     
     /// \brief Manage the transfer of a log file to the client, given the filename.
     bool TransferFile(String const& filename, uint32_t filesize, logger::Manager::MD5Hash const& filehash);
+    /// \brief Set the log manager used to look up file hashes for ETags
+    void SetLogManager(logger::Manager *manager);
 
     /// \brief Accumulate messages to be returned to the client for the current transaction
     void AddMessage(String const& message);
@@ -59,6 +62,11 @@ public:
     /// \brief Replace the entire message to be returned to the client for the current transaction
     void SetMessage(DynamicJsonDocument const& message);
 
+    /// \brief Function type to generate a response directly into the output given
+    typedef std::function<void(Print&)> Streamer;
+    /// \brief Stream the JSON response for the current transaction directly to the client
+    void StreamMessage(Streamer source);
+
     enum HTTPReturnCodes {
         OK              = 200,  // The request succeeded
         BADREQUEST      = 400,  // The server cannot or will not process the request
@@ -85,7 +93,8 @@ public:
     /// \brief Determine the wireless mode currently configures
     static WirelessMode GetWirelessMode(void);
 
-    void RunLoop(void);
+    /// \brief Service the adapter from the main loop, returning True if there is more work to do
+    bool RunLoop(void);
     
 private:
     /// \brief Sub-class implementation of code to start the interface.
@@ -99,19 +108,26 @@ private:
     /// \brief Sub-class implementation of code to send a log file to the client.
     virtual bool sendLogFile(String const& filename, uint32_t filesize, logger::Manager::MD5Hash const& filehash) = 0;
 
+    /// \brief Sub-class implementation of code to set the log manager
+    virtual void setLogManager(logger::Manager *manager) = 0;
+
     /// \brief Sub-class implementation of code to accumulate messages for transmission
     virtual void accumulateMessage(String const& message) = 0;
 
     /// \brief Sub-class implementation of code to replace message for transmission
     virtual void setMessage(DynamicJsonDocument const& message) = 0;
 
+    /// \brief Sub-class implementation of code to stream the response directly to the client
+    virtual void streamMessage(Streamer source) = 0;
+
     /// \brief Sub-class implementation of code to set the status code for the transaction
     virtual void setStatusCode(HTTPReturnCodes status_code) = 0;
 
     /// \brief Sub-class implementation of code to transmit messages (and complete transaction)
     virtual bool transmitMessages(void) = 0;
 
-    virtual void runLoop(void) = 0;
+    /// \brief Sub-class implementation of code to service the adapter
+    virtual bool runLoop(void) = 0;
 };
 
 /// \class WiFiAdapterFactory
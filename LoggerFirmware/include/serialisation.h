@@ -67,6 +67,11 @@ public:
     void operator+=(double d);
     /// \brief Add an array of characters (C-style string) to the output buffer
     void operator+=(const char *p);
+
+    /// \brief Read-only access to the data assembled so far
+    uint8_t const *Data(void) const { return m_buffer; }
+    /// \brief Number of bytes assembled so far
+    uint32_t Length(void) const { return m_nData; }
     
 private:
     friend class Serialiser;
@@ -0,0 +1,342 @@
+/*! \file ArchiveStream.cpp
+ *  \brief Incremental, resumable generation of a tar archive of the log files
+ *
+ * Downloading all of the log files as a single archive used to mean compressing the whole of the
+ * log directory inside the web-server's request handler, which stopped logging until it was done,
+ * and had to start again from the beginning if the connection dropped.  This module generates the
+ * archive in slices from the scheduler instead, following a manifest of the files (and their sizes)
+ * that's written when the download starts, so that the archive contents are deterministic and a
+ * client can resume an interrupted download from any offset.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include "ArchiveStream.h"
+#include "LogCompressor.h"
+#include "Scheduler.h"
+#include "StorageMetrics.h"
+
+namespace logger {
+
+/// Default constructor for the archive stream.  Nothing happens until a manifest is made (or loaded),
+/// and the output started.
+
+ArchiveStream::ArchiveStream(void)
+: m_fs(nullptr), m_id(0), m_count(0), m_length(0), m_output(nullptr), m_offset(0), m_next(0),
+  m_haveEntry(false), m_buffer(nullptr), m_pending(0), m_sent(0)
+{
+}
+
+/// Default destructor, abandoning any archive being written.
+
+ArchiveStream::~ArchiveStream(void)
+{
+    Stop();
+}
+
+/// Compute the size of an entry in the archive for a file of the given size: a header block, and then
+/// the file contents padded to a whole number of blocks.
+///
+/// \param size Size of the file (bytes)
+/// \return Size of the entry in the archive (bytes)
+
+uint64_t ArchiveStream::entrySize(uint32_t size)
+{
+    return ArchiveBlockSize + ((static_cast<uint64_t>(size) + ArchiveBlockSize - 1) / ArchiveBlockSize) * ArchiveBlockSize;
+}
+
+/// Update a 32-bit FNV-1a hash with the contents of a string.
+///
+/// \param hash Current value of the hash
+/// \param s    String to add to the hash
+/// \return Updated value of the hash
+
+static uint32_t fnv1a(uint32_t hash, String const& s)
+{
+    for (size_t n = 0; n < s.length(); ++n) {
+        hash ^= static_cast<uint8_t>(s[n]);
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+/// Make a new manifest for the files in the directory given, replacing any manifest that already exists.
+/// Files are listed in directory order, one per line, with size, modification time, and path.  The manifest
+/// identifier is a hash of the manifest contents, so that the same set of files gives the same identifier
+/// (and therefore the same archive).  Any archive being written is abandoned.
+///
+/// \param filesystem   File system on which to find the files (and write the manifest)
+/// \param path         Directory to archive (subdirectories are not included)
+/// \return True if the manifest was made and there is at least one file to archive, otherwise False
+
+bool ArchiveStream::Prepare(fs::FS& filesystem, const char *path)
+{
+    Stop();
+    m_fs = &filesystem;
+    m_id = 2166136261U;
+    m_count = 0;
+    m_length = 2*ArchiveBlockSize; // End-of-archive marker
+
+    File manifest = filesystem.open(ArchiveManifestFile, FILE_WRITE);
+    if (!manifest) {
+        Serial.println("ERR: failed to open archive manifest for writing.");
+        m_length = 0;
+        return false;
+    }
+    File dir = filesystem.open(path);
+    if (dir && dir.isDirectory()) {
+        File f = dir.openNextFile();
+        while (f) {
+            String name(f.path());
+            // Log files that have been compressed are only sent in compressed form, and compressed files
+            // that are still being written aren't sent at all.
+            bool skip = name.endsWith(PartialSuffix) ||
+                (!name.endsWith(CompressedSuffix) && filesystem.exists(LogCompressor::CompressedName(name)));
+            if (!f.isDirectory() && !skip) {
+                String line = String(static_cast<unsigned long>(f.size())) + " " +
+                    String(static_cast<unsigned long>(f.getLastWrite())) + " " + f.path() + "\n";
+                manifest.print(line);
+                m_id = fnv1a(m_id, line);
+                m_length += entrySize(f.size());
+                ++m_count;
+            }
+            f.close();
+            f = dir.openNextFile();
+        }
+    }
+    manifest.close();
+    if (m_count == 0) m_length = 0;
+    return m_count > 0;
+}
+
+/// Read back the manifest written by the last call to \a Prepare() (which might have been before a restart),
+/// recomputing the identifier and total length of the archive, so that an interrupted download can be resumed.
+/// Any archive being written is abandoned.
+///
+/// \param filesystem   File system on which the manifest was written
+/// \return True if there is a manifest with at least one file, otherwise False
+
+bool ArchiveStream::Load(fs::FS& filesystem)
+{
+    Stop();
+    m_fs = &filesystem;
+    m_id = 2166136261U;
+    m_count = 0;
+    m_length = 2*ArchiveBlockSize;
+    m_next = 0;
+
+    m_manifest = filesystem.open(ArchiveManifestFile, FILE_READ);
+    if (m_manifest) {
+        while (nextEntry()) {
+            m_id = fnv1a(m_id, String(static_cast<unsigned long>(m_entry.size)) + " " +
+                String(static_cast<unsigned long>(m_entry.mtime)) + " " + m_entry.name + "\n");
+            m_length += entrySize(m_entry.size);
+            ++m_count;
+        }
+        m_manifest.close();
+    }
+    if (m_count == 0) m_length = 0;
+    return m_count > 0;
+}
+
+/// Read the next entry from the manifest, computing its offset in the archive from the end of the
+/// previous entry.
+///
+/// \return True if an entry was read, or False at the end of the manifest
+
+bool ArchiveStream::nextEntry(void)
+{
+    m_entry.start = m_next;
+    m_haveEntry = false;
+    while (m_manifest.available()) {
+        String line = m_manifest.readStringUntil('\n');
+        unsigned long size, mtime;
+        int name_start = 0;
+        if (sscanf(line.c_str(), "%lu %lu %n", &size, &mtime, &name_start) == 2 &&
+            static_cast<unsigned int>(name_start) < line.length()) {
+            m_entry.name = line.substring(name_start);
+            m_entry.size = size;
+            m_entry.mtime = mtime;
+            m_next = m_entry.start + entrySize(m_entry.size);
+            m_haveEntry = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Start writing the archive for the current manifest to the output given, starting from the offset given
+/// (which allows an interrupted download to be resumed).  The manifest is read from the start to find the
+/// entry that contains the offset.  The output is then written by calls to \a Step().
+///
+/// \param output   Output for the archive (which must remain valid until the archive is complete or stopped)
+/// \param offset   Offset (bytes) in the archive at which to start
+/// \return True if the archive was started, otherwise False
+
+bool ArchiveStream::Start(Print *output, uint64_t offset)
+{
+    Stop();
+    if (m_fs == nullptr || m_length == 0 || offset >= m_length) return false;
+    m_manifest = m_fs->open(ArchiveManifestFile, FILE_READ);
+    if (!m_manifest) {
+        Serial.println("ERR: failed to open archive manifest for reading.");
+        return false;
+    }
+    m_next = 0;
+    while (nextEntry() && m_next <= offset) {
+        // Skip the entries that are entirely before the starting offset
+    }
+    if ((m_buffer = new uint8_t[ArchiveChunkSize]) == nullptr) {
+        Serial.println("ERR: failed to allocate archive buffer.");
+        m_manifest.close();
+        return false;
+    }
+    m_offset = offset;
+    m_pending = m_sent = 0;
+    m_output = output;
+    return true;
+}
+
+/// Abandon the archive being written, if any, closing the files and releasing the buffer.  The offset
+/// reached is retained for reporting.
+
+void ArchiveStream::Stop(void)
+{
+    if (m_file) m_file.close();
+    if (m_manifest) m_manifest.close();
+    delete[] m_buffer;
+    m_buffer = nullptr;
+    m_pending = m_sent = 0;
+    m_output = nullptr;
+}
+
+/// Generate the ustar header block for the current entry.  The contents depend only on the manifest, so
+/// that the archive is the same each time it is generated.
+///
+/// \param block    Buffer for the header (at least \a ArchiveBlockSize bytes)
+
+void ArchiveStream::header(uint8_t *block) const
+{
+    char *h = reinterpret_cast<char*>(block);
+    memset(h, 0, ArchiveBlockSize);
+    const char *name = m_entry.name.c_str();
+    if (*name == '/') ++name;
+    strncpy(h, name, 100);
+    snprintf(h + 100, 8, "%07o", 0644);
+    snprintf(h + 108, 8, "%07o", 0);
+    snprintf(h + 116, 8, "%07o", 0);
+    snprintf(h + 124, 12, "%011lo", static_cast<unsigned long>(m_entry.size));
+    snprintf(h + 136, 12, "%011lo", static_cast<unsigned long>(m_entry.mtime));
+    h[156] = '0';
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
+    // The checksum is computed with the checksum field set to spaces
+    memset(h + 148, ' ', 8);
+    unsigned long checksum = 0;
+    for (size_t n = 0; n < ArchiveBlockSize; ++n) checksum += block[n];
+    snprintf(h + 148, 8, "%06lo", checksum);
+    h[155] = ' ';
+}
+
+/// Generate up to a buffer-full of the archive at the current offset: the remainder of the header for the
+/// current entry, file data, padding, or (after the last entry) the end-of-archive marker.  Each call only
+/// generates from one of these, so the number of bytes can be less than the buffer size.
+///
+/// \return Number of bytes generated, or zero at the end of the archive (or on error)
+
+size_t ArchiveStream::generate(void)
+{
+    if (m_offset >= m_length) return 0;
+    if (!m_haveEntry) {
+        size_t n = static_cast<size_t>(std::min<uint64_t>(ArchiveChunkSize, m_length - m_offset));
+        memset(m_buffer, 0, n);
+        return n;
+    }
+    uint64_t rel = m_offset - m_entry.start;
+    if (rel < ArchiveBlockSize) {
+        header(m_buffer);
+        size_t n = ArchiveBlockSize - rel;
+        if (rel > 0) memmove(m_buffer, m_buffer + rel, n);
+        return n;
+    }
+    rel -= ArchiveBlockSize;
+    if (rel < m_entry.size) {
+        if (!m_file) {
+            if (!(m_file = m_fs->open(m_entry.name, FILE_READ))) {
+                Serial.printf("ERR: failed to open \"%s\" for archive.\n", m_entry.name.c_str());
+                return 0;
+            }
+        }
+        if (m_file.position() != rel && !m_file.seek(rel)) {
+            Serial.printf("ERR: failed to seek in \"%s\" for archive.\n", m_entry.name.c_str());
+            return 0;
+        }
+        size_t n = static_cast<size_t>(std::min<uint64_t>(ArchiveChunkSize, m_entry.size - rel));
+        uint32_t start = StorageIO.Start();
+        size_t got = m_file.read(m_buffer, n);
+        StorageIO.Stop(STORAGE_TRANSFER, start, got);
+        if (got != n) {
+            Serial.printf("ERR: short read from \"%s\" for archive (file changed?).\n", m_entry.name.c_str());
+            return 0;
+        }
+        return n;
+    }
+    size_t n = static_cast<size_t>(std::min<uint64_t>(ArchiveChunkSize, m_next - m_offset));
+    memset(m_buffer, 0, n);
+    return n;
+}
+
+/// Write a slice of the archive to the output, in buffer-sized pieces, until the scheduler's time slice
+/// for the current task has expired, or the output can't take any more just now.  The output is expected not
+/// to block: it takes as much of each piece as it can (possibly nothing), and the rest is offered again on the
+/// next call.  Failure of the output (e.g., the client going away) is for the owner of the output to detect.
+/// If the archive can't be generated (e.g., because a file in the manifest has been removed), it is stopped.
+///
+/// \return True if there is more of the archive to write, otherwise False
+
+bool ArchiveStream::Step(void)
+{
+    if (!Active()) return false;
+    do {
+        if (m_sent == m_pending) {
+            if ((m_pending = generate()) == 0) {
+                Stop();
+                return false;
+            }
+            m_sent = 0;
+        }
+        size_t n = m_output->write(m_buffer + m_sent, m_pending - m_sent);
+        m_sent += n;
+        m_offset += n;
+        if (m_sent < m_pending) return true;    // Output is full for now: try again next time
+        if (m_haveEntry && m_offset >= m_next) {
+            m_file.close();
+            nextEntry();
+        }
+        if (m_offset >= m_length) {
+            Stop();
+            return false;
+        }
+    } while (!Tasks.SliceExpired());
+    return true;
+}
+
+}
@@ -27,28 +27,54 @@
  * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <algorithm>
+
 #include "Arduino.h"
 #include "base64.h"
 
 #include "WiFiClientSecure.h"
 #include "HTTPClient.h"
+#include "StreamString.h"
 #include "ArduinoJson.h"
+#include "MD5Builder.h"
 
 #include "AutoUpload.h"
 #include "Configuration.h"
 #include "Status.h"
+#include "Scheduler.h"
+#include "Trace.h"
+#include "StorageMetrics.h"
 
 namespace net {
 
+String AuthHeader(void)
+{
+    String logger_uuid, upload_token, upload_header;
+
+    if (logger::LoggerConfig.GetConfigString(logger::Config::CONFIG_MODULEID_S, logger_uuid) &&
+        logger::LoggerConfig.GetConfigString(logger::Config::CONFIG_UPLOAD_TOKEN_S, upload_token) &&
+        !upload_token.isEmpty()) {
+        String auth_token = logger_uuid + ":" + upload_token;
+        upload_header = String("Basic ") + base64::encode(auth_token);
+    } else {
+        upload_header = "";
+    }
+    return upload_header;
+}
+
 UploadManager::UploadManager(logger::Manager *logManager)
-: m_logManager(logManager), m_timeout(-1), m_lastUploadCycle(0)
+: m_logManager(logManager), m_timeout(-1), m_window(0), m_lastUploadCycle(0), m_wifi(nullptr),
+  m_lifetime(DefaultConnectionLifetime*1000), m_connectedAt(0), m_backoff(0), m_retryAt(0),
+  m_jobs(nullptr), m_events(nullptr), m_task(nullptr), m_cycleActive(false), m_abort(false), m_resumable(true), m_transfer()
 {
-    String server, port, upload_interval, upload_duration, timeout;
+    String server, port, upload_interval, upload_duration, timeout, lifetime, order;
     logger::LoggerConfig.GetConfigString(logger::Config::CONFIG_UPLOAD_SERVER_S, server);
     logger::LoggerConfig.GetConfigString(logger::Config::CONFIG_UPLOAD_PORT_S, port);
     logger::LoggerConfig.GetConfigString(logger::Config::CONFIG_UPLOAD_INTERVAL_S, upload_interval);
     logger::LoggerConfig.GetConfigString(logger::Config::CONFIG_UPLOAD_DURATION_S, upload_duration);
     logger::LoggerConfig.GetConfigString(logger::Config::CONFIG_UPLOAD_TIMEOUT_S, timeout);
+    logger::LoggerConfig.GetConfigString(logger::Config::CONFIG_UPLOAD_LIFETIME_S, lifetime);
+    logger::LoggerConfig.GetConfigString(logger::Config::CONFIG_UPLOAD_ORDER_S, order);
     if (server.isEmpty()) {
         m_logManager = nullptr;
         return;
@@ -57,139 +83,399 @@ UploadManager::UploadManager(logger::Manager *logManager)
     m_serverURL = String("https://") + server + ":" + port + "/";
     m_uploadInterval = static_cast<unsigned long>(upload_interval.toDouble() * 1000.0);
     m_uploadDuration = static_cast<unsigned long>(upload_duration.toDouble() * 1000.0);
+    m_window = m_uploadDuration;
     m_timeout = static_cast<int32_t>(timeout.toDouble() * 1000.0);
+    if (lifetime.toDouble() > 0.0) {
+        m_lifetime = static_cast<unsigned long>(lifetime.toDouble() * 1000.0);
+    }
+    m_scheduler.SetOrder(order);
 }
 
+/// Default destructor for the upload manager.  This stops the background task (abandoning any transfer
+/// in progress, which the server keeps for the next session), removes the queues, and closes the connection.
+
 UploadManager::~UploadManager(void)
 {
+    if (m_task != nullptr) vTaskDelete(m_task);
+    if (m_jobs != nullptr) {
+        Job job;
+        while (xQueueReceive(m_jobs, &job, 0) == pdTRUE) delete job.status;
+        vQueueDelete(m_jobs);
+    }
+    if (m_events != nullptr) vQueueDelete(m_events);
+    closeConnection();
+}
 
+/// Make the queues for jobs and events, and start the background task.  The task runs at just above idle
+/// priority on the core that the main loop isn't using, so that the time spent waiting for the server (and
+/// in the TLS handshakes) never holds up data ingest.  Nothing is started if there's no server configured.
+///
+/// \return True if the task was started, otherwise False
+
+bool UploadManager::Begin(void)
+{
+    if (m_logManager == nullptr) return false;
+    m_jobs = xQueueCreate(1, sizeof(Job));
+    m_events = xQueueCreate(UploadQueueLength, sizeof(Event));
+    if (m_jobs == nullptr || m_events == nullptr) {
+        Serial.println("ERR: failed to create upload manager queues.");
+        return false;
+    }
+    if (xTaskCreatePinnedToCore(worker, "upload", UploadStackSize, this, tskIDLE_PRIORITY + 1,
+                                &m_task, UploadCore) != pdPASS) {
+        Serial.println("ERR: failed to start upload task.");
+        m_task = nullptr;
+        return false;
+    }
+    return true;
 }
 
-void UploadManager::UploadCycle(void)
+/// Run a slice of the automatic upload cycle in the main loop.  This collects any events that the upload
+/// task has posted, removing files that have been sent and counting failed attempts for files that haven't,
+/// and then, if no cycle is running and the upload interval has expired, starts a new cycle in the task.
+/// The status that the task checks in with is assembled here, since it reads state that belongs to the
+/// main loop; everything else (the check-in, and the transfers) happens in the task.
+///
+/// \return True if there are more events to collect, otherwise False
+
+bool UploadManager::UploadCycle(void)
 {
+    if (m_logManager == nullptr || m_task == nullptr) return false;
+
+    Event event;
+    while (xQueueReceive(m_events, &event, 0) == pdTRUE) {
+        switch (event.type) {
+            case UPLOAD_PROGRESS:
+                Serial.printf("DBG: UploadManager::UploadCycle file %u at %u B.\n", event.fileID, event.value);
+                break;
+            case UPLOAD_COMPLETE:
+                // File transferred to the server successfully, so we can delete locally
+                m_logManager->RemoveLogFile(event.fileID);
+                break;
+            case UPLOAD_FAILED:
+                // File did not transfer, so we update the upload attempt metadata and move on
+                m_logManager->IncrementUploadCount(event.fileID);
+                break;
+            case UPLOAD_CYCLE_END:
+                Serial.printf("DBG: UploadManager::UploadCycle cycle complete with %u file(s) sent.\n",
+                    event.fileID);
+                m_cycleActive = false;
+                break;
+        }
+        if (logger::Tasks.SliceExpired()) return true;
+    }
+    if (m_cycleActive) return false;
+
     unsigned long start_time = millis();
-    if ((start_time - m_lastUploadCycle) < m_uploadInterval) return; // Not time yet ...
+    if ((start_time - m_lastUploadCycle) < m_uploadInterval) return false; // Not time yet ...
     m_lastUploadCycle = start_time;
 
     if (m_logManager->CountLogFiles() == 0) {
-        return; // Nothing to transfer, so no need to get in touch ...
+        return false; // Nothing to transfer, so no need to get in touch ...
     }
 
-    if (!ReportStatus()) {
-        // Failed to report status ... means the server's not there, or we're not connected
-        Serial.printf("DBG: UploadManager::UploadCycle failed to report status at %d ms elapsed.\n",
-            m_lastUploadCycle);
-        return;
-    }
-    DynamicJsonDocument files(logger::status::GenerateFilelist(m_logManager));
-    int filecount = files["files"]["count"].as<int>();
-    for (int n = 0; n < filecount; ++n) {
-        uint32_t file_id = files["files"]["detail"][n]["id"].as<uint32_t>();
-        if (TransferFile(m_logManager->FileSystem(), file_id)) {
-            // File transferred to the server successfully, so we can delete locally
-            m_logManager->RemoveLogFile(file_id);
-        } else {
-            // File did not transfer, so we update the upload attempt metadata and move on
-            
-        }
-        unsigned long current_elapsed = millis();
-        if ((current_elapsed - start_time) > m_uploadDuration) {
-            // We're only allowed to update for a specific length of time (since otherwise we'll
-            // halt all logging!)
-            break;
-        }
+    if (backingOff()) return false; // Server wasn't there recently, so don't keep trying
+
+    // The task isn't running a cycle, so the connection parameters can be refreshed from the configuration
+    // (which might have changed since the last cycle) without a lock.
+    logger::LoggerConfig.GetConfigString(logger::Config::CONFIG_UPLOAD_CERT_S, m_cert);
+    m_authHeader = AuthHeader();
+
+    // The POST needs to know the length of the body, so the status has to be assembled before
+    // it's sent, but it can be streamed directly into the string.
+    Job job;
+    job.status = new StreamString();
+    logger::status::StreamStatus(m_logManager, *job.status);
+    if (xQueueSend(m_jobs, &job, 0) != pdTRUE) {
+        delete job.status;
+        return false;
     }
+    m_cycleActive = true;
+    return false;
 }
 
-class SecureClient {
-public:
-    SecureClient(void)
-    {
+/// Start a request to the server, re-using the connection from the previous request if it's still open
+/// (and not older than the configured lifetime), or otherwise making a new one.  The HTTP client is set to
+/// keep the connection open after each request, which the server allows unless it's closing down or the
+/// connection has been idle for too long.  If a connection failed recently, no new connection is tried
+/// until the back-off delay has passed.
+///
+/// \param url  Full URL for the request
+/// \return Pointer to the HTTP client to use for the request, or nullptr if it can't be made
+
+HTTPClient *UploadManager::openRequest(String const& url)
+{
+    if (backingOff()) return nullptr;
+    if (m_wifi == nullptr) {
+        if (m_cert.length() == 0) return nullptr;
         m_wifi = new WiFiClientSecure();
-        if (!m_wifi) {
-            return;
-        }
-        logger::LoggerConfig.GetConfigString(logger::Config::CONFIG_UPLOAD_CERT_S, m_cert);
-        if (m_cert.length() == 0) {
-            delete m_wifi;
-            m_wifi = nullptr;
-        } else {
-            m_wifi->setCACert(m_cert.c_str());
-        }
+        m_wifi->setCACert(m_cert.c_str());
+    }
+    unsigned long now = millis();
+    if (m_wifi->connected() && (now - m_connectedAt) > m_lifetime) {
+        // Connection has been up for long enough, so start a new one
+        m_wifi->stop();
     }
+    bool reused = m_wifi->connected();
+    if (!reused) m_connectedAt = now;
 
-    ~SecureClient(void)
-    {
-        delete m_wifi;
+    m_http.setReuse(true);
+    m_http.setConnectTimeout(m_timeout);
+    if (!m_http.begin(*m_wifi, url)) return nullptr;
+    m_http.setTimeout(static_cast<uint16_t>(m_timeout));
+    if (!m_authHeader.isEmpty()) {
+        m_http.addHeader(String("Authorization"), m_authHeader);
     }
+    UploadStats.Request(reused);
+    return &m_http;
+}
 
-    WiFiClientSecure *Client(void) const
-    {
-        return m_wifi;
+/// Complete a request to the server.  If the request failed at the connection level (rather than with an
+/// HTTP error from the server), the connection is dropped, and the delay before reconnecting is doubled (up
+/// to a maximum); otherwise the connection is left open for the next request, and the delay is reset.
+///
+/// \param http_rc  HTTP response code, or a negative error code from the client
+
+void UploadManager::closeRequest(int http_rc)
+{
+    if (http_rc < 0) {
+        m_http.end();
+        if (m_wifi != nullptr) m_wifi->stop();
+        m_backoff = m_backoff == 0 ? MinReconnectBackoff : min(2*m_backoff, MaxReconnectBackoff);
+        m_retryAt = millis() + m_backoff;
+        UploadStats.Failure();
+        Serial.printf("DBG: UploadManager::closeRequest connection failed (%d); retry in %lu ms.\n",
+            http_rc, m_backoff);
+    } else {
+        m_backoff = 0;
+        m_http.end(); // Leaves the connection open if the server agreed to keep it alive
     }
+}
 
-private:
-    WiFiClientSecure    *m_wifi;
-    String              m_cert;
-};
+/// Close the connection to the server, releasing the memory for the TLS session, and complete the
+/// statistics for the upload cycle.
 
-String AuthHeader(void)
+void UploadManager::closeConnection(void)
 {
-    String logger_uuid, upload_token, upload_header;
+    m_http.end();
+    if (m_wifi != nullptr) {
+        m_wifi->stop();
+        delete m_wifi;
+        m_wifi = nullptr;
+    }
+    UploadStats.EndCycle();
+}
 
-    if (logger::LoggerConfig.GetConfigString(logger::Config::CONFIG_MODULEID_S, logger_uuid) &&
-        logger::LoggerConfig.GetConfigString(logger::Config::CONFIG_UPLOAD_TOKEN_S, upload_token) &&
-        !upload_token.isEmpty()) {
-        String auth_token = logger_uuid + ":" + upload_token;
-        upload_header = String("Basic ") + base64::encode(auth_token);
+/// Determine whether a connection failed recently enough that no new connection should be tried yet.
+///
+/// \return True if the reconnection back-off delay is still running, otherwise False
+
+bool UploadManager::backingOff(void) const
+{
+    return m_backoff > 0 && static_cast<long>(millis() - m_retryAt) < 0;
+}
+
+/// Determine whether the current upload cycle has run for longer than its upload window.
+///
+/// \return True if the cycle is out of time, otherwise False
+
+bool UploadManager::cycleExpired(void) const
+{
+    return timeLeft() == 0;
+}
+
+/// Determine how much of the upload window for the current cycle is left.
+///
+/// \return Time (ms) left in the upload window
+
+unsigned long UploadManager::timeLeft(void) const
+{
+    unsigned long elapsed = millis() - m_lastUploadCycle;
+    return elapsed < m_window ? m_window - elapsed : 0;
+}
+
+/// Entry point for the background task, which waits for the main loop to start an upload cycle, and then
+/// runs it to completion (or until it runs out of time).
+///
+/// \param param    Pointer to the \a UploadManager that owns the task
+
+void UploadManager::worker(void *param)
+{
+    UploadManager *self = static_cast<UploadManager*>(param);
+    Job job;
+    while (true) {
+        if (xQueueReceive(self->m_jobs, &job, portMAX_DELAY) != pdTRUE) continue;
+        if (self->m_abort) {
+            delete job.status;
+            continue;
+        }
+        self->runCycle(job);
+    }
+}
+
+/// Run a complete upload cycle in the background task: check in with the server, and then send the closed
+/// log files in the order chosen by the scheduler until there are none left that can finish in the time
+/// left in the upload window (which the scheduler sizes from the bandwidth to the server).  The outcome for each file is posted back to the main loop, which does the book-keeping.
+/// All of the requests in a cycle share a single connection to the server, so that only the first pays
+/// for the TLS handshake; the connection is closed at the end of the cycle to release its memory.
+///
+/// \param job Description of the cycle to run
+
+void UploadManager::runCycle(Job const& job)
+{
+    uint32_t sent = 0;
+    UploadStats.BeginCycle();
+    bool checked_in = ReportStatus(*job.status);
+    delete job.status;
+    if (!checked_in) {
+        // Failed to report status ... means the server's not there, or we're not connected
+        Serial.printf("DBG: UploadManager::runCycle failed to report status at %lu ms elapsed.\n",
+            m_lastUploadCycle);
     } else {
-        upload_header = "";
+        std::vector<logger::Manager::LogSummary> files;
+        m_logManager->SummariseLogFiles(files);
+        m_scheduler.Plan(files, m_uploadDuration);
+        m_window = m_scheduler.Window();
+        m_resumable = true; // The server might have been updated since the last cycle
+        uint32_t file_id;
+        while (!m_abort && !cycleExpired() && m_scheduler.Next(timeLeft(), m_resumable, file_id)) {
+            TransferState state = uploadFile(file_id);
+            if (state == TRANSFER_COMPLETE) {
+                m_scheduler.Succeeded(file_id);
+                post(UPLOAD_COMPLETE, file_id, 0, pdMS_TO_TICKS(1000));
+                ++sent;
+            } else if (state == TRANSFER_FAILED) {
+                m_scheduler.Failed(file_id);
+                post(UPLOAD_FAILED, file_id, 0, pdMS_TO_TICKS(1000));
+            }
+            // Otherwise, the cycle ran out of time part-way through the file, which carries on next cycle
+        }
+        UploadStats.Schedule(m_scheduler.Bandwidth(), m_window, m_scheduler.Deferred());
     }
-    return upload_header;
+    m_transfer.session = "";
+    closeConnection();
+    post(UPLOAD_CYCLE_END, sent, checked_in ? 1 : 0, portMAX_DELAY);
 }
 
-bool UploadManager::ReportStatus(void)
+/// Send a single log file to the server, in chunks if the server provides resumable uploads, or otherwise
+/// as a whole file.  If the connection fails, the task waits out the reconnection back-off before trying
+/// again, as long as the cycle has time left.
+///
+/// \param file_id Log file number to transfer
+/// \return State of the transfer: complete, failed, or (if the cycle ran out of time) continuing
+
+UploadManager::TransferState UploadManager::uploadFile(uint32_t file_id)
+{
+    m_transfer.session = "";
+    m_transfer.filename = ""; // The file might have been compressed since the last cycle
+    TransferState state = m_resumable ? TRANSFER_CONTINUE : TRANSFER_UNSUPPORTED;
+    while (state == TRANSFER_CONTINUE) {
+        if (cycleExpired()) return TRANSFER_CONTINUE;
+        if (backingOff()) {
+            unsigned long wait = m_retryAt - millis();
+            vTaskDelay(pdMS_TO_TICKS(min(wait, timeLeft()) + 1));
+            continue;
+        }
+        state = ResumeTransfer(file_id);
+        if (state == TRANSFER_CONTINUE && !m_transfer.session.isEmpty()) {
+            uint32_t received = m_transfer.missing.empty() ? m_transfer.size : m_transfer.missing.front().first;
+            m_scheduler.Progress(file_id, received);
+            post(UPLOAD_PROGRESS, file_id, received, 0);
+        }
+    }
+    if (state == TRANSFER_UNSUPPORTED) {
+        m_resumable = false;
+        state = TransferFile(m_logManager->FileSystem(), file_id) ? TRANSFER_COMPLETE : TRANSFER_FAILED;
+    }
+    return state;
+}
+
+/// Post an event back to the main loop.  Progress reports are dropped if the queue is full, but outcomes
+/// wait for space; if an outcome is lost anyway (because the loop has stopped collecting), the file is simply
+/// sent again in the next cycle.
+///
+/// \param type    Type of event
+/// \param file_id Log file number that the event refers to
+/// \param value   Event-specific value
+/// \param wait    Time to wait for space in the queue (ticks)
+
+void UploadManager::post(EventType type, uint32_t file_id, uint32_t value, TickType_t wait)
+{
+    Event event;
+    event.type = type;
+    event.fileID = file_id;
+    event.value = value;
+    xQueueSend(m_events, &event, wait);
+}
+
+/// Check in with the server, sending the logger's status (which is assembled by the main loop).
+///
+/// \param status_json Status of the logger, as a JSON document
+/// \return True if the server accepted the status, otherwise False
+
+bool UploadManager::ReportStatus(String const& status_json)
 {
-    DynamicJsonDocument status(logger::status::CurrentStatus(m_logManager));
     String url = m_serverURL + "checkin";
-    String status_json;
-    serializeJson(status, status_json);
 
-    SecureClient wifi;
-    HTTPClient client;
     bool rc = false; // By default ...
-    String auth_header(AuthHeader());
-
-    client.setConnectTimeout(m_timeout);
-    if (client.begin(*wifi.Client(), url)) {
-        client.setTimeout(static_cast<uint16_t>(m_timeout));
-        if (!auth_header.isEmpty()) {
-            client.addHeader(String("Authorization"), auth_header);
-        }
+    HTTPClient *client = openRequest(url);
+    if (client != nullptr) {
         int http_rc;
-        if ((http_rc = client.POST(status_json)) == HTTP_CODE_OK) {
+        if ((http_rc = client->POST(status_json)) == HTTP_CODE_OK) {
             // 200 OK is expected; in the future, there might also be some other information
             rc = true;
         } else {
             // Didn't get expected response from server
             Serial.printf("DBG: UploadManager::ReportStatus: error code %d = |%s|\n",
-                http_rc, client.errorToString(http_rc).c_str());
+                http_rc, client->errorToString(http_rc).c_str());
             rc = false;
         }
+        UploadStats.Sent(status_json.length());
+        closeRequest(http_rc);
     }
-    client.end();
 
     return rc;
 }
 
+/// \class AbortableFile
+/// \brief Log file being read for upload, which stops returning data once the upload is aborted
+///
+/// The HTTP client (and the MD5 of a chunk) read the file in pieces for as long as it has data available, so
+/// reporting no more data once the abort flag is set stops the transfer after the current piece, and leaves
+/// the SD card free when power is failing.
+
+class AbortableFile : public Stream {
+public:
+    AbortableFile(File& file, volatile bool const& abort)
+    : m_file(file), m_abort(abort)
+    {}
+
+    int available() override { return m_abort ? 0 : m_file.available(); }
+    int read() override { return m_abort ? -1 : m_file.read(); }
+    int peek() override { return m_abort ? -1 : m_file.peek(); }
+    size_t readBytes(char *buffer, size_t length) override { return m_abort ? 0 : m_file.readBytes(buffer, length); }
+    size_t write(uint8_t b) override { return 0; }
+    void flush() override {}
+
+private:
+    File                &m_file;    ///< File being uploaded
+    volatile bool const &m_abort;   ///< Flag: True => stop reading
+};
+
 bool UploadManager::TransferFile(fs::FS& controller, uint32_t file_id)
 {
     String                      file_name;
     uint32_t                    file_size;
     logger::Manager::MD5Hash    file_hash;
-    uint16_t                    upload_count;
+    bool                        compressed;
 
-    m_logManager->EnumerateLogFile(file_id, file_name, file_size, file_hash, upload_count);
+    // If the file has been compressed, the compressed version is sent instead (with its own hash), and
+    // the server decodes it after checking the digest.
+    if (!m_logManager->UploadSource(file_id, file_name, file_size, file_hash, compressed)) {
+        Serial.printf("ERR: UploadManager::TransferFile log file %u is not available for auto-upload.\n",
+            file_id);
+        return false;
+    }
     File f = controller.open(file_name, FILE_READ);
     if (!f) {
         Serial.printf("ERR: UploadManager::TransferFile failed to open file |%s| for auto-upload.\n",
@@ -197,31 +483,35 @@ bool UploadManager::TransferFile(fs::FS& controller, uint32_t file_id)
         return false;
     }
 
-    SecureClient wifi;
-    HTTPClient client;
     bool rc = false; // By default ...
 
     String digest_header(String("md5=") + file_hash.Value());
-    String auth_header(AuthHeader());
     String url(m_serverURL + "update");
 
-    client.setConnectTimeout(m_timeout);
-    if (client.begin(*wifi.Client(), url)) {
-        client.setTimeout(static_cast<uint16_t>(m_timeout));
+    HTTPClient *client = openRequest(url);
+    if (client != nullptr) {
         int http_rc;
 
-        client.addHeader(String("Digest"), digest_header);
-        client.addHeader(String("Content-Type"), String("application/octet-stream"), false, true);
-        if (!auth_header.isEmpty()) {
-            client.addHeader(String("Authorization"), auth_header);
+        client->addHeader(String("Digest"), digest_header);
+        client->addHeader(String("Content-Type"), String("application/octet-stream"), false, true);
+        if (compressed) {
+            client->addHeader(String("Content-Encoding"), String("gzip"));
         }
 
         Serial.printf("DBG: UploadManager::TransferFile POST starting ...\n");
-        if ((http_rc = client.sendRequest("POST", &f, file_size)) == HTTP_CODE_OK) {
+        logger::Tracer.Emit(logger::TRACE_UPLOAD_BEGIN, file_id, file_size);
+        uint32_t start = logger::StorageIO.Start();
+        unsigned long sent_at = millis();
+        AbortableFile body(f, m_abort);
+        http_rc = client->sendRequest("POST", &body, file_size);
+        logger::StorageIO.Stop(logger::STORAGE_TRANSFER, start, file_size);
+        UploadStats.Sent(file_size);
+        if (http_rc == HTTP_CODE_OK) {
+            m_scheduler.Sample(file_size, millis() - sent_at);
             Serial.printf("DBG: UploadManager::TransferFile POST completed with 200OK\n");
             // If we get a 200OK then the response body should be a JSON document with information
             // about the upload (successful or unsuccessful).
-            String payload = client.getString();
+            String payload = client->getString();
             DynamicJsonDocument response(1024);
             deserializeJson(response, payload);
             if (response.containsKey("status")) {
@@ -248,14 +538,510 @@ bool UploadManager::TransferFile(fs::FS& controller, uint32_t file_id)
         } else {
             // Didn't get expected response from server
             Serial.printf("DBG: UploadManager::TransferFile: error code %d = |%s|\n",
-                http_rc, client.errorToString(http_rc).c_str());
+                http_rc, client->errorToString(http_rc).c_str());
             rc = false;
         }
+        logger::Tracer.Emit(logger::TRACE_UPLOAD_END, file_id, rc ? 1 : 0);
+        closeRequest(http_rc);
     }
     f.close();
-    client.end();
 
     return rc;
 }
 
+/// Carry out the next step of a resumable transfer of a log file: open the session with the server if
+/// this is a new file (or the session was lost), send the next chunk that the server is missing, or commit
+/// the file once there's nothing left missing.  Each step is a single request, so that the upload task
+/// can report progress and check the time between chunks.  If the connection drops, or the cycle runs out of time, the
+/// server keeps the chunks it has, and the next session opened for the same file carries on from there.
+///
+/// \param file_id Log file number to transfer
+/// \return State of the transfer after the step
+
+UploadManager::TransferState UploadManager::ResumeTransfer(uint32_t file_id)
+{
+    TransferState state;
+    if (m_transfer.session.isEmpty() || m_transfer.fileID != file_id) {
+        state = startSession(file_id);
+    } else if (m_transfer.missing.empty()) {
+        state = commitSession();
+    } else {
+        state = sendChunk();
+    }
+    if (state == TRANSFER_COMPLETE || state == TRANSFER_FAILED) {
+        logger::Tracer.Emit(logger::TRACE_UPLOAD_END, file_id, state == TRANSFER_COMPLETE ? 1 : 0);
+    }
+    return state;
+}
+
+/// Open an upload session with the server for a log file (or re-open the session if the server already
+/// has one for the same file), sending the compressed sibling if there is one.  Servers without resumable
+/// uploads either don't have the end-point, or answer with the list of end-points rather than a session.
+///
+/// \param file_id Log file number to transfer
+/// \return State of the transfer
+
+UploadManager::TransferState UploadManager::startSession(uint32_t file_id)
+{
+    logger::Manager::MD5Hash    file_hash;
+
+    if (m_transfer.fileID != file_id || m_transfer.filename.isEmpty()) {
+        m_transfer.fileID = file_id;
+        m_transfer.failures = 0;
+        if (!m_logManager->UploadSource(file_id, m_transfer.filename, m_transfer.size, file_hash,
+                                        m_transfer.compressed)) {
+            Serial.printf("ERR: UploadManager::startSession log file %u is not available for auto-upload.\n",
+                file_id);
+            m_transfer.filename = "";
+            return TRANSFER_FAILED;
+        }
+        m_transfer.hash = file_hash.Value();
+        logger::Tracer.Emit(logger::TRACE_UPLOAD_BEGIN, file_id, m_transfer.size);
+    }
+
+    DynamicJsonDocument request(256);
+    request["file"] = file_id;
+    request["size"] = m_transfer.size;
+    request["md5"] = m_transfer.hash;
+    if (m_transfer.compressed) request["encoding"] = "gzip";
+    StreamString body;
+    serializeJson(request, body);
+
+    DynamicJsonDocument response(1024);
+    int http_rc = exchange(m_serverURL + "upload/start", &body, body.length(), String(), response);
+    if (http_rc == HTTP_CODE_NOT_FOUND || (http_rc == HTTP_CODE_OK && !response.containsKey("session"))) {
+        Serial.printf("DBG: UploadManager::startSession server doesn't support resumable uploads.\n");
+        return TRANSFER_UNSUPPORTED;
+    }
+    if (http_rc != HTTP_CODE_OK || !updateMissing(response)) {
+        Serial.printf("DBG: UploadManager::startSession failed to open session for file %d (code %d).\n",
+            file_id, http_rc);
+        return ++m_transfer.failures < MaxChunkFailures ? TRANSFER_CONTINUE : TRANSFER_FAILED;
+    }
+    m_transfer.session = response["session"].as<String>();
+    m_transfer.chunk = response["chunk"] | 65536;
+    if (m_transfer.chunk == 0) m_transfer.chunk = 65536;
+    Serial.printf("DBG: UploadManager::startSession session %s for file %d with %d range(s) missing.\n",
+        m_transfer.session.c_str(), file_id, static_cast<int>(m_transfer.missing.size()));
+    return TRANSFER_CONTINUE;
+}
+
+/// Send the next chunk that the server is missing for the current session, with the MD5 of the chunk as
+/// its digest.  The server replies with the ranges that it still needs, which replace the local list.  A
+/// chunk that fails (in transfer, or the server's digest check) is sent again on the next step, up to a
+/// limit for each cycle.
+///
+/// \return State of the transfer
+
+UploadManager::TransferState UploadManager::sendChunk(void)
+{
+    uint32_t offset = m_transfer.missing.front().first;
+    uint32_t length = m_transfer.missing.front().second - offset;
+    if (length > m_transfer.chunk) length = m_transfer.chunk;
+
+    File f = m_logManager->FileSystem().open(m_transfer.filename, FILE_READ);
+    if (!f) {
+        Serial.printf("ERR: UploadManager::sendChunk failed to open file |%s| for auto-upload.\n",
+            m_transfer.filename.c_str());
+        return TRANSFER_FAILED;
+    }
+    uint32_t start = logger::StorageIO.Start();
+    MD5Builder md5;
+    md5.begin();
+    AbortableFile body(f, m_abort);
+    f.seek(offset);
+    md5.addStream(body, length);
+    md5.calculate();
+    f.seek(offset);
+
+    String url(m_serverURL + "upload/chunk?session=" + m_transfer.session + "&offset=" + String(offset));
+    DynamicJsonDocument response(1024);
+    unsigned long sent_at = millis();
+    int http_rc = exchange(url, &body, length, md5.toString(), response);
+    if (http_rc == HTTP_CODE_OK) m_scheduler.Sample(length, millis() - sent_at);
+    f.close();
+    logger::StorageIO.Stop(logger::STORAGE_TRANSFER, start, 2*length);
+
+    if (http_rc == HTTP_CODE_NOT_FOUND) {
+        // Session has expired at the server, so it has to be opened again
+        m_transfer.session = "";
+    } else if (http_rc == HTTP_CODE_OK && updateMissing(response) && response["status"] == "success") {
+        return TRANSFER_CONTINUE;
+    }
+    Serial.printf("DBG: UploadManager::sendChunk failed at offset %d for file %d (code %d).\n",
+        offset, m_transfer.fileID, http_rc);
+    return ++m_transfer.failures < MaxChunkFailures ? TRANSFER_CONTINUE : TRANSFER_FAILED;
+}
+
+/// Ask the server to commit the file for the current session, once it has all of the chunks.  The server
+/// checks the whole file against its digest before sending it on; if that fails, it reports the whole file
+/// as missing again, and the transfer starts over (up to the limit on failures).
+///
+/// \return State of the transfer
+
+UploadManager::TransferState UploadManager::commitSession(void)
+{
+    String url(m_serverURL + "upload/commit?session=" + m_transfer.session);
+    DynamicJsonDocument response(1024);
+    int http_rc = exchange(url, nullptr, 0, String(), response);
+    if (http_rc == HTTP_CODE_OK && response["status"] == "success") {
+        Serial.printf("DBG: UploadManager::commitSession file %d committed.\n", m_transfer.fileID);
+        return TRANSFER_COMPLETE;
+    }
+    if (http_rc == HTTP_CODE_NOT_FOUND) {
+        m_transfer.session = "";
+    } else if (http_rc == HTTP_CODE_OK && updateMissing(response) && response["status"] == "incomplete") {
+        return TRANSFER_CONTINUE;
+    }
+    Serial.printf("DBG: UploadManager::commitSession failed for file %d (code %d).\n",
+        m_transfer.fileID, http_rc);
+    return ++m_transfer.failures < MaxChunkFailures ? TRANSFER_CONTINUE : TRANSFER_FAILED;
+}
+
+/// Make a single POST request to the server as part of a resumable transfer, and decode the JSON response.
+///
+/// \param url         Full URL for the request, including any query parameters
+/// \param body        Stream to send as the body of the request (or nullptr for none)
+/// \param length      Number of bytes to send from the stream
+/// \param digest      MD5 digest of the body, or empty for none
+/// \param response    (Out) JSON response from the server, if the request succeeded
+/// \return HTTP response code, or a negative error code from the client
+
+int UploadManager::exchange(String const& url, Stream *body, size_t length, String const& digest,
+                            DynamicJsonDocument& response)
+{
+    int http_rc = HTTPC_ERROR_CONNECTION_REFUSED;
+    HTTPClient *client = openRequest(url);
+    if (client != nullptr) {
+        if (!digest.isEmpty()) {
+            client->addHeader(String("Digest"), String("md5=") + digest);
+        }
+        client->addHeader(String("Content-Type"), String("application/octet-stream"), false, true);
+        if (body == nullptr) {
+            http_rc = client->POST(static_cast<uint8_t*>(nullptr), 0);
+        } else {
+            http_rc = client->sendRequest("POST", body, length);
+        }
+        if (http_rc == HTTP_CODE_OK) {
+            deserializeJson(response, client->getString());
+        }
+        UploadStats.Sent(length);
+        closeRequest(http_rc);
+    }
+    return http_rc;
+}
+
+/// Replace the list of ranges that the server is missing for the current transfer with those in a response
+/// from the server.  The server only lists the first few ranges, but sends an up-to-date list after every
+/// chunk, so the local list never runs out before the file is complete.
+///
+/// \param response    JSON response from the server
+/// \return True if the response contained a list of missing ranges, otherwise False
+
+bool UploadManager::updateMissing(DynamicJsonDocument const& response)
+{
+    JsonArrayConst missing = response["missing"].as<JsonArrayConst>();
+    if (missing.isNull()) return false;
+    m_transfer.missing.clear();
+    for (JsonVariantConst range : missing) {
+        m_transfer.missing.push_back(std::make_pair(range[0].as<uint32_t>(), range[1].as<uint32_t>()));
+    }
+    return true;
+}
+
+/// Default constructor for the upload statistics.
+
+UploadMetrics::UploadMetrics(void)
+: m_current(), m_last(), m_active(false), m_start(0), m_cycles(0), m_handshakes(0), m_reused(0),
+  m_lock(portMUX_INITIALIZER_UNLOCKED)
+{
+}
+
+/// Start the statistics for a new upload cycle.
+
+void UploadMetrics::BeginCycle(void)
+{
+    portENTER_CRITICAL(&m_lock);
+    m_current = Cycle();
+    m_start = millis();
+    m_active = true;
+    portEXIT_CRITICAL(&m_lock);
+}
+
+/// Count a request to the server, noting whether it was sent on a connection that was already open (and
+/// therefore saved a TLS handshake) or needed a new one.
+///
+/// \param reused  Flag: True => request re-used an open connection
+
+void UploadMetrics::Request(bool reused)
+{
+    portENTER_CRITICAL(&m_lock);
+    if (reused) {
+        ++m_current.reused;
+        ++m_reused;
+    } else {
+        ++m_current.handshakes;
+        ++m_handshakes;
+    }
+    portEXIT_CRITICAL(&m_lock);
+}
+
+/// Count a request that failed to connect, or failed while sending.
+
+void UploadMetrics::Failure(void)
+{
+    portENTER_CRITICAL(&m_lock);
+    ++m_current.failures;
+    portEXIT_CRITICAL(&m_lock);
+}
+
+/// Count bytes sent to the server in the current cycle.
+///
+/// \param bytes   Number of bytes sent
+
+void UploadMetrics::Sent(uint32_t bytes)
+{
+    portENTER_CRITICAL(&m_lock);
+    m_current.bytes += bytes;
+    portEXIT_CRITICAL(&m_lock);
+}
+
+/// Record the schedule for the current cycle: the bandwidth estimate, the upload window that was allowed,
+/// and the number of files that were held back after failures, or skipped because they wouldn't fit.
+///
+/// \param bandwidth   Estimated bandwidth (bytes/s) to the server
+/// \param window      Upload window (ms) for the cycle
+/// \param deferred    Number of files not attempted in the cycle
+
+void UploadMetrics::Schedule(uint32_t bandwidth, unsigned long window, uint32_t deferred)
+{
+    portENTER_CRITICAL(&m_lock);
+    m_current.bandwidth = bandwidth;
+    m_current.window = window;
+    m_current.deferred = deferred;
+    portEXIT_CRITICAL(&m_lock);
+}
+
+/// Complete the statistics for the current upload cycle, which then become those reported for the last
+/// cycle.  Calling this outside of a cycle has no effect.
+
+void UploadMetrics::EndCycle(void)
+{
+    portENTER_CRITICAL(&m_lock);
+    if (!m_active) {
+        portEXIT_CRITICAL(&m_lock);
+        return;
+    }
+    m_current.elapsed = millis() - m_start;
+    m_last = m_current;
+    m_active = false;
+    ++m_cycles;
+    Cycle last(m_last);
+    portEXIT_CRITICAL(&m_lock);
+    Serial.printf("DBG: UploadMetrics::EndCycle %u handshake(s), %u saved, %u failure(s), %u B in %u ms.\n",
+        last.handshakes, last.reused, last.failures, last.bytes, last.elapsed);
+}
+
+/// Generate a JSON document with the upload statistics: the number of complete cycles, and the total number
+/// of connections made and handshakes saved by re-using connections; and, for the last complete cycle, the
+/// same counts along with the connection failures, bytes sent, duration (ms), and throughput (bytes/s), and
+/// the schedule (estimated bandwidth in bytes/s, upload window in ms, and files deferred).
+///
+/// \return JSON document with the upload summary
+
+DynamicJsonDocument UploadMetrics::Render(void) const
+{
+    // Take a copy under the lock, since the upload task might be counting at the same time
+    portENTER_CRITICAL(&m_lock);
+    Cycle cycle(m_last);
+    uint32_t cycles = m_cycles, handshakes = m_handshakes, reused = m_reused;
+    portEXIT_CRITICAL(&m_lock);
+
+    DynamicJsonDocument doc(512);
+    doc["cycles"] = cycles;
+    doc["handshakes"] = handshakes;
+    doc["saved"] = reused;
+    JsonObject last = doc.createNestedObject("last");
+    last["handshakes"] = cycle.handshakes;
+    last["saved"] = cycle.reused;
+    last["failures"] = cycle.failures;
+    last["bytes"] = cycle.bytes;
+    last["elapsed"] = cycle.elapsed;
+    last["rate"] = cycle.elapsed > 0 ? 1000.0 * cycle.bytes / cycle.elapsed : 0.0;
+    last["bandwidth"] = cycle.bandwidth;
+    last["window"] = cycle.window;
+    last["deferred"] = cycle.deferred;
+    return doc;
+}
+
+UploadMetrics UploadStats;  ///< Static parameter for upload statistics
+
+/// Default constructor for the upload scheduler.  The bandwidth starts unknown, so that the first files are
+/// tried regardless of size, and the estimate is built from there.
+
+UploadScheduler::UploadScheduler(void)
+: m_order(ORDER_OLDEST), m_bandwidth(0.0), m_window(0), m_deferred(0)
+{
+}
+
+/// Set the priority order for the files from a configuration string ("oldest", "newest", or "smallest").
+/// Anything else gives the default, oldest first.
+///
+/// \param order   Name of the priority order
+
+void UploadScheduler::SetOrder(String const& order)
+{
+    if (order == "newest")
+        m_order = ORDER_NEWEST;
+    else if (order == "smallest")
+        m_order = ORDER_SMALLEST;
+    else
+        m_order = ORDER_OLDEST;
+}
+
+/// Set up for a new upload cycle: forget the history of files that are no longer on the logger, count down
+/// the hold-off for files that failed recently (leaving them out of this cycle), put the rest into priority
+/// order, and size the upload window to fit the data waiting at the estimated bandwidth (with a margin),
+/// but no shorter than the configured duration, and no longer than a multiple of it.
+///
+/// \param files       Closed log files on the logger
+/// \param duration    Configured duration (ms) for each upload cycle
+
+void UploadScheduler::Plan(std::vector<logger::Manager::LogSummary> const& files, unsigned long duration)
+{
+    std::map<uint32_t, FileState> history;
+    uint64_t pending = 0;
+
+    m_queue.clear();
+    m_deferred = 0;
+    for (auto const& file : files) {
+        auto entry = m_files.find(file.lognumber);
+        if (entry != m_files.end()) {
+            history.insert(*entry);
+            FileState& state = history[file.lognumber];
+            if (state.holdoff > 0) {
+                --state.holdoff;
+                ++m_deferred;
+                continue;
+            }
+        }
+        m_queue.push_back(file);
+    }
+    m_files.swap(history);
+
+    std::sort(m_queue.begin(), m_queue.end(),
+        [this](logger::Manager::LogSummary const& a, logger::Manager::LogSummary const& b) {
+            switch (m_order) {
+                case ORDER_NEWEST:
+                    return a.sequence > b.sequence;
+                case ORDER_SMALLEST:
+                    if (remaining(a) != remaining(b)) return remaining(a) < remaining(b);
+                    return a.sequence < b.sequence;
+                default:
+                    return a.sequence < b.sequence;
+            }
+        });
+    for (auto const& file : m_queue) pending += remaining(file);
+
+    m_window = duration;
+    if (m_bandwidth > 0.0) {
+        double needed = WindowMargin * 1000.0 * pending / m_bandwidth;
+        if (needed > m_window) m_window = min(static_cast<unsigned long>(needed), MaxWindowFactor * duration);
+    }
+    Serial.printf("DBG: UploadScheduler::Plan %u file(s), %u kB waiting, %u held back, %.0f B/s, window %lu ms.\n",
+        static_cast<uint32_t>(m_queue.size()), static_cast<uint32_t>(pending/1024), m_deferred, m_bandwidth, m_window);
+}
+
+/// Find the next file to upload in priority order that can be sent in the time left in the window at the
+/// estimated bandwidth; files before it that can't are skipped for this cycle.  If nothing fits but the
+/// server keeps partial uploads, the first file is started anyway so that the window isn't wasted.  Until
+/// there's a bandwidth estimate, every file fits.
+///
+/// \param time_left   Time (ms) left in the upload window
+/// \param resumable   Flag: True => the server keeps the chunks of partial uploads
+/// \param file_id     (Out) Log file number to upload next
+/// \return True if there's a file to upload, otherwise False
+
+bool UploadScheduler::Next(unsigned long time_left, bool resumable, uint32_t& file_id)
+{
+    if (m_queue.empty()) return false;
+    for (auto file = m_queue.begin(); file != m_queue.end(); ++file) {
+        if (m_bandwidth <= 0.0 || 1000.0 * remaining(*file) / m_bandwidth <= time_left) {
+            file_id = file->lognumber;
+            m_deferred += file - m_queue.begin();
+            m_queue.erase(m_queue.begin(), file + 1);
+            return true;
+        }
+    }
+    if (resumable) {
+        file_id = m_queue.front().lognumber;
+        m_deferred += m_queue.size() - 1;
+        m_queue.clear();
+        return true;
+    }
+    m_deferred += m_queue.size();
+    m_queue.clear();
+    return false;
+}
+
+/// Add the throughput of a transfer into the bandwidth estimate.  Small transfers are left out, since they
+/// mostly measure the latency of the connection rather than its bandwidth.
+///
+/// \param bytes   Number of bytes sent
+/// \param elapsed Time (ms) taken to send them (and get the response)
+
+void UploadScheduler::Sample(uint32_t bytes, uint32_t elapsed)
+{
+    if (bytes < MinBandwidthSample || elapsed == 0) return;
+    double rate = 1000.0 * bytes / elapsed;
+    if (m_bandwidth <= 0.0)
+        m_bandwidth = rate;
+    else
+        m_bandwidth = BandwidthSmoothing * rate + (1.0 - BandwidthSmoothing) * m_bandwidth;
+}
+
+/// Note how much of a file the server has, so that the next cycle only counts the rest when deciding
+/// whether the file can finish in the window.
+///
+/// \param file_id     Log file number
+/// \param received    Number of bytes (from the start of the file) that the server has
+
+void UploadScheduler::Progress(uint32_t file_id, uint32_t received)
+{
+    m_files[file_id].received = received;
+}
+
+/// Note that a file has been sent, which clears its history.
+///
+/// \param file_id     Log file number
+
+void UploadScheduler::Succeeded(uint32_t file_id)
+{
+    m_files.erase(file_id);
+}
+
+/// Note that a file failed to send, and hold it back for a number of cycles that doubles with each
+/// consecutive failure, up to a limit.
+///
+/// \param file_id     Log file number
+
+void UploadScheduler::Failed(uint32_t file_id)
+{
+    FileState& state = m_files[file_id];
+    if (state.failures < 6) ++state.failures;
+    state.holdoff = min(static_cast<uint8_t>(1 << (state.failures - 1)), MaxFileHoldoff);
+}
+
+/// Work out how much of a file is still to be sent, given what the server had at the last report.
+///
+/// \param file    Summary of the log file
+/// \return Number of bytes still to be sent
+
+uint32_t UploadScheduler::remaining(logger::Manager::LogSummary const& file) const
+{
+    auto entry = m_files.find(file.lognumber);
+    if (entry == m_files.end() || entry->second.received >= file.filesize) return file.filesize;
+    return file.filesize - entry->second.received;
+}
+
 };
@@ -0,0 +1,150 @@
+/*! \file BenchmarkRunner.cpp
+ *  \brief Run the storage benchmark on the logger's own storage, in the background
+ *
+ * This connects the portable storage benchmark to the logger's file system, and runs it in steps from
+ * the scheduler so that the logger keeps servicing its other tasks while the card is characterised.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "esp_timer.h"
+#include "BenchmarkRunner.h"
+
+namespace logger {
+
+/// Microsecond clock for the benchmark, from the ESP32 high-resolution timer.
+///
+/// \return Time since boot (us)
+
+static uint64_t benchmark_clock(void)
+{
+    return static_cast<uint64_t>(esp_timer_get_time());
+}
+
+/// Default constructor.  Nothing is allocated until a benchmark is started.
+
+BenchmarkRunner::BenchmarkRunner(void)
+: m_medium(nullptr), m_benchmark(nullptr), m_reported(true)
+{
+}
+
+/// Default destructor, abandoning any run in progress.
+
+BenchmarkRunner::~BenchmarkRunner(void)
+{
+    Stop();
+    delete m_benchmark;
+    delete m_medium;
+}
+
+/// Start a benchmark run on the file system given, replacing any previous run (and its results).
+///
+/// \param filesystem   File system on which to run the benchmark (i.e., the logging medium)
+/// \param params       Parameters for the benchmark
+/// \return True if the benchmark started, otherwise False (the reason is in the report)
+
+bool BenchmarkRunner::Start(fs::FS& filesystem, bench::Parameters const& params)
+{
+    Stop();
+    delete m_benchmark;
+    delete m_medium;
+    m_medium = new FileMedium(filesystem);
+    m_benchmark = new bench::Benchmark(m_medium, benchmark_clock);
+    m_reported = !m_benchmark->Start(params);
+    return !m_reported;
+}
+
+/// Run a step of the benchmark, if one is in progress, and report on the console when the run
+/// finishes.  This is intended to be called from the scheduler.
+///
+/// \return True if there is more work to do, otherwise False
+
+bool BenchmarkRunner::Step(void)
+{
+    if (m_benchmark == nullptr) return false;
+    bool more = m_benchmark->Step(BenchmarkStepBudget);
+    if (!more && !m_reported) {
+        if (m_benchmark->Complete()) {
+            Serial.printf("INFO: storage benchmark complete: %s.\n", m_benchmark->Passed() ? "pass" : "fail");
+        } else {
+            Serial.printf("ERR: storage benchmark failed: %s.\n", m_benchmark->Error().c_str());
+        }
+        m_reported = true;
+    }
+    return more;
+}
+
+/// Abandon any benchmark run in progress, removing the scratch file.
+
+void BenchmarkRunner::Stop(void)
+{
+    if (m_benchmark != nullptr && m_benchmark->Running()) {
+        m_benchmark->Stop();
+        m_reported = true;
+    }
+}
+
+/// Generate a JSON document with the state of the benchmark ("idle", "running", "complete", or
+/// "failed" with the error), the parameters of the current or last run, and the results of each test
+/// completed so far: bytes, elapsed time (us), throughput (bytes/s), block latency percentiles (us),
+/// and whether the test met the required rate.  "pass" is the overall result once the run is complete.
+///
+/// \return JSON document with the benchmark summary
+
+DynamicJsonDocument BenchmarkRunner::Render(void) const
+{
+    DynamicJsonDocument doc(1536);
+    if (m_benchmark == nullptr) {
+        doc["state"] = "idle";
+        return doc;
+    }
+    if (m_benchmark->Running()) {
+        doc["state"] = "running";
+    } else if (m_benchmark->Complete()) {
+        doc["state"] = "complete";
+        doc["pass"] = m_benchmark->Passed();
+    } else if (!m_benchmark->Error().empty()) {
+        doc["state"] = "failed";
+        doc["error"] = m_benchmark->Error().c_str();
+    } else {
+        doc["state"] = "idle";
+    }
+    bench::Parameters const& params = m_benchmark->Params();
+    doc["parameters"]["filesize"] = params.fileSize;
+    doc["parameters"]["blocksize"] = params.blockSize;
+    doc["parameters"]["flush"] = params.flushEvery;
+    doc["parameters"]["required"] = params.requiredRate;
+    std::vector<bench::Result> const& results = m_benchmark->Results();
+    for (size_t n = 0; n < results.size(); ++n) {
+        JsonObject test = doc["results"].createNestedObject(results[n].name);
+        test["bytes"] = results[n].bytes;
+        test["elapsed"] = results[n].elapsed;
+        test["rate"] = results[n].rate;
+        test["latency"]["p50"] = results[n].p50;
+        test["latency"]["p90"] = results[n].p90;
+        test["latency"]["p99"] = results[n].p99;
+        test["latency"]["max"] = results[n].max;
+        if (results[n].write) test["pass"] = results[n].pass;
+    }
+    return doc;
+}
+
+BenchmarkRunner Bench;  ///< Static parameter to use for running the storage benchmark
+
+}
@@ -0,0 +1,630 @@
+/*! \file BlockTransfer.cpp
+ *  \brief Portable block-framed protocol for transferring log files over a serial link
+ *
+ * The original serial transfer sends the file as a raw byte stream, so a single corrupted or dropped
+ * byte is only detected by the MD5 check at the end, and the whole file has to be sent again.  This
+ * module provides a framed protocol in its place: the file is sent in blocks, each with a sequence
+ * number and CRC32, inside a sliding window that the receiver acknowledges (cumulatively, and
+ * selectively for blocks that arrive out of order), so that only damaged blocks are re-sent.  Frames
+ * start with a sync pattern, so anything else on the link (e.g., debug messages) is skipped.  The core
+ * is independent of the Arduino environment so that the same code can be used for the receiver on the
+ * host.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include "BlockTransfer.h"
+
+namespace xfer {
+
+const size_t HeaderPayloadSize = 8 + HashSize;  ///< Size (bytes) of the header frame's payload
+const size_t ReadChunk = 256;                   ///< Size (bytes) of each read from the link when parsing
+const size_t CompactThreshold = 4096;           ///< Parsed bytes in the buffer before it's compacted
+
+/// Store a 16-bit value, little-endian.
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+/// Store a 32-bit value, little-endian.
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    for (int n = 0; n < 4; ++n) p[n] = (v >> (8*n)) & 0xFF;
+}
+
+/// Load a 16-bit value, little-endian.
+
+static uint16_t get16(const uint8_t *p)
+{
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+/// Load a 32-bit value, little-endian.
+
+static uint32_t get32(const uint8_t *p)
+{
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+        (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+/// Compute a CRC32 with the reflected IEEE 802.3 polynomial (the same as zlib's crc32()), using a table
+/// that's built on first use.  A CRC can be continued over several blocks by passing the result for the
+/// previous block as \a crc.
+///
+/// \param data Data to add to the CRC
+/// \param n    Number of bytes of data
+/// \param crc  CRC of the data so far (zero to start)
+/// \return CRC32 of the data so far, including this block
+
+uint32_t CRC32(const uint8_t *data, size_t n, uint32_t crc)
+{
+    static uint32_t table[256];
+    static bool initialised = false;
+    if (!initialised) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        initialised = true;
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < n; ++i) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+/// Write a frame to the link: sync pattern, type, flags (currently zero), sequence number, payload length,
+/// payload, and then the CRC32 of everything after the sync pattern.
+///
+/// \param link     Serial link to write to
+/// \param type     Type of the frame
+/// \param sequence Sequence number for the frame
+/// \param payload  Payload for the frame (may be nullptr if \a n is zero)
+/// \param n        Size of the payload (bytes)
+/// \return True if the whole frame was accepted by the link, otherwise False
+
+bool SendFrame(Channel *link, FrameType type, uint32_t sequence, const uint8_t *payload, size_t n)
+{
+    uint8_t header[FrameHeaderSize], trailer[FrameTrailerSize];
+    header[0] = FrameSync[0];
+    header[1] = FrameSync[1];
+    header[2] = static_cast<uint8_t>(type);
+    header[3] = 0;
+    put32(header + 4, sequence);
+    put16(header + 8, static_cast<uint16_t>(n));
+    uint32_t crc = CRC32(header + 2, FrameHeaderSize - 2);
+    if (n > 0) crc = CRC32(payload, n, crc);
+    put32(trailer, crc);
+    if (link->Write(header, FrameHeaderSize) != FrameHeaderSize) return false;
+    if (n > 0 && link->Write(payload, n) != n) return false;
+    return link->Write(trailer, FrameTrailerSize) == FrameTrailerSize;
+}
+
+/// Constructor for the frame parser.
+///
+/// \param stats    Statistics to update with CRC errors and bytes skipped
+
+FrameParser::FrameParser(Statistics *stats)
+: m_start(0), m_stats(stats)
+{
+}
+
+/// Read whatever is available from the link, and look for the next frame.  Frames are returned one
+/// at a time, so this should be called until it returns False to get everything that's arrived.
+///
+/// \param link     Serial link to read from
+/// \param frame    (Out) Frame found
+/// \return True if a frame was found, otherwise False
+
+bool FrameParser::Poll(Channel *link, Frame& frame)
+{
+    if (extract(frame)) return true;
+    uint8_t chunk[ReadChunk];
+    size_t n;
+    while ((n = link->Read(chunk, sizeof(chunk))) > 0) {
+        m_buffer.insert(m_buffer.end(), chunk, chunk + n);
+        if (extract(frame)) return true;
+    }
+    return false;
+}
+
+/// Look for a frame in the bytes accumulated so far, skipping anything before the sync pattern, and
+/// anything that has a sync pattern but isn't a valid frame.
+///
+/// \param frame    (Out) Frame found
+/// \return True if a frame was found, otherwise False
+
+bool FrameParser::extract(Frame& frame)
+{
+    bool found = false;
+    while (!found) {
+        while (m_buffer.size() - m_start >= 2 &&
+                (m_buffer[m_start] != FrameSync[0] || m_buffer[m_start + 1] != FrameSync[1])) {
+            ++m_start;
+            ++m_stats->skipped;
+        }
+        if (m_buffer.size() - m_start < FrameHeaderSize) break;
+        const uint8_t *p = m_buffer.data() + m_start;
+        uint8_t type = p[2];
+        uint16_t length = get16(p + 8);
+        if (type < FRAME_HEADER || type > FRAME_ABORT || length > MaxBlockSize) {
+            // Not a real frame, so carry on looking after the sync pattern
+            ++m_start;
+            ++m_stats->skipped;
+            continue;
+        }
+        size_t total = FrameHeaderSize + length + FrameTrailerSize;
+        if (m_buffer.size() - m_start < total) {
+            if (!validAfter(m_start + 2)) break;
+            // This frame will never be complete, so drop it and start again from the next sync
+            ++m_start;
+            ++m_stats->skipped;
+            continue;
+        }
+        if (CRC32(p + 2, FrameHeaderSize - 2 + length) != get32(p + FrameHeaderSize + length)) {
+            ++m_stats->crcErrors;
+            ++m_start;
+            ++m_stats->skipped;
+            continue;
+        }
+        frame.type = static_cast<FrameType>(type);
+        frame.sequence = get32(p + 4);
+        frame.payload.assign(p + FrameHeaderSize, p + FrameHeaderSize + length);
+        m_start += total;
+        found = true;
+    }
+    if (m_start == m_buffer.size()) {
+        m_buffer.clear();
+        m_start = 0;
+    } else if (m_start > CompactThreshold) {
+        m_buffer.erase(m_buffer.begin(), m_buffer.begin() + m_start);
+        m_start = 0;
+    }
+    return found;
+}
+
+/// Check whether there's a complete frame with a good CRC starting anywhere in the buffer from the offset
+/// given.  Frames are written to the link one after another, so if there is, any frame that starts before
+/// the offset and is still waiting for bytes was cut short (or was a false sync).
+///
+/// \param offset   Offset in the buffer at which to start looking
+/// \return True if a valid frame was found, otherwise False
+
+bool FrameParser::validAfter(size_t offset) const
+{
+    for (size_t at = offset; at + FrameHeaderSize <= m_buffer.size(); ++at) {
+        const uint8_t *p = m_buffer.data() + at;
+        if (p[0] != FrameSync[0] || p[1] != FrameSync[1]) continue;
+        uint16_t length = get16(p + 8);
+        if (p[2] < FRAME_HEADER || p[2] > FRAME_ABORT || length > MaxBlockSize) continue;
+        if (m_buffer.size() - at < FrameHeaderSize + length + FrameTrailerSize) continue;
+        if (CRC32(p + 2, FrameHeaderSize - 2 + length) == get32(p + FrameHeaderSize + length)) return true;
+    }
+    return false;
+}
+
+/// Constructor for the sender.  Nothing is sent until \a Start().
+///
+/// \param link     Serial link to send the file over
+/// \param clock    Microsecond clock
+
+Sender::Sender(Channel *link, Clock clock)
+: m_link(link), m_clock(clock), m_source(nullptr), m_state(STATE_IDLE), m_size(0), m_blocks(0), m_base(0),
+  m_next(0), m_mask(0), m_stamp(0), m_fileCRC(0), m_retries(0), m_start(0), m_lastProgress(0),
+  m_parser(&m_stats)
+{
+    memset(m_hash, 0, HashSize);
+    memset(m_sent, 0, sizeof(m_sent));
+}
+
+/// Set up to send a file, and send the header.
+///
+/// \param source   Interface to read the file
+/// \param size     Size of the file (bytes)
+/// \param hash     Hash (MD5) of the file, passed through to the receiver (or nullptr if not known)
+/// \param params   Block size, window, and time-outs for the transfer
+/// \return True if the transfer started, otherwise False (the reason is in \a Error())
+
+bool Sender::Start(Source *source, uint32_t size, const uint8_t *hash, Parameters const& params)
+{
+    m_error.clear();
+    m_stats = Statistics();
+    if (params.blockSize == 0 || params.blockSize > MaxBlockSize || params.window == 0 || params.window > MaxWindow) {
+        fail("block size or window is out of range", false);
+        return false;
+    }
+    m_source = source;
+    m_params = params;
+    m_size = size;
+    if (hash != nullptr) {
+        memcpy(m_hash, hash, HashSize);
+    } else {
+        memset(m_hash, 0, HashSize);
+    }
+    m_blocks = (size + params.blockSize - 1) / params.blockSize;
+    m_base = m_next = 1;
+    m_mask = 0;
+    m_stamp = 0;
+    memset(m_sent, 0, sizeof(m_sent));
+    m_fileCRC = 0;
+    m_retries = 0;
+    m_buffer.resize(params.blockSize);
+    m_start = m_lastProgress = m_clock();
+    m_state = STATE_HEADER;
+    return sendHeader();
+}
+
+/// Run the transfer for up to the time budget given: act on any acknowledgements that have arrived,
+/// send as many new blocks as the window allows, and re-send if nothing has been acknowledged for too long
+/// (everything outstanding, since if the last blocks sent were lost, nothing will prompt a selective re-send).
+///
+/// \param budget   Time (us) to spend before returning
+/// \return True if the transfer is still in progress, otherwise False
+
+bool Sender::Step(uint32_t budget)
+{
+    if (!Running()) return false;
+    uint64_t start = m_clock();
+
+    Frame frame;
+    while (Running() && m_parser.Poll(m_link, frame)) {
+        if (frame.type == FRAME_ABORT) {
+            fail("transfer abandoned by receiver", false);
+        } else if (frame.type == FRAME_ACK && frame.payload.size() >= 4) {
+            acknowledge(frame.sequence, get32(frame.payload.data()));
+        }
+    }
+    while (m_state == STATE_DATA && m_next <= m_blocks && m_next < m_base + m_params.window &&
+            m_clock() - start < budget) {
+        if (!sendBlock(m_next)) break;
+        ++m_next;
+    }
+    if (!Running()) return false;
+
+    uint64_t now = m_clock();
+    if (now - m_lastProgress > m_params.timeout) {
+        ++m_stats.timeouts;
+        if (++m_retries > m_params.maxRetries) {
+            fail("no acknowledgement from receiver", true);
+            return false;
+        }
+        switch (m_state) {
+            case STATE_HEADER:  sendHeader(); break;
+            case STATE_DATA:    resend(); break;
+            case STATE_END:     sendEnd(); break;
+            default:            break;
+        }
+        m_lastProgress = now;
+    }
+    m_stats.elapsed = now - m_start;
+    return Running();
+}
+
+/// Abandon the transfer in progress (if any), telling the receiver.
+
+void Sender::Stop(void)
+{
+    if (Running()) fail("transfer stopped", true);
+}
+
+/// Send the header frame, with the file size, block size, window, and hash.
+///
+/// \return True if the frame was sent, otherwise False
+
+bool Sender::sendHeader(void)
+{
+    uint8_t payload[HeaderPayloadSize];
+    put32(payload, m_size);
+    put16(payload + 4, static_cast<uint16_t>(m_params.blockSize));
+    put16(payload + 6, static_cast<uint16_t>(m_params.window));
+    memcpy(payload + 8, m_hash, HashSize);
+    ++m_stats.frames;
+    return SendFrame(m_link, FRAME_HEADER, 0, payload, HeaderPayloadSize);
+}
+
+/// Read a block from the file, and send it.  Blocks are first sent in order, so the CRC of the whole
+/// file is accumulated as each is sent for the first time.
+///
+/// \param sequence Sequence number of the block (1 for the first)
+/// \return True if the block was sent, otherwise False
+
+bool Sender::sendBlock(uint32_t sequence)
+{
+    uint32_t offset = (sequence - 1) * m_params.blockSize;
+    size_t n = std::min<uint32_t>(m_params.blockSize, m_size - offset);
+    if (m_source->Read(offset, m_buffer.data(), n) != n) {
+        fail("failed to read block from file", true);
+        return false;
+    }
+    if (sequence == m_next) {
+        m_fileCRC = CRC32(m_buffer.data(), n, m_fileCRC);
+    } else {
+        ++m_stats.retransmits;
+    }
+    m_sent[sequence % MaxWindow] = ++m_stamp;
+    ++m_stats.frames;
+    return SendFrame(m_link, FRAME_DATA, sequence, m_buffer.data(), n);
+}
+
+/// Send again every block in the window that the receiver hasn't reported having.
+
+void Sender::resend(void)
+{
+    for (uint32_t sequence = m_base; sequence < m_next && Running(); ++sequence) {
+        bool have = sequence > m_base && (m_mask & (1UL << (sequence - m_base - 1))) != 0;
+        if (!have) sendBlock(sequence);
+    }
+}
+
+/// Send the end frame, with the CRC of the whole file.
+///
+/// \return True if the frame was sent, otherwise False
+
+bool Sender::sendEnd(void)
+{
+    uint8_t payload[4];
+    put32(payload, m_fileCRC);
+    ++m_stats.frames;
+    return SendFrame(m_link, FRAME_END, m_blocks + 1, payload, sizeof(payload));
+}
+
+/// Act on an acknowledgement from the receiver.  Progress (the next block needed moving forward) resets
+/// the time-out; any block before the latest one the receiver has that was sent before it is assumed to
+/// have been lost, and is sent again.  Once all of the blocks are acknowledged, the end frame is sent.
+///
+/// \param next Sequence number of the next frame the receiver needs
+/// \param mask Bit mask of the blocks after \a next that the receiver already has (bit 0 for next + 1)
+
+void Sender::acknowledge(uint32_t next, uint32_t mask)
+{
+    switch (m_state) {
+        case STATE_HEADER:
+            if (next < 1) return;
+            m_state = STATE_DATA;
+            if (m_blocks == 0) {
+                m_state = STATE_END;
+                sendEnd();
+            }
+            break;
+        case STATE_DATA:
+            if (next > m_next) return;  // Can't be for this transfer
+            if (next > m_base) {
+                m_base = next;
+                m_stats.bytes = std::min<uint64_t>(static_cast<uint64_t>(m_base - 1) * m_params.blockSize, m_size);
+            } else if (next < m_base) {
+                return; // Stale
+            }
+            m_mask = mask;
+            {
+                // Selective re-send: find the latest block the receiver has, and re-send anything before
+                // it that it doesn't have, if that was sent before the block that's arrived
+                uint32_t latest = 0;
+                for (int bit = 31; bit >= 0 && latest == 0; --bit) {
+                    uint32_t sequence = m_base + 1 + bit;
+                    if ((mask & (1UL << bit)) != 0 && sequence < m_next) latest = sequence;
+                }
+                if (latest != 0) {
+                    uint32_t latest_stamp = m_sent[latest % MaxWindow];
+                    for (uint32_t sequence = m_base; sequence < latest && Running(); ++sequence) {
+                        bool have = sequence > m_base && (m_mask & (1UL << (sequence - m_base - 1))) != 0;
+                        if (!have && m_sent[sequence % MaxWindow] < latest_stamp) sendBlock(sequence);
+                    }
+                }
+            }
+            if (m_base <= m_blocks) break;
+            m_state = STATE_END;
+            sendEnd();
+            break;
+        case STATE_END:
+            if (next < m_blocks + 2) return;
+            m_stats.bytes = m_size;
+            m_state = STATE_DONE;
+            break;
+        default:
+            return;
+    }
+    m_retries = 0;
+    m_lastProgress = m_clock();
+}
+
+/// Abandon the transfer with an error, optionally telling the receiver.
+///
+/// \param message  Description of the error
+/// \param tell     Flag: True => send an abort frame to the receiver
+
+void Sender::fail(const char *message, bool tell)
+{
+    if (tell) SendFrame(m_link, FRAME_ABORT, 0, nullptr, 0);
+    m_error = message;
+    m_state = STATE_FAILED;
+}
+
+/// Constructor for the receiver, which starts waiting for the header straight away.
+///
+/// \param link     Serial link to receive the file from
+/// \param sink     Output for the file
+/// \param clock    Microsecond clock
+
+Receiver::Receiver(Channel *link, Sink *sink, Clock clock)
+: m_link(link), m_sink(sink), m_clock(clock), m_state(STATE_WAITING), m_size(0), m_blockSize(0), m_window(0),
+  m_blocks(0), m_next(0), m_fileCRC(0), m_start(0), m_lastFrame(0), m_parser(&m_stats)
+{
+    memset(m_hash, 0, HashSize);
+    memset(m_held, 0, sizeof(m_held));
+    m_start = m_lastFrame = m_clock();
+}
+
+/// Run the transfer for up to the time budget given, acting on each frame that has arrived.
+///
+/// \param budget   Time (us) to spend before returning
+/// \return True if the transfer is still in progress, otherwise False
+
+bool Receiver::Step(uint32_t budget)
+{
+    uint64_t start = m_clock();
+    Frame frame;
+    while ((m_state == STATE_WAITING || m_state == STATE_DATA || m_state == STATE_LINGER) &&
+            m_clock() - start < budget && m_parser.Poll(m_link, frame)) {
+        m_lastFrame = m_clock();
+        process(frame);
+    }
+    uint64_t now = m_clock();
+    if (m_state == STATE_LINGER) {
+        if (now - m_lastFrame > LingerTime) m_state = STATE_DONE;
+    } else if (m_state == STATE_WAITING || m_state == STATE_DATA) {
+        if (now - m_lastFrame > IdleTimeout) {
+            ++m_stats.timeouts;
+            fail("timed out waiting for sender", true);
+        }
+    }
+    if (m_state == STATE_DATA) m_stats.elapsed = now - m_start;
+    return m_state == STATE_WAITING || m_state == STATE_DATA || m_state == STATE_LINGER;
+}
+
+/// Abandon the transfer in progress (if any), telling the sender.
+
+void Receiver::Stop(void)
+{
+    if (m_state == STATE_WAITING || m_state == STATE_DATA) fail("transfer stopped", true);
+}
+
+/// Act on a frame from the sender.  Every frame other than an abort is acknowledged, so that a lost
+/// acknowledgement is made good by the next one.
+///
+/// \param frame    Frame received
+
+void Receiver::process(Frame const& frame)
+{
+    switch (frame.type) {
+        case FRAME_ABORT:
+            fail("transfer abandoned by sender", false);
+            return;
+        case FRAME_HEADER:
+            if (m_state == STATE_WAITING) {
+                if (frame.payload.size() < HeaderPayloadSize) return;
+                m_size = get32(frame.payload.data());
+                m_blockSize = get16(frame.payload.data() + 4);
+                m_window = get16(frame.payload.data() + 6);
+                memcpy(m_hash, frame.payload.data() + 8, HashSize);
+                if (m_blockSize == 0 || m_blockSize > MaxBlockSize || m_window == 0 || m_window > MaxWindow) {
+                    fail("block size or window in header is out of range", true);
+                    return;
+                }
+                m_blocks = (m_size + m_blockSize - 1) / m_blockSize;
+                m_next = 1;
+                m_fileCRC = 0;
+                m_start = m_clock();
+                m_state = STATE_DATA;
+            }
+            break;
+        case FRAME_DATA:
+            if (m_state != STATE_DATA) break;
+            if (!accept(frame.sequence, frame.payload)) return;
+            break;
+        case FRAME_END:
+            if (m_state == STATE_DATA && frame.sequence == m_blocks + 1 && m_next == m_blocks + 1) {
+                if (frame.payload.size() < 4 || get32(frame.payload.data()) != m_fileCRC) {
+                    fail("CRC of the whole file does not match", true);
+                    return;
+                }
+                m_next = m_blocks + 2;
+                m_stats.elapsed = m_clock() - m_start;
+                m_state = STATE_LINGER;
+            }
+            break;
+        default:
+            return;
+    }
+    if (m_state != STATE_WAITING) acknowledge();
+}
+
+/// Accept a data block: if it's the next one needed, it's written to the sink, followed by any blocks
+/// that arrived early and now follow on; if it's within the window after that, it's held; duplicates
+/// and blocks outside the window are ignored (but still acknowledged).
+///
+/// \param sequence Sequence number of the block
+/// \param data     Contents of the block
+/// \return True if the transfer can continue, otherwise False
+
+bool Receiver::accept(uint32_t sequence, std::vector<uint8_t> const& data)
+{
+    if (sequence < m_next || sequence > m_blocks || sequence >= m_next + m_window) return true;
+    uint32_t expected = std::min<uint32_t>(m_blockSize, m_size - (sequence - 1) * m_blockSize);
+    if (data.size() != expected) return true;
+    if (sequence > m_next) {
+        uint32_t slot = sequence % MaxWindow;
+        if (!m_held[slot]) {
+            m_early[slot] = data;
+            m_held[slot] = true;
+        }
+        return true;
+    }
+    const std::vector<uint8_t> *block = &data;
+    while (true) {
+        if (!m_sink->Write(block->data(), block->size())) {
+            fail("failed to write block to file", true);
+            return false;
+        }
+        m_fileCRC = CRC32(block->data(), block->size(), m_fileCRC);
+        m_stats.bytes += block->size();
+        if (block != &data) m_held[m_next % MaxWindow] = false;
+        ++m_next;
+        uint32_t slot = m_next % MaxWindow;
+        if (m_next > m_blocks || !m_held[slot]) break;
+        block = &m_early[slot];
+    }
+    return true;
+}
+
+/// Send an acknowledgement: the next block needed (as the sequence number) and a mask of the blocks after
+/// that which have arrived early.
+
+void Receiver::acknowledge(void)
+{
+    uint32_t mask = 0;
+    if (m_state == STATE_DATA) {
+        for (uint32_t bit = 0; bit < 32 && m_next + 1 + bit <= m_blocks && 1 + bit < m_window; ++bit) {
+            if (m_held[(m_next + 1 + bit) % MaxWindow]) mask |= 1UL << bit;
+        }
+    }
+    uint8_t payload[4];
+    put32(payload, mask);
+    ++m_stats.frames;
+    SendFrame(m_link, FRAME_ACK, m_next, payload, sizeof(payload));
+}
+
+/// Abandon the transfer with an error, optionally telling the sender.
+///
+/// \param message  Description of the error
+/// \param tell     Flag: True => send an abort frame to the sender
+
+void Receiver::fail(const char *message, bool tell)
+{
+    if (tell) SendFrame(m_link, FRAME_ABORT, 0, nullptr, 0);
+    m_error = message;
+    m_state = STATE_FAILED;
+}
+
+}
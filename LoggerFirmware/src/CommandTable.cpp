@@ -0,0 +1,264 @@
+/*! \file CommandTable.cpp
+ *  \brief Allocation-free parsing and table-driven dispatch of text commands
+ *
+ * Commands to the logger are a verb followed by arguments, and may come several at a time (separated by
+ * semicolons).  This splits them up, and finds the verb in a table sorted at compile time,
+ * all with pointers into the original text so that nothing is copied or allocated.  Lines of input are
+ * assembled from bulk reads by a \a LineReader, which grows geometrically for long lines (e.g., JSON
+ * configurations) rather than a character at a time.  There are no Arduino dependencies, so the same code
+ * can be built and checked on a host.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "CommandTable.h"
+
+namespace cmd {
+
+/// Check for white space (as used to separate arguments).
+///
+/// \param c    Character to check
+/// \return True if the character is a space, tab, or line end, otherwise False
+
+static bool space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/// Check whether the token is exactly the word given.
+///
+/// \param word Null-terminated word to compare against
+/// \return True if the token and word are the same, otherwise False
+
+bool Token::Is(const char *word) const
+{
+    return strncmp(text, word, length) == 0 && word[length] == '\0';
+}
+
+/// Compare the token with a word, in the same way as \a strcmp().
+///
+/// \param word Null-terminated word to compare against
+/// \return Negative if the token is before the word, zero if the same, positive if after
+
+int Token::Compare(const char *word) const
+{
+    for (size_t i = 0; i < length; ++i) {
+        if (word[i] == '\0') return 1;
+        if (text[i] != word[i]) return static_cast<unsigned char>(text[i]) < static_cast<unsigned char>(word[i]) ? -1 : 1;
+    }
+    return word[length] == '\0' ? 0 : -1;
+}
+
+/// Split a command into its verb (the first word) and arguments.  Up to \a MaxArguments arguments are split
+/// out at white space; anything after that is only in \a rest (and \a From()).
+///
+/// \param line Command to split, with no leading white space
+
+void Command::Parse(Token const& line)
+{
+    const char *p = line.text, *end = line.text + line.length;
+    while (p < end && !space(*p)) ++p;
+    verb = Token(line.text, p - line.text);
+    while (p < end && space(*p)) ++p;
+    while (end > p && space(end[-1])) --end;
+    rest = Token(p, end - p);
+    count = 0;
+    while (p < end && count < MaxArguments) {
+        const char *start = p;
+        while (p < end && !space(*p)) ++p;
+        args[count++] = Token(start, p - start);
+        while (p < end && space(*p)) ++p;
+    }
+}
+
+/// Generate a token for everything from the start of an argument to the end of the command, for commands
+/// where the first arguments select an action, and the rest is free text or JSON.
+///
+/// \param n    Argument to start from (zero for the first)
+/// \return Token for the rest of the command, or an empty token if there aren't that many arguments
+
+Token Command::From(size_t n) const
+{
+    if (n >= count) return Token();
+    return Token(args[n].text, rest.text + rest.length - args[n].text);
+}
+
+/// Find the next command in a batch.  Commands are separated by semicolons, except inside braces, brackets,
+/// or quoted strings, so that JSON arguments stay with their command; line ends are just white space, so that
+/// multi-line arguments (pretty-printed JSON, or PEM certificates) are never split.  If the verb takes free
+/// text (as determined by \a freeText), the command is everything to the end of the batch, so that passwords,
+/// names, and the like can contain anything.  Empty commands are skipped, and white space is trimmed from the
+/// ends of the command.
+///
+/// \param text     (In/Out) Start of the remaining text, moved past the command found
+/// \param end      End of the text
+/// \param command  (Out) Command found
+/// \param freeText Check for verbs that take free text (or nullptr if none do)
+/// \return True if a command was found, otherwise False
+
+bool NextCommand(const char *&text, const char *end, Token& command, bool (*freeText)(Token const& verb))
+{
+    while (text < end && (space(*text) || *text == ';')) ++text;
+    if (text == end) return false;
+    const char *start = text;
+    if (freeText != nullptr) {
+        const char *verb_end = start;
+        while (verb_end < end && !space(*verb_end) && *verb_end != ';') ++verb_end;
+        if (freeText(Token(start, verb_end - start))) text = end;
+    }
+    int depth = 0;
+    bool quoted = false;
+    for (; text < end; ++text) {
+        char c = *text;
+        if (quoted) {
+            if (c == '\\' && text + 1 < end) {
+                ++text;
+            } else if (c == '"') {
+                quoted = false;
+            }
+        } else if (c == '"') {
+            quoted = true;
+        } else if (c == '{' || c == '[') {
+            ++depth;
+        } else if ((c == '}' || c == ']') && depth > 0) {
+            --depth;
+        } else if (depth == 0 && c == ';') {
+            break;
+        }
+    }
+    const char *stop = text;
+    while (stop > start && space(stop[-1])) --stop;
+    command = Token(start, stop - start);
+    return true;
+}
+
+/// Construct a line reader.  The buffer isn't allocated until there's something to put in it.
+///
+/// \param initial  Size of the buffer for a new line (bytes)
+/// \param maximum  Largest size that the buffer can grow to for a long line (bytes)
+
+LineReader::LineReader(size_t initial, size_t maximum)
+: m_buffer(nullptr), m_capacity(0), m_initial(initial < 16 ? 16 : initial),
+  m_maximum(maximum < initial ? initial : maximum), m_length(0), m_dropped(0),
+  m_complete(false), m_overflow(false)
+{
+}
+
+/// Default destructor, releasing the line buffer.
+
+LineReader::~LineReader(void)
+{
+    free(m_buffer);
+}
+
+/// Make sure that there's space in the buffer for more characters, and a terminator.  The buffer doubles
+/// in size as required, so that a long line costs linear time overall, up to the maximum size set.
+///
+/// \param n    Number of characters to add
+/// \return True if there's space, otherwise False (the line is too long, or there's no memory)
+
+bool LineReader::reserve(size_t n)
+{
+    size_t needed = m_length + n + 1;
+    if (needed <= m_capacity) return true;
+    if (needed > m_maximum) return false;
+    size_t capacity = m_capacity == 0 ? m_initial : m_capacity;
+    while (capacity < needed) capacity *= 2;
+    if (capacity > m_maximum) capacity = m_maximum;
+    char *buffer = static_cast<char*>(realloc(m_buffer, capacity));
+    if (buffer == nullptr) return false;
+    m_buffer = buffer;
+    m_capacity = capacity;
+    return true;
+}
+
+/// Add characters from the middle of a line (i.e., with no new-line) into the buffer, dealing with any
+/// backspaces.  If the line gets too long, the contents are discarded, and the rest of the line is just
+/// counted until its end.
+///
+/// \param data Characters to add
+/// \param n    Number of characters to add
+
+void LineReader::add(const char *data, size_t n)
+{
+    if (!m_overflow && !reserve(n)) {
+        m_overflow = true;
+        m_dropped = m_length;
+        m_length = 0;
+    }
+    if (m_overflow) {
+        m_dropped += n;
+        return;
+    }
+    if (memchr(data, '\b', n) == nullptr) {
+        memcpy(m_buffer + m_length, data, n);
+        m_length += n;
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            if (data[i] == '\b') {
+                if (m_length > 0) --m_length;
+            } else {
+                m_buffer[m_length++] = data[i];
+            }
+        }
+    }
+    m_buffer[m_length] = '\0';
+}
+
+/// Add a block of characters to the line.  Characters are taken up to and including the first new-line,
+/// at which point the line is complete, and the caller should deal with it and \a Clear() the reader before
+/// adding the rest of the block.  Nothing is taken while a line is complete.
+///
+/// \param data Characters to add
+/// \param n    Number of characters available
+/// \return Number of characters taken from \a data
+
+size_t LineReader::Append(const char *data, size_t n)
+{
+    if (m_complete || n == 0) return 0;
+    const char *eol = static_cast<const char*>(memchr(data, '\n', n));
+    size_t used = eol == nullptr ? n : eol - data;
+    add(data, used);
+    if (eol != nullptr) {
+        m_complete = true;
+        ++used;
+    }
+    return used;
+}
+
+/// Start a new line, forgetting the previous one.  If the buffer had to grow for a long line, it's
+/// released so that the memory isn't held after the line's been dealt with.
+
+void LineReader::Clear(void)
+{
+    if (m_capacity > m_initial) {
+        free(m_buffer);
+        m_buffer = nullptr;
+        m_capacity = 0;
+    }
+    if (m_buffer != nullptr) m_buffer[0] = '\0';
+    m_length = 0;
+    m_dropped = 0;
+    m_complete = false;
+    m_overflow = false;
+}
+
+}
@@ -62,6 +62,10 @@ const String lookup[] = {
     "Bridge",           ///< Control whether to start the UDP->RS-422 bridge on WiFi startup (binary)
     "WebServer",        ///< Control whether to use the web server interface to configure the system (binary)
     "Upload",           ///< Control whether to auto-upload files when online (binary)
+    "Metrics",          ///< Control whether to record performance metrics packets in the log files (binary)
+    "Compress",         ///< Control whether to compress log files when they are closed (binary)
+    "Live",             ///< Control whether to publish the live data stream over UDP (binary)
+    "BridgeCoalesce",   ///< Control whether the UDP bridge only writes whole sentences to RS-422 (binary)
     "modid",            ///< Set the module's Unique ID (string)
     "shipname",         ///< Set the ship's name (string)
     "ap_ssid",          ///< Set the WiFi SSID (string)
@@ -86,6 +90,11 @@ const String lookup[] = {
     "UploadInterval",   ///< Interval (seconds) between upload attempts
     "UploadDuration",   ///< Time (seconds) for upload activity before diverting back to other efforts
     "UploadCert",       ///< Certificate to pass to the upload server for TLS
+    "UploadLifetime",   ///< Maximum age (seconds) of a connection to the upload server before reconnecting
+    "UploadOrder",      ///< Order in which log files are uploaded (oldest, newest, or smallest first)
+    "LiveAddress",      ///< UDP address (multicast group or broadcast) for the live data stream
+    "LivePort",         ///< UDP port for the live data stream
+    "LiveFilter",       ///< Packet IDs (comma-separated) to send on the live data stream, or empty for all
     "mDNSName"
 };
 
@@ -198,7 +207,7 @@ DynamicJsonDocument ConfigJSON::ExtractConfig(bool secure)
     // Note fixed size of document here.  Since what's being rendered into it is pretty well
     // controlled here, it's probably relatively safe; you should assess if you add anything
     // into the payload, however.
-    DynamicJsonDocument params(1024);
+    DynamicJsonDocument params(2048);
     params["version"]["firmware"] = FirmwareVersion();
     params["version"]["commandproc"] = SerialCommand::SoftwareVersion();
     params["version"]["nmea0183"] = nmea::N0183::Logger::SoftwareVersion();
@@ -208,7 +217,8 @@ DynamicJsonDocument ConfigJSON::ExtractConfig(bool secure)
 
     // Enable/disable for the various loggers and features
     bool nmea0183_enable, nmea2000_enable, imu_enable, powmon_enable, sdmmc_enable,
-         udp_bridge_enable, webserver_on_boot, upload_online;
+         udp_bridge_enable, webserver_on_boot, upload_online, metrics_enable, compress_enable, live_enable,
+         bridge_coalesce;
     LoggerConfig.GetConfigBinary(Config::CONFIG_NMEA0183_B, nmea0183_enable);
     LoggerConfig.GetConfigBinary(Config::ConfigParam::CONFIG_NMEA2000_B, nmea2000_enable);
     LoggerConfig.GetConfigBinary(Config::ConfigParam::CONFIG_MOTION_B, imu_enable);
@@ -217,6 +227,14 @@ DynamicJsonDocument ConfigJSON::ExtractConfig(bool secure)
     LoggerConfig.GetConfigBinary(Config::ConfigParam::CONFIG_BRIDGE_B, udp_bridge_enable);
     LoggerConfig.GetConfigBinary(Config::ConfigParam::CONFIG_WEBSERVER_B, webserver_on_boot);
     LoggerConfig.GetConfigBinary(Config::ConfigParam::CONFIG_UPLOAD_B, upload_online);
+    if (!LoggerConfig.GetConfigBinary(Config::ConfigParam::CONFIG_METRICS_B, metrics_enable))
+        metrics_enable = false;
+    if (!LoggerConfig.GetConfigBinary(Config::ConfigParam::CONFIG_COMPRESS_B, compress_enable))
+        compress_enable = false;
+    if (!LoggerConfig.GetConfigBinary(Config::ConfigParam::CONFIG_LIVE_B, live_enable))
+        live_enable = false;
+    if (!LoggerConfig.GetConfigBinary(Config::ConfigParam::CONFIG_BRIDGE_COALESCE_B, bridge_coalesce))
+        bridge_coalesce = false;
     params["enable"]["nmea0183"] = nmea0183_enable;
     params["enable"]["nmea2000"] = nmea2000_enable;
     params["enable"]["imu"] = imu_enable;
@@ -225,6 +243,10 @@ DynamicJsonDocument ConfigJSON::ExtractConfig(bool secure)
     params["enable"]["udpbridge"] = udp_bridge_enable;
     params["enable"]["webserver"] = webserver_on_boot;
     params["enable"]["upload"] = upload_online;
+    params["enable"]["metrics"] = metrics_enable;
+    params["enable"]["compress"] = compress_enable;
+    params["enable"]["live"] = live_enable;
+    params["enable"]["bridgecoalesce"] = bridge_coalesce;
 
     // String configurations for the various parameters in configuration
     String wifi_station_delay, wifi_station_retries, wifi_station_timeout, wifi_ip_address, wifi_mode;
@@ -264,17 +286,30 @@ DynamicJsonDocument ConfigJSON::ExtractConfig(bool secure)
     params["baudrate"]["port2"] = baudrate_port2.toInt();
     params["udpbridge"] = udp_bridge_port.toInt();
 
-    String upload_server, upload_port, upload_timeout, upload_interval, upload_duration;
+    String upload_server, upload_port, upload_timeout, upload_interval, upload_duration, upload_lifetime, upload_order;
     LoggerConfig.GetConfigString(Config::CONFIG_UPLOAD_SERVER_S, upload_server);
     LoggerConfig.GetConfigString(Config::CONFIG_UPLOAD_PORT_S, upload_port);
     LoggerConfig.GetConfigString(Config::CONFIG_UPLOAD_TIMEOUT_S, upload_timeout);
     LoggerConfig.GetConfigString(Config::CONFIG_UPLOAD_INTERVAL_S, upload_interval);
     LoggerConfig.GetConfigString(Config::CONFIG_UPLOAD_DURATION_S, upload_duration);
+    LoggerConfig.GetConfigString(Config::CONFIG_UPLOAD_LIFETIME_S, upload_lifetime);
+    LoggerConfig.GetConfigString(Config::CONFIG_UPLOAD_ORDER_S, upload_order);
+    if (upload_order.isEmpty()) upload_order = "oldest";
     params["upload"]["server"] = upload_server;
     params["upload"]["port"] = upload_port.toInt();
     params["upload"]["timeout"] = upload_timeout.toDouble();
     params["upload"]["interval"] = upload_interval.toDouble();
     params["upload"]["duration"] = upload_duration.toDouble();
+    params["upload"]["lifetime"] = upload_lifetime.toDouble();
+    params["upload"]["order"] = upload_order;
+
+    String live_address, live_port, live_filter;
+    LoggerConfig.GetConfigString(Config::CONFIG_LIVE_ADDRESS_S, live_address);
+    LoggerConfig.GetConfigString(Config::CONFIG_LIVE_PORT_S, live_port);
+    LoggerConfig.GetConfigString(Config::CONFIG_LIVE_FILTER_S, live_filter);
+    params["live"]["address"] = live_address;
+    params["live"]["port"] = live_port.toInt();
+    params["live"]["filter"] = live_filter;
 
     return params;
 }
@@ -294,7 +329,7 @@ bool ConfigJSON::SetConfig(String const& json_string)
     // Note fixed size of document here.  Since the configuration string is typically of well-
     // known size, this shouldn't be too dangerous, but it's probably wise to review this if
     // you add anything into the payload.
-    DynamicJsonDocument params(1024);
+    DynamicJsonDocument params(2048);
     deserializeJson(params, json_string);
 
     if (!params.containsKey("version") || !params["version"].containsKey("commandproc")) {
@@ -318,6 +353,14 @@ bool ConfigJSON::SetConfig(String const& json_string)
                 LoggerConfig.SetConfigBinary(Config::CONFIG_WEBSERVER_B, params["enable"]["webserver"]);
             if (params["enable"].containsKey("upload"))
                 LoggerConfig.SetConfigBinary(Config::CONFIG_UPLOAD_B, params["enable"]["upload"]);
+            if (params["enable"].containsKey("metrics"))
+                LoggerConfig.SetConfigBinary(Config::CONFIG_METRICS_B, params["enable"]["metrics"]);
+            if (params["enable"].containsKey("compress"))
+                LoggerConfig.SetConfigBinary(Config::CONFIG_COMPRESS_B, params["enable"]["compress"]);
+            if (params["enable"].containsKey("live"))
+                LoggerConfig.SetConfigBinary(Config::CONFIG_LIVE_B, params["enable"]["live"]);
+            if (params["enable"].containsKey("bridgecoalesce"))
+                LoggerConfig.SetConfigBinary(Config::CONFIG_BRIDGE_COALESCE_B, params["enable"]["bridgecoalesce"]);
         }
         if (params.containsKey("wifi")) {
             if (params["wifi"].containsKey("mode"))
@@ -368,6 +411,18 @@ bool ConfigJSON::SetConfig(String const& json_string)
                 LoggerConfig.SetConfigString(Config::CONFIG_UPLOAD_INTERVAL_S, params["upload"]["interval"]);
             if (params["upload"].containsKey("duration"))
                 LoggerConfig.SetConfigString(Config::CONFIG_UPLOAD_DURATION_S, params["upload"]["duration"]);
+            if (params["upload"].containsKey("lifetime"))
+                LoggerConfig.SetConfigString(Config::CONFIG_UPLOAD_LIFETIME_S, params["upload"]["lifetime"]);
+            if (params["upload"].containsKey("order"))
+                LoggerConfig.SetConfigString(Config::CONFIG_UPLOAD_ORDER_S, params["upload"]["order"]);
+        }
+        if (params.containsKey("live")) {
+            if (params["live"].containsKey("address"))
+                LoggerConfig.SetConfigString(Config::CONFIG_LIVE_ADDRESS_S, params["live"]["address"]);
+            if (params["live"].containsKey("port"))
+                LoggerConfig.SetConfigString(Config::CONFIG_LIVE_PORT_S, params["live"]["port"]);
+            if (params["live"].containsKey("filter"))
+                LoggerConfig.SetConfigString(Config::CONFIG_LIVE_FILTER_S, params["live"]["filter"]);
         }
     } else {
         return false;
@@ -375,7 +430,7 @@ bool ConfigJSON::SetConfig(String const& json_string)
     return true;
 }
 
-static const char *stable_config = "{\"version\": {\"commandproc\": \"1.4.1\"}, \"enable\": {\"nmea0183\": true, \"nmea2000\": true, \"imu\": false, \"powermonitor\": false, \"sdmmc\": false, \"udpbridge\": false, \"webserver\": true, \"upload\": false}, \"wifi\": {\"mode\": \"AP\", \"address\": \"192.168.4.1\", \"station\": {\"delay\": 20, \"retries\": 5, \"timeout\": 5, \"mdns\": \"wibl\"}, \"ssids\": {\"ap\": \"wibl-config\", \"station\": \"wibl-logger\"}, \"passwords\": {\"ap\": \"wibl-config-password\", \"station\": \"wibl-logger-password\"}}, \"uniqueID\": \"TNODEID\", \"shipname\": \"Anonymous\", \"baudrate\": {\"port1\": 4800, \"port2\": 4800}, \"udpbridge\": 12345, \"upload\": {\"server\": \"192.168.4.2\", \"port\": 80, \"timeout\": 5.0, \"interval\": 1800.0, \"duration\": 10.0}}";
+static const char *stable_config = "{\"version\": {\"commandproc\": \"1.5.0\"}, \"enable\": {\"nmea0183\": true, \"nmea2000\": true, \"imu\": false, \"powermonitor\": false, \"sdmmc\": false, \"udpbridge\": false, \"webserver\": true, \"upload\": false}, \"wifi\": {\"mode\": \"AP\", \"address\": \"192.168.4.1\", \"station\": {\"delay\": 20, \"retries\": 5, \"timeout\": 5, \"mdns\": \"wibl\"}, \"ssids\": {\"ap\": \"wibl-config\", \"station\": \"wibl-logger\"}, \"passwords\": {\"ap\": \"wibl-config-password\", \"station\": \"wibl-logger-password\"}}, \"uniqueID\": \"TNODEID\", \"shipname\": \"Anonymous\", \"baudrate\": {\"port1\": 4800, \"port2\": 4800}, \"udpbridge\": 12345, \"upload\": {\"server\": \"192.168.4.2\", \"port\": 80, \"timeout\": 5.0, \"interval\": 1800.0, \"duration\": 10.0, \"lifetime\": 300.0, \"order\": \"oldest\"}, \"live\": {\"address\": \"255.255.255.255\", \"port\": 40182, \"filter\": \"\"}}";
 
 bool ConfigJSON::SetStableConfig(void)
 {
@@ -0,0 +1,224 @@
+/*! \file ConsoleBuffer.cpp
+ *  \brief Staging buffer for console log messages, with coalescing and rate limiting
+ *
+ * The console log is written by a number of sub-systems, some of which (e.g., the NMEA0183 assembler
+ * on a noisy or inverted input) can generate messages at a very high rate.  Rather than writing and
+ * flushing the console file for each message, messages are staged in RAM here and written in batches,
+ * with repeated messages coalesced into a count, and each source rate-limited so that one noisy
+ * source can't fill the buffer (or the card).
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ConsoleBuffer.h"
+
+namespace logger {
+
+/// Names for each of the console message sources, in enum order, for reporting
+static const char *source_names[ConsoleSourceCount] = {
+    "system", "nmea0183-1", "nmea0183-2", "nmea2000"
+};
+
+/// Compute the FNV-1a hash of a message, so that repeats can be recognised without keeping a copy
+/// of the last message.
+///
+/// \param text     Message text
+/// \param length   Length of the message (bytes)
+/// \return 32-bit hash of the message
+
+static uint32_t message_hash(const char *text, uint32_t length)
+{
+    uint32_t hash = 2166136261UL;
+    for (uint32_t n = 0; n < length; ++n) {
+        hash ^= static_cast<uint8_t>(text[n]);
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+/// Default constructor, allocating the ring buffer, and starting each source with a full bucket.  If the
+/// buffer can't be allocated, all messages are dropped (and counted).
+
+ConsoleBuffer::ConsoleBuffer(void)
+: m_head(0), m_tail(0), m_oldest(0), m_lastHash(0), m_lastSource(ConsoleSourceCount), m_repeats(0),
+  m_lost(0), m_written(0), m_coalesced(0), m_suppressed(0), m_dropped(0)
+{
+    m_buffer = static_cast<char*>(malloc(ConsoleBufferSize));
+    uint32_t now = millis();
+    for (int n = 0; n < ConsoleSourceCount; ++n) {
+        m_buckets[n].tokens = ConsoleBurst * 1000;
+        m_buckets[n].refilled = now;
+        m_buckets[n].suppressed = 0;
+    }
+}
+
+/// Default destructor.  Any messages still pending are lost, so the owner should \a Drain() first.
+
+ConsoleBuffer::~ConsoleBuffer(void)
+{
+    free(m_buffer);
+}
+
+/// Add a message to the buffer.  A repeat of the last message from the same source is only counted;
+/// otherwise, the message is stored (with a newline) if the source's rate limit allows it, preceded by
+/// a note of any messages from the source that were suppressed since it was last allowed one.
+///
+/// \param message  Text of the message (without newline)
+/// \param source   Sub-system generating the message
+
+void ConsoleBuffer::Add(String const& message, ConsoleSource source)
+{
+    uint32_t hash = message_hash(message.c_str(), message.length());
+    if (hash == m_lastHash && source == m_lastSource) {
+        if (m_repeats == 0 && pending() == 0) m_oldest = millis();
+        ++m_repeats;
+        ++m_coalesced;
+        return;
+    }
+    closeRepeats();
+    if (!allow(source)) {
+        ++m_buckets[source].suppressed;
+        ++m_suppressed;
+        return;
+    }
+    if (m_buckets[source].suppressed > 0) {
+        String note = String("WARN: ") + m_buckets[source].suppressed + " console messages from "
+                        + source_names[source] + " suppressed by rate limit.";
+        if (!append(note.c_str(), note.length())) ++m_lost;
+        m_buckets[source].suppressed = 0;
+    }
+    if (append(message.c_str(), message.length())) {
+        m_lastHash = hash;
+        m_lastSource = source;
+    } else {
+        ++m_lost;
+        ++m_dropped;
+    }
+}
+
+/// Determine whether the pending messages should be written to file now, either because enough data
+/// has built up to make a write efficient, or because the oldest message has waited long enough.
+///
+/// \return True if \a Drain() should be called, otherwise False
+
+bool ConsoleBuffer::Due(void) const
+{
+    uint32_t n = pending();
+    if (n >= ConsoleBatchSize) return true;
+    if (n == 0 && m_repeats == 0 && m_lost == 0) return false;
+    return millis() - m_oldest >= ConsoleBatchInterval;
+}
+
+/// Write all pending messages to the output (typically the console file), including the count for
+/// any repeats of the last message, and a note of any messages lost because the buffer was full.  The
+/// output is not flushed; that's up to the caller.
+///
+/// \param output   Stream on which to write the messages
+/// \return Number of bytes written
+
+size_t ConsoleBuffer::Drain(Stream& output)
+{
+    size_t written = 0;
+    closeRepeats();
+    while (pending() > 0) {
+        uint32_t n = (m_head > m_tail ? m_head : ConsoleBufferSize) - m_tail;
+        written += output.write(reinterpret_cast<const uint8_t*>(m_buffer + m_tail), n);
+        m_tail = (m_tail + n) % ConsoleBufferSize;
+    }
+    if (m_lost > 0) {
+        written += output.printf("WARN: %u console messages lost due to full buffer.\n", m_lost);
+        m_lost = 0;
+    }
+    m_written += written;
+    return written;
+}
+
+/// Add a line of text to the ring buffer, with a trailing newline, if there's space for all of it.
+///
+/// \param text     Text to add
+/// \param length   Length of the text (bytes)
+/// \return True if the text was added, otherwise False
+
+bool ConsoleBuffer::append(const char *text, uint32_t length)
+{
+    if (m_buffer == nullptr) return false;
+    uint32_t used = pending();
+    if (used + length + 1 > ConsoleBufferSize - 1) return false;
+    if (used == 0) m_oldest = millis();
+    for (uint32_t n = 0; n < length; ++n) {
+        m_buffer[m_head] = text[n];
+        m_head = (m_head + 1) % ConsoleBufferSize;
+    }
+    m_buffer[m_head] = '\n';
+    m_head = (m_head + 1) % ConsoleBufferSize;
+    return true;
+}
+
+/// Add the count of repeats of the last message to the buffer, if there have been any since the last
+/// time this was done.
+
+void ConsoleBuffer::closeRepeats(void)
+{
+    if (m_repeats == 0) return;
+    String note = String("INFO: last message repeated ") + m_repeats + " times.";
+    if (!append(note.c_str(), note.length())) ++m_lost;
+    m_repeats = 0;
+}
+
+/// Refill the source's token bucket for the time since it was last refilled, and then take a token
+/// for a message, if there's one available.  Tokens are kept in thousandths of a message so that the
+/// refill can be done in integer arithmetic with millisecond resolution.
+///
+/// \param source   Sub-system generating the message
+/// \return True if the message is allowed, otherwise False
+
+bool ConsoleBuffer::allow(ConsoleSource source)
+{
+    Bucket& bucket = m_buckets[source];
+    uint32_t now = millis();
+    uint32_t elapsed = now - bucket.refilled;
+    bucket.refilled = now;
+    if (elapsed > ConsoleBurst * 1000 / ConsoleRate) elapsed = ConsoleBurst * 1000 / ConsoleRate;
+    bucket.tokens += elapsed * ConsoleRate;
+    if (bucket.tokens > ConsoleBurst * 1000) bucket.tokens = ConsoleBurst * 1000;
+    if (bucket.tokens < 1000) return false;
+    bucket.tokens -= 1000;
+    return true;
+}
+
+/// Generate a JSON document with the buffer statistics: bytes pending, total bytes written to file,
+/// and the total number of messages coalesced as repeats, suppressed by rate limiting, and dropped
+/// because the buffer was full.
+///
+/// \return JSON document with the console buffer summary
+
+DynamicJsonDocument ConsoleBuffer::Render(void) const
+{
+    DynamicJsonDocument doc(256);
+    doc["pending"] = pending();
+    doc["written"] = m_written;
+    doc["coalesced"] = m_coalesced;
+    doc["suppressed"] = m_suppressed;
+    doc["dropped"] = m_dropped;
+    return doc;
+}
+
+}
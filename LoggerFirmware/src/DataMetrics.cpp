@@ -25,6 +25,7 @@
  * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include "soc/twai_struct.h"
 #include "DataMetrics.h"
 
 namespace logger {
@@ -129,9 +130,65 @@ int DataObs::Size(void) const
     return MaximumDataObsRender;
 }
 
+/// Default constructor for the rate window, with all slots empty.
+
+RateWindow::RateWindow(void)
+: m_current(0), m_next(0), m_filled(0)
+{
+    for (int n = 0; n < IngestWindow; ++n) m_slots[n] = 0;
+}
+
+/// Close the current one-second slot, and then add empty slots for any further seconds that have
+/// passed (e.g., if the sampling task was held up), up to the length of the window.
+///
+/// \param seconds Number of seconds since the window was last advanced
+
+void RateWindow::Advance(uint32_t seconds)
+{
+    if (seconds > IngestWindow) seconds = IngestWindow;
+    for (uint32_t n = 0; n < seconds; ++n) {
+        m_slots[m_next] = m_current;
+        m_current = 0;
+        m_next = (m_next + 1) % IngestWindow;
+        if (m_filled < IngestWindow) ++m_filled;
+    }
+}
+
+/// Compute the mean rate over the completed slots in the window.
+///
+/// \return Event rate (events/s), or zero if no slots have been completed
+
+double RateWindow::Rate(void) const
+{
+    if (m_filled == 0) return 0.0;
+    uint32_t total = 0;
+    for (int n = 0; n < m_filled; ++n) total += m_slots[n];
+    return static_cast<double>(total) / m_filled;
+}
+
 DataMetrics::DataMetrics(void)
 {
     m_supplyVoltage = -1.0;
+    m_nPGNs = 0;
+    m_otherPGNs = 0;
+    m_messages = 0;
+    m_frames = 0;
+    m_canOverruns = 0;
+    m_canErrors = 0;
+    m_canErrorLevel = 0;
+    m_canBusOffs = 0;
+    m_canBusOff = false;
+    m_rxErrorCount = 0;
+    m_txErrorCount = 0;
+    for (int n = 0; n < IngestChannels; ++n) {
+        m_channels[n].sentences = 0;
+        m_channels[n].checksum = 0;
+        m_channels[n].dropped = 0;
+        m_channels[n].overflows = 0;
+        m_channels[n].errors = 0;
+    }
+    m_writerDrops = 0;
+    m_lastSample = millis();
 }
 
 DataMetrics::~DataMetrics(void)
@@ -182,6 +239,171 @@ DynamicJsonDocument DataMetrics::LastKnownGood(void) const
     return summary;
 }
 
+/// Count an NMEA2000 message received, by PGN and in total.  The first \a MaxIngestPGNs PGNs seen are
+/// counted individually, and the rest together.  The number of CAN frames is estimated from the payload
+/// length: messages of up to eight bytes are single frames, and longer messages are assumed to be fast
+/// packets (six bytes in the first frame, and seven in each of the rest).
+///
+/// \param pgn     Parameter group number of the message
+/// \param length  Payload length (bytes)
+
+void DataMetrics::CountPGN(uint32_t pgn, uint32_t length)
+{
+    uint32_t frames = length <= 8 ? 1 : 1 + (length - 6 + 6) / 7;
+    ++m_messages;
+    m_frames += frames;
+    m_messageRate.Add(1);
+    m_frameRate.Add(frames);
+
+    for (int n = 0; n < m_nPGNs; ++n) {
+        if (m_pgns[n].pgn == pgn) {
+            ++m_pgns[n].count;
+            return;
+        }
+    }
+    if (m_nPGNs < MaxIngestPGNs) {
+        m_pgns[m_nPGNs].pgn = pgn;
+        m_pgns[m_nPGNs].count = 1;
+        ++m_nPGNs;
+    } else {
+        ++m_otherPGNs;
+    }
+}
+
+/// Count an NMEA0183 sentence assembled on a channel (whether or not it's subsequently logged).
+///
+/// \param channel NMEA0183 channel (1 or 2)
+
+void DataMetrics::CountSentence(int channel)
+{
+    if (channel < 1 || channel > IngestChannels) return;
+    ++m_channels[channel-1].sentences;
+    m_channels[channel-1].rate.Add(1);
+}
+
+/// Count an NMEA0183 sentence that failed validation (i.e., bad checksum, or malformed).
+///
+/// \param channel NMEA0183 channel (1 or 2)
+
+void DataMetrics::CountChecksumFailure(int channel)
+{
+    if (channel < 1 || channel > IngestChannels) return;
+    ++m_channels[channel-1].checksum;
+}
+
+/// Count an NMEA0183 sentence that was dropped because the assembler's ring buffer was full.
+///
+/// \param channel NMEA0183 channel (1 or 2)
+
+void DataMetrics::CountRingDrop(int channel)
+{
+    if (channel < 1 || channel > IngestChannels) return;
+    ++m_channels[channel-1].dropped;
+}
+
+/// Count a UART receive error.  This is called from the UART event task for the channel, rather than
+/// the main loop, but since each counter only has one writer, no locking is required.
+///
+/// \param channel     NMEA0183 channel (1 or 2)
+/// \param overflow    Flag: error was a FIFO or receive buffer overflow (i.e., data was lost)
+
+void DataMetrics::CountUARTError(int channel, bool overflow)
+{
+    if (channel < 1 || channel > IngestChannels) return;
+    if (overflow)
+        ++m_channels[channel-1].overflows;
+    else
+        ++m_channels[channel-1].errors;
+}
+
+/// Check the CAN controller's status for receive overruns and errors.  The NMEA2000 driver services the
+/// controller's interrupts itself (and therefore clears them), so the status is sampled instead: a
+/// data overrun is counted (and the overrun flag cleared) each time it's seen, increases in the receive
+/// and transmit error counters are accumulated as a lower bound on the number of error frames, and
+/// transitions into bus-off are counted.  This should be called at the CAN polling rate.
+
+void DataMetrics::SampleCAN(void)
+{
+    const uint32_t StatusOverrun = 0x02;    // SR.1: data overrun status
+    const uint32_t StatusBusOff = 0x80;     // SR.7: bus-off status
+    const uint32_t CommandClearOverrun = 0x08;  // CMR.3: clear data overrun
+
+    uint32_t status = TWAI.status_reg.val;
+    if (status & StatusOverrun) {
+        ++m_canOverruns;
+        TWAI.command_reg.val = CommandClearOverrun;
+    }
+    bool bus_off = (status & StatusBusOff) != 0;
+    if (bus_off && !m_canBusOff) ++m_canBusOffs;
+    m_canBusOff = bus_off;
+
+    m_rxErrorCount = TWAI.rx_error_counter_reg.val & 0xFF;
+    m_txErrorCount = TWAI.tx_error_counter_reg.val & 0xFF;
+    uint32_t level = m_rxErrorCount + m_txErrorCount;
+    if (level > m_canErrorLevel) m_canErrors += level - m_canErrorLevel;
+    m_canErrorLevel = level;
+}
+
+/// Advance the rate windows by the number of whole seconds since they were last advanced.  This
+/// should be called at least once a second.
+
+void DataMetrics::Sample(void)
+{
+    uint32_t now = millis();
+    uint32_t seconds = (now - m_lastSample) / 1000;
+    if (seconds == 0) return;
+    m_lastSample += seconds * 1000;
+    m_messageRate.Advance(seconds);
+    m_frameRate.Advance(seconds);
+    for (int n = 0; n < IngestChannels; ++n) m_channels[n].rate.Advance(seconds);
+}
+
+/// Generate a JSON document with the ingest counters.  For NMEA2000, this has the message and estimated
+/// frame counts and rates, the estimated bus load (%, from the frame rate), the CAN controller overruns,
+/// error counter increases, current error counters and bus-off transitions, and the message count for
+/// each PGN.  For each NMEA0183 channel, it has the sentence count and rate, and the number of sentences
+/// failing validation, dropped from the assembler ring, and lost to UART overflow (along with other UART
+/// errors).  Rates are over the last "window" seconds.
+///
+/// \return JSON document with the ingest summary
+
+DynamicJsonDocument DataMetrics::Ingest(void) const
+{
+    DynamicJsonDocument doc(1024 + 48*m_nPGNs);
+    double frame_rate = m_frameRate.Rate();
+
+    doc["window"] = IngestWindow;
+    JsonObject n2k = doc.createNestedObject("nmea2000");
+    n2k["messages"] = m_messages;
+    n2k["frames"] = m_frames;
+    n2k["rate"] = m_messageRate.Rate();
+    n2k["framerate"] = frame_rate;
+    n2k["load"] = 100.0 * frame_rate * CANFrameBits / CANBitRate;
+    n2k["overruns"] = m_canOverruns;
+    n2k["errors"] = m_canErrors;
+    n2k["rxerr"] = m_rxErrorCount;
+    n2k["txerr"] = m_txErrorCount;
+    n2k["busoff"] = m_canBusOffs;
+    JsonObject pgns = n2k.createNestedObject("pgns");
+    for (int n = 0; n < m_nPGNs; ++n) {
+        pgns[String(m_pgns[n].pgn)] = m_pgns[n].count;
+    }
+    if (m_otherPGNs > 0) pgns["other"] = m_otherPGNs;
+
+    JsonArray channels = doc.createNestedArray("nmea0183");
+    for (int n = 0; n < IngestChannels; ++n) {
+        JsonObject channel = channels.createNestedObject();
+        channel["sentences"] = m_channels[n].sentences;
+        channel["rate"] = m_channels[n].rate.Rate();
+        channel["checksum"] = m_channels[n].checksum;
+        channel["dropped"] = m_channels[n].dropped;
+        channel["overflows"] = static_cast<uint32_t>(m_channels[n].overflows);
+        channel["errors"] = static_cast<uint32_t>(m_channels[n].errors);
+    }
+    doc["writer"]["dropped"] = m_writerDrops;
+    return doc;
+}
+
 DataMetrics Metrics;
 
 };
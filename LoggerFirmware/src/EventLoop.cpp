@@ -0,0 +1,216 @@
+/*! \file EventLoop.cpp
+ *  \brief Event notification for the main processing loop of the logger
+ *
+ * Rather than having the main loop of the logger poll every sub-system on every pass (which keeps
+ * the processor at 100% doing nothing useful), this module allows the sources of work for the logger
+ * (serial data, IMU interrupts, command input, and periodic timers) to post notifications to the
+ * loop task, which then blocks until there's something to do.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "esp_timer.h"
+#include "EventLoop.h"
+
+namespace logger {
+
+/// Names for each of the event sources, in bit order, for reporting
+static const char *source_names[EventSourceCount] = {
+    "can", "uart", "imu", "serial", "service", "supply", "resume"
+};
+
+/// Default constructor for the event loop.  This only sets up the book-keeping; the loop task
+/// isn't known until \a Begin() is called from it.
+
+EventLoop::EventLoop(void)
+: m_loopTask(nullptr), m_canTimer(nullptr), m_serviceTimer(nullptr), m_supplyTimer(nullptr),
+  m_wakeups(0), m_idleTime(0), m_startTime(0)
+{
+    for (int i = 0; i < EventSourceCount; ++i) {
+        m_postTime[i] = 0;
+        m_maxLatency[i] = 0;
+    }
+}
+
+/// Default destructor for the event loop, stopping and removing any timers that were set up.
+
+EventLoop::~EventLoop(void)
+{
+    if (m_canTimer != nullptr) xTimerDelete(m_canTimer, 0);
+    if (m_serviceTimer != nullptr) xTimerDelete(m_serviceTimer, 0);
+    if (m_supplyTimer != nullptr) xTimerDelete(m_supplyTimer, 0);
+}
+
+/// Register the calling task as the one that runs the main loop (i.e., the one that will be notified
+/// when events are posted), and then start the periodic timers for the sources that can't generate
+/// their own notifications.  This must be called from the loop task (i.e., from setup()).
+///
+/// \return True if the timers were started, otherwise False
+
+bool EventLoop::Begin(void)
+{
+    m_loopTask = xTaskGetCurrentTaskHandle();
+    m_startTime = esp_timer_get_time();
+
+    m_canTimer = xTimerCreate("evt-can", pdMS_TO_TICKS(CANPollPeriod), pdTRUE,
+                              reinterpret_cast<void*>(EVT_CAN_RX), timerCallback);
+    m_serviceTimer = xTimerCreate("evt-service", pdMS_TO_TICKS(ServicePeriod), pdTRUE,
+                              reinterpret_cast<void*>(EVT_SERVICE), timerCallback);
+    m_supplyTimer = xTimerCreate("evt-supply", pdMS_TO_TICKS(SupplyPollPeriod), pdTRUE,
+                              reinterpret_cast<void*>(EVT_SUPPLY), timerCallback);
+    if (m_canTimer == nullptr || m_serviceTimer == nullptr || m_supplyTimer == nullptr) {
+        Serial.println("ERR: failed to create event loop timers.");
+        return false;
+    }
+    if (xTimerStart(m_canTimer, 0) != pdPASS ||
+        xTimerStart(m_serviceTimer, 0) != pdPASS ||
+        xTimerStart(m_supplyTimer, 0) != pdPASS) {
+        Serial.println("ERR: failed to start event loop timers.");
+        return false;
+    }
+    return true;
+}
+
+/// Record the time of the first post (since the loop last serviced it) for each source in the event
+/// set, so that the latency to wake-up can be computed.  Zero is used as the "not posted" marker, so
+/// a timestamp that happens to be zero is nudged by a microsecond.
+///
+/// \param events   Bit-set of \a EventSource flags being posted
+
+void IRAM_ATTR EventLoop::markPosted(uint32_t events)
+{
+    uint32_t now = static_cast<uint32_t>(esp_timer_get_time());
+    if (now == 0) now = 1;
+    for (int i = 0; i < EventSourceCount; ++i) {
+        if ((events & (1 << i)) && m_postTime[i] == 0)
+            m_postTime[i] = now;
+    }
+}
+
+/// Post one or more events to the loop task from task context (including FreeRTOS timer callbacks
+/// and the serial event tasks).  Events posted before \a Begin() is called are ignored.
+///
+/// \param events   Bit-set of \a EventSource flags to post
+
+void EventLoop::Post(uint32_t events)
+{
+    if (m_loopTask == nullptr) return;
+    markPosted(events);
+    xTaskNotify(m_loopTask, events, eSetBits);
+}
+
+/// Post one or more events to the loop task from an interrupt service routine, requesting a context
+/// switch on exit from the interrupt if the loop task is now of higher priority than the task that
+/// was interrupted.
+///
+/// \param events   Bit-set of \a EventSource flags to post
+
+void IRAM_ATTR EventLoop::PostFromISR(uint32_t events)
+{
+    if (m_loopTask == nullptr) return;
+    BaseType_t woken = pdFALSE;
+    markPosted(events);
+    xTaskNotifyFromISR(m_loopTask, events, eSetBits, &woken);
+    if (woken == pdTRUE) portYIELD_FROM_ISR();
+}
+
+/// Block the calling (loop) task until at least one event has been posted, and then return the set of
+/// events that are pending (clearing them).  The time spent blocked is accumulated as idle time, and the
+/// latency from first post to wake-up is tracked for each source.  Since the housekeeping timer is
+/// always running, the wait is indefinite.
+///
+/// \return Bit-set of \a EventSource flags that are pending
+
+uint32_t EventLoop::Wait(void)
+{
+    uint32_t events = 0;
+    uint64_t start = esp_timer_get_time();
+    xTaskNotifyWait(0, ULONG_MAX, &events, portMAX_DELAY);
+    uint64_t end = esp_timer_get_time();
+    m_idleTime += end - start;
+    ++m_wakeups;
+    markServiced(events, static_cast<uint32_t>(end));
+    return events;
+}
+
+/// Check for events that have been posted since the loop last woke, without blocking.  This allows
+/// the scheduler to pick up higher-priority work that arrives while it is working through lower-priority
+/// tasks.
+///
+/// \return Bit-set of \a EventSource flags that are pending (possibly zero)
+
+uint32_t EventLoop::Poll(void)
+{
+    uint32_t events = 0;
+    if (xTaskNotifyWait(0, ULONG_MAX, &events, 0) == pdTRUE) {
+        markServiced(events, static_cast<uint32_t>(esp_timer_get_time()));
+    }
+    return events;
+}
+
+/// Update the worst-case latency from first post to service for each source in the event set, and
+/// reset the post time markers for those sources.
+///
+/// \param events  Bit-set of \a EventSource flags being serviced
+/// \param now     Current time (us)
+
+void EventLoop::markServiced(uint32_t events, uint32_t now)
+{
+    for (int i = 0; i < EventSourceCount; ++i) {
+        if ((events & (1 << i)) && m_postTime[i] != 0) {
+            uint32_t latency = now - m_postTime[i];
+            if (latency > m_maxLatency[i]) m_maxLatency[i] = latency;
+            m_postTime[i] = 0;
+        }
+    }
+}
+
+/// Generate a JSON document that summarises the performance of the event loop: the number of times
+/// that the loop has been woken, the percentage of time that it has been idle (i.e., blocked waiting for
+/// events), and the worst-case latency (in microseconds) between an event being posted for each source
+/// and the loop waking up to service it.
+///
+/// \return JSON document with the event loop summary
+
+DynamicJsonDocument EventLoop::Render(void) const
+{
+    DynamicJsonDocument doc(512);
+    uint64_t elapsed = esp_timer_get_time() - m_startTime;
+    doc["wakeups"] = m_wakeups;
+    doc["idle"] = elapsed > 0 ? 100.0 * m_idleTime / elapsed : 0.0;
+    for (int i = 0; i < EventSourceCount; ++i) {
+        doc["latency"][source_names[i]] = m_maxLatency[i];
+    }
+    return doc;
+}
+
+/// Callback for the periodic timers, which posts the event stored as the timer's ID to the loop.
+/// This runs in the FreeRTOS timer service task, and therefore can use the task-context post.
+///
+/// \param timer    Handle for the timer that expired
+
+void EventLoop::timerCallback(TimerHandle_t timer)
+{
+    uint32_t event = reinterpret_cast<uint32_t>(pvTimerGetTimerID(timer));
+    Events.Post(event);
+}
+
+EventLoop Events;   ///< Static parameter to use for the main loop event notification
+
+}
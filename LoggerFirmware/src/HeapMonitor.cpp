@@ -25,6 +25,8 @@
  * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <string.h>
+#include "esp_heap_caps.h"
 #include "HeapMonitor.h"
 
 namespace logger {
@@ -96,4 +98,184 @@ void HeapMonitor::FlashMemoryReport(Stream& s)
         flash_size, flash_speed, static_cast<uint32_t>(flash_mode));
 }
 
-}
\ No newline at end of file
+/// Default constructor for the heap tracker.  Scopes are ignored until \a Begin() is called.
+
+HeapTracker::HeapTracker(void)
+: m_owner(nullptr), m_nTags(0), m_rejectedTags(0), m_depth(0), m_historyNext(0), m_historyCount(0),
+  m_worstFragmentation(0.0), m_lastSample(0), m_startTime(0)
+{
+}
+
+/// Register the calling task as the one whose tagged scopes are tracked.  This should be called from
+/// setup(), so that the main loop task is used.
+
+void HeapTracker::Begin(void)
+{
+    m_owner = xTaskGetCurrentTaskHandle();
+    m_startTime = millis();
+    m_lastSample = m_startTime;
+}
+
+/// Register a named tag with the tracker, or find the index of a tag that's already registered with
+/// the same name.
+///
+/// \param name Name for the tag (must be a static string, since only the pointer is stored)
+/// \return Index for the tag, or -1 if there are no more tags available (the scope is then untracked,
+///         and the refusal is counted in the report, so that \a MaxHeapTags can be raised)
+
+int HeapTracker::Tag(const char *name)
+{
+    for (int n = 0; n < m_nTags; ++n) {
+        if (strcmp(m_tags[n].name, name) == 0) return n;
+    }
+    if (m_nTags == MaxHeapTags) {
+        Serial.printf("ERR: no more heap tags available for \"%s\" (maximum %d).\n", name, MaxHeapTags);
+        ++m_rejectedTags;
+        return -1;
+    }
+    TagStats& t = m_tags[m_nTags];
+    t.name = name;
+    t.live = 0;
+    t.peak = 0;
+    t.allocated = 0;
+    t.scopes = 0;
+    return m_nTags++;
+}
+
+/// Determine whether the calling task is the one whose scopes are being tracked.
+///
+/// \return True if scopes should be tracked, otherwise False
+
+bool HeapTracker::tracking(void) const
+{
+    return m_owner != nullptr && xTaskGetCurrentTaskHandle() == m_owner;
+}
+
+/// Start a tagged scope, recording the current free heap.  Scopes can be nested, in which case the
+/// change in the inner scope is charged to its own tag, and not to the outer scope's.
+///
+/// \param tag  Index of the tag to charge (as returned by \a Tag())
+
+void HeapTracker::Push(int tag)
+{
+    if (!tracking()) return;
+    if (m_depth < MaxHeapScopeDepth) {
+        Scope& s = m_stack[m_depth];
+        s.tag = tag;
+        s.startFree = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+        s.nested = 0;
+    }
+    ++m_depth;
+}
+
+/// End the most recent tagged scope, charging the change in free heap across the scope (less any
+/// change already charged to nested scopes) to the scope's tag.
+
+void HeapTracker::Pop(void)
+{
+    if (!tracking() || m_depth == 0) return;
+    --m_depth;
+    if (m_depth >= MaxHeapScopeDepth) return;
+
+    Scope& s = m_stack[m_depth];
+    int32_t used = static_cast<int32_t>(s.startFree) -
+                   static_cast<int32_t>(heap_caps_get_free_size(MALLOC_CAP_8BIT));
+    if (m_depth > 0) m_stack[m_depth-1].nested += used;
+    used -= s.nested;
+
+    if (s.tag < 0 || s.tag >= m_nTags) return;
+    TagStats& t = m_tags[s.tag];
+    t.live += used;
+    if (t.live > t.peak) t.peak = t.live;
+    if (used > 0) t.allocated += used;
+    ++t.scopes;
+}
+
+/// Compute the fragmentation index for the heap, defined as one minus the ratio of the largest free
+/// block to the total free space.  With no fragmentation, all of the free space is in one block and
+/// the index is zero; as the free space is broken up, the index approaches one.
+///
+/// \return Fragmentation index in [0, 1]
+
+double HeapTracker::Fragmentation(void)
+{
+    size_t free_bytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    if (free_bytes == 0) return 1.0;
+    return 1.0 - static_cast<double>(largest)/free_bytes;
+}
+
+/// Record a sample of the fragmentation index into the history, if the sample period has expired since
+/// the last sample.  Finding the largest free block requires a walk of the heap, so this shouldn't be
+/// done too often; the call is cheap if it's not time for a sample yet.
+
+void HeapTracker::Sample(void)
+{
+    unsigned long now = millis();
+    if ((now - m_lastSample) < HeapSamplePeriod) return;
+    m_lastSample = now;
+
+    double frag = Fragmentation();
+    if (frag > m_worstFragmentation) m_worstFragmentation = frag;
+    m_history[m_historyNext] = static_cast<uint8_t>(100.0*frag + 0.5);
+    m_historyNext = (m_historyNext + 1) % HeapHistoryLength;
+    if (m_historyCount < HeapHistoryLength) ++m_historyCount;
+}
+
+/// Generate a JSON document with the current state of the heap (size, free, low-water, largest block),
+/// the current and worst fragmentation index, the history of fragmentation samples (percent, oldest
+/// first), and the usage attributed to each tag: live and peak bytes, total bytes allocated, and the
+/// average allocation rate (bytes/s) since tracking started.  If any tags were refused because the
+/// table was full, the number refused is reported as "rejected".
+///
+/// \return JSON document with the heap summary
+
+DynamicJsonDocument HeapTracker::Render(void) const
+{
+    DynamicJsonDocument doc(512 + HeapHistoryLength*8 + 128*m_nTags);
+    HeapMonitor heap;
+    double elapsed = (millis() - m_startTime)/1000.0;
+
+    doc["total"] = heap.HeapSize();
+    doc["free"] = heap.CurrentSize();
+    doc["lowwater"] = heap.LowWater();
+    doc["largest"] = heap.LargestBlock();
+    doc["fragmentation"]["current"] = Fragmentation();
+    doc["fragmentation"]["worst"] = m_worstFragmentation;
+    doc["fragmentation"]["period"] = HeapSamplePeriod/1000;
+    JsonArray history = doc["fragmentation"].createNestedArray("history");
+    int start = (m_historyNext - m_historyCount + HeapHistoryLength) % HeapHistoryLength;
+    for (int n = 0; n < m_historyCount; ++n) {
+        history.add(m_history[(start + n) % HeapHistoryLength]);
+    }
+    if (m_rejectedTags > 0) doc["rejected"] = m_rejectedTags;
+    for (int n = 0; n < m_nTags; ++n) {
+        JsonObject tag = doc["tags"].createNestedObject(m_tags[n].name);
+        tag["live"] = m_tags[n].live;
+        tag["peak"] = m_tags[n].peak;
+        tag["allocated"] = m_tags[n].allocated;
+        tag["rate"] = elapsed > 0.0 ? m_tags[n].allocated / elapsed : 0.0;
+    }
+    return doc;
+}
+
+/// Start a tagged scope for the lifetime of the object, so that early returns don't unbalance the
+/// scope stack.
+///
+/// \param tag  Index of the tag to charge (as returned by \a HeapTracker::Tag())
+
+HeapScope::HeapScope(int tag)
+{
+    HeapTags.Push(tag);
+}
+
+/// End the tagged scope started at construction.
+
+HeapScope::~HeapScope(void)
+{
+    HeapTags.Pop();
+}
+
+HeapTracker HeapTags;   ///< Static parameter to use for heap attribution
+
+}
@@ -29,6 +29,8 @@
 #include "LSM6DSL.h"
 #include "NVMFile.h"
 #include "IMULogger.h"
+#include "EventLoop.h"
+#include "Trace.h"
 
 namespace imu {
 
@@ -98,11 +100,12 @@ volatile bool imu_data_ready = false;
 
 /// Interrupt service routine for the IMU interrupt, indicating that data is ready at the IMU
 /// for reading.  This indicates that the data is ready by setting a global variable that the
-/// logger can read.
+/// logger can read, and then wakes the main loop so that the data is transferred promptly.
 
 void IRAM_ATTR IMUDataReady()
 {
     imu_data_ready = true;
+    logger::Events.PostFromISR(logger::EVT_IMU_DRDY);
 }
 
 /// Standard constructor for the IMU logger, with output to the specified log manager.
@@ -206,6 +209,7 @@ void Logger::TransferData(void)
         if (m_sensor->readFullData(reading) != IMU_SUCCESS) {
             Serial.print("ERR: failed to read from IMU system ... needs investigation.\n");
         } else {
+            logger::Tracer.Emit(logger::TRACE_PACKET_RX, logger::TRACE_SRC_IMU);
             Serialisable buffer(7*sizeof(int16_t) + sizeof(unsigned long));
             buffer += static_cast<uint32_t>(now);
             for (uint32_t i = 0; i < 7; ++i)
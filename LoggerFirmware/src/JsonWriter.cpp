@@ -0,0 +1,250 @@
+/*! \file JsonWriter.cpp
+ *  \brief Streaming JSON output in bounded memory
+ *
+ * Status reports and file lists can get large when there are many log files on the logger, and
+ * building them as a JSON document (and then serialising that to a string) needs several large
+ * contiguous blocks of heap.  This module provides a writer that emits the JSON incrementally,
+ * through a small fixed buffer, to any Arduino Print target (serial, a chunked HTTP response, or a
+ * file), so that the memory required is independent of the size of the output.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "JsonWriter.h"
+
+namespace logger {
+
+/// Constructor for the writer.  Nothing is written to the target until the buffer fills, or the writer
+/// is flushed (or destroyed).
+///
+/// \param output   Print target for the JSON output
+/// \param pretty   Flag: True => indent the output as serializeJsonPretty() would
+
+JsonWriter::JsonWriter(Print& output, bool pretty)
+: m_output(output), m_pretty(pretty), m_embedded(false), m_used(0), m_total(0), m_depth(0), m_empty(1)
+{
+}
+
+/// Default destructor, which writes any remaining buffered output to the target.
+
+JsonWriter::~JsonWriter(void)
+{
+    Flush();
+}
+
+/// Write any buffered output to the target.
+
+void JsonWriter::Flush(void)
+{
+    if (m_used > 0) {
+        m_output.write(reinterpret_cast<const uint8_t*>(m_buffer), m_used);
+        m_used = 0;
+    }
+}
+
+/// Add a single character to the output buffer, writing the buffer to the target if it's full.
+///
+/// \param c    Character to add
+
+void JsonWriter::put(char c)
+{
+    if (m_used == JsonWriterBufferSize) Flush();
+    m_buffer[m_used++] = c;
+    ++m_total;
+}
+
+/// Add a string to the output buffer, with surrounding quotes, and with the same escapes as ArduinoJson
+/// uses (i.e., quote, backslash, and control characters).
+///
+/// \param s    Zero-terminated string to add
+
+void JsonWriter::quoted(const char *s)
+{
+    static const char *hex = "0123456789abcdef";
+    put('"');
+    for (; *s != '\0'; ++s) {
+        char c = *s;
+        switch (c) {
+            case '"':  put('\\'); put('"'); break;
+            case '\\': put('\\'); put('\\'); break;
+            case '\b': put('\\'); put('b'); break;
+            case '\f': put('\\'); put('f'); break;
+            case '\n': put('\\'); put('n'); break;
+            case '\r': put('\\'); put('r'); break;
+            case '\t': put('\\'); put('t'); break;
+            default:
+                if (static_cast<uint8_t>(c) < 0x20) {
+                    put('\\'); put('u'); put('0'); put('0');
+                    put(hex[(c >> 4) & 0x0F]);
+                    put(hex[c & 0x0F]);
+                } else {
+                    put(c);
+                }
+                break;
+        }
+    }
+    put('"');
+}
+
+/// Add a newline, and indentation for the current depth, if the output is being pretty-printed.
+
+void JsonWriter::newline(void)
+{
+    if (!m_pretty) return;
+    put('\n');
+    for (int n = 0; n < m_depth; ++n) {
+        put(' '); put(' ');
+    }
+}
+
+/// Start a new member of the current object or array, adding the separator from the previous member
+/// (if any), indentation, and the key (if any).
+///
+/// \param key  Key for the member in an object, or nullptr in an array (or at top level)
+
+void JsonWriter::member(const char *key)
+{
+    if (m_depth > 0) {
+        uint32_t bit = 1U << m_depth;
+        if (m_empty & bit)
+            m_empty &= ~bit;
+        else
+            put(',');
+        newline();
+    }
+    if (key != nullptr) {
+        quoted(key);
+        put(':');
+        if (m_pretty) put(' ');
+    }
+}
+
+/// Open an object or array as a new member of the current container.
+///
+/// \param key  Key for the member in an object, or nullptr in an array (or at top level)
+/// \param c    Opening character for the container
+
+void JsonWriter::open(const char *key, char c)
+{
+    member(key);
+    put(c);
+    if (m_depth == JsonWriterMaxDepth - 1) {
+        Serial.println("ERR: JSON writer nesting is too deep; output will be malformed.");
+        return;
+    }
+    ++m_depth;
+    m_empty |= 1U << m_depth;
+}
+
+/// Close the current object or array.  Empty containers are closed on the same line.
+///
+/// \param c    Closing character for the container
+
+void JsonWriter::close(char c)
+{
+    if (m_depth == 0) return;
+    bool empty = (m_empty & (1U << m_depth)) != 0;
+    --m_depth;
+    if (!empty) newline();
+    put(c);
+}
+
+/// Open an object, as a member of the enclosing object (with key), or array (without key).
+///
+/// \param key  Key for the object in the enclosing object, or nullptr
+
+void JsonWriter::BeginObject(const char *key) { open(key, '{'); }
+
+/// Close the innermost open object.
+
+void JsonWriter::EndObject(void) { close('}'); }
+
+/// Open an array, as a member of the enclosing object (with key), or array (without key).
+///
+/// \param key  Key for the array in the enclosing object, or nullptr
+
+void JsonWriter::BeginArray(const char *key) { open(key, '['); }
+
+/// Close the innermost open array.
+
+void JsonWriter::EndArray(void) { close(']'); }
+
+/// Add a string value as a member of the current object or array.  A null string is written as JSON null.
+///
+/// \param key      Key for the value in an object, or nullptr in an array
+/// \param value    Zero-terminated string to add
+
+void JsonWriter::Value(const char *key, const char *value)
+{
+    member(key);
+    if (value == nullptr) {
+        put('n'); put('u'); put('l'); put('l');
+    } else {
+        quoted(value);
+    }
+}
+
+/// Add an existing JSON document (or element of one) as a member of the current object or array.  The
+/// document is serialised through the writer, so it isn't converted to a string first; when pretty-printing,
+/// the document's lines are indented to the current depth.  This is intended for the small, fixed-size
+/// documents generated by the various metrics modules.
+///
+/// \param key  Key for the document in an object, or nullptr in an array
+/// \param doc  JSON document to add
+
+void JsonWriter::Document(const char *key, JsonVariantConst doc)
+{
+    member(key);
+    m_embedded = true;
+    if (m_pretty)
+        serializeJsonPretty(doc, *this);
+    else
+        serializeJson(doc, *this);
+    m_embedded = false;
+}
+
+/// Write a single character through the writer.  While serialising an embedded document with pretty-printing,
+/// newlines are followed by indentation for the current depth.
+///
+/// \param c    Character to write
+/// \return Number of characters written (always 1)
+
+size_t JsonWriter::write(uint8_t c)
+{
+    if (m_embedded && c == '\n') {
+        newline();
+    } else {
+        put(static_cast<char>(c));
+    }
+    return 1;
+}
+
+/// Write a block of characters through the writer.
+///
+/// \param buffer   Characters to write
+/// \param size     Number of characters to write
+/// \return Number of characters written
+
+size_t JsonWriter::write(const uint8_t *buffer, size_t size)
+{
+    for (size_t n = 0; n < size; ++n) write(buffer[n]);
+    return size;
+}
+
+}
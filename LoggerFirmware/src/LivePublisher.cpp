@@ -0,0 +1,231 @@
+/*! \file LivePublisher.cpp
+ *  \brief Publish the live data stream from the logger over UDP
+ *
+ * Applications on the same network as the logger (chart plotters, QA dashboards, etc.) often want
+ * to see the data as it arrives, rather than waiting for the log files.  This module takes a copy of
+ * each packet as it's written to the log file, batches them into UDP datagrams with a sequence number
+ * (so that receivers can detect loss), and sends them to a broadcast or multicast address from a
+ * background task.  The packets have the same format as in the log files, so the same readers apply.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "LivePublisher.h"
+#include "Configuration.h"
+
+namespace net {
+
+const uint32_t HeaderSize = 12;     ///< Size (bytes) of the header at the start of each datagram
+const uint32_t PacketOverhead = 8;  ///< Size (bytes) of the ID and length before each packet's data
+
+/// Default constructor for the live data counts.
+
+LiveMetrics::LiveMetrics(void)
+: packets(0), filtered(0), dropped(0), oversize(0), datagrams(0), failures(0), bytes(0)
+{
+}
+
+/// Generate a JSON document with the live data counts: packets sent, filtered out, dropped because the
+/// network couldn't keep up, and too big to send; and datagrams and bytes sent, and datagrams that failed.
+///
+/// \return JSON document with the live data summary
+
+DynamicJsonDocument LiveMetrics::Render(void) const
+{
+    DynamicJsonDocument doc(256);
+    doc["packets"] = packets;
+    doc["filtered"] = filtered;
+    doc["dropped"] = dropped;
+    doc["oversize"] = oversize;
+    doc["datagrams"] = datagrams;
+    doc["failures"] = failures;
+    doc["bytes"] = bytes;
+    return doc;
+}
+
+LiveMetrics LiveStats;  ///< Static parameter for live data statistics
+
+/// Constructor for the live data publisher.  This reads the address, port, and packet filter from the
+/// configuration (defaulting to broadcast on \a DefaultLivePort, with everything sent), and allocates the
+/// datagram buffers; the task and queues are made in \a Begin().
+
+LivePublisher::LivePublisher(void)
+: m_address(255, 255, 255, 255), m_port(DefaultLivePort), m_filter(0), m_buffers(nullptr), m_staging(nullptr),
+  m_stagedAt(0), m_sequence(0), m_free(nullptr), m_ready(nullptr), m_task(nullptr)
+{
+    String address, port, filter;
+    logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_LIVE_ADDRESS_S, address);
+    logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_LIVE_PORT_S, port);
+    logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_LIVE_FILTER_S, filter);
+    if (!address.isEmpty() && !m_address.fromString(address)) {
+        Serial.printf("ERR: live data address |%s| is not valid; using broadcast.\n", address.c_str());
+        m_address = IPAddress(255, 255, 255, 255);
+    }
+    if (port.toInt() > 0) m_port = port.toInt();
+    m_filter = ParseFilter(filter);
+    m_buffers = new Datagram[LiveBufferCount];
+}
+
+/// Default destructor for the live data publisher.  This stops the background task, and releases the
+/// queues and buffers (anything not sent is lost).
+
+LivePublisher::~LivePublisher(void)
+{
+    if (m_task != nullptr) vTaskDelete(m_task);
+    if (m_free != nullptr) vQueueDelete(m_free);
+    if (m_ready != nullptr) vQueueDelete(m_ready);
+    delete[] m_buffers;
+}
+
+/// Make the queues for the datagram buffers, put all of the buffers into the free pool, and start the
+/// background task, which runs at just above idle priority on the core that the main loop isn't using.
+///
+/// \return True if the task was started, otherwise False
+
+bool LivePublisher::Begin(void)
+{
+    m_free = xQueueCreate(LiveBufferCount, sizeof(Datagram*));
+    m_ready = xQueueCreate(LiveBufferCount, sizeof(Datagram*));
+    if (m_free == nullptr || m_ready == nullptr) {
+        Serial.println("ERR: failed to create live data queues.");
+        return false;
+    }
+    for (int n = 0; n < LiveBufferCount; ++n) {
+        Datagram *buffer = m_buffers + n;
+        xQueueSend(m_free, &buffer, 0);
+    }
+    if (xTaskCreatePinnedToCore(worker, "live", LiveStackSize, this, tskIDLE_PRIORITY + 1,
+                                &m_task, LiveCore) != pdPASS) {
+        Serial.println("ERR: failed to start live data task.");
+        m_task = nullptr;
+        return false;
+    }
+    Serial.printf("INFO: live data stream to %s:%u.\n", m_address.toString().c_str(), m_port);
+    return true;
+}
+
+/// Add a packet into the live data stream, if it passes the filter.  This never blocks: if there's no room
+/// in the datagram being filled, it's passed to the sending task and a new one started; if there are no free
+/// buffers (i.e., the network isn't keeping up), the packet is dropped.
+///
+/// \param pktID    ID number for the packet
+/// \param data     Serialised data for the packet
+
+void LivePublisher::Publish(uint32_t pktID, Serialisable const& data)
+{
+    if (m_task == nullptr) return;
+    if (m_filter != 0 && (pktID >= 32 || (m_filter & (1UL << pktID)) == 0)) {
+        ++LiveStats.filtered;
+        return;
+    }
+    uint32_t size = PacketOverhead + data.Length();
+    if (size > LiveDatagramSize - HeaderSize) {
+        ++LiveStats.oversize;
+        return;
+    }
+    if (m_staging != nullptr && m_staging->length + size > LiveDatagramSize) flush();
+    if (m_staging == nullptr) {
+        if (xQueueReceive(m_free, &m_staging, 0) != pdTRUE) {
+            m_staging = nullptr;
+            ++LiveStats.dropped;
+            return;
+        }
+        m_staging->count = 0;
+        m_staging->length = HeaderSize;
+        m_stagedAt = millis();
+    }
+    uint32_t length = data.Length();
+    uint8_t *p = m_staging->data + m_staging->length;
+    memcpy(p, &pktID, sizeof(uint32_t));
+    memcpy(p + sizeof(uint32_t), &length, sizeof(uint32_t));
+    memcpy(p + PacketOverhead, data.Data(), length);
+    m_staging->length += size;
+    ++m_staging->count;
+    ++LiveStats.packets;
+}
+
+/// Send the datagram being filled if its first packet has been waiting for longer than \a LiveFlushInterval,
+/// so that the latency of the stream is bounded when data is arriving slowly.  This should be called from
+/// the main loop, which is the only thing that fills datagrams.
+
+void LivePublisher::Service(void)
+{
+    if (m_staging != nullptr && (millis() - m_stagedAt) >= LiveFlushInterval) flush();
+}
+
+/// Convert a list of packet IDs (separated by commas) into a bit mask for the filter.  IDs outside of the
+/// range 1--31 are ignored; an empty list gives a zero mask, which sends everything.
+///
+/// \param filter   Comma-separated list of packet IDs
+/// \return Bit mask with a bit set for each packet ID in the list
+
+uint32_t LivePublisher::ParseFilter(String const& filter)
+{
+    uint32_t mask = 0;
+    int start = 0;
+    while (start < static_cast<int>(filter.length())) {
+        int end = filter.indexOf(',', start);
+        if (end < 0) end = filter.length();
+        long id = filter.substring(start, end).toInt();
+        if (id > 0 && id < 32) mask |= 1UL << id;
+        start = end + 1;
+    }
+    return mask;
+}
+
+/// Complete the header of the datagram being filled (the number of packets and the sequence number) and
+/// pass it to the sending task.  There are only as many buffers as places in the queue, so this can't block.
+
+void LivePublisher::flush(void)
+{
+    uint8_t *p = m_staging->data;
+    memcpy(p, "WIBL", 4);
+    p[4] = static_cast<uint8_t>(SerialiserVersionMajor);
+    p[5] = static_cast<uint8_t>(SerialiserVersionMinor);
+    memcpy(p + 6, &m_staging->count, sizeof(uint16_t));
+    memcpy(p + 8, &m_sequence, sizeof(uint32_t));
+    ++m_sequence;
+    xQueueSend(m_ready, &m_staging, 0);
+    m_staging = nullptr;
+}
+
+/// Entry point for the background task, which sends each datagram as it arrives in the queue, and then
+/// returns the buffer to the free pool.
+///
+/// \param param    Pointer to the \a LivePublisher that owns the task
+
+void LivePublisher::worker(void *param)
+{
+    LivePublisher *self = static_cast<LivePublisher*>(param);
+    Datagram *datagram;
+    while (true) {
+        if (xQueueReceive(self->m_ready, &datagram, portMAX_DELAY) != pdTRUE) continue;
+        size_t sent = self->m_udp.writeTo(datagram->data, datagram->length, self->m_address, self->m_port);
+        if (sent == datagram->length) {
+            ++LiveStats.datagrams;
+            LiveStats.bytes += sent;
+        } else {
+            ++LiveStats.failures;
+        }
+        xQueueSend(self->m_free, &datagram, portMAX_DELAY);
+    }
+}
+
+}
@@ -0,0 +1,254 @@
+/*! \file LogCompressor.cpp
+ *  \brief Background compression of log files once they have been closed
+ *
+ * Log files are written raw so that the logger never has to spend time compressing data while it's
+ * being ingested, but once a file has been closed it won't change again, and transfers (to a browser
+ * on the web server, or to the upload server) are much faster for the compressed version.  This module
+ * compresses closed log files into a gzip sibling on the second core, so that the main loop carries on
+ * logging while it happens, and reports back the size and MD5 hash of the result for the inventory.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "MD5Builder.h"
+#include <ESP32-targz.h>
+#include "LogCompressor.h"
+
+namespace logger {
+
+/// \class HashingFile
+/// \brief Output stream that writes to a file, computing the MD5 hash of the data as it goes
+///
+/// The compressor only needs somewhere to write, but the inventory needs the hash of the compressed
+/// file; hashing on the way through saves reading the whole file back again.  Once the abort flag is
+/// set, nothing more is written, which makes the compressor give up on the file quickly.
+
+class HashingFile : public Stream {
+public:
+    HashingFile(File& output, volatile bool const& abort)
+    : m_output(output), m_abort(abort)
+    {
+        m_md5.begin();
+    }
+
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+
+    size_t write(uint8_t b) override { return write(&b, 1); }
+    size_t write(const uint8_t *buf, size_t size) override {
+        if (m_abort) return 0;
+        size_t written = m_output.write(buf, size);
+        m_md5.add(buf, written);
+        return written;
+    }
+
+    void Hash(uint8_t hash[16])
+    {
+        m_md5.calculate();
+        m_md5.getBytes(hash);
+    }
+
+private:
+    File                &m_output;  ///< File being written
+    volatile bool const &m_abort;   ///< Flag: True => stop writing
+    MD5Builder          m_md5;      ///< Hash of the data written so far
+};
+
+/// Constructor for the compressor.  This only sets up the book-keeping; the task and queues are made
+/// in \a Begin().
+///
+/// \param filesystem   File system on which the log files are stored
+
+LogCompressor::LogCompressor(fs::FS& filesystem)
+: m_fs(filesystem), m_jobs(nullptr), m_results(nullptr), m_task(nullptr), m_abort(false),
+  m_files(0), m_failures(0), m_dropped(0), m_rawBytes(0), m_compressedBytes(0), m_elapsed(0), m_slowest(0)
+{
+}
+
+/// Default destructor for the compressor.  This stops the background task (abandoning any file that's
+/// being compressed, which just leaves a partial file to be over-written next time) and removes the queues.
+
+LogCompressor::~LogCompressor(void)
+{
+    if (m_task != nullptr) vTaskDelete(m_task);
+    if (m_jobs != nullptr) vQueueDelete(m_jobs);
+    if (m_results != nullptr) vQueueDelete(m_results);
+}
+
+/// Make the queues for jobs and results, and start the background task.  The task runs at just above
+/// idle priority on the core that the main loop isn't using, so that it only uses time that would
+/// otherwise be wasted.
+///
+/// \return True if the task was started, otherwise False
+
+bool LogCompressor::Begin(void)
+{
+    m_jobs = xQueueCreate(CompressorQueueLength, sizeof(Job));
+    m_results = xQueueCreate(CompressorQueueLength, sizeof(Result));
+    if (m_jobs == nullptr || m_results == nullptr) {
+        Serial.println("ERR: failed to create log compressor queues.");
+        return false;
+    }
+    if (xTaskCreatePinnedToCore(worker, "compress", CompressorStackSize, this, tskIDLE_PRIORITY + 1,
+                                &m_task, CompressorCore) != pdPASS) {
+        Serial.println("ERR: failed to start log compressor task.");
+        m_task = nullptr;
+        return false;
+    }
+    return true;
+}
+
+/// Queue a log file for compression.  This doesn't block: if the queue is full (which would take a very
+/// fast rate of file rotation), the file is simply left uncompressed, and counted.
+///
+/// \param filenum  Log file number
+/// \param filename Name of the log file
+/// \return True if the file was queued, otherwise False
+
+bool LogCompressor::Submit(uint32_t filenum, String const& filename)
+{
+    if (m_jobs == nullptr) return false;
+    Job job;
+    job.filenum = filenum;
+    strncpy(job.filename, filename.c_str(), sizeof(job.filename) - 1);
+    job.filename[sizeof(job.filename) - 1] = '\0';
+    if (xQueueSend(m_jobs, &job, 0) != pdTRUE) {
+        ++m_dropped;
+        return false;
+    }
+    return true;
+}
+
+/// Collect the next result from the background task, if there is one, and add it into the statistics.
+/// This should be called from the main loop, which is then the only thing that changes the inventory.
+///
+/// \param result   (Out) Outcome of compressing a single file
+/// \return True if a result was collected, otherwise False
+
+bool LogCompressor::Collect(Result& result)
+{
+    if (m_results == nullptr || xQueueReceive(m_results, &result, 0) != pdTRUE) return false;
+    if (result.success) {
+        ++m_files;
+        m_rawBytes += result.rawSize;
+        m_compressedBytes += result.compressedSize;
+    } else {
+        ++m_failures;
+    }
+    m_elapsed += result.elapsed;
+    if (result.elapsed > m_slowest) m_slowest = result.elapsed;
+    return true;
+}
+
+/// Generate a JSON document with the compression statistics: the number of files compressed, failed
+/// (or not worth compressing), and not queued; the overall compression ratio; and the mean and longest
+/// time taken per file (ms).
+///
+/// \return JSON document with the compression summary
+
+DynamicJsonDocument LogCompressor::Render(void) const
+{
+    DynamicJsonDocument doc(256);
+    uint32_t attempts = m_files + m_failures;
+    doc["files"] = m_files;
+    doc["failures"] = m_failures;
+    doc["dropped"] = m_dropped;
+    doc["pending"] = m_jobs == nullptr ? 0 : uxQueueMessagesWaiting(m_jobs);
+    doc["ratio"] = m_rawBytes > 0 ? static_cast<double>(m_compressedBytes) / m_rawBytes : 0.0;
+    doc["mean"] = attempts > 0 ? m_elapsed / attempts : 0;
+    doc["max"] = m_slowest;
+    return doc;
+}
+
+/// Entry point for the background task, which compresses each file as it arrives in the queue and posts
+/// the result back for the main loop.  Results are only dropped if the loop isn't collecting them, in which
+/// case the compressed file is still there for the inventory to find when it's next rebuilt.
+///
+/// \param param    Pointer to the \a LogCompressor that owns the task
+
+void LogCompressor::worker(void *param)
+{
+    LogCompressor *self = static_cast<LogCompressor*>(param);
+    Job job;
+    Result result;
+    while (true) {
+        if (xQueueReceive(self->m_jobs, &job, portMAX_DELAY) != pdTRUE) continue;
+        if (self->m_abort) continue;
+        self->compress(job, result);
+        xQueueSend(self->m_results, &result, pdMS_TO_TICKS(1000));
+    }
+}
+
+/// Compress a single log file into its gzip sibling.  The output goes to a partial file first, and is only
+/// renamed into place once it's complete and known to be smaller than the original.
+///
+/// \param job      Log file to compress
+/// \param result   (Out) Outcome of the compression
+
+void LogCompressor::compress(Job const& job, Result& result)
+{
+    String source_name(job.filename);
+    String target_name(CompressedName(source_name));
+    String partial_name(target_name + PartialSuffix);
+    uint32_t start = millis();
+
+    result.filenum = job.filenum;
+    result.success = false;
+    result.rawSize = 0;
+    result.compressedSize = 0;
+    memset(result.hash, 0, sizeof(result.hash));
+
+    File source = m_fs.open(source_name, FILE_READ);
+    if (!source) {
+        result.elapsed = millis() - start;
+        return;
+    }
+    File target = m_fs.open(partial_name, FILE_WRITE);
+    if (!target) {
+        source.close();
+        result.elapsed = millis() - start;
+        return;
+    }
+    result.rawSize = source.size();
+    HashingFile output(target, m_abort);
+    size_t compressed = LZPacker::compress(&source, result.rawSize, &output);
+    output.Hash(result.hash);
+    source.close();
+    target.close();
+    if (m_abort) {
+        // Power is failing: leave the partial file to be over-written next time, rather than using the
+        // file system again
+        result.elapsed = millis() - start;
+        return;
+    }
+
+    if (compressed > 0 && compressed < result.rawSize) {
+        m_fs.remove(target_name);
+        if (m_fs.rename(partial_name, target_name)) {
+            result.success = true;
+            result.compressedSize = compressed;
+        }
+    }
+    if (!result.success) m_fs.remove(partial_name);
+    result.elapsed = millis() - start;
+}
+
+}
@@ -33,6 +33,9 @@
 #include "StatusLED.h"
 #include "MemController.h"
 #include "NVMFile.h"
+#include "StorageMetrics.h"
+#include "DataMetrics.h"
+#include "Scheduler.h"
 
 namespace logger {
 
@@ -50,6 +53,7 @@ namespace logger {
 const int MAX_LOG_FILE_SIZE = 10*1024*1024; ///< Maximum size of a single log file before swapping
 const int MAX_CONSOLE_FILE_SIZE = 100*1024; ///< Maximum size of the console log before rotation
 const int MAX_CONSOLE_LOGS = 3; ///< Maximum number of console logs to support before over-writing
+const int TRANSFER_BLOCK_SIZE = 1024; ///< Size (bytes) of the blocks read from a log file when sending it to a stream
 
 Manager::MD5Hash::MD5Hash(void)
 {
@@ -84,11 +88,12 @@ void Manager::MD5Hash::Set(uint8_t hash[16])
 }
 
 Manager::Inventory::Inventory(Manager *manager, bool verbose)
-: m_logManager(manager), m_verbose(verbose)
+: m_logManager(manager), m_verbose(verbose), m_nextSequence(0), m_fileCount(0), m_totalSize(0)
 {
     m_filesize.resize(MaxLogFiles);
     m_hashes.resize(MaxLogFiles);
     m_uploadCount.resize(MaxLogFiles);
+    m_sequence.resize(MaxLogFiles);
     Reinitialise();
 }
 
@@ -109,10 +114,19 @@ bool Manager::Inventory::Reinitialise(void)
         m_filesize[entry] = 0;
         m_hashes[entry] = emptyhash;
         m_uploadCount[entry] = 0;
+        m_sequence[entry] = 0;
+    }
+    m_nextSequence = 0;
+    m_fileCount = 0;
+    m_totalSize = 0;
+    for (uint32_t entry = 0; entry < m_compressedSize.size(); ++entry) {
+        m_compressedSize[entry] = 0;
+        m_compressedHash[entry] = emptyhash;
     }
 
     for (uint32_t f = 0; f < filecount; ++f) {
         Update(filenumbers[f]);
+        findCompressed(filenumbers[f]);
     }
 
     delete[] filenumbers;
@@ -138,7 +152,19 @@ bool Manager::Inventory::Update(uint32_t filenum, MD5Hash *filehash)
     if (m_verbose)
         Serial.printf("DBG: Inventory update for file %u.\n", filenum);
     if (filenum >= MaxLogFiles) return false;
+    // Files are numbered with the first free slot, so the number doesn't say which is newer; the sequence
+    // is given when a file first appears in the inventory instead (which, for the files found at boot, is
+    // in order of number, since there's no clock to tell them apart).
+    if (m_sequence[filenum] == 0) m_sequence[filenum] = ++m_nextSequence;
+    if (m_filesize[filenum] != 0) {
+        --m_fileCount;
+        m_totalSize -= m_filesize[filenum];
+    }
     m_logManager->enumerate(filenum, filename, m_filesize[filenum]);
+    if (m_filesize[filenum] != 0) {
+        ++m_fileCount;
+        m_totalSize += m_filesize[filenum];
+    }
     m_logManager->hash(filename, m_hashes[filenum]);
     if (m_verbose)
         Serial.printf("DBG: File |%s|, %u B, hash |%s|.\n", filename.c_str(), m_filesize[filenum], m_hashes[filenum].Value().c_str());
@@ -149,9 +175,18 @@ bool Manager::Inventory::Update(uint32_t filenum, MD5Hash *filehash)
 void Manager::Inventory::RemoveLogFile(uint32_t filenum)
 {
     if (filenum >= MaxLogFiles) return;
+    if (m_filesize[filenum] != 0) {
+        --m_fileCount;
+        m_totalSize -= m_filesize[filenum];
+    }
     m_filesize[filenum] = 0;
     m_hashes[filenum] = Manager::MD5Hash();
     m_uploadCount[filenum] = 0;
+    m_sequence[filenum] = 0;
+    if (filenum < m_compressedSize.size()) {
+        m_compressedSize[filenum] = 0;
+        m_compressedHash[filenum] = Manager::MD5Hash();
+    }
 }
 
 uint32_t Manager::Inventory::CountLogFiles(uint32_t filenumbers[MaxLogFiles])
@@ -168,11 +203,13 @@ uint32_t Manager::Inventory::CountLogFiles(uint32_t filenumbers[MaxLogFiles])
 
 uint32_t Manager::Inventory::CountLogFiles(void)
 {
-    uint32_t filecount = 0;
-    for (uint32_t entry = 0; entry < MaxLogFiles; ++entry) {
-        if (m_filesize[entry] != 0) ++filecount;
-    }
-    return filecount;
+    return m_fileCount;
+}
+
+uint32_t Manager::Inventory::Summarise(uint64_t& totalsize)
+{
+    totalsize = m_totalSize;
+    return m_fileCount;
 }
 
 uint32_t Manager::Inventory::GetNextLogNumber(void)
@@ -219,6 +256,73 @@ uint16_t Manager::Inventory::IncrementUploadCount(uint32_t filenum)
     return rc;
 }
 
+uint32_t Manager::Inventory::Sequence(uint32_t filenum)
+{
+    if (filenum >= MaxLogFiles || m_filesize[filenum] == 0)
+        return 0;
+    return m_sequence[filenum];
+}
+
+/// Start tracking the compressed siblings of the log files, as well as the files themselves.  Since this
+/// doubles the memory used for the inventory, it's only done when compression is turned on; any siblings
+/// that are already on the card (e.g., from before a restart) are found and hashed here.
+
+void Manager::Inventory::TrackCompressed(void)
+{
+    if (!m_compressedSize.empty()) return;
+    m_compressedSize.resize(MaxLogFiles, 0);
+    m_compressedHash.resize(MaxLogFiles);
+    for (uint32_t entry = 0; entry < MaxLogFiles; ++entry) {
+        if (m_filesize[entry] != 0) findCompressed(entry);
+    }
+}
+
+/// Look up the size and hash of the compressed sibling of a log file.
+///
+/// \param filenum  Log file number
+/// \param filesize (Out) Size of the compressed sibling (bytes)
+/// \param hash     (Out) MD5 hash of the compressed sibling
+/// \return True if the file has a compressed sibling that's being tracked, otherwise False
+
+bool Manager::Inventory::LookupCompressed(uint32_t filenum, uint32_t& filesize, MD5Hash& hash)
+{
+    if (filenum >= m_compressedSize.size() || m_compressedSize[filenum] == 0) return false;
+    filesize = m_compressedSize[filenum];
+    hash = m_compressedHash[filenum];
+    return true;
+}
+
+/// Record the size and hash of a compressed sibling that has just been written (so that it doesn't have to
+/// be read back for hashing).
+///
+/// \param filenum  Log file number
+/// \param filesize Size of the compressed sibling (bytes)
+/// \param hash     MD5 hash of the compressed sibling
+/// \return True if the sibling was recorded, otherwise False
+
+bool Manager::Inventory::UpdateCompressed(uint32_t filenum, uint32_t filesize, MD5Hash const& hash)
+{
+    if (filenum >= m_compressedSize.size() || m_filesize[filenum] == 0) return false;
+    m_compressedSize[filenum] = filesize;
+    m_compressedHash[filenum] = hash;
+    return true;
+}
+
+void Manager::Inventory::findCompressed(uint32_t filenum)
+{
+    if (filenum >= m_compressedSize.size()) return;
+    String filename = LogCompressor::CompressedName(m_logManager->MakeLogName(filenum));
+    File f = m_logManager->m_storage->Controller().open(filename, FILE_READ);
+    if (f) {
+        m_compressedSize[filenum] = f.size();
+        f.close();
+        m_logManager->hash(filename, m_compressedHash[filenum]);
+    } else {
+        m_compressedSize[filenum] = 0;
+        m_compressedHash[filenum] = Manager::MD5Hash();
+    }
+}
+
 #ifdef DEBUG_LOG_MANAGER
 
 // When bringing up new hardware designs, it can be problematic if the hardware doesn't
@@ -390,6 +494,29 @@ void Manager::TransferLogFile(int file_num, Stream& output)
 
 #else   // DEBUG_LOG_MANAGER
 
+/// \class InventoryLock
+/// \brief Hold the lock on the log manager's inventory for the lifetime of the object
+///
+/// The main loop is the only thing that changes the inventory, but the upload task reads it, so
+/// anything that reads or changes the inventory (or the number of the file currently being written)
+/// takes the lock.  The lock is recursive, since some of the public methods call others.
+
+class InventoryLock {
+public:
+    InventoryLock(SemaphoreHandle_t lock)
+    : m_lock(lock)
+    {
+        if (m_lock != nullptr) xSemaphoreTakeRecursive(m_lock, portMAX_DELAY);
+    }
+    ~InventoryLock(void)
+    {
+        if (m_lock != nullptr) xSemaphoreGiveRecursive(m_lock);
+    }
+
+private:
+    SemaphoreHandle_t   m_lock; ///< Lock to hold
+};
+
 /// \brief Default constructor.
 ///
 /// Set up for writing to logs, and also for the console log (same idea as a Unix-style
@@ -399,8 +526,10 @@ void Manager::TransferLogFile(int file_num, Stream& output)
 /// \param led  Pointer to the LED controller for the logger (external owner)
 
 Manager::Manager(StatusLED *led, mem::MemController *storage)
-: m_storage(storage), m_led(led), m_inventory(nullptr), m_noDataAlgEmitted(false)
+: m_storage(storage), m_logOpen(false), m_serialiser(nullptr), m_led(led), m_inventory(nullptr),
+  m_compressor(nullptr), m_noDataAlgEmitted(false)
 {
+    m_inventoryLock = xSemaphoreCreateRecursiveMutex();
 #if defined(ARDUINO_ARCH_ESP32) || defined(ESP32)
     m_consoleLog = m_storage->Controller().open("/console.log", FILE_APPEND);
 #else
@@ -421,8 +550,13 @@ Manager::~Manager(void)
         m_outputLog.close();
     if (m_inventory != nullptr)
         delete m_inventory;
-    m_consoleLog.println("INFO: shutting down log manager under control.");
+    if (m_compressor != nullptr)
+        delete m_compressor;
+    Syslog("INFO: shutting down log manager under control.");
+    WriteConsole();
     m_consoleLog.close();
+    if (m_inventoryLock != nullptr)
+        vSemaphoreDelete(m_inventoryLock);
 }
 
 /// Start logging data to a new log file, generating the next log number in sequence that
@@ -435,13 +569,19 @@ Manager::~Manager(void)
 void Manager::StartNewLog(void)
 {
     Serial.println("Starting new log ...");
-    m_currentFile = GetNextLogNumber();
+    {
+        InventoryLock lock(m_inventoryLock);
+        m_currentFile = GetNextLogNumber();
+    }
     Serial.println(String("Log Number: ") + m_currentFile);
     String filename = MakeLogName(m_currentFile);
     Serial.println(String("Log Name: ") + filename);
 
+    uint32_t start = StorageIO.Start();
     m_outputLog = m_storage->Controller().open(filename, FILE_WRITE);
+    StorageIO.Stop(STORAGE_OPEN, start);
     if (m_outputLog) {
+        m_logOpen.store(true);
         m_serialiser = new Serialiser(m_outputLog);
         logger::AlgoRequestStore algstore;
         algstore.SerialiseAlgorithms(m_serialiser);
@@ -451,13 +591,12 @@ void Manager::StartNewLog(void)
         filterstore.SerialiseIDs(m_serialiser);
         logger::ScalesStore scalesstore;
         scalesstore.SerialiseScales(m_serialiser);
-        m_consoleLog.println(String("INFO: started logging to ") + filename);
+        Syslog(String("INFO: started logging to ") + filename);
     } else {
         m_serialiser = nullptr;
-        m_consoleLog.println(String("ERR: Failed to open output log file as ") + filename);
+        Syslog(String("ERR: Failed to open output log file as ") + filename);
     }
     
-    m_consoleLog.flush();
     ResetDynamicAlgorithms();
     
     Serial.println("New log file initialisation complete.");
@@ -465,14 +604,45 @@ void Manager::StartNewLog(void)
 
 /// Close the current log file, and reset the Serialiser.  This ensures that the output log
 /// file is safely closed, and no other object has reference to the file structure used
-/// for it.
+/// for it.  If compression is on, the file is then queued for compression in the background.
+///     The \a File object for the log is only ever touched by the main loop: other tasks (e.g., uploads)
+/// check \a m_logOpen instead, so the file can be opened and closed without holding the inventory lock.
 
 void Manager::CloseLogfile(void)
 {
+    m_logOpen.store(false);
     delete m_serialiser;
     m_serialiser = nullptr;
+    uint32_t start = StorageIO.Start();
     m_outputLog.close();
-    if (m_inventory != nullptr) m_inventory->Update(m_currentFile);
+    StorageIO.Stop(STORAGE_CLOSE, start);
+    if (m_inventory != nullptr) {
+        InventoryLock lock(m_inventoryLock);
+        m_inventory->Update(m_currentFile);
+    }
+    if (m_compressor != nullptr && !m_compressor->Submit(m_currentFile, MakeLogName(m_currentFile))) {
+        Syslog(String("ERR: failed to queue log file ") + m_currentFile + " for compression.");
+    }
+}
+
+/// Stop recording, and close the current log file with as little work as possible, when power is
+/// failing.  Background compression is abandoned (so that the file system is free), and the file is just
+/// closed, which writes its directory entry; the inventory isn't updated (which would hash the whole file)
+/// and the file isn't queued for compression, since both are rebuilt from the files at the next boot.
+/// Nothing is written to the console, so that the time goes on getting the data safe.  Any packets that
+/// arrive afterwards are dropped.
+///
+/// \return Time (us) taken to close the file
+
+uint32_t Manager::EmergencyClose(void)
+{
+    uint32_t start = micros();
+    if (m_compressor != nullptr) m_compressor->Abort();
+    m_logOpen.store(false);
+    delete m_serialiser;
+    m_serialiser = nullptr;
+    m_outputLog.close();
+    return micros() - start;
 }
 
 /// Remove a specific log file from the SD card.  The specification of the filename, etc.
@@ -486,16 +656,17 @@ void Manager::CloseLogfile(void)
 
 bool Manager::RemoveLogFile(uint32_t file_num)
 {
+    InventoryLock lock(m_inventoryLock);
     String filename = MakeLogName(file_num);
     bool rc = m_storage->Controller().remove(filename);
+    removeCompressed(file_num);
 
     if (rc) {
-        m_consoleLog.printf("INFO: erased log file %d by user command.\n", file_num);
+        Syslog(String("INFO: erased log file ") + file_num + " by user command.");
         if (m_inventory != nullptr) m_inventory->RemoveLogFile(file_num);
     } else {
-        m_consoleLog.printf("ERR: failed to erase log file %d on user command.\n", file_num);
+        Syslog(String("ERR: failed to erase log file ") + file_num + " on user command.");
     }
-    m_consoleLog.flush();
     
     return rc;
 }
@@ -506,6 +677,7 @@ bool Manager::RemoveLogFile(uint32_t file_num)
 
 void Manager::RemoveAllLogfiles(void)
 {
+    InventoryLock lock(m_inventoryLock);
     uint32_t *filenumbers = new uint32_t[MaxLogFiles];
 
     CloseLogfile(); // All means all ...
@@ -516,17 +688,17 @@ void Manager::RemoveAllLogfiles(void)
         String filename = MakeLogName(filenumbers[f]);
         Serial.printf("INFO: erasing log file: \"%s\".\n", filename.c_str());
         bool rc = m_storage->Controller().remove(filename);
+        removeCompressed(filenumbers[f]);
         if (rc) {
-            m_consoleLog.printf("INFO: erased log file \"%s\" by user command.\n", filename.c_str());
+            Syslog(String("INFO: erased log file \"") + filename + "\" by user command.");
             ++files_closed;
             if (m_inventory != nullptr) m_inventory->RemoveLogFile(filenumbers[f]);
         } else {
-            m_consoleLog.printf("ERR: failed to erase log file \"%s\" by user command.\n", filename.c_str());
+            Syslog(String("ERR: failed to erase log file \"") + filename + "\" by user command.");
         }
     }
     delete[] filenumbers;
-    m_consoleLog.printf("INFO: erased %u log files of %u.\n", files_closed, filecount);
-    m_consoleLog.flush();
+    Syslog(String("INFO: erased ") + files_closed + " log files of " + filecount + ".");
     StartNewLog(); // We need to have something running for the logging effort!
 }
 
@@ -538,6 +710,7 @@ void Manager::RemoveAllLogfiles(void)
 
 uint32_t Manager::CountLogFiles(uint32_t filenumbers[MaxLogFiles])
 {
+    InventoryLock lock(m_inventoryLock);
     uint32_t filecount;
     if (m_inventory != nullptr) {
         filecount = m_inventory->CountLogFiles(filenumbers);
@@ -548,6 +721,7 @@ uint32_t Manager::CountLogFiles(uint32_t filenumbers[MaxLogFiles])
 
 uint32_t Manager::CountLogFiles(void)
 {
+    InventoryLock lock(m_inventoryLock);
     uint32_t filecount;
     if (m_inventory != nullptr) {
         filecount = m_inventory->CountLogFiles();
@@ -556,6 +730,31 @@ uint32_t Manager::CountLogFiles(void)
     return filecount;
 }
 
+/// Count the log files on the SD card, and their total size, for status reporting.  With the inventory
+/// on, these are kept up to date as files are added, updated, and removed, so this is cheap enough to
+/// call frequently; otherwise, each file has to be opened to find its size.
+///
+/// \param totalsize   (Out) Total size of the log files (bytes)
+/// \return Number of files on the SD card
+
+uint32_t Manager::SummariseLogFiles(uint64_t& totalsize)
+{
+    InventoryLock lock(m_inventoryLock);
+    if (m_inventory != nullptr) return m_inventory->Summarise(totalsize);
+
+    uint32_t *filenumbers = new uint32_t[MaxLogFiles];
+    uint32_t filecount = count(filenumbers);
+    totalsize = 0;
+    for (uint32_t f = 0; f < filecount; ++f) {
+        String filename;
+        uint32_t filesize;
+        enumerate(filenumbers[f], filename, filesize);
+        totalsize += filesize;
+    }
+    delete[] filenumbers;
+    return filecount;
+}
+
 /// Make a list of all of the files that exist on the SD card in the log directory, along with their
 /// sizes.  This is generally used to work out which files can be transferred to the client application.
 ///
@@ -567,6 +766,7 @@ uint32_t Manager::CountLogFiles(void)
 void Manager::EnumerateLogFile(uint32_t lognumber, String& filename, uint32_t& filesize, MD5Hash& filehash,
     uint16_t& uploadcount)
 {
+    InventoryLock lock(m_inventoryLock);
     filename = MakeLogName(lognumber);
 
     if (m_inventory != nullptr) {
@@ -583,38 +783,172 @@ void Manager::EnumerateLogFile(uint32_t lognumber, String& filename, uint32_t& f
     }
 }
 
+/// Look up the compressed sibling of a log file, which is only reported if the inventory is tracking
+/// compressed files (i.e., compression is on), since otherwise the hash isn't known.
+///
+/// \param lognumber  Number of the file to look up
+/// \param filename   (Out) Name of the compressed sibling
+/// \param filesize   (Out) Size of the compressed sibling in bytes
+/// \param filehash   (Out) MD5 hash of the compressed sibling
+/// \return True if the log file has a compressed sibling, otherwise False
+
+bool Manager::EnumerateCompressed(uint32_t lognumber, String& filename, uint32_t& filesize, MD5Hash& filehash)
+{
+    InventoryLock lock(m_inventoryLock);
+    if (m_inventory == nullptr || !m_inventory->LookupCompressed(lognumber, filesize, filehash)) return false;
+    filename = LogCompressor::CompressedName(MakeLogName(lognumber));
+    return true;
+}
+
+/// Look up the hash of a file in the log directory by name, which works for log files and their compressed
+/// siblings, as long as they're in the inventory.  The file that's currently being written doesn't have a
+/// hash (since it's still changing), and neither do snapshots and other files in the log directory.
+///
+/// \param filename   Full path of the file (e.g., as requested from the web server)
+/// \param filehash   (Out) MD5 hash of the file
+/// \return True if the hash is known, otherwise False
+
+bool Manager::LookupDigest(String const& filename, MD5Hash& filehash)
+{
+    if (m_inventory == nullptr || !filename.startsWith("/logs/")) return false;
+    bool compressed = filename.endsWith(CompressedSuffix);
+    String logname = compressed ? filename.substring(0, filename.length() - strlen(CompressedSuffix)) : filename;
+    int32_t lognumber = ExtractLogNumber(logname);
+    if (lognumber < 0 || logname != MakeLogName(lognumber)) return false;
+    InventoryLock lock(m_inventoryLock);
+    if (m_logOpen.load() && static_cast<uint32_t>(lognumber) == m_currentFile) return false;
+
+    uint32_t filesize;
+    uint16_t uploads;
+    if (compressed) return m_inventory->LookupCompressed(lognumber, filesize, filehash);
+    return m_inventory->Lookup(lognumber, filesize, filehash, uploads) && !filehash.Empty();
+}
+
+/// Look up the file to send to the upload server for a log file: the compressed sibling if there is one,
+/// otherwise the log file itself, along with its size and hash.  This holds the inventory lock for the
+/// look-up so that it can be called from the upload task while the main loop is logging; the file that's
+/// currently being written, and files that aren't in the inventory, are not reported.
+///
+/// \param lognumber  Number of the log file to look up
+/// \param filename   (Out) Name of the file to send
+/// \param filesize   (Out) Size of the file to send in bytes
+/// \param filehash   (Out) MD5 hash of the file to send
+/// \param compressed (Out) Flag: True => the file to send is the gzip-compressed sibling
+/// \return True if the log file can be sent, otherwise False
+
+bool Manager::UploadSource(uint32_t lognumber, String& filename, uint32_t& filesize, MD5Hash& filehash,
+    bool& compressed)
+{
+    InventoryLock lock(m_inventoryLock);
+    if (m_logOpen.load() && lognumber == m_currentFile) return false;
+    uint16_t uploads;
+    filesize = 0;
+    EnumerateLogFile(lognumber, filename, filesize, filehash, uploads);
+    compressed = EnumerateCompressed(lognumber, filename, filesize, filehash);
+    return filesize > 0;
+}
+
+/// Summarise the closed log files for the upload scheduler: the number of each file, the size of the file
+/// that would be sent (the compressed sibling, if there is one), and the order in which the files were
+/// closed.  The whole list is made under a single lock, so it can be called from the upload task.  Without
+/// an inventory, the files are found on the card, and the sequence is just the file number.
+///
+/// \param files   (Out) Summaries of the closed log files
+/// \return Number of closed log files
+
+uint32_t Manager::SummariseLogFiles(std::vector<LogSummary>& files)
+{
+    InventoryLock lock(m_inventoryLock);
+    uint32_t *filenumbers = new uint32_t[MaxLogFiles];
+    uint32_t filecount = CountLogFiles(filenumbers);
+    String filename;
+    MD5Hash filehash;
+    bool compressed;
+
+    files.clear();
+    files.reserve(filecount);
+    for (uint32_t n = 0; n < filecount; ++n) {
+        LogSummary summary;
+        summary.lognumber = filenumbers[n];
+        if (!UploadSource(summary.lognumber, filename, summary.filesize, filehash, compressed)) continue;
+        summary.sequence = m_inventory != nullptr ? m_inventory->Sequence(summary.lognumber) : summary.lognumber;
+        files.push_back(summary);
+    }
+    delete[] filenumbers;
+    return files.size();
+}
+
 /// Record a packet into the current output file, and check on size (making a new file if
-/// required).
+/// required).  If there's a tap set (e.g., for the live data stream), it gets a copy of the packet.
 ///
 /// \param pktID    Reference number to save with the packet
 /// \param data Serialisable or derived object with data to write
 
 void Manager::Record(PacketIDs pktID, Serialisable const& data)
 {
-    m_serialiser->Process((uint32_t)pktID, data);
+    if (m_serialiser == nullptr) {
+        // No log file open (it failed to open, or logging has stopped for power failure)
+        Metrics.CountWriterDrop();
+        return;
+    }
+    if (!m_serialiser->Process((uint32_t)pktID, data)) {
+        Metrics.CountWriterDrop();
+    }
+    if (m_tap) m_tap((uint32_t)pktID, data);
     m_led->TriggerDataIndication();
     if (m_outputLog.size() > MAX_LOG_FILE_SIZE) {
-        m_consoleLog.printf("INFO: Cycling to next log file after %d B to current log file.\n", m_outputLog.size());
-        m_consoleLog.flush();
+        Syslog(String("INFO: Cycling to next log file after ") + m_outputLog.size() + " B to current log file.");
         CloseLogfile();
         StartNewLog();
     }
 }
 
-void Manager::Syslog(String const& message)
+/// Add a message to the console log.  This only stages the message in RAM (see \a ConsoleBuffer for
+/// coalescing of repeats and rate limiting); it is written to the console file in a batch by
+/// \a ServiceConsole(), so that a noisy source can't hold up logging with a flush for each message.
+///
+/// \param message Text of the message (without newline)
+/// \param source  Sub-system generating the message, for rate limiting
+
+void Manager::Syslog(String const& message, ConsoleSource source)
+{
+    m_console.Add(message, source);
+}
+
+/// Write any pending console messages to the console file, if the buffer says that they're due (by
+/// size or age), and then rotate the console files if required.  This is intended to be called from
+/// the scheduler, so that file rotation is kept off the path of the code generating messages.
+///
+/// \return False (there's never more work to do)
+
+bool Manager::ServiceConsole(void)
+{
+    if (m_console.Due()) {
+        WriteConsole();
+        RotateConsoleLogs();
+    }
+    return false;
+}
+
+/// Write all of the pending console messages to the console file, and flush the file.
+
+void Manager::WriteConsole(void)
 {
-    m_consoleLog.println(message);
+    uint32_t start = StorageIO.Start();
+    size_t written = m_console.Drain(m_consoleLog);
     m_consoleLog.flush();
-    RotateConsoleLogs(); // This is maybe a little much, but does ensure we don't exceed the max size.
+    StorageIO.Stop(STORAGE_SYSLOG, start, written);
 }
 
 void Manager::CloseConsole(void)
 {
+    WriteConsole();
     m_consoleLog.close();
 }
 
 void Manager::HashFile(uint32_t file_num, MD5Hash& filehash)
 {
+    InventoryLock lock(m_inventoryLock);
     if (m_inventory != nullptr) {
         m_inventory->Update(file_num, &filehash);
     } else {
@@ -625,6 +959,7 @@ void Manager::HashFile(uint32_t file_num, MD5Hash& filehash)
 
 uint16_t Manager::IncrementUploadCount(uint32_t file_num)
 {
+    InventoryLock lock(m_inventoryLock);
     uint16_t rc;
 
     if (m_inventory != nullptr) {
@@ -641,7 +976,74 @@ void Manager::AddInventory(bool verbose)
     m_inventory = new Inventory(this, verbose);
 }
 
+/// Start the background compression of log files as they are closed.  This should be called after
+/// \a AddInventory(), since the inventory then tracks the compressed files too (so that transfers
+/// can find them without hashing).
+
+void Manager::AddCompressor(void)
+{
+    if (m_compressor != nullptr) return;
+    m_compressor = new LogCompressor(m_storage->Controller());
+    if (!m_compressor->Begin()) {
+        delete m_compressor;
+        m_compressor = nullptr;
+        return;
+    }
+    if (m_inventory != nullptr) m_inventory->TrackCompressed();
+}
+
+/// Collect the results of background compression, and record them in the inventory.  If the log file
+/// has been removed (or replaced) while it was being compressed, the compressed file is out of date,
+/// and is removed instead.
+///
+/// \return True if there may be more results to collect, otherwise False
+
+bool Manager::ServiceCompression(void)
+{
+    if (m_compressor == nullptr) return false;
+    LogCompressor::Result result;
+    while (m_compressor->Collect(result)) {
+        if (!result.success) {
+            Syslog(String("INFO: log file ") + result.filenum + " not compressed.");
+        } else if (m_inventory != nullptr) {
+            InventoryLock lock(m_inventoryLock);
+            MD5Hash hash;
+            hash.Set(result.hash);
+            if (m_inventory->Filesize(result.filenum) != result.rawSize ||
+                    !m_inventory->UpdateCompressed(result.filenum, result.compressedSize, hash)) {
+                removeCompressed(result.filenum);
+            }
+        }
+        if (Tasks.SliceExpired()) return true;
+    }
+    return false;
+}
+
+DynamicJsonDocument Manager::CompressionStatus(void) const
+{
+    if (m_compressor == nullptr) {
+        DynamicJsonDocument doc(32);
+        doc["enabled"] = false;
+        return doc;
+    }
+    return m_compressor->Render();
+}
+
 bool Manager::WriteSnapshot(const char *name, String const& contents, String& url)
+{
+    return WriteSnapshot(name, [&contents](Print& output) { output.print(contents); }, url);
+}
+
+/// Write a snapshot file into the log directory, with contents generated directly into the file
+/// (rather than being assembled in memory first).  This is used for snapshots that can be large,
+/// such as the catalogue of log files.
+///
+/// \param name        Filename for the snapshot (in the log directory)
+/// \param generator   Function to write the contents of the snapshot into the output given
+/// \param url         (Out) URL for the snapshot on the web server
+/// \return True if the snapshot file was written, otherwise False
+
+bool Manager::WriteSnapshot(const char *name, std::function<void(Print&)> generator, String& url)
 {
     // Since the /logs directory is served out as the second static website, we need to
     // put the snapshots into the same directory so they can be seen.  This causes some
@@ -650,7 +1052,7 @@ bool Manager::WriteSnapshot(const char *name, String const& contents, String& ur
     url = String("/logs/") + name;
     File f = m_storage->Controller().open(url, FILE_WRITE);
     if (f) {
-        f.print(contents);
+        generator(f);
         f.close();
         return true;
     }
@@ -666,6 +1068,23 @@ void Manager::ResetDynamicAlgorithms(void)
     m_noDataAlgEmitted = false;
 }
 
+/// Record a metrics packet (a JSON document with performance information for the logger) into the
+/// current log file, so that the logger's behaviour can be reviewed alongside the data.  The packet
+/// is serialised as a length word followed by the minified JSON string.
+///
+/// \param metrics JSON document to record
+
+void Manager::RecordMetrics(DynamicJsonDocument const& metrics)
+{
+    if (m_serialiser == nullptr) return;
+    String json;
+    serializeJson(metrics, json);
+    Serialisable packet(json.length() + 4);
+    packet += json.length();
+    packet += json.c_str();
+    m_serialiser->Process(Pkt_Metrics, packet);
+}
+
 void Manager::EmitNoDataReject(void)
 {
     if (m_noDataAlgEmitted) return;
@@ -738,10 +1157,14 @@ int32_t Manager::ExtractLogNumber(String const& filename)
         // This is not a log file, so converting the extension would not be useful
         return -1;
     }
-    // Since we know that it's a log file (test above) then we know that it must have an
-    // extension that can be converted into an integer (since they are only made by
-    // MakeLogName() here, and therefore always have the same format)
-    return filename.substring(filename.indexOf('.')+1).toInt();
+    // Log files are only made by MakeLogName() here, so they always have an integer extension;
+    // anything more (e.g., compressed siblings) means it's not the log file itself.
+    String extension = filename.substring(filename.indexOf('.')+1);
+    if (extension.length() == 0) return -1;
+    for (uint32_t c = 0; c < extension.length(); ++c) {
+        if (!isDigit(extension[c])) return -1;
+    }
+    return extension.toInt();
 }
 
 /// Output the contents of the system console log to something that implements the Stream
@@ -751,6 +1174,7 @@ int32_t Manager::ExtractLogNumber(String const& filename)
 
 void Manager::DumpConsoleLog(Stream& output)
 {
+    WriteConsole();
     m_consoleLog.close();
     m_consoleLog = m_storage->Controller().open("/console.log", FILE_READ);
     while (m_consoleLog.available()) {
@@ -774,7 +1198,7 @@ void Manager::RotateConsoleLogs(void)
             String target_file = "/console." + String(target);
             String source_file = "/console." + String(target-1);
             if (m_storage->Controller().exists(source_file))
-                m_storage->Controller().rename(source_file.c_str(), source_file.c_str());
+                m_storage->Controller().rename(source_file.c_str(), target_file.c_str());
         }
         m_storage->Controller().rename("/console.log", "/console.1");
         m_consoleLog = m_storage->Controller().open("/console.log", FILE_APPEND);
@@ -804,14 +1228,17 @@ void Manager::TransferLogFile(uint32_t file_num, MD5Hash const& filehash, Stream
     output.write(filehash.Hash(), MD5Hash::ObjectSize());
     output.write((const uint8_t*)&file_size, sizeof(uint32_t));
     
+    // The file goes in blocks rather than a byte at a time, and without progress messages, since
+    // anything else written to the output would end up in the middle of the file at the other end.
     unsigned long start = millis();
-    while (f.available()) {
-        output.write(f.read());
-        ++bytes_transferred;
-        if ((bytes_transferred % 1024) == 0) {
-            Serial.printf("Transferred %u bytes.\n", bytes_transferred);
-        }
+    uint32_t io_start = StorageIO.Start();
+    uint8_t buffer[TRANSFER_BLOCK_SIZE];
+    int n;
+    while ((n = f.read(buffer, TRANSFER_BLOCK_SIZE)) > 0) {
+        output.write(buffer, n);
+        bytes_transferred += n;
     }
+    StorageIO.Stop(STORAGE_TRANSFER, io_start, bytes_transferred);
     unsigned long end = millis();
     unsigned long duration = (end - start)/1000;
     f.close();
@@ -840,6 +1267,12 @@ uint32_t Manager::count(uint32_t *filenumbers)
     return file_count;
 }
 
+void Manager::removeCompressed(uint32_t lognum)
+{
+    String filename = LogCompressor::CompressedName(MakeLogName(lognum));
+    if (m_storage->Controller().exists(filename)) m_storage->Controller().remove(filename);
+}
+
 void Manager::enumerate(uint32_t lognumber, String& filename, uint32_t& filesize)
 {
     filename = MakeLogName(lognumber);
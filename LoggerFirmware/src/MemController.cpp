@@ -109,6 +109,18 @@ private:
     {
         return &SD;
     }
+
+    /// \brief Return the total capacity of the SD card.
+    uint64_t get_total_bytes(void)
+    {
+        return SD.totalBytes();
+    }
+
+    /// \brief Return the space used on the SD card.
+    uint64_t get_used_bytes(void)
+    {
+        return SD.usedBytes();
+    }
 };
 
 /// \class MMCController
@@ -175,6 +187,18 @@ private:
     {
         return &SD_MMC;
     }
+
+    /// \brief Return the total capacity of the card or module.
+    uint64_t get_total_bytes(void)
+    {
+        return SD_MMC.totalBytes();
+    }
+
+    /// \brief Return the space used on the card or module.
+    uint64_t get_used_bytes(void)
+    {
+        return SD_MMC.usedBytes();
+    }
 };
 
 /// All WIBL-based loggers have to provide some large-scale storage for the logged data, but the particular
@@ -32,6 +32,7 @@
 #include "Configuration.h"
 #include "NVMFile.h"
 #include "DataMetrics.h"
+#include "Trace.h"
 
 namespace nmea {
 namespace N0183 {
@@ -142,7 +143,7 @@ void MessageAssembler::AddCharacter(const char in)
                         Serial.println(message);
                     }
                     if (m_logManager != nullptr) {
-                        m_logManager->Syslog(message);
+                        m_logManager->Syslog(message, consoleSource());
                     }
                 }
 
@@ -167,7 +168,7 @@ void MessageAssembler::AddCharacter(const char in)
                                 + String(m_channel) + " due to bad start characters.";
                     Serial.println(message);
                     if (m_logManager != nullptr) {
-                        m_logManager->Syslog(message);
+                        m_logManager->Syslog(message, consoleSource());
                     }
                 }
             }
@@ -178,11 +179,21 @@ void MessageAssembler::AddCharacter(const char in)
                 case '\n':
                     // The end of the current sentence, so we convert the current sentence
                     // onto the ring buffer.  Note that we don't store the carriage return.
-                    m_buffer[m_writePoint] = m_current;
-                    m_writePoint = (m_writePoint + 1) % RingBufferLength;
-                    if (m_debugAssembly) {
-                        Serial.println(String("debug: LF on channel ") + m_channel +
-                                              " to complete sentence; moved to FIFO");
+                    // If the ring is full, the sentence is dropped (and counted) rather than
+                    // overwriting the oldest, which would make the ring look empty.
+                    if ((m_writePoint + 1) % RingBufferLength == m_readPoint) {
+                        logger::Metrics.CountRingDrop(m_channel);
+                        if (m_debugAssembly) {
+                            Serial.println(String("debug: FIFO full on channel ") + m_channel +
+                                                  "; sentence dropped");
+                        }
+                    } else {
+                        m_buffer[m_writePoint] = m_current;
+                        m_writePoint = (m_writePoint + 1) % RingBufferLength;
+                        if (m_debugAssembly) {
+                            Serial.println(String("debug: LF on channel ") + m_channel +
+                                                  " to complete sentence; moved to FIFO");
+                        }
                     }
                     m_state = STATE_SEARCHING;
                     if (m_debugAssembly) {
@@ -204,7 +215,7 @@ void MessageAssembler::AddCharacter(const char in)
                     message = "WARN: sentence restarted before end of previous one?! (channel " + String(m_channel) + ").";
                     Serial.println(message);
                     if (m_logManager != nullptr) {
-                        m_logManager->Syslog(message);
+                        m_logManager->Syslog(message, consoleSource());
                     }
                     if (m_debugAssembly) {
                         Serial.println(String("debug: new sentence started with timestamp ") +
@@ -221,7 +232,7 @@ void MessageAssembler::AddCharacter(const char in)
                         message = "WARN: over-long sentence detected, and ignored (channel " + String(m_channel) + ").";
                         Serial.println(message);
                         if (m_logManager != nullptr) {
-                            m_logManager->Syslog(message);
+                            m_logManager->Syslog(message, consoleSource());
                         }
                         if (m_debugAssembly) {
                             Serial.println(String("debug: reset state to SEARCHING on channel ") +
@@ -234,7 +245,7 @@ void MessageAssembler::AddCharacter(const char in)
         default:
             Serial.println("ERR: unknown state in message assembly! Resetting to SEARCHING.");
             if (m_logManager != nullptr) {
-                m_logManager->Syslog("ERR: unknown state in message assembly! Resetting to SEARCHING.");
+                m_logManager->Syslog("ERR: unknown state in message assembly! Resetting to SEARCHING.", consoleSource());
             }
             m_state = STATE_SEARCHING;
             break;
@@ -389,6 +400,7 @@ void Logger::ProcessMessages(void)
     }
     for (int channel = 0; channel < ChannelCount; ++channel) {
         while ((sentence = m_channel[channel].NextSentence()) != nullptr) {
+            logger::Metrics.CountSentence(channel + 1);
             if (filterMessage(sentence)) {
                 if (m_verbose) {
                     Serial.printf("DBG: rejecting sentence \"%s\" due to filtering constraints.\n", sentence->Contents());
@@ -396,6 +408,7 @@ void Logger::ProcessMessages(void)
                 continue;
             }
             if (!sentence->Valid()) {
+                logger::Metrics.CountChecksumFailure(channel + 1);
                 if (m_verbose) {
                     Serial.printf("DBG: rejecting |%s| because it is invalid.\n", sentence->Contents());
                 }
@@ -404,6 +417,9 @@ void Logger::ProcessMessages(void)
             if (m_verbose) {
                 Serial.printf("DBG: logging \"%s\"\n", sentence->Contents());
             }
+            logger::Tracer.Emit(logger::TRACE_PACKET_RX,
+                channel == 0 ? logger::TRACE_SRC_NMEA0183_1 : logger::TRACE_SRC_NMEA0183_2,
+                strlen(sentence->Contents()));
 
             logger::DataObs obs(sentence->Timestamp(), sentence->Contents());
             logger::Metrics.RegisterObs(obs);
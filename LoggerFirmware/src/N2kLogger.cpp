@@ -36,6 +36,8 @@
 #include "N2kLogger.h"
 #include "N2kMessages.h"
 #include "DataMetrics.h"
+#include "Profiler.h"
+#include "Trace.h"
 #include "N2kMsg.h"
 
 namespace nmea {
@@ -160,8 +162,26 @@ String Timestamp::TimeDatum::printable(void) const
     return rtn;
 }
 
+/// PGNs handled by the logger, with the names of the profiler sections used for their handlers
+static const struct {
+    unsigned long   pgn;    ///< Parameter Group Number for the message
+    const char      *name;  ///< Name for the profiler section
+} profiled_pgns[ProfiledPGNs] = {
+    { 126992UL, "pgn126992" },
+    { 127257UL, "pgn127257" },
+    { 128267UL, "pgn128267" },
+    { 129026UL, "pgn129026" },
+    { 129029UL, "pgn129029" },
+    { 130311UL, "pgn130311" },
+    { 130312UL, "pgn130312" },
+    { 130313UL, "pgn130313" },
+    { 130314UL, "pgn130314" },
+    { 130316UL, "pgn130316" }
+};
+
 /// Default constructor for the logger and message handler.  This essentially just initialises
-/// the base class (with the pointer to the NMEA2000 source handler).
+/// the base class (with the pointer to the NMEA2000 source handler), and registers a profiler
+/// section for each of the PGN handlers.
 ///
 /// \param source   Pointer to the NMEA2000 object handling the CAN bus interface.
 /// \param output   Log manager that handles the details of where the log files live, and work
@@ -169,6 +189,9 @@ String Timestamp::TimeDatum::printable(void) const
 Logger::Logger(tNMEA2000 *source, logger::Manager *output)
 : tNMEA2000::tMsgHandler(0, source), m_verbose(false), m_logManager(output)
 {
+    for (int n = 0; n < ProfiledPGNs; ++n) {
+        m_profileSection[n] = logger::Profile.Section(profiled_pgns[n].name);
+    }
 }
 
 /// Default destructor for the object.  This attempts to take down the output log file cleanly,
@@ -223,6 +246,10 @@ void Logger::HandleMsg(const tN2kMsg& message)
 {
     // Everything is going to need a timestamp, so get it once.
     Timestamp::TimeDatum now = m_timeReference.Now();
+    uint32_t start = logger::Profile.Start();
+    logger::Tracer.Emit(logger::TRACE_PACKET_RX, logger::TRACE_SRC_NMEA2000, message.PGN);
+    logger::Tracer.Emit(logger::TRACE_HANDLER_BEGIN, 0, message.PGN);
+    logger::Metrics.CountPGN(message.PGN, message.DataLen);
     
     switch (message.PGN) {
         case 126992UL:  HandleSystemTime(now, message); break;
@@ -242,6 +269,16 @@ void Logger::HandleMsg(const tN2kMsg& message)
             }
             break;
     }
+    logger::Tracer.Emit(logger::TRACE_HANDLER_END, 0, message.PGN);
+
+    if (start != 0) {
+        for (int n = 0; n < ProfiledPGNs; ++n) {
+            if (profiled_pgns[n].pgn == message.PGN) {
+                logger::Profile.Stop(m_profileSection[n], start);
+                break;
+            }
+        }
+    }
 }
 
 /// Manage the translation and serialisation of the SystemTime message.  This extracts the
@@ -313,7 +350,7 @@ void Logger::HandleAttitude(Timestamp::TimeDatum const& t, tN2kMsg const& msg)
         s += roll;
         m_logManager->Record(logger::Manager::PacketIDs::Pkt_Attitude, s);
     } else {
-        m_logManager->Syslog(t.printable() + ": ERR: Failed to parse attitude data packet.");
+        m_logManager->Syslog(t.printable() + ": ERR: Failed to parse attitude data packet.", logger::CONSOLE_NMEA2000);
     }
 }
 
@@ -345,7 +382,7 @@ void Logger::HandleDepth(Timestamp::TimeDatum const& t, tN2kMsg const& msg)
         s += range;
         m_logManager->Record(logger::Manager::PacketIDs::Pkt_Depth, s);
     } else {
-        m_logManager->Syslog(t.printable() + ": ERR: Failed to parse water depth packet.");
+        m_logManager->Syslog(t.printable() + ": ERR: Failed to parse water depth packet.", logger::CONSOLE_NMEA2000);
     }
 }
 
@@ -377,7 +414,7 @@ void Logger::HandleCOG(Timestamp::TimeDatum const& t, tN2kMsg const& msg)
             m_logManager->Record(logger::Manager::PacketIDs::Pkt_COG, s);
         }
     } else {
-        m_logManager->Syslog(t.printable() + ": ERR: Failed to parse COG/SOG packet.");
+        m_logManager->Syslog(t.printable() + ": ERR: Failed to parse COG/SOG packet.", logger::CONSOLE_NMEA2000);
     }
 }
 
@@ -442,7 +479,7 @@ void Logger::HandleGNSS(Timestamp::TimeDatum const& t, tN2kMsg const& msg)
             m_logManager->Syslog(String("INFO: Time update to: ") + m_timeReference.printable() + String(" from GNSS record."));
         }
     } else {
-        m_logManager->Syslog(t.printable() + ": ERR: Failed to parse primary GNSS report packet.");
+        m_logManager->Syslog(t.printable() + ": ERR: Failed to parse primary GNSS report packet.", logger::CONSOLE_NMEA2000);
     }
 }
 
@@ -479,7 +516,7 @@ void Logger::HandleEnvironment(Timestamp::TimeDatum const& t, tN2kMsg const& msg
         s += pressure;
         m_logManager->Record(logger::Manager::PacketIDs::Pkt_Environment, s);
     } else {
-        m_logManager->Syslog(t.printable() + ": ERR: Failed to parse environmental parameters packet.");
+        m_logManager->Syslog(t.printable() + ": ERR: Failed to parse environmental parameters packet.", logger::CONSOLE_NMEA2000);
     }
 }
 
@@ -513,7 +550,7 @@ void Logger::HandleTemperature(Timestamp::TimeDatum const& t, tN2kMsg const& msg
             m_logManager->Record(logger::Manager::PacketIDs::Pkt_Temperature, s);
         }
     } else {
-        m_logManager->Syslog(t.printable() + ": ERR: Failed to parse temperature packet.");
+        m_logManager->Syslog(t.printable() + ": ERR: Failed to parse temperature packet.", logger::CONSOLE_NMEA2000);
     }
 }
 
@@ -546,7 +583,7 @@ void Logger::HandleHumidity(Timestamp::TimeDatum const& t, tN2kMsg const& msg)
             m_logManager->Record(logger::Manager::PacketIDs::Pkt_Humidity, s);
         }
     } else {
-        m_logManager->Syslog(t.printable() + ": ERR: Failed to parse humidity packet.");
+        m_logManager->Syslog(t.printable() + ": ERR: Failed to parse humidity packet.", logger::CONSOLE_NMEA2000);
     }
 }
 
@@ -579,7 +616,7 @@ void Logger::HandlePressure(Timestamp::TimeDatum const& t, tN2kMsg const& msg)
             m_logManager->Record(logger::Manager::PacketIDs::Pkt_Pressure, s);
         }
     } else {
-        m_logManager->Syslog(t.printable() + ": ERR: Failed to parse pressure packet.");
+        m_logManager->Syslog(t.printable() + ": ERR: Failed to parse pressure packet.", logger::CONSOLE_NMEA2000);
     }
 }
 
@@ -612,7 +649,7 @@ void Logger::HandleExtTemperature(Timestamp::TimeDatum const& t, tN2kMsg const&
             m_logManager->Record(logger::Manager::PacketIDs::Pkt_Temperature, s);
         }
     } else {
-        m_logManager->Syslog(t.printable() + ": ERR: Failed to parse temperature packet.");
+        m_logManager->Syslog(t.printable() + ": ERR: Failed to parse temperature packet.", logger::CONSOLE_NMEA2000);
     }
 }
 
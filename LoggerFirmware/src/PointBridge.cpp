@@ -3,7 +3,8 @@
  *
  * This code implements the functionality to capture broadcast UDP packets from the WiFi
  * and transmit them on the first NMEA0183 channel (assuming that it's enabled on the
- * hardware).
+ * hardware).  Packets are queued by the network task, and written to the UART by a background
+ * task paced to the baud rate.
  *
  * Copyright (c) 2021, University of New Hampshire, Center for Coastal and Ocean Mapping.
  *
@@ -24,6 +25,9 @@
  * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <string.h>
+#include <algorithm>
+#include "esp_timer.h"
 #include "PointBridge.h"
 #include "AsyncUDP.h"
 #include "Configuration.h"
@@ -31,31 +35,133 @@
 namespace nmea {
 namespace N0183 {
 
+const uint32_t BitsPerByte = 10;    ///< Bits on the line for each byte (8N1: start, eight data, stop)
+
+static_assert((BridgeRingSize & (BridgeRingSize - 1)) == 0, "bridge queue size must be a power of two");
+
+/// Default constructor for the bridge counts.
+
+BridgeMetrics::BridgeMetrics(void)
+: packets(0), received(0), dropped(0), lost(0), highWater(0), writes(0), written(0), fragments(0)
+{
+}
+
+/// Generate a JSON document with the bridge counts: packets and bytes received from the network, sentences
+/// and bytes dropped because the queue was full, the most bytes that have been waiting in the queue, writes
+/// and bytes to the UART, and partial sentences written after waiting too long for their end.
+///
+/// \return JSON document with the bridge summary
+
+DynamicJsonDocument BridgeMetrics::Render(void) const
+{
+    DynamicJsonDocument doc(256);
+    doc["packets"] = packets;
+    doc["received"] = received;
+    doc["dropped"] = dropped;
+    doc["lost"] = lost;
+    doc["highwater"] = highWater;
+    doc["capacity"] = BridgeRingSize;
+    doc["writes"] = writes;
+    doc["written"] = written;
+    doc["fragments"] = fragments;
+    return doc;
+}
+
+BridgeMetrics BridgeStats;  ///< Static parameter for bridge statistics
+
+/// Constructor for the queue, allocating the buffer.
+///
+/// \param size Size of the buffer (bytes), which must be a power of two
+
+ByteRing::ByteRing(uint32_t size)
+: m_buffer(new uint8_t[size]), m_size(size), m_head(0), m_tail(0)
+{
+}
+
+/// Default destructor, releasing the buffer.
+
+ByteRing::~ByteRing(void)
+{
+    delete[] m_buffer;
+}
+
+/// Add a block of data to the queue, so long as all of it fits.  This must only be called by the producer.
+///
+/// \param data Data to add
+/// \param n    Number of bytes to add
+/// \return True if the data was added, otherwise False (and nothing was added)
+
+bool ByteRing::Put(const uint8_t *data, uint32_t n)
+{
+    uint32_t head = m_head.load(std::memory_order_relaxed);
+    uint32_t tail = m_tail.load(std::memory_order_acquire);
+    if (m_size - (head - tail) < n) return false;
+    uint32_t at = head & (m_size - 1);
+    uint32_t first = std::min(n, m_size - at);
+    memcpy(m_buffer + at, data, first);
+    memcpy(m_buffer, data + first, n - first);
+    m_head.store(head + n, std::memory_order_release);
+    return true;
+}
+
+/// Copy data from the front of the queue, without removing it (so that the consumer can decide how much to
+/// use, and then \a Consume() that much).  This must only be called by the consumer.
+///
+/// \param data (Out) Buffer for the data
+/// \param n    Size of the buffer (bytes)
+/// \return Number of bytes copied
+
+uint32_t ByteRing::Peek(uint8_t *data, uint32_t n) const
+{
+    uint32_t tail = m_tail.load(std::memory_order_relaxed);
+    uint32_t head = m_head.load(std::memory_order_acquire);
+    n = std::min(n, head - tail);
+    uint32_t at = tail & (m_size - 1);
+    uint32_t first = std::min(n, m_size - at);
+    memcpy(data, m_buffer + at, first);
+    memcpy(data + first, m_buffer, n - first);
+    return n;
+}
+
 /// Bring up a UDP to RS-422 packet bridge that captures packets on a known UDP broadcast port via the
 /// WiFi interface, and passes them to the first RS-422 serial interface, making the system into a transmitter
-/// as well as a receiver.
+/// as well as a receiver.  The drain task is started before listening, so that it's there for the first packet.
 
 PointBridge::PointBridge(void)
-: m_verbose(false)
+: m_bridge(nullptr), m_verbose(false), m_coalesce(false), m_baudRate(4800), m_ring(BridgeRingSize), m_task(nullptr)
 {
-    m_bridge = new AsyncUDP();
-    String port;
+    String port, baud;
     uint16_t port_number;
     logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_BRIDGE_PORT_S, port);
     if (port.isEmpty()) {
-        port_number = 40181;
+        port_number = DefaultBridgePort;
     } else {
         port_number = port.toInt();
     }
+    logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_BAUDRATE_1_S, baud);
+    if (baud.toInt() > 0) m_baudRate = baud.toInt();
+    if (!logger::LoggerConfig.GetConfigBinary(logger::Config::ConfigParam::CONFIG_BRIDGE_COALESCE_B, m_coalesce))
+        m_coalesce = false;
+    if (xTaskCreatePinnedToCore(worker, "bridge", BridgeStackSize, this, tskIDLE_PRIORITY + 1,
+                                &m_task, BridgeCore) != pdPASS) {
+        Serial.println("ERR: failed to start UDP bridge task.");
+        m_task = nullptr;
+        return;
+    }
+    m_bridge = new AsyncUDP();
     if (m_bridge->listen(IP_ADDR_BROADCAST, port_number)) {
         Serial.println("INFO: UDP bridge connected.");
         m_bridge->onPacket(std::bind(&PointBridge::HandlePacket, this, std::placeholders::_1));
     }
 }
 
+/// Default destructor.  The UDP interface goes first, so that nothing more is queued, and then the drain
+/// task (anything still in the queue is lost).
+
 PointBridge::~PointBridge(void)
 {
     delete m_bridge;
+    if (m_task != nullptr) vTaskDelete(m_task);
 }
 
 /// Configure the bridge for verbose mode, where it reports all of the packets being transferred to the
@@ -69,19 +175,130 @@ void PointBridge::SetVerbose(bool state)
 }
 
 /// Call-back member function to handle the reception of a packet on the asynchronous UDP thread.  This
-/// provides simple logging, and routes the data out through the first RS-422 interface (Serial1)
+/// runs in the network task, so it only queues the data for the drain task: each sentence goes into the
+/// queue whole, or (if there isn't room) is dropped and counted, so that what gets to the UART is never a
+/// sentence with a piece missing from the middle.
 ///
 /// \param packet   Packet of UDP information to transfer to output serial
 
 void PointBridge::HandlePacket(AsyncUDPPacket& packet)
 {
-    Serial1.write(packet.data(), packet.length());
-    if (m_verbose) {
-        Serial.print("DBG: wrote :");
-        Serial.write(packet.data(), packet.length());
-        Serial.println("");
+    const uint8_t *data = packet.data();
+    uint32_t remaining = packet.length();
+    ++BridgeStats.packets;
+    BridgeStats.received += remaining;
+    while (remaining > 0) {
+        const uint8_t *end = static_cast<const uint8_t*>(memchr(data, '\n', remaining));
+        uint32_t n = end == nullptr ? remaining : end - data + 1;
+        if (!m_ring.Put(data, n)) {
+            ++BridgeStats.dropped;
+            BridgeStats.lost += n;
+        }
+        data += n;
+        remaining -= n;
     }
+    uint32_t used = m_ring.Used();
+    if (used > BridgeStats.highWater) BridgeStats.highWater = used;
+    xTaskNotifyGive(m_task);
 }
 
+/// Work out how much of the data at the front of the queue to write next.  The unit of writing is the first
+/// sentence (or, if there's no end of sentence in the data, everything there is), and nothing is written
+/// until there's credit for all of it; after that, as much more as the credit covers is written, up to the
+/// end of the last whole sentence.  With coalescing on, a partial sentence isn't written at all unless it
+/// fills the buffer, or it's been waiting too long for its end (\a flush).
+///
+/// \param data     Data at the front of the queue
+/// \param n        Number of bytes of data
+/// \param credit   Number of bytes that can be written at the baud rate
+/// \param flush    Flag: True => write a partial sentence that's been held too long
+/// \param needed   (Out) Credit needed to write the next unit, or zero if waiting for more data
+/// \return Number of bytes to write now (zero if nothing)
+
+uint32_t PointBridge::nextWrite(const uint8_t *data, uint32_t n, uint32_t credit, bool flush, uint32_t& needed) const
+{
+    const uint8_t *end = static_cast<const uint8_t*>(memchr(data, '\n', n));
+    uint32_t unit = end == nullptr ? n : end - data + 1;
+    needed = 0;
+    if (end == nullptr && m_coalesce && !flush && n < BridgeChunkSize) return 0;
+    if (credit < unit) {
+        needed = unit;
+        return 0;
+    }
+    if (end == nullptr) return unit;
+    uint32_t limit = std::min(n, credit);
+    while (data[limit - 1] != '\n') --limit;
+    return limit;
+}
+
+/// Entry point for the background task, which writes from the queue to the UART.  Credit for writing
+/// builds up at the baud rate (up to \a BridgeChunkSize), and each write uses it up, so the task waits
+/// (for the credit, for more data, or for the end of a partial sentence) rather than blocking on the UART.
+///
+/// \param param    Pointer to the \a PointBridge that owns the task
+
+void PointBridge::worker(void *param)
+{
+    PointBridge *self = static_cast<PointBridge*>(param);
+    uint8_t chunk[BridgeChunkSize];
+    uint32_t credit = BridgeChunkSize;
+    int64_t last = esp_timer_get_time();
+    bool holding = false;
+    unsigned long held_since = 0;
+    TickType_t wait = portMAX_DELAY;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        uint32_t baud = Serial1.baudRate();
+        uint32_t rate = std::max<uint32_t>((baud > 0 ? baud : self->m_baudRate) / BitsPerByte, 1);  // bytes/s
+        int64_t now = esp_timer_get_time();
+        uint32_t earned = static_cast<uint32_t>((now - last) * rate / 1000000);
+        if (credit + earned >= BridgeChunkSize) {
+            credit = BridgeChunkSize;
+            last = now;
+        } else if (earned > 0) {
+            credit += earned;
+            last += static_cast<int64_t>(earned) * 1000000 / rate;
+        }
+
+        uint32_t n = self->m_ring.Peek(chunk, BridgeChunkSize);
+        if (n == 0) {
+            holding = false;
+            wait = portMAX_DELAY;
+            continue;
+        }
+        bool flush = holding && (millis() - held_since) >= BridgeHoldTime;
+        uint32_t needed;
+        uint32_t count = self->nextWrite(chunk, n, credit, flush, needed);
+        if (count > 0) {
+            Serial1.write(chunk, count);
+            self->m_ring.Consume(count);
+            credit -= count;
+            ++BridgeStats.writes;
+            BridgeStats.written += count;
+            if (self->m_coalesce && chunk[count - 1] != '\n') ++BridgeStats.fragments;
+            if (self->m_verbose) {
+                Serial.print("DBG: wrote :");
+                Serial.write(chunk, count);
+                Serial.println("");
+            }
+            holding = false;
+            wait = 0;
+        } else if (needed > 0) {
+            // Wait for the credit to build up for the next write
+            wait = pdMS_TO_TICKS((needed - credit) * 1000 / rate) + 1;
+        } else {
+            // Hold the partial sentence for its end, but not for ever
+            if (!holding) {
+                holding = true;
+                held_since = millis();
+            }
+            unsigned long held = millis() - held_since;
+            wait = held >= BridgeHoldTime ? 0 : pdMS_TO_TICKS(BridgeHoldTime - held) + 1;
+        }
+    }
+}
+
+}
 }
-}
\ No newline at end of file
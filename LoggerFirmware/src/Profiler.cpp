@@ -0,0 +1,166 @@
+/*! \file Profiler.cpp
+ *  \brief Lightweight latency profiling for the logger's main loop and message handlers
+ *
+ * In order to tune the logger for dense buses, it's necessary to know how long each part of the
+ * main loop takes, and how long it is between successive services of each sub-system (which
+ * determines, e.g., whether the CAN controller overflows).  This module provides a profiler based
+ * on the CPU cycle counter, which keeps log2-bucketed latency histograms for named sections of
+ * code, and has negligible overhead when it is disabled.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "esp_timer.h"
+#include "Profiler.h"
+
+namespace logger {
+
+/// Default constructor for the profiler.  Profiling is off until enabled with the "profile" command.
+
+Profiler::Profiler(void)
+: m_nSections(0), m_enabled(false)
+{
+}
+
+/// Register a named section with the profiler, or find the index of a section that's already been
+/// registered with the same name (so that, e.g., objects that get re-created don't use up sections).
+///
+/// \param name Name of the section (must be a static string, since only the pointer is stored)
+/// \return Index of the section, or -1 if there are no more sections available
+
+int Profiler::Section(const char *name)
+{
+    for (int n = 0; n < m_nSections; ++n) {
+        if (strcmp(m_sections[n].name, name) == 0) return n;
+    }
+    if (m_nSections == MaxProfileSections) {
+        Serial.printf("ERR: no more profiler sections available for \"%s\".\n", name);
+        return -1;
+    }
+    m_sections[m_nSections].name = name;
+    clear(m_sections[m_nSections]);
+    return m_nSections++;
+}
+
+/// Clear the statistics for all of the registered sections.
+
+void Profiler::Reset(void)
+{
+    for (int n = 0; n < m_nSections; ++n) clear(m_sections[n]);
+}
+
+/// Clear the statistics for a single section.
+///
+/// \param h    Section statistics to clear
+
+void Profiler::clear(Histogram& h)
+{
+    for (int b = 0; b < ProfileBuckets; ++b) h.buckets[b] = 0;
+    h.count = 0;
+    h.total = 0;
+    h.longest = 0;
+    h.lastService = 0;
+    h.maxGap = 0;
+}
+
+/// Add the cycles used for a single service of a section to its statistics, and update the gap between
+/// successive services.  The bucket is the position of the most significant set bit in the cycle count.
+///
+/// \param section  Index of the section (as returned by \a Section())
+/// \param start    Cycle count at the start of the service (as returned by \a Start())
+
+void Profiler::record(int section, uint32_t start)
+{
+    if (section < 0 || section >= m_nSections) return;
+    uint32_t cycles = ESP.getCycleCount() - start;
+    int64_t now = esp_timer_get_time();
+    Histogram& h = m_sections[section];
+
+    ++h.buckets[31 - __builtin_clz(cycles | 1)];
+    ++h.count;
+    h.total += cycles;
+    if (cycles > h.longest) h.longest = cycles;
+    if (h.lastService != 0) {
+        uint32_t gap = static_cast<uint32_t>(now - h.lastService);
+        if (gap > h.maxGap) h.maxGap = gap;
+    }
+    h.lastService = now;
+}
+
+/// Find the last non-zero bucket in the histogram for a section, after which the histogram is truncated
+/// for reporting.
+///
+/// \param h   Statistics for the section
+/// \return Index of the last non-zero bucket (or zero, if there are none)
+
+int Profiler::lastBucket(Histogram const& h)
+{
+    int last = ProfileBuckets - 1;
+    while (last > 0 && h.buckets[last] == 0) --last;
+    return last;
+}
+
+/// Generate a JSON document with the profile for each section that has been serviced since the last
+/// reset.  Times are converted to microseconds using the current CPU clock rate; the histogram is
+/// reported in cycles (bucket N covering [2^N, 2^(N+1)) cycles), truncated after the last non-zero
+/// bucket.  "gap" is the longest time between successive services, and "since" the time since the
+/// last service.
+///     The document is sized for the sections and buckets actually reported (section names are static
+/// strings, and are therefore not copied), so that a profile with few active sections, or short
+/// histograms, doesn't take a worst-case allocation from the heap.
+///
+/// \return JSON document with the profile summary
+
+DynamicJsonDocument Profiler::Render(void) const
+{
+    int active = 0;
+    size_t capacity = JSON_OBJECT_SIZE(3);
+    for (int n = 0; n < m_nSections; ++n) {
+        if (m_sections[n].count == 0) continue;
+        ++active;
+        capacity += JSON_OBJECT_SIZE(6) + JSON_ARRAY_SIZE(lastBucket(m_sections[n]) + 1);
+    }
+    capacity += JSON_OBJECT_SIZE(active);
+
+    DynamicJsonDocument doc(capacity);
+    double mhz = getCpuFrequencyMhz();
+    int64_t now = esp_timer_get_time();
+
+    doc["enabled"] = m_enabled;
+    doc["mhz"] = static_cast<int>(mhz);
+    for (int n = 0; n < m_nSections; ++n) {
+        Histogram const& h = m_sections[n];
+        if (h.count == 0) continue;
+        JsonObject section = doc["sections"].createNestedObject(h.name);
+        section["count"] = h.count;
+        section["mean"] = h.total / (mhz * h.count);
+        section["max"] = h.longest / mhz;
+        section["gap"] = h.maxGap;
+        section["since"] = static_cast<uint32_t>(now - h.lastService);
+        int last = lastBucket(h);
+        JsonArray buckets = section.createNestedArray("buckets");
+        for (int b = 0; b <= last; ++b) buckets.add(h.buckets[b]);
+    }
+    return doc;
+}
+
+Profiler Profile;   ///< Static parameter to use for profiling
+
+}
@@ -0,0 +1,182 @@
+/*! \file Scheduler.cpp
+ *  \brief Cooperative scheduler for the sub-systems serviced by the main loop
+ *
+ * Each sub-system that needs service from the main loop registers as a task with a priority, a
+ * time budget for each invocation, and the set of events that make it runnable.  The scheduler then
+ * runs the tasks in priority order when their events arrive, accounting for the time that each
+ * uses, so that data ingest gets serviced regardless of what the network side of the logger is doing.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "esp_timer.h"
+#include "Scheduler.h"
+#include "EventLoop.h"
+#include "Profiler.h"
+#include "HeapMonitor.h"
+#include "Trace.h"
+
+namespace logger {
+
+/// Default constructor for the scheduler.  Tasks are added with \a Register().
+
+Scheduler::Scheduler(void)
+: m_deadline(0)
+{
+}
+
+/// Default destructor for the scheduler.
+
+Scheduler::~Scheduler(void)
+{
+}
+
+/// Register a task with the scheduler.  The task list is kept in priority order (with tasks of the
+/// same priority in the order they were registered) so that \a Dispatch() can simply run the first
+/// pending task in the list.
+///
+/// \param name     Name of the task for reporting (must be a static string)
+/// \param priority Priority class for the task
+/// \param budget   Time budget (us) for each invocation of the task
+/// \param events   Mask of \a EventSource flags that make the task runnable
+/// \param slice    Function to call for each invocation; returns True if more work remains
+
+void Scheduler::Register(const char *name, TaskPriority priority, uint32_t budget, uint32_t events, Slice slice)
+{
+    Task task;
+    task.name = name;
+    task.priority = priority;
+    task.budget = budget;
+    task.events = events;
+    task.slice = slice;
+    task.pending = false;
+    task.resume = false;
+    task.runs = 0;
+    task.overruns = 0;
+    task.worst = 0;
+    task.section = Profile.Section(name);
+    task.heapTag = HeapTags.Tag(name);
+    task.traceName = Tracer.Name(name);
+
+    std::vector<Task>::iterator it = m_tasks.begin();
+    while (it != m_tasks.end() && it->priority <= priority) ++it;
+    m_tasks.insert(it, task);
+}
+
+/// Mark as runnable all of the tasks that respond to any of the given events.
+///
+/// \param events   Bit-set of \a EventSource flags that have arrived
+
+void Scheduler::markPending(uint32_t events)
+{
+    if (events == 0) return;
+    for (size_t n = 0; n < m_tasks.size(); ++n) {
+        if (m_tasks[n].events & events) m_tasks[n].pending = true;
+    }
+}
+
+/// Run all of the tasks made runnable by the events given, in priority order.  After each task, any
+/// events that have arrived in the meantime are collected so that (e.g.) CAN bus service is run before
+/// any lower-priority tasks that remain.  Tasks that report more work remaining are not run again in the
+/// same pass; they are marked to resume and a \a EVT_RESUME event is posted so that the loop comes
+/// straight back after checking for other work.
+///
+/// \param events   Bit-set of \a EventSource flags returned by the event loop
+
+void Scheduler::Dispatch(uint32_t events)
+{
+    markPending(events);
+    while (true) {
+        Task *task = nullptr;
+        for (size_t n = 0; n < m_tasks.size(); ++n) {
+            if (m_tasks[n].pending) {
+                task = &m_tasks[n];
+                break;
+            }
+        }
+        if (task == nullptr) break;
+
+        task->pending = false;
+        int64_t start = esp_timer_get_time();
+        uint32_t cycles = Profile.Start();
+        m_deadline = start + task->budget;
+        HeapTags.Push(task->heapTag);
+        Tracer.Emit(TRACE_TASK_BEGIN, task->traceName);
+        bool more = task->slice();
+        Tracer.Emit(TRACE_TASK_END, task->traceName, more ? 1 : 0);
+        HeapTags.Pop();
+        Profile.Stop(task->section, cycles);
+        uint32_t elapsed = static_cast<uint32_t>(esp_timer_get_time() - start);
+        m_deadline = 0;
+
+        ++task->runs;
+        if (elapsed > task->worst) task->worst = elapsed;
+        if (elapsed > task->budget) ++task->overruns;
+        if (more) task->resume = true;
+
+        markPending(Events.Poll());
+    }
+
+    bool resume = false;
+    for (size_t n = 0; n < m_tasks.size(); ++n) {
+        if (m_tasks[n].resume) {
+            m_tasks[n].resume = false;
+            m_tasks[n].pending = true;
+            resume = true;
+        }
+    }
+    if (resume) Events.Post(EVT_RESUME);
+}
+
+/// Determine whether the task currently being run has used up its time budget for this invocation.
+/// Long operations should check this periodically, and return (indicating more work) if it has.
+/// Outside of a task, this always returns False.
+///
+/// \return True if the current task should yield, otherwise False
+
+bool Scheduler::SliceExpired(void) const
+{
+    if (m_deadline == 0) return false;
+    return esp_timer_get_time() > m_deadline;
+}
+
+/// Generate a JSON document with the run-time statistics for each of the registered tasks: priority,
+/// budget (us), number of runs, number of runs that exceeded the budget, and worst-case run-time (us).
+///
+/// \return JSON document with the scheduler summary
+
+DynamicJsonDocument Scheduler::Render(void) const
+{
+    DynamicJsonDocument doc(128 + 160*m_tasks.size());
+    JsonArray tasks = doc.createNestedArray("tasks");
+    for (size_t n = 0; n < m_tasks.size(); ++n) {
+        JsonObject task = tasks.createNestedObject();
+        task["name"] = m_tasks[n].name;
+        task["priority"] = static_cast<int>(m_tasks[n].priority);
+        task["budget"] = m_tasks[n].budget;
+        task["runs"] = m_tasks[n].runs;
+        task["overruns"] = m_tasks[n].overruns;
+        task["worst"] = m_tasks[n].worst;
+    }
+    return doc;
+}
+
+Scheduler Tasks;    ///< Static parameter to use for scheduling the main loop
+
+}
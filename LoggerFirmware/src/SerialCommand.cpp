@@ -28,7 +28,6 @@
 #include "ArduinoJson.h"
 #include "WiFiAdapter.h"
 #include "SerialCommand.h"
-#include "IncrementalBuffer.h"
 #include "OTAUpdater.h"
 #include "Configuration.h"
 #include "HeapMonitor.h"
@@ -36,10 +35,18 @@
 #include "IMULogger.h"
 #include "DataMetrics.h"
 #include "Status.h"
+#include "Scheduler.h"
+#include "Profiler.h"
+#include "Trace.h"
+#include "BenchmarkRunner.h"
+#include "TransferRunner.h"
 
 const uint32_t CommandMajorVersion = 1;
-const uint32_t CommandMinorVersion = 4;
-const uint32_t CommandPatchVersion = 1;
+const uint32_t CommandMinorVersion = 5;
+const uint32_t CommandPatchVersion = 0;
+
+const size_t SerialLineStartSize = 128;     ///< Line buffer for serial commands (grows for long commands)
+const size_t SerialLineMaxSize = 16384;     ///< Longest serial command accepted (bytes), e.g., for JSON setup
 
 /// Default constructor for the SerialCommand object.  This stores the pointers for the logger and
 /// status LED controllers for reference, and then generates a BLE service object.  This turns on
@@ -52,17 +59,17 @@ const uint32_t CommandPatchVersion = 1;
 
 SerialCommand::SerialCommand(nmea::N2000::Logger *CANLogger, nmea::N0183::Logger *serialLogger,
                              logger::Manager *logManager, StatusLED *led)
-: m_CANLogger(CANLogger), m_serialLogger(serialLogger), m_logManager(logManager), m_led(led), m_echoOn(true), m_passThrough(false)
+: m_CANLogger(CANLogger), m_serialLogger(serialLogger), m_live(nullptr), m_logManager(logManager), m_led(led),
+  m_serialLine(SerialLineStartSize, SerialLineMaxSize), m_chunkStart(0), m_chunkEnd(0), m_echoOn(true), m_passThrough(false)
 {
     logger::HeapMonitor heap;
 
     Serial.printf("DBG: Before SerialCommand setup, heap free = %d B\n", heap.CurrentSize());
 
-    m_serialBuffer.ResetLength(1024);
-
     // WiFi always gets created, since we'll need it eventually to get data off.  The only question is
     // whether it gets started when the system first somes up or not.
     m_wifi = WiFiAdapterFactory::Create();
+    m_wifi->SetLogManager(m_logManager);
 
     Serial.printf("DBG: After WiFi interface create, heap free = %d B, delta = %d B\n",
         heap.CurrentSize(), heap.DeltaSinceLast());
@@ -88,11 +95,14 @@ SerialCommand::SerialCommand(nmea::N2000::Logger *CANLogger, nmea::N0183::Logger
             logger::LoggerConfig.GetConfigBinary(logger::Config::ConfigParam::CONFIG_UPLOAD_B, start_autoupload);
             if (start_autoupload) {
                 m_uploadManager = new net::UploadManager(m_logManager);
+                m_uploadManager->Begin();
                 Serial.printf("DBG: After UploadManager start, heap free = %d B, delta = %d B\n",
                     heap.CurrentSize(), heap.DeltaSinceLast());
             } else {
                 m_uploadManager = nullptr;
             }
+
+            startLive();
         } else {
             Serial.printf("ERR: Failed to start WiFi interface.\n");
         }
@@ -105,6 +115,7 @@ SerialCommand::SerialCommand(nmea::N2000::Logger *CANLogger, nmea::N0183::Logger
 
 SerialCommand::~SerialCommand()
 {
+    stopLive();
     delete m_uploadManager;
     delete m_bridge;
     delete m_wifi;
@@ -197,8 +208,9 @@ void SerialCommand::EraseLogfile(String const& filenum, CommandSource src)
 /// directly.  Allowed states are "normal", "error", "initialising", and "full".
 ///
 /// \param command  Command string for LED status to set
+/// \param src      Stream by which the command arrived
 
-void SerialCommand::ModifyLEDState(String const& command)
+void SerialCommand::ModifyLEDState(String const& command, CommandSource src)
 {
     if (command == "normal") {
         m_led->SetStatus(StatusLED::Status::sNORMAL);
@@ -213,7 +225,7 @@ void SerialCommand::ModifyLEDState(String const& command)
     } else if (command == "stopped") {
         m_led->SetStatus(StatusLED::Status::sSTOPPED);
     } else {
-        Serial.println("ERR: LED status command not recognised.");
+        EmitMessage("ERR: LED status command not recognised.\n", src);
     }
 }
 
@@ -304,8 +316,9 @@ void SerialCommand::SetShipname(String const& name, CommandSource src)
 /// options are "on" and "off".
 ///
 /// \param mode String with "on" or "off" to configure verbose reporting mode
+/// \param src  Stream by which the command arrived
 
-void SerialCommand::SetVerboseMode(String const& mode)
+void SerialCommand::SetVerboseMode(String const& mode, CommandSource src)
 {
     if (mode == "on") {
         if (m_CANLogger != nullptr) m_CANLogger->SetVerbose(true);
@@ -316,7 +329,7 @@ void SerialCommand::SetVerboseMode(String const& mode)
         if (m_serialLogger != nullptr) m_serialLogger->SetVerbose(false);
         if (m_bridge != nullptr) m_bridge->SetVerbose(false);
     } else {
-        Serial.println("ERR: verbose mode not recognised.");
+        EmitMessage("ERR: verbose mode not recognised.\n", src);
     }
 }
 
@@ -338,6 +351,58 @@ void SerialCommand::Shutdown(void)
     // for power-down.
 }
 
+/// Shut down the logger for safe removal of power, in response to the "stop" command.
+///
+/// \param src  Stream by which the command arrived
+
+void SerialCommand::StopLogging(CommandSource src)
+{
+    Shutdown();
+}
+
+/// Close the current log file, and start the next one in sequence.  On WiFi, the client gets the current
+/// status in return, so that it can see the new file.
+///
+/// \param src  Stream by which the command arrived
+
+void SerialCommand::StepLog(CommandSource src)
+{
+    m_logManager->CloseLogfile();
+    m_logManager->StartNewLog();
+    if (src == CommandSource::WirelessPort && m_wifi != nullptr) {
+        ReportCurrentStatus(src);
+    }
+}
+
+/// Restart the logger immediately (without closing files, as for a power cycle).
+///
+/// \param src  Stream by which the command arrived
+
+void SerialCommand::Restart(CommandSource src)
+{
+    ESP.restart();
+}
+
+/// Start an over-the-air firmware update.  This puts the logger into a loop that ends with a full reset.
+///
+/// \param src  Stream by which the command arrived
+
+void SerialCommand::StartOTA(CommandSource src)
+{
+    EmitMessage("Starting OTA update sequence ...\n", src);
+    OTAUpdater updater;
+}
+
+/// Stealth command to turn on "pass through" mode (see \a ConfigurePassthrough()).  This is intentionally
+/// not in the syntax list: it really is just for debugging.
+///
+/// \param src  Stream by which the command arrived
+
+void SerialCommand::StartPassthrough(CommandSource src)
+{
+    ConfigurePassthrough("on", src);
+}
+
 /// Specify the SSID string to use for the WiFi interface.
 ///
 /// \param ssid SSID to use for the WiFi, when activated
@@ -495,6 +560,7 @@ void SerialCommand::ManageWireless(String const& command, CommandSource src)
                 } else {
                     m_bridge = nullptr;
                 }
+                if (m_live == nullptr) startLive();
             } else {
                 Serial.println("ERR: WiFi startup failed");
             }
@@ -517,6 +583,7 @@ void SerialCommand::ManageWireless(String const& command, CommandSource src)
                 m_bridge = nullptr;
                 Serial.printf("DBG: After UDP bridge stopped, heap free = %d B, delta = %d B\n", heap.CurrentSize(), heap.DeltaSinceLast());
             }
+            stopLive();
         } else {
             EmitMessage("ERR: manual wireless shutdown can only be done on serial line.", src);
             if (src == CommandSource::WirelessPort && m_wifi != nullptr)
@@ -543,19 +610,37 @@ void SerialCommand::ManageWireless(String const& command, CommandSource src)
 /// Send a log file to the client (so long as it isn't on BLE, which is way too slow!).  This sends
 /// plain binary 8-bit data to the client, which needs to know how to deal with that.  This
 /// generally means it really only works on the WiFi connection.
+///     On the serial port, "transfer block file-number" sends the file with the block transfer protocol
+/// instead, which checks and re-sends each block, and recovers from anything else written to the port
+/// while the file is going.  The transfer runs in the background, and has the port until it finishes.
 ///
-/// \param filenum      Log file number to transfer
+/// \param command  Log file number to transfer, optionally preceded by "block"
 /// \param src      Stream by which the command arrived.
 
-void SerialCommand::TransferLogFile(String const& filenum, CommandSource src)
+void SerialCommand::TransferLogFile(String const& command, CommandSource src)
 {
+    String          filenum(command);
+    bool            block = false;
     String          filename;
     uint32_t        filesize;
     uint16_t        uploadCount;
     uint32_t        file_number = filenum.toInt();
     logger::Manager::MD5Hash filehash;
     unsigned long   tx_start, tx_end, tx_duration;
-   
+
+    if (filenum.startsWith("block")) {
+        block = true;
+        filenum = filenum.substring(6);
+        filenum.trim();
+        file_number = filenum.toInt();
+        if (src != CommandSource::SerialPort) {
+            EmitMessage("ERR: block transfer is only available on the serial port.\n", src);
+            if (src == CommandSource::WirelessPort && m_wifi != nullptr) {
+                m_wifi->SetStatusCode(WiFiAdapter::HTTPReturnCodes::BADREQUEST);
+            }
+            return;
+        }
+    }
     m_logManager->EnumerateLogFile(file_number, filename, filesize, filehash, uploadCount);
     if (filesize == 0) {
         // This implies File Not Found (since all log files have at least the serialiser
@@ -573,7 +658,13 @@ void SerialCommand::TransferLogFile(String const& filenum, CommandSource src)
     }
     switch (src) {
         case CommandSource::SerialPort:
-            m_logManager->TransferLogFile(file_number, filehash, Serial);
+            if (block) {
+                if (logger::Transfer.Start(m_logManager->FileSystem(), filename, filesize, filehash.Hash())) {
+                    m_logManager->Syslog(String("INFO: started block transfer of ") + filename + ".");
+                }
+            } else {
+                m_logManager->TransferLogFile(file_number, filehash, Serial);
+            }
             break;
         case CommandSource::WirelessPort:
             Serial.printf("DBG: Transferring \"%s\", total %u bytes.\n", filename.c_str(), filesize);
@@ -675,6 +766,8 @@ void SerialCommand::ConfigureSerialPortSpeed(String const& params, CommandSource
 ///     power       on | off                Power monitoring and emergency shutdown
 ///     sdio        on | off                SD/MMC interface for SD card (otherwise SPI)
 ///     bridge      on <port-number> | off  UDP->RS-422 bridge (port number for the UDP broadcast packet)
+///     live        on [<address> <port> [<ids>]] | off
+///                                         UDP live data stream (address, port, and comma-separated packet IDs)
 ///
 /// \param params   Parameters for the command: on|off <optional>
 /// \param src      Channel to report information on (Serial, WiFi, BLE)
@@ -705,6 +798,10 @@ void SerialCommand::ConfigureLoggers(String const& params, CommandSource src)
         logger::LoggerConfig.SetConfigBinary(logger::Config::ConfigParam::CONFIG_MOTION_B, state);
     } else if (logger.startsWith("power")) {
         logger::LoggerConfig.SetConfigBinary(logger::Config::ConfigParam::CONFIG_POWMON_B, state);
+    } else if (logger.startsWith("metrics")) {
+        logger::LoggerConfig.SetConfigBinary(logger::Config::ConfigParam::CONFIG_METRICS_B, state);
+    } else if (logger.startsWith("compress")) {
+        logger::LoggerConfig.SetConfigBinary(logger::Config::ConfigParam::CONFIG_COMPRESS_B, state);
     } else if (logger.startsWith("sdio")) {
 #ifndef DEBUG_NEMO30
         if (!state) {
@@ -715,16 +812,49 @@ void SerialCommand::ConfigureLoggers(String const& params, CommandSource src)
         logger::LoggerConfig.SetConfigBinary(logger::Config::ConfigParam::CONFIG_SDMMC_B, state);
     } else if (logger.startsWith("bridge")) {
         if (state) {
-            // If we're configuring on, then there should also be a port number
+            // If we're configuring on, then there should also be a port number, and optionally
+            // "coalesce" to only write whole sentences to the serial output
             String port = logger.substring(7);
+            port.trim();
+            bool coalesce = false;
+            int space = port.indexOf(' ');
+            if (space >= 0) {
+                coalesce = port.substring(space + 1).startsWith("coalesce");
+                port = port.substring(0, space);
+            }
             uint16_t port_number = port.toInt();
             if (port_number < 1024) {
                 EmitMessage("ERR: UDP bridge port is not valid.\n", src);
                 return;
             }
             logger::LoggerConfig.SetConfigString(logger::Config::ConfigParam::CONFIG_BRIDGE_PORT_S, port);
+            logger::LoggerConfig.SetConfigBinary(logger::Config::ConfigParam::CONFIG_BRIDGE_COALESCE_B, coalesce);
         }
         logger::LoggerConfig.SetConfigBinary(logger::Config::ConfigParam::CONFIG_BRIDGE_B, state);
+    } else if (logger.startsWith("live")) {
+        if (state && logger.length() > 5) {
+            // Optionally, the destination address and port, and a packet filter
+            String args = logger.substring(5);
+            args.trim();
+            int space = args.indexOf(' ');
+            String address = space < 0 ? args : args.substring(0, space);
+            String port = space < 0 ? "" : args.substring(space + 1);
+            String filter;
+            space = port.indexOf(' ');
+            if (space >= 0) {
+                filter = port.substring(space + 1);
+                port = port.substring(0, space);
+            }
+            IPAddress check;
+            if (!check.fromString(address) || port.toInt() < 1024 || port.toInt() > 65535) {
+                EmitMessage("ERR: live data stream address or port is not valid.\n", src);
+                return;
+            }
+            logger::LoggerConfig.SetConfigString(logger::Config::ConfigParam::CONFIG_LIVE_ADDRESS_S, address);
+            logger::LoggerConfig.SetConfigString(logger::Config::ConfigParam::CONFIG_LIVE_PORT_S, port);
+            logger::LoggerConfig.SetConfigString(logger::Config::ConfigParam::CONFIG_LIVE_FILTER_S, filter);
+        }
+        logger::LoggerConfig.SetConfigBinary(logger::Config::ConfigParam::CONFIG_LIVE_B, state);
     } else {
         EmitMessage("ERR: logger name not recognised.\n", src);
     }
@@ -791,6 +921,16 @@ void SerialCommand::ReportConfigurationJSON(CommandSource src, bool secure)
     }
 }
 
+/// Report the current configuration of the logger using JSON formatting, in response to the "setup"
+/// command with no arguments.  Passwords are not included.
+///
+/// \param src  Command channel that provided the command (and therefore gets the result)
+
+void SerialCommand::ReportSetup(CommandSource src)
+{
+    ReportConfigurationJSON(src);
+}
+
 /// Provide summary report of all of the configuration parameters being managed by the Confgiuration
 /// module.  Some of this information can be determined from other locations, but this might be simpler
 /// for some purposes (e.g., getting a synoptic list of all of the configuration parameters to set up
@@ -822,6 +962,22 @@ void SerialCommand::ReportConfiguration(CommandSource src)
     EmitMessage("  Bridge UDP: ", src);
     logger::LoggerConfig.GetConfigBinary(logger::Config::ConfigParam::CONFIG_BRIDGE_B, bin_param);
     EmitMessage(bin_param ? "on\n" : "off\n", src);
+    EmitMessage("  Bridge Sentence Coalescing: ", src);
+    if (!logger::LoggerConfig.GetConfigBinary(logger::Config::ConfigParam::CONFIG_BRIDGE_COALESCE_B, bin_param))
+        bin_param = false;
+    EmitMessage(bin_param ? "on\n" : "off\n", src);
+    EmitMessage("  Metrics Packets: ", src);
+    if (!logger::LoggerConfig.GetConfigBinary(logger::Config::ConfigParam::CONFIG_METRICS_B, bin_param))
+        bin_param = false;
+    EmitMessage(bin_param ? "on\n" : "off\n", src);
+    EmitMessage("  Compress Logs: ", src);
+    if (!logger::LoggerConfig.GetConfigBinary(logger::Config::ConfigParam::CONFIG_COMPRESS_B, bin_param))
+        bin_param = false;
+    EmitMessage(bin_param ? "on\n" : "off\n", src);
+    EmitMessage("  Live Data UDP: ", src);
+    if (!logger::LoggerConfig.GetConfigBinary(logger::Config::ConfigParam::CONFIG_LIVE_B, bin_param))
+        bin_param = false;
+    EmitMessage(bin_param ? "on\n" : "off\n", src);
 
     EmitMessage("  Webserver: ", src);
     logger::LoggerConfig.GetConfigBinary(logger::Config::ConfigParam::CONFIG_WEBSERVER_B, bin_param);
@@ -845,6 +1001,10 @@ void SerialCommand::ReportConfiguration(CommandSource src)
     logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_UPLOAD_INTERVAL_S, string_param);
     EmitMessage(" " + string_param, src);
     logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_UPLOAD_DURATION_S, string_param);
+    EmitMessage(" " + string_param, src);
+    logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_UPLOAD_LIFETIME_S, string_param);
+    EmitMessage(" " + string_param, src);
+    logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_UPLOAD_ORDER_S, string_param);
     EmitMessage(" " + string_param + "\n", src);
 
     logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_MODULEID_S, string_param);
@@ -869,6 +1029,12 @@ void SerialCommand::ReportConfiguration(CommandSource src)
     EmitMessage("  Serial Channel 2 Speed: " + string_param + " baud\n", src);
     logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_BRIDGE_PORT_S, string_param);
     EmitMessage("  Bridge UDP Port: " + string_param + "\n", src);
+    String live_port, live_filter;
+    logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_LIVE_ADDRESS_S, string_param);
+    logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_LIVE_PORT_S, live_port);
+    logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_LIVE_FILTER_S, live_filter);
+    EmitMessage("  Live Data Destination: " + string_param + ":" + live_port
+        + (live_filter.isEmpty() ? String(" (all packets)") : " (packets " + live_filter + ")") + "\n", src);
 }
 
 /// This pulls from a JSON-format specification all of the parameters required to
@@ -907,6 +1073,234 @@ void SerialCommand::ReportHeapSize(CommandSource src)
     EmitMessage(msg, src);
 }
 
+/// Report the detailed heap state: fragmentation index and history, and the usage attributed to each
+/// of the sub-systems tagged for tracking.  This is reported as JSON either on the serial port
+/// (pretty-printed), or to the WiFi client.
+///
+/// \param src Channel on which the command was received (and the report should be sent)
+
+void SerialCommand::ReportHeapDetail(CommandSource src)
+{
+    DynamicJsonDocument heap(logger::HeapTags.Render());
+
+    if (src == CommandSource::SerialPort) {
+        String json;
+        serializeJsonPretty(heap, json);
+        EmitMessage(json+"\n", src);
+    } else {
+        if (m_wifi != nullptr) {
+            m_wifi->SetMessage(heap);
+        }
+    }
+}
+
+/// Report details of the heap, as selected by the argument to the "heap" command (currently only "detail").
+///
+/// \param command  Detail to report
+/// \param src      Stream by which the command arrived
+
+void SerialCommand::ConfigureHeap(String const& command, CommandSource src)
+{
+    if (command == "detail") {
+        ReportHeapDetail(src);
+    } else {
+        EmitMessage("ERR: heap report \"" + command + "\" not recognised.\n", src);
+        if (src == CommandSource::WirelessPort && m_wifi != nullptr) {
+            m_wifi->SetStatusCode(WiFiAdapter::HTTPReturnCodes::NOTFOUND);
+        }
+    }
+}
+
+/// Report the current latency profile for the main loop, scheduled tasks, and NMEA2000 message
+/// handlers, as accumulated by the profiler since it was last reset.  This is reported as JSON
+/// either on the serial port (pretty-printed), or to the WiFi client.
+///
+/// \param src Channel on which the command was received (and the report should be sent)
+
+void SerialCommand::ReportProfile(CommandSource src)
+{
+    DynamicJsonDocument profile(logger::Profile.Render());
+
+    if (src == CommandSource::SerialPort) {
+        String json;
+        serializeJsonPretty(profile, json);
+        EmitMessage(json+"\n", src);
+    } else {
+        if (m_wifi != nullptr) {
+            m_wifi->SetMessage(profile);
+        }
+    }
+}
+
+/// Turn the latency profiler on or off, or clear the accumulated statistics.  Profiling is off at
+/// boot, since it adds a small overhead to each profiled section.
+///
+/// \param command Command string: "on", "off", or "reset"
+/// \param src     Channel on which the command was received
+
+void SerialCommand::ConfigureProfile(String const& command, CommandSource src)
+{
+    if (command == "on") {
+        logger::Profile.Enable(true);
+    } else if (command == "off") {
+        logger::Profile.Enable(false);
+    } else if (command == "reset") {
+        logger::Profile.Reset();
+    } else {
+        EmitMessage("ERR: profile command not recognised.\n", src);
+        if (src == CommandSource::WirelessPort && m_wifi != nullptr) {
+            m_wifi->SetStatusCode(WiFiAdapter::HTTPReturnCodes::BADREQUEST);
+        }
+        return;
+    }
+    ReportProfile(src);
+}
+
+/// Report the state of the binary event trace (whether it's on, and how many records it holds).  This
+/// is reported as JSON either on the serial port (pretty-printed), or to the WiFi client.
+///
+/// \param src Channel on which the command was received (and the report should be sent)
+
+void SerialCommand::ReportTrace(CommandSource src)
+{
+    DynamicJsonDocument trace(logger::Tracer.Render());
+
+    if (src == CommandSource::SerialPort) {
+        String json;
+        serializeJsonPretty(trace, json);
+        EmitMessage(json+"\n", src);
+    } else {
+        if (m_wifi != nullptr) {
+            m_wifi->SetMessage(trace);
+        }
+    }
+}
+
+/// Turn the binary event trace on or off, discard the records it holds, or dump it.  The dump is
+/// binary, and therefore is only sent on the serial port (in the same way as a log file transfer);
+/// WiFi clients should use the /trace endpoint instead.  Tracing is off at boot, since the ring takes
+/// memory that isn't allocated until it's first used.
+///
+/// \param command Command string: "on", "off", "clear", or "dump"
+/// \param src     Channel on which the command was received
+
+void SerialCommand::ConfigureTrace(String const& command, CommandSource src)
+{
+    if (command == "on") {
+        if (!logger::Tracer.Enable(true)) {
+            EmitMessage("ERR: failed to start trace.\n", src);
+        }
+    } else if (command == "off") {
+        logger::Tracer.Enable(false);
+    } else if (command == "clear") {
+        logger::Tracer.Clear();
+    } else if (command == "dump") {
+        if (src == CommandSource::SerialPort) {
+            logger::Tracer.Dump(Serial);
+        } else {
+            EmitMessage("ERR: use the /trace endpoint to download the trace over WiFi.\n", src);
+            if (m_wifi != nullptr) {
+                m_wifi->SetStatusCode(WiFiAdapter::HTTPReturnCodes::BADREQUEST);
+            }
+        }
+        return;
+    } else {
+        EmitMessage("ERR: trace command not recognised.\n", src);
+        if (src == CommandSource::WirelessPort && m_wifi != nullptr) {
+            m_wifi->SetStatusCode(WiFiAdapter::HTTPReturnCodes::BADREQUEST);
+        }
+        return;
+    }
+    ReportTrace(src);
+}
+
+/// Report the state of the storage benchmark, with the results of the tests completed so far.  This
+/// is reported as JSON either on the serial port (pretty-printed), or to the WiFi client.
+///
+/// \param src Channel on which the command was received (and the report should be sent)
+
+void SerialCommand::ReportBenchmark(CommandSource src)
+{
+    DynamicJsonDocument benchmark(logger::Bench.Render());
+
+    if (src == CommandSource::SerialPort) {
+        String json;
+        serializeJsonPretty(benchmark, json);
+        EmitMessage(json+"\n", src);
+    } else {
+        if (m_wifi != nullptr) {
+            m_wifi->SetMessage(benchmark);
+        }
+    }
+}
+
+/// Start or stop the storage benchmark.  The benchmark runs in the background against a scratch file
+/// on the logging medium, and the results are collected by repeating the "benchmark" command until the
+/// state is "complete".  Parameters not given on "start" are left at their defaults; parameters that are
+/// given must be unsigned decimal integers (in range), and the first that isn't is reported by name
+/// without starting the benchmark.
+///
+/// \param command Command string: "start [size-kB [block-B [flush-N [rate-B/s]]]]" or "stop"
+/// \param src     Channel on which the command was received
+
+void SerialCommand::ConfigureBenchmark(String const& command, CommandSource src)
+{
+    if (command.startsWith("start")) {
+        bench::Parameters params;
+        String args = command.substring(5);
+        args.trim();
+        const char *names[4] = { "size-kB", "block-B", "flush-N", "rate-B/s" };
+        const uint64_t limits[4] = { 0xFFFFFFFFULL/1024, 0xFFFFFFFFULL, 0xFFFFFFFFULL, 0xFFFFFFFFULL };
+        uint32_t values[4] = { params.fileSize/1024, params.blockSize, params.flushEvery, params.requiredRate };
+        String invalid;
+        for (int n = 0; n < 4 && args.length() > 0 && invalid.length() == 0; ++n) {
+            int space = args.indexOf(' ');
+            String value = space < 0 ? args : args.substring(0, space);
+            uint64_t number = 0;
+            for (unsigned int c = 0; c < value.length() && number <= limits[n]; ++c) {
+                if (!isDigit(value[c])) {
+                    number = limits[n] + 1;
+                } else {
+                    number = 10*number + (value[c] - '0');
+                }
+            }
+            if (number > limits[n]) {
+                invalid = String(names[n]) + " \"" + value + "\" is not a number in range";
+            } else {
+                values[n] = static_cast<uint32_t>(number);
+            }
+            args = space < 0 ? String() : args.substring(space + 1);
+            args.trim();
+        }
+        if (invalid.length() == 0 && args.length() > 0) {
+            invalid = String("unexpected \"") + args + "\" after rate-B/s";
+        }
+        if (invalid.length() > 0) {
+            EmitMessage("ERR: benchmark " + invalid + "; not started.\n", src);
+            if (src == CommandSource::WirelessPort && m_wifi != nullptr) {
+                m_wifi->SetStatusCode(WiFiAdapter::HTTPReturnCodes::BADREQUEST);
+            }
+            return;
+        }
+        params.fileSize = values[0]*1024;
+        params.blockSize = values[1];
+        params.flushEvery = values[2];
+        params.requiredRate = values[3];
+        if (!logger::Bench.Start(m_logManager->FileSystem(), params)) {
+            EmitMessage("ERR: failed to start storage benchmark: " + logger::Bench.Error() + ".\n", src);
+        }
+    } else if (command == "stop") {
+        logger::Bench.Stop();
+    } else {
+        EmitMessage("ERR: benchmark command not recognised.\n", src);
+        if (src == CommandSource::WirelessPort && m_wifi != nullptr) {
+            m_wifi->SetStatusCode(WiFiAdapter::HTTPReturnCodes::BADREQUEST);
+        }
+        return;
+    }
+    ReportBenchmark(src);
+}
+
 /// Report the algorithms being recommended for use on the data, as stored in the logger.  This is
 /// broken out because the system has to be able to report the algorithms either on demand, or as a
 /// response to setting a new algorithm (or clearing the list), before finalising the file on the
@@ -977,9 +1371,9 @@ void SerialCommand::ConfigureAlgRequest(String const& params, CommandSource src)
 /// in post-processing.  The post-processing code can generate a default "platform" element, but if the user
 /// sets up a string here, it can be used to completely replaces this (and provide a lot more information)
 /// if required.  The code here does not check that the metadata is valid JSON, and just replicates it into
-/// the output data files so that the post-processing code has the option to use it if appropriate.  Note
-/// that the JSON should be collapsed into a single line so that there are no \r\n in the data (otherwise
-/// it'll get split into multiple WIBL commands, and will not be recognised).
+/// the output data files so that the post-processing code has the option to use it if appropriate.  The
+/// metadata is free text, so it takes the rest of the request; on the serial port, however, it has to be
+/// collapsed into a single line, since each line is a separate request.
 ///
 /// \param params   Parameters for the command: <arbitrary-text>
 /// \param src      Channel on which to report results of the command (Serial, WiFi, BLE)
@@ -1159,22 +1553,27 @@ void SerialCommand::ConfigureWebserver(String const& params, CommandSource src)
 
 /// Report on the current status of the logger, including the WiFi status, the number of files available,
 /// and their sizes.  Reporting is done in JSON format, pretty-printed if on the serial stream, as compact
-/// as possible if on the WiFi.
+/// as possible if on the WiFi.  In both cases, the report is streamed straight to the output as it is
+/// generated, so that the memory required doesn't depend on the number of log files.
 ///
 /// \param src  CommandSource for the stream that generated the request
 /// \return N/A
 
 void SerialCommand::ReportCurrentStatus(CommandSource src)
 {
-    DynamicJsonDocument status(logger::status::CurrentStatus(m_logManager));
+    // The status report is one of the heavier users of the heap (with multiple JSON
+    // documents), so it's tracked separately from the rest of the command processor.
+    static int heap_tag = logger::HeapTags.Tag("status");
+    logger::HeapScope scope(heap_tag);
 
     if (src == CommandSource::SerialPort) {
-        String json;
-        serializeJsonPretty(status, json);
-        EmitMessage(json+"\n", src);
+        logger::status::StreamStatus(m_logManager, Serial, true);
+        Serial.print("\n");
     } else {
         if (m_wifi != nullptr) {
-            m_wifi->SetMessage(status);
+            m_wifi->StreamMessage([this](Print& output) {
+                logger::status::StreamStatus(m_logManager, output);
+            });
         }
     }
 }
@@ -1252,6 +1651,28 @@ void SerialCommand::ResetLabDefaults(CommandSource src)
     }
 }
 
+/// Handle the "lab" command: "lab defaults" reports the lab-default configuration, "lab defaults json" sets
+/// it, and "lab reset" resets the logger's configuration to it.
+///
+/// \param command  Action ("defaults" or "reset"), and the JSON configuration for "defaults"
+/// \param src      Channel on which this command was received
+
+void SerialCommand::ConfigureLab(String const& command, CommandSource src)
+{
+    if (command == "defaults") {
+        ReportLabDefaults(src);
+    } else if (command.startsWith("defaults ")) {
+        SetLabDefaults(command.substring(9), src);
+    } else if (command == "reset") {
+        ResetLabDefaults(src);
+    } else {
+        EmitMessage("ERR: lab command \"" + command + "\" not recognised.\n", src);
+        if (src == CommandSource::WirelessPort && m_wifi != nullptr) {
+            m_wifi->SetStatusCode(WiFiAdapter::HTTPReturnCodes::NOTFOUND);
+        }
+    }
+}
+
 /// Get and report the upload authorisation stored in the logger (if it exists).  This is used to handshake
 /// with the upload server if the logger is sending data directly over WiFi to the outside world.
 ///
@@ -1362,10 +1783,9 @@ void SerialCommand::SnapshotResource(String const& resource, CommandSource src)
             defaults = String("{}");
         rc = m_logManager->WriteSnapshot("defaults.jsn", defaults, url);
     } else if (resource == "catalog") {
-        DynamicJsonDocument files(logger::status::GenerateFilelist(m_logManager));
-        String contents;
-        serializeJson(files, contents);
-        rc = m_logManager->WriteSnapshot("catalog.jsn", contents, url);
+        rc = m_logManager->WriteSnapshot("catalog.jsn", [this](Print& output) {
+            logger::status::StreamFilelist(m_logManager, output);
+        }, url);
     } else if (resource == "archive") {
         String contents;
         DynamicJsonDocument json(logger::ConfigJSON::ExtractConfig());
@@ -1375,9 +1795,9 @@ void SerialCommand::SnapshotResource(String const& resource, CommandSource src)
         if (contents.isEmpty())
             contents = String("{}");
         m_logManager->WriteSnapshot("defaults.jsn", contents, url);
-        json = DynamicJsonDocument(logger::status::GenerateFilelist(m_logManager));
-        serializeJson(json, contents);
-        m_logManager->WriteSnapshot("catalog.jsn", contents, url);
+        m_logManager->WriteSnapshot("catalog.jsn", [this](Print& output) {
+            logger::status::StreamFilelist(m_logManager, output);
+        }, url);
         url = "/archive";
         rc = true;
     } else {
@@ -1398,18 +1818,25 @@ void SerialCommand::ReportUploadConfig(CommandSource src)
 {
     if (src == CommandSource::SerialPort) {
         bool enable;
-        String upload_address, upload_port, upload_timeout, upload_interval, upload_duration;
+        String upload_address, upload_port, upload_timeout, upload_interval, upload_duration, upload_lifetime,
+            upload_order;
         logger::LoggerConfig.GetConfigBinary(logger::Config::ConfigParam::CONFIG_UPLOAD_B, enable);
         logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_UPLOAD_SERVER_S, upload_address);
         logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_UPLOAD_PORT_S, upload_port);
         logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_UPLOAD_TIMEOUT_S, upload_timeout);
         logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_UPLOAD_INTERVAL_S, upload_interval);
         logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_UPLOAD_DURATION_S, upload_duration);
+        logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_UPLOAD_LIFETIME_S, upload_lifetime);
+        if (upload_lifetime.isEmpty()) upload_lifetime = String(net::DefaultConnectionLifetime);
+        logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_UPLOAD_ORDER_S, upload_order);
+        if (upload_order.isEmpty()) upload_order = "oldest";
         EmitMessage(String("Upload is ") + (enable ? "on" : "off") +
             " with URL http://" + upload_address + ":" + upload_port +
             ", connection timeout " + upload_timeout + "s" +
             ", upload interval " + upload_interval + "s" +
-            ", and upload duration " + upload_duration + "s\n", src);
+            ", upload duration " + upload_duration + "s" +
+            ", connection lifetime " + upload_lifetime + "s" +
+            ", and " + upload_order + " files first\n", src);
     } else if (src == CommandSource::WirelessPort) {
         ReportConfigurationJSON(src);
     } else {
@@ -1444,6 +1871,7 @@ void SerialCommand::ConfigureUpload(String const& command, CommandSource src)
     int timeout_position = command.indexOf(' ', port_position) + 1;
     int interval_position = command.indexOf(' ', timeout_position) + 1;
     int duration_position = command.indexOf(' ', interval_position) + 1;
+    int lifetime_position = command.indexOf(' ', duration_position) + 1; // Optional
 
     if (port_position == 0 || timeout_position == 0 || interval_position == 0 || duration_position == 0) {
         EmitMessage("ERR: malformed upload specification; see syntax for details.\n", src);
@@ -1456,14 +1884,21 @@ void SerialCommand::ConfigureUpload(String const& command, CommandSource src)
     String port(command.substring(port_position, timeout_position-1));
     String timeout(command.substring(timeout_position, interval_position-1));
     String interval(command.substring(interval_position, duration_position-1));
-    String duration(command.substring(duration_position));
+    String duration, lifetime;
+    if (lifetime_position > 0) {
+        duration = command.substring(duration_position, lifetime_position-1);
+        lifetime = command.substring(lifetime_position);
+    } else {
+        duration = command.substring(duration_position);
+    }
 
     // We need to check that the components of the specification are valid, although we can't do much
     // about the address.
     long port_value = port.toInt(),
          timeout_value = timeout.toInt(), interval_value = interval.toInt(), duration_value = duration.toInt();
     
-    if (port_value <= 0 || port_value > 65535 || timeout_value <= 0 || interval_value <= 0 || duration_value <= 0) {
+    if (port_value <= 0 || port_value > 65535 || timeout_value <= 0 || interval_value <= 0 || duration_value <= 0 ||
+            (lifetime_position > 0 && lifetime.toInt() <= 0)) {
         EmitMessage("ERR: malformed upload specification; see syntax for details.\n", src);
         if (src == CommandSource::WirelessPort && m_wifi != nullptr) {
             m_wifi->SetStatusCode(WiFiAdapter::HTTPReturnCodes::BADREQUEST);
@@ -1476,6 +1911,9 @@ void SerialCommand::ConfigureUpload(String const& command, CommandSource src)
     logger::LoggerConfig.SetConfigString(logger::Config::ConfigParam::CONFIG_UPLOAD_TIMEOUT_S, timeout);
     logger::LoggerConfig.SetConfigString(logger::Config::ConfigParam::CONFIG_UPLOAD_INTERVAL_S, interval);
     logger::LoggerConfig.SetConfigString(logger::Config::ConfigParam::CONFIG_UPLOAD_DURATION_S, duration);
+    if (lifetime_position > 0) {
+        logger::LoggerConfig.SetConfigString(logger::Config::ConfigParam::CONFIG_UPLOAD_LIFETIME_S, lifetime);
+    }
     
     if (src == CommandSource::WirelessPort) {
         ReportConfigurationJSON(src);
@@ -1491,11 +1929,14 @@ void SerialCommand::Syntax(CommandSource src)
     EmitMessage("  accept [NMEA0183-ID | all]          Configure which NMEA0183 messages to accept.\n", src);
     EmitMessage("  algorithm [name params | none]      Add (or report) an algorithm request to the cloud processing.\n", src);
     EmitMessage("  auth [cert|token data]              Set or report the upload authentication information.\n", src);
+    EmitMessage("  benchmark [start [size-kB [block-B [flush-N [rate-B/s]]]]|stop]\n", src);
+    EmitMessage("                                      Run the storage benchmark on the log medium, or report results.\n", src);
     EmitMessage("  configure [on|off logger-name]      Configure individual loggers on/off (or report config).\n", src);
+    EmitMessage("                                      (\"live\" also takes [address port [packet-ids]] when on.)\n", src);
     EmitMessage("  echo on|off                         Control character echo on serial line.\n", src);
     EmitMessage("  erase file-number|all               Remove a specific [file-number] or all log files.\n", src);
     EmitMessage("  filecount                           Report the number of log files currently available for transfer.\n", src);
-    EmitMessage("  heap                                Report current free heap size.\n", src);
+    EmitMessage("  heap [detail]                       Report current free heap size (or detailed usage and fragmentation).\n", src);
     EmitMessage("  help|syntax                         Generate this list.\n", src);
     EmitMessage("  invert 1|2                          Invert polarity of RS-422 input on port 1|2.\n", src);
     EmitMessage("  lab defaults [specification]        Report, or set, lab default configuration in JSON format.\n", src);
@@ -1507,6 +1948,7 @@ void SerialCommand::Syntax(CommandSource src)
     EmitMessage("  metadata [platform-specific]        Store or report a platform-specific metadata JSON element.\n", src);
     EmitMessage("  ota                                 Start Over-the-Air update sequence for the logger.\n", src);
     EmitMessage("  password ap|station [wifi-password] Set the WiFi password.\n", src);
+    EmitMessage("  profile [on|off|reset]              Control loop latency profiling, or report the current profile.\n", src);
     EmitMessage("  restart                             Restart the logger module hardware.\n", src);
     EmitMessage("  scales                              Report any registered sensor-specific scale factors.\n", src);
     EmitMessage("  setup [json-specification]          Report the configuration of the logger, or set it, using JSON specifications.\n", src);
@@ -1519,9 +1961,10 @@ void SerialCommand::Syntax(CommandSource src)
     EmitMessage("  status                              Generate JSON-format status message for current dynamic configuration\n", src);
     EmitMessage("  steplog                             Close current log file, and move to the next in sequence.\n", src);
     EmitMessage("  stop                                Close files and go into self-loop for power-down.\n", src);
-    EmitMessage("  transfer file-number                Transfer log file [file-number] (WiFi and serial only).\n", src);
+    EmitMessage("  trace [on|off|clear|dump]           Control binary event tracing, or report the trace state.\n", src);
+    EmitMessage("  transfer [block] file-number        Transfer log file [file-number] (WiFi and serial only; block on serial only).\n", src);
     EmitMessage("  uniqueid [logger-name]              Set or report the logger's unique identification string.\n", src);
-    EmitMessage("  upload [on|off]|[srvaddr srvport timeout interval duration]\n", src);
+    EmitMessage("  upload [on|off]|[srvaddr srvport timeout interval duration [lifetime]]\n", src);
     EmitMessage("                                      Control whether files are auto-updated when connected\n", src);
     EmitMessage("  verbose on|off                      Control verbosity of reporting for serial input strings.\n", src);
     EmitMessage("  version                             Report NMEA0183 and NMEA2000 logger version numbers.\n", src);
@@ -1530,199 +1973,176 @@ void SerialCommand::Syntax(CommandSource src)
     EmitMessage("  wireless on|off|accesspoint|station Control WiFi activity [on|off] and mode [accesspoint|station].\n", src);
 }
 
-/// Execute the command strings received from the serial interface(s).  This tests the
-/// string for known commands, and passes on the options from the string (if any) to
-/// the particular methods used for command implementation.  Note that this interface
-/// is pretty fragile, since it doesn't check for partial commands, or differences in case,
-/// etc.  The expectation is that commands either come from developers, or through an
-/// app, and therefore it shouldn't need to be particularly strong.
+/// Execute one or more commands: several can be sent at once, separated by semicolons (which are ignored
+/// inside JSON arguments).  Commands that take free text (see \a cmd::Verbs) get everything to the end of
+/// the request, so passwords, names, and certificates are never split, and line ends never separate
+/// commands.  Each is looked up and run in turn, and any output (and, on WiFi, the status code) is added
+/// to what's already been generated.
 ///
-/// \param cmd  String with the user command to execute.
-/// \param src      Stream by which the command arrived
+/// \param commands Command(s) to execute
+/// \param src      Stream by which the command(s) arrived
 
-void SerialCommand::Execute(String const& cmd, CommandSource src)
+void SerialCommand::Execute(String const& commands, CommandSource src)
 {
-    if (cmd.startsWith("accept")) {
-        if (cmd.length() == 6) {
-            ReportNMEAFilter(src);
-        } else {
-            AddNMEAFilter(cmd.substring(7), src);
-        }
-    } else if (cmd.startsWith("algorithm")) {
-        if (cmd.length() == 9) {
-            ReportAlgRequests(src);
-        } else {
-            ConfigureAlgRequest(cmd.substring(10), src);
-        }
-    } else if (cmd.startsWith("auth")) {
-        if (cmd.length() == 4) {
-            GetAuthorisation(src);
-        } else {
-            SetAuthorisation(cmd.substring(5), src);
-        }
-    } else if (cmd.startsWith("configure")) {
-        if (cmd.length() == 9) {
-            ReportConfiguration(src);
-        } else {
-            ConfigureLoggers(cmd.substring(10), src);
-        }
-    } else if (cmd.startsWith("echo")) {
-        ConfigureEcho(cmd.substring(5), src);
-    } else if (cmd.startsWith("erase")) {
-        EraseLogfile(cmd.substring(6), src);
-    } else if (cmd == "filecount") {
-        ReportFileCount(src);
-    } else if (cmd == "heap") {
-        ReportHeapSize(src);
-    } else if (cmd == "help" || cmd == "syntax") {
-        Syntax(src);
-    } else if (cmd.startsWith("invert")) {
-        ConfigureSerialPortInvert(cmd.substring(7), src);
-    } else if (cmd.startsWith("lab defaults")) {
-        if (cmd.length() == 12) {
-            ReportLabDefaults(src);
-        } else {
-            SetLabDefaults(cmd.substring(13), src);
-        }
-    } else if (cmd.startsWith("lab reset")) {
-        ResetLabDefaults(src);
-    } else if (cmd.startsWith("led")) {
-        ModifyLEDState(cmd.substring(4));
-    } else if (cmd == "log") {
-        ReportConsoleLog(src);
-    } else if (cmd.startsWith("mdns")) {
-        if (cmd.length() == 4) {
-            GetMDNSName(src);
-        } else {
-            SetMDNSName(cmd.substring(5), src);
-        }
-    } else if (cmd.startsWith("metadata")) {
-        if (cmd.length() == 8) {
-            ReportMetadataElement(src);
-        } else {
-            StoreMetadataElement(cmd.substring(9), src);
-        }
-    } else if (cmd.startsWith("ota")) {
-        EmitMessage("Starting OTA update sequence ...\n", src);
-        OTAUpdater updater; // This puts the logger into a loop which ends with a full reset
-    } else if (cmd == "passthrough") {
-        // Note that this is intentionally not defined in the syntax list, or elsewhere: it
-        // really is just for debugging.
-        ConfigurePassthrough("on", src);
-    } else if (cmd.startsWith("password")) {
-        if (cmd.length() == 8)
-            GetWiFiPassword(src);
-        else
-            SetWiFiPassword(cmd.substring(9), src);
-    } else if (cmd == "restart") {
-        ESP.restart();
-    } else if (cmd == "scales") {
-        ReportScalesElement(src);
-    } else if (cmd.startsWith("setup")) {
-        if (cmd.length() == 5) {
-            ReportConfigurationJSON(src);
-        } else {
-            SetupLogger(cmd.substring(6), src);
-        }
-    } else if (cmd.startsWith("shipname")) {
-        if (cmd.length() == 8) {
-            ReportShipname(src);
-        } else {
-            SetShipname(cmd.substring(9), src);
-        }
-    } else if (cmd == "sizes") {
-        ReportCurrentStatus(src);
-    } else if (cmd.startsWith("snapshot")) {
-        SnapshotResource(cmd.substring(9), src);
-    } else if (cmd.startsWith("speed")) {
-        ConfigureSerialPortSpeed(cmd.substring(6), src);
-    } else if (cmd.startsWith("ssid")) {
-        if (cmd.length() == 4)
-            GetWiFiSSID(src);
-        else
-            SetWiFiSSID(cmd.substring(5), src);
-    } else if (cmd == "status") {
-        ReportCurrentStatus(src);
-    } else if (cmd == "steplog") {
-        m_logManager->CloseLogfile();
-        m_logManager->StartNewLog();
-        if (src == CommandSource::WirelessPort && m_wifi != nullptr) {
-            ReportCurrentStatus(src);
-        }
-    } else if (cmd == "stop") {
-        Shutdown();
-    } else if (cmd.startsWith("transfer")) {
-        TransferLogFile(cmd.substring(9), src);
-    } else if (cmd.startsWith("uniqueid")) {
-        if (cmd.length() == 8) {
-            ReportIdentificationString(src);
-        } else {
-            SetIdentificationString(cmd.substring(9), src);
-        }
-    } else if (cmd.startsWith("upload")) {
-        if (cmd.length() == 6) {
-            ReportUploadConfig(src);
-        } else {
-            ConfigureUpload(cmd.substring(7), src);
-        }
-    } else if (cmd.startsWith("verbose")) {
-        SetVerboseMode(cmd.substring(8));
-    } else if (cmd == "version") {
-        ReportSoftwareVersion(src);
-    } else if (cmd.startsWith("webserver")) {
-        if (cmd.length() == 9) {
-            ReportWebserverConfig(src);
-        } else {
-            ConfigureWebserver(cmd.substring(10), src);
+    const char *text = commands.c_str();
+    const char *end = text + commands.length();
+    cmd::Token line;
+    while (cmd::NextCommand(text, end, line, cmd::FreeText)) {
+        dispatch(line, src);
+    }
+}
+
+/// Look up a single command in the command table, by binary search on the verb (the first word), and run
+/// the handler for the command with or without arguments as appropriate.  The verbs must be in strictly
+/// increasing (\a strcmp()) order, which is checked at compile time.  Each entry has a handler for the
+/// command on its own (typically a report) and/or a handler for the command with arguments (which gets
+/// everything after the verb); if the one needed is missing, the command is not recognised.  The table is
+/// also checked at compile time against \a cmd::Verbs, which the host tools use to check the commands.
+///
+/// \param line Command to execute (verb and arguments)
+/// \param src  Stream by which the command arrived
+
+void SerialCommand::dispatch(cmd::Token const& line, CommandSource src)
+{
+    static constexpr CommandEntry commands[] = {
+        { "accept",     &SerialCommand::ReportNMEAFilter,           &SerialCommand::AddNMEAFilter },
+        { "algorithm",  &SerialCommand::ReportAlgRequests,          &SerialCommand::ConfigureAlgRequest },
+        { "auth",       &SerialCommand::GetAuthorisation,           &SerialCommand::SetAuthorisation },
+        { "benchmark",  &SerialCommand::ReportBenchmark,            &SerialCommand::ConfigureBenchmark },
+        { "configure",  &SerialCommand::ReportConfiguration,        &SerialCommand::ConfigureLoggers },
+        { "echo",       nullptr,                                    &SerialCommand::ConfigureEcho },
+        { "erase",      nullptr,                                    &SerialCommand::EraseLogfile },
+        { "filecount",  &SerialCommand::ReportFileCount,            nullptr },
+        { "heap",       &SerialCommand::ReportHeapSize,             &SerialCommand::ConfigureHeap },
+        { "help",       &SerialCommand::Syntax,                     nullptr },
+        { "invert",     nullptr,                                    &SerialCommand::ConfigureSerialPortInvert },
+        { "lab",        nullptr,                                    &SerialCommand::ConfigureLab },
+        { "led",        nullptr,                                    &SerialCommand::ModifyLEDState },
+        { "log",        &SerialCommand::ReportConsoleLog,           nullptr },
+        { "mdns",       &SerialCommand::GetMDNSName,                &SerialCommand::SetMDNSName },
+        { "metadata",   &SerialCommand::ReportMetadataElement,      &SerialCommand::StoreMetadataElement },
+        { "ota",        &SerialCommand::StartOTA,                   nullptr },
+        { "passthrough",&SerialCommand::StartPassthrough,           nullptr },
+        { "password",   &SerialCommand::GetWiFiPassword,            &SerialCommand::SetWiFiPassword },
+        { "profile",    &SerialCommand::ReportProfile,              &SerialCommand::ConfigureProfile },
+        { "restart",    &SerialCommand::Restart,                    nullptr },
+        { "scales",     &SerialCommand::ReportScalesElement,        nullptr },
+        { "setup",      &SerialCommand::ReportSetup,                &SerialCommand::SetupLogger },
+        { "shipname",   &SerialCommand::ReportShipname,             &SerialCommand::SetShipname },
+        { "sizes",      &SerialCommand::ReportCurrentStatus,        nullptr },
+        { "snapshot",   nullptr,                                    &SerialCommand::SnapshotResource },
+        { "speed",      nullptr,                                    &SerialCommand::ConfigureSerialPortSpeed },
+        { "ssid",       &SerialCommand::GetWiFiSSID,                &SerialCommand::SetWiFiSSID },
+        { "status",     &SerialCommand::ReportCurrentStatus,        nullptr },
+        { "steplog",    &SerialCommand::StepLog,                    nullptr },
+        { "stop",       &SerialCommand::StopLogging,                nullptr },
+        { "syntax",     &SerialCommand::Syntax,                     nullptr },
+        { "trace",      &SerialCommand::ReportTrace,                &SerialCommand::ConfigureTrace },
+        { "transfer",   nullptr,                                    &SerialCommand::TransferLogFile },
+        { "uniqueid",   &SerialCommand::ReportIdentificationString, &SerialCommand::SetIdentificationString },
+        { "upload",     &SerialCommand::ReportUploadConfig,         &SerialCommand::ConfigureUpload },
+        { "verbose",    nullptr,                                    &SerialCommand::SetVerboseMode },
+        { "version",    &SerialCommand::ReportSoftwareVersion,      nullptr },
+        { "webserver",  &SerialCommand::ReportWebserverConfig,      &SerialCommand::ConfigureWebserver },
+        { "wireless",   nullptr,                                    &SerialCommand::ManageWireless }
+    };
+    static_assert(cmd::Sorted(commands), "command table must be in alphabetical order of verb");
+    static_assert(cmd::Matches(commands), "command table must match the verbs in CommandVerbs.h");
+
+    cmd::Command command;
+    command.Parse(line);
+    CommandEntry const *entry = cmd::Lookup(commands, command.verb);
+    if (entry != nullptr) {
+        if (command.rest.Empty() && entry->report != nullptr) {
+            (this->*entry->report)(src);
+            return;
         }
-    } else if (cmd.startsWith("wireless")) {
-        ManageWireless(cmd.substring(9), src);
-    } else {
-        EmitMessage("ERR: command not recognised: \"" + cmd + "\".\n", src);
-        if (src == CommandSource::WirelessPort && m_wifi != nullptr) {
-            m_wifi->SetStatusCode(WiFiAdapter::HTTPReturnCodes::NOTFOUND);
+        if (entry->configure != nullptr) {
+            (this->*entry->configure)(String(command.rest.text, command.rest.length), src);
+            return;
         }
     }
+    EmitMessage("ERR: command not recognised: \"" + String(line.text, line.length) + "\".\n", src);
+    if (src == CommandSource::WirelessPort && m_wifi != nullptr) {
+        m_wifi->SetStatusCode(WiFiAdapter::HTTPReturnCodes::NOTFOUND);
+    }
 }
 
-/// User-level routine to get commands from any number of sources, and attempt to execute
-/// them.  The system uses the Serial input by defult, but will also check for commands from the
-/// Bluetooth LE UART service if there is a client connected.
+/// User-level routine to get commands from the Serial input, and attempt to execute them.  Everything
+/// waiting on the port is read in blocks, and assembled into lines, which are run as soon as they're
+/// complete.  This continues until there's nothing left, or the scheduler's time budget for the task
+/// expires; anything read but not yet assembled is kept for the next call, so a long command (e.g.,
+/// a JSON configuration for "setup") arrives at the rate that the port can deliver it, without holding
+/// up logging.
 ///
 /// This routine has to be executed regularly to keep the processing rate going, since commands
-/// will be ignored if this code does not run.  Running this periodically in the loop() is appropriate.
+/// will be ignored if this code does not run.  It is registered with the scheduler in setup(), and
+/// called whenever there is console input, and on the housekeeping tick.  While a block transfer is
+/// running, the input belongs to the transfer, and is left alone.
+///
+/// \return True if there are more characters waiting to be processed, otherwise False
 
-void SerialCommand::ProcessCommand(void)
+bool SerialCommand::ProcessCommand(void)
 {
-    if (Serial.available() > 0) {
-        int c = Serial.read();
-        if (m_echoOn) Serial.printf("%c", c);
-        if (c == '\b') {
-            // Delete (or at least backspace) character
-            m_serialBuffer.RemoveLastCharacter();
-        } else {
-            m_serialBuffer.AddCharacter(c);
+    if (logger::Transfer.Active()) return false;  // The block transfer has the serial port
+    while (true) {
+        if (m_chunkStart == m_chunkEnd) {
+            int available = Serial.available();
+            if (available <= 0) break;
+            size_t n = static_cast<size_t>(available) < SerialChunkSize ? available : SerialChunkSize;
+            m_chunkStart = 0;
+            m_chunkEnd = Serial.read(m_serialChunk, n);
+            if (m_echoOn && m_chunkEnd > 0) Serial.write(m_serialChunk, m_chunkEnd);
         }
-        if (c == '\n') {
-            String cmd(m_serialBuffer.Contents());
-            m_serialBuffer.Reset();
-            if (m_passThrough) {
-                if (cmd.startsWith("passthrough")) {
-                    ConfigurePassthrough("off", CommandSource::SerialPort);
-                } else {
-                    Serial1.print(cmd);
-                }
-            } else {
-                cmd.trim();
-                
-                Serial.printf("Found console command: \"%s\"\n", cmd.c_str());
+        m_chunkStart += m_serialLine.Append(m_serialChunk + m_chunkStart, m_chunkEnd - m_chunkStart);
+        if (m_serialLine.Complete()) {
+            runSerialLine();
+            m_serialLine.Clear();
+        }
+        if (logger::Tasks.SliceExpired()) break;
+    }
+    return m_chunkStart < m_chunkEnd || Serial.available() > 0;
+}
 
-                Execute(cmd, CommandSource::SerialPort);
-            }
+/// Run a complete line from the serial port, either as a command (or batch of commands), or by passing
+/// it through to the NMEA0183 output if passthrough mode is on.  A line that was too long to assemble is
+/// reported and ignored.
+
+void SerialCommand::runSerialLine(void)
+{
+    if (m_serialLine.Overflowed()) {
+        Serial.printf("ERR: command too long (%u B, limit %u B); ignored.\n",
+            static_cast<unsigned>(m_serialLine.Dropped()), static_cast<unsigned>(SerialLineMaxSize));
+        return;
+    }
+    cmd::Token line = m_serialLine.Line();
+    if (m_passThrough) {
+        if (line.length >= 11 && strncmp(line.text, "passthrough", 11) == 0) {
+            ConfigurePassthrough("off", CommandSource::SerialPort);
+        } else {
+            Serial1.write(line.text, line.length);
+            Serial1.write('\n');
         }
+    } else {
+        String cmd(line.text, line.length);
+        cmd.trim();
+
+        Serial.printf("Found console command: \"%s\"\n", cmd.c_str());
+
+        Execute(cmd, CommandSource::SerialPort);
     }
+}
+
+/// User-level routine to service the WiFi interface (if it is running), and execute any command that
+/// has been received from a client.
+///
+/// \return True if the interface has more work to do (an archive download in progress), otherwise False
+
+bool SerialCommand::ProcessWireless(void)
+{
+    bool more = false;
     if (m_wifi != nullptr) {
-        m_wifi->RunLoop();
+        more = m_wifi->RunLoop();
         String cmd = m_wifi->ReceivedString();
         if (cmd.length() != 0) {
             cmd.trim();
@@ -1730,20 +2150,92 @@ void SerialCommand::ProcessCommand(void)
             Execute(cmd, CommandSource::WirelessPort);
             m_wifi->TransmitMessages();
         }
-        if (m_uploadManager != nullptr) {
-            m_uploadManager->UploadCycle();
-        }
     }
+    if (m_live != nullptr) m_live->Service();
+    return more;
 }
 
-/// Provide an external interface to the shutdown HCF so that we log the fact that the emergency
-/// power has been activated, and therefore the system is going down.
+/// User-level routine to run a slice of the automatic upload cycle (if the WiFi interface is running
+/// and upload is configured).
+///
+/// \return True if the upload cycle has more work to do, otherwise False
 
-void SerialCommand::EmergencyStop(void)
+bool SerialCommand::ProcessUpload(void)
 {
-    Serial.println("WARN: Emergency power activated, shutting down.");
-    m_logManager->Syslog("warning: emergency power activated, shutting down.");
-    Shutdown();
+    if (m_wifi != nullptr && m_uploadManager != nullptr) {
+        return m_uploadManager->UploadCycle();
+    }
+    return false;
+}
+
+/// Start the live data stream over UDP if it's configured on, and connect it to the log manager so that it
+/// gets a copy of each packet as it's logged.  This should only be called once the WiFi interface is up.
+
+void SerialCommand::startLive(void)
+{
+    bool start_live;
+    if (!logger::LoggerConfig.GetConfigBinary(logger::Config::ConfigParam::CONFIG_LIVE_B, start_live) || !start_live)
+        return;
+    logger::HeapMonitor heap;
+    m_live = new net::LivePublisher();
+    if (!m_live->Begin()) {
+        delete m_live;
+        m_live = nullptr;
+        return;
+    }
+    m_logManager->SetPacketTap([this](uint32_t pktID, Serialisable const& data) { m_live->Publish(pktID, data); });
+    Serial.printf("DBG: After live data start, heap free = %d B, delta = %d B\n", heap.CurrentSize(), heap.DeltaSinceLast());
+}
+
+/// Disconnect the live data stream from the log manager, and stop it (if it's running).
+
+void SerialCommand::stopLive(void)
+{
+    if (m_live == nullptr) return;
+    m_logManager->SetPacketTap(nullptr);
+    delete m_live;
+    m_live = nullptr;
+}
+
+/// Stop logging as fast as possible when the supply monitor reports that the logger is running on the
+/// hold-up capacitor.  Nothing else in the loop runs after this is called, so intake stops immediately;
+/// the log file is then closed with the minimum of work (see \a logger::Manager::EmergencyClose()), and
+/// only once the data is safe does anything go to the serial port or console log.  The time to get the
+/// data safe (from when the supply dropped below the threshold) is recorded in the console log, so that
+/// the hold-up capacitance can be sized from real shutdowns.
+///
+/// The upload task is the only other user of the SD card, so it is told to stop reading log files before
+/// the close; it is stopped cooperatively rather than suspended, since a task suspended while holding the
+/// FatFs volume lock would block the close indefinitely, so the close waits at most for one read already
+/// in progress.  The live-data and UDP bridge tasks only take packets from the (now idle) intake, and
+/// never touch the SD card, so they are left to run until the power goes.
+///
+/// \param latency Time (us) between the supply dropping below the threshold and this call
+
+void SerialCommand::EmergencyStop(uint32_t latency)
+{
+    uint32_t entry = micros();
+    if (m_uploadManager != nullptr) m_uploadManager->Abort();
+    uint32_t close = m_logManager->EmergencyClose();
+    uint32_t safe = micros() - entry;
+    m_led->SetStatus(StatusLED::Status::sSTOPPED);
+
+    // Data is safe: now there's time to report
+    String report = String("emergency power activated at ") + logger::Metrics.SupplyVoltage()
+        + " V; log file closed in " + close + " us, data safe " + (latency + safe) + " us after supply failure ("
+        + latency + " us to respond).";
+    Serial.println("WARN: " + report);
+    m_logManager->Syslog("WARN: " + report);
+    uint32_t start = micros();
+    m_logManager->CloseConsole();
+    uint32_t now = micros();
+    Serial.printf("INF: console log closed in %u us, %u us after supply failure; stopped for power-down.\n",
+        now - start, latency + (now - entry));
+    while (true) {
+        delay(1000);
+    }
+    // Intentionally never completes - this is where the code halts
+    // for power-down.
 }
 
 /// Generate a message on the output stream associated with the source given.
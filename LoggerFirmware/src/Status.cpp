@@ -2,8 +2,9 @@
  * \brief General commands to support status report generation
  *
  * The logger needs to generate status information to report to the user, and for
- * uploads when enabled.  The free functions here manage this process, and the
- * construction of DynamicJsonDocuments (without the memory hassles).
+ * uploads when enabled.  The free functions here manage this process, streaming the
+ * larger reports (status and file list) straight to their output, and constructing
+ * DynamicJsonDocuments for the rest (without the memory hassles).
  *
  * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
  *
@@ -32,101 +33,238 @@
 #include "IMULogger.h"
 #include "SerialCommand.h"
 #include "DataMetrics.h"
+#include "EventLoop.h"
+#include "Scheduler.h"
+#include "Profiler.h"
+#include "HeapMonitor.h"
+#include "StorageMetrics.h"
+#include "JsonWriter.h"
+#include "AutoUpload.h"
+#include "LivePublisher.h"
+#include "PointBridge.h"
 
 namespace logger {
 namespace status {
 
-/// Generate a list of all known files on the logger (and their attributes) into
-/// an existing JSON document.  This includes the number of files, their reference
-/// IDs, sizes, MD5 hashes, and filenames in the store.
+/// Write the list of all known files on the logger (and their attributes) as the "files" member of
+/// the object currently open in the writer.  This includes the number of files, their reference IDs,
+/// sizes, MD5 hashes, filenames in the store, and upload attempts.  Each file's entry is written as
+/// it is enumerated, so the memory required doesn't depend on the number of files.
 ///
-/// @param filelist JsonDocument with the file list, ready to insert
+/// @param m    Log manager to enumerate the files
+/// @param out  JSON writer with an object open, ready to add the file list
 
-DynamicJsonDocument GenerateFilelist(logger::Manager *m)
+void WriteFilelist(logger::Manager *m, JsonWriter& out)
 {
     uint32_t *filenumbers = new uint32_t[logger::MaxLogFiles];
     uint32_t n_files = m->CountLogFiles(filenumbers);
-    DynamicJsonDocument doc(100*n_files + 256); // Approximate guess, but can expand
-
-    doc["files"]["count"] = n_files;
-    for (int n = 0; n < n_files; ++n) {
-        String filename;
-        uint32_t filesize;
-        logger::Manager::MD5Hash filehash;
-        uint16_t uploadCount;
-        m->EnumerateLogFile(filenumbers[n], filename, filesize, filehash, uploadCount);
-        StaticJsonDocument<256> entry;
-        entry["id"] = filenumbers[n];
-        entry["len"] = filesize;
-        if (!filehash.Empty())
-            entry["md5"] = filehash.Value();
-        entry["url"] = filename;
-        entry["uploads"] = uploadCount;
-
-        int entry_size = entry.memoryUsage();
-        if (doc.memoryUsage() + entry_size > 0.95*doc.capacity()) {
-            // It's likely that adding the entry will cause the document to run out of
-            // space.  We therefore double the capacity (since it's expensive, and we
-            // don't want to have to do it more than once) before we attempt the addition.
-            int capacity = doc.capacity() * 2;
-            DynamicJsonDocument new_doc(capacity);
-            new_doc.set(doc);
-            doc = new_doc;
-        }
-        if (!doc["files"]["detail"].add(entry.as<JsonObject>())) {
-            // Out of memory, even after adding more above (most likely),
-            // so make a new allocation.  Note that the addition can partially
-            // work, so you can end up with a malformed entry in the array (and
-            // one more entry than you expect).  We therefore remove this last
-            // element before continuing -- luckily, it should be at the index in
-            // the array of the file number.
-            doc["files"]["detail"].remove(n);
-            int capacity = doc.capacity() * 2;
-            DynamicJsonDocument new_doc(capacity);
-            new_doc.set(doc);
-            doc = new_doc;
-            doc["files"]["detail"].add(entry.as<JsonObject>());
+
+    out.BeginObject("files");
+    out.Value("count", n_files);
+    if (n_files > 0) {
+        out.BeginArray("detail");
+        for (int n = 0; n < n_files; ++n) {
+            String filename;
+            uint32_t filesize;
+            logger::Manager::MD5Hash filehash;
+            uint16_t uploadCount;
+            m->EnumerateLogFile(filenumbers[n], filename, filesize, filehash, uploadCount);
+            out.BeginObject();
+            out.Value("id", filenumbers[n]);
+            out.Value("len", filesize);
+            if (!filehash.Empty())
+                out.Value("md5", filehash.Value());
+            out.Value("url", filename);
+            out.Value("uploads", uploadCount);
+            out.EndObject();
         }
+        out.EndArray();
     }
+    out.EndObject();
     delete[] filenumbers;
-    return doc;
 }
 
-DynamicJsonDocument CurrentStatus(logger::Manager *m)
+/// Stream a JSON document with the list of all known files on the logger to the output given.
+///
+/// @param m        Log manager to enumerate the files
+/// @param output   Print target for the JSON
+/// @param pretty   Flag: True => pretty-print the JSON
+
+void StreamFilelist(logger::Manager *m, Print& output, bool pretty)
 {
-    DynamicJsonDocument filelist(GenerateFilelist(m));
-    DynamicJsonDocument lkg(logger::Metrics.LastKnownGood());
+    JsonWriter out(output, pretty);
+    out.BeginObject();
+    WriteFilelist(m, out);
+    out.EndObject();
+}
 
-    // The total capacity should be, approximately, the sum of the biggest components
-    // (above), plus some limited information on versions, elapsed time, and boot
-    // status.  We're assuming here that 1024B is enough for the extras ... that
-    // might not always be the case.
-    int capacity = filelist.capacity() + lkg.capacity() + 1024;
+/// Stream a JSON document with the current status of the logger to the output given: versions of the
+/// software components, elapsed time, supply voltage, web-server status, performance summaries, the
+/// last-known-good data from each source, and the file list.  Each of the summaries is generated and
+/// written in turn, so only one is in memory at a time, and the file list is written as it is enumerated.
+///
+/// @param m        Log manager to enumerate the files
+/// @param output   Print target for the JSON
+/// @param pretty   Flag: True => pretty-print the JSON
 
-    DynamicJsonDocument status(capacity);
+void StreamStatus(logger::Manager *m, Print& output, bool pretty)
+{
+    JsonWriter out(output, pretty);
+    out.BeginObject();
 
-    status["version"]["firmware"] = logger::FirmwareVersion();
-    status["version"]["commandproc"] = SerialCommand::SoftwareVersion();
-    status["version"]["nmea0183"] = nmea::N0183::Logger::SoftwareVersion();
-    status["version"]["nmea2000"] = nmea::N2000::Logger::SoftwareVersion();
-    status["version"]["imu"] = imu::Logger::SoftwareVersion();
-    status["version"]["serialiser"] = Serialiser::SoftwareVersion();
+    out.BeginObject("version");
+    out.Value("firmware", logger::FirmwareVersion());
+    out.Value("commandproc", SerialCommand::SoftwareVersion());
+    out.Value("nmea0183", nmea::N0183::Logger::SoftwareVersion());
+    out.Value("nmea2000", nmea::N2000::Logger::SoftwareVersion());
+    out.Value("imu", imu::Logger::SoftwareVersion());
+    out.Value("serialiser", Serialiser::SoftwareVersion());
+    out.EndObject();
 
     int now = millis();
-    status["elapsed"] = now;
-    
-    status["supply"] = logger::Metrics.SupplyVoltage();
+    out.Value("elapsed", now);
+
+    out.Value("supply", logger::Metrics.SupplyVoltage());
 
     String server_status, boot_status;
     logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_WS_STATUS_S, server_status);
     logger::LoggerConfig.GetConfigString(logger::Config::CONFIG_WS_BOOTSTATUS_S, boot_status);
-    status["webserver"]["current"] = server_status;
-    status["webserver"]["boot"] = boot_status;
+    out.BeginObject("webserver");
+    out.Value("current", server_status);
+    out.Value("boot", boot_status);
+    out.EndObject();
+
+    out.Document("events", logger::Events.Render().as<JsonVariantConst>());
+    out.Document("scheduler", logger::Tasks.Render().as<JsonVariantConst>());
+    out.Document("heap", logger::HeapTags.Render().as<JsonVariantConst>());
+    out.Document("storage", logger::StorageIO.Render().as<JsonVariantConst>());
+    out.Document("ingest", logger::Metrics.Ingest().as<JsonVariantConst>());
+    out.Document("console", m->ConsoleStatus().as<JsonVariantConst>());
+    out.Document("compression", m->CompressionStatus().as<JsonVariantConst>());
+    out.Document("upload", net::UploadStats.Render().as<JsonVariantConst>());
+    out.Document("live", net::LiveStats.Render().as<JsonVariantConst>());
+    out.Document("bridge", nmea::N0183::BridgeStats.Render().as<JsonVariantConst>());
+    if (logger::Profile.Enabled()) {
+        // The profile can be quite large, so it's only added when it's being collected.
+        out.Document("profile", logger::Profile.Render().as<JsonVariantConst>());
+    }
+    out.Document("data", logger::Metrics.LastKnownGood().as<JsonVariantConst>());
+    WriteFilelist(m, out);
 
-    status["data"] = lkg;
-    status["files"] = filelist["files"];
+    out.EndObject();
+}
+
+/// Generate a JSON document with the performance metrics that are recorded periodically into the
+/// log file, so that the logger's behaviour can be reviewed along with the data.  This is a subset
+/// of the status information, without the file list and data summaries.
+///
+/// @return JSON document with the current metrics
+
+DynamicJsonDocument CurrentMetrics(void)
+{
+    DynamicJsonDocument storage(logger::StorageIO.Render());
+    DynamicJsonDocument ingest(logger::Metrics.Ingest());
+    DynamicJsonDocument metrics(storage.capacity() + ingest.capacity() + 256);
+
+    metrics["elapsed"] = millis();
+    metrics["storage"] = storage;
+    metrics["ingest"] = ingest;
+
+    return metrics;
+}
+
+const char *StatusFeed::names[StatusFeed::SectionCount] = {
+    "supply", "webserver", "inventory", "data", "ingest", "storage", "compression", "upload", "live"
+};
+
+/// Constructor for the status feed.  Nothing is rendered until the first \a Refresh().
+///
+/// @param m    Log manager used to count the files
 
-    return status;
+StatusFeed::StatusFeed(logger::Manager *m)
+: m_logManager(m), m_elapsed(0)
+{
+}
+
+/// Render each section of the summary, and compare with the last version sent.  If any have changed,
+/// a Server-Sent Event with the elapsed time and the changed sections is assembled, ready for \a Delta().
+///
+/// @return True if any section changed (and the event is ready), otherwise False
+
+bool StatusFeed::Refresh(void)
+{
+    m_elapsed = millis();
+    m_delta = "data: {\"elapsed\":" + String(m_elapsed);
+    bool changed = false;
+    for (int n = 0; n < SectionCount; ++n) {
+        String section = render(n);
+        if (section == m_sections[n]) continue;
+        m_sections[n] = section;
+        m_delta += String(",\"") + names[n] + "\":" + section;
+        changed = true;
+    }
+    m_delta += "}\n\n";
+    if (!changed) m_delta = "";
+    return changed;
+}
+
+/// Assemble an event with all of the sections of the summary, as they were last rendered, for a client
+/// that has just subscribed.
+///
+/// @return Server-Sent Event with the full summary
+
+String StatusFeed::Snapshot(void) const
+{
+    String event = "data: {\"elapsed\":" + String(m_elapsed);
+    for (int n = 0; n < SectionCount; ++n) {
+        if (m_sections[n].isEmpty()) continue;
+        event += String(",\"") + names[n] + "\":" + m_sections[n];
+    }
+    event += "}\n\n";
+    return event;
+}
+
+/// Render one section of the summary as minified JSON.  The supply voltage is rounded to 10 mV (as it's
+/// displayed) so that noise in the reading doesn't count as a change; the inventory is just the number of
+/// files and their total size, rather than the full list.
+///
+/// @param section  Index of the section to render
+/// @return Minified JSON for the section
+
+String StatusFeed::render(int section)
+{
+    String json;
+    switch (section) {
+        case 0:
+            json = String(round(logger::Metrics.SupplyVoltage()*100.0)/100.0, 2);
+            break;
+        case 1: {
+            String server_status, boot_status;
+            logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_WS_STATUS_S, server_status);
+            logger::LoggerConfig.GetConfigString(logger::Config::CONFIG_WS_BOOTSTATUS_S, boot_status);
+            StaticJsonDocument<256> doc;
+            doc["current"] = server_status;
+            doc["boot"] = boot_status;
+            serializeJson(doc, json);
+            break;
+        }
+        case 2: {
+            uint64_t total;
+            uint32_t n_files = m_logManager->SummariseLogFiles(total);
+            StaticJsonDocument<64> doc;
+            doc["count"] = n_files;
+            doc["size"] = total;
+            serializeJson(doc, json);
+            break;
+        }
+        case 3: serializeJson(logger::Metrics.LastKnownGood(), json); break;
+        case 4: serializeJson(logger::Metrics.Ingest(), json); break;
+        case 5: serializeJson(logger::StorageIO.Render(), json); break;
+        case 6: serializeJson(m_logManager->CompressionStatus(), json); break;
+        case 7: serializeJson(net::UploadStats.Render(), json); break;
+        case 8: serializeJson(net::LiveStats.Render(), json); break;
+    }
+    return json;
 }
 
 DynamicJsonDocument GenerateJSON(String const& source)
@@ -0,0 +1,241 @@
+/*! \file StorageBenchmark.cpp
+ *  \brief Portable benchmark for qualifying the storage medium used for logging
+ *
+ * The quality of SD cards (and, to a lesser extent, eMMC modules) varies enormously, and a card that
+ * can't sustain the logger's write rate will lose data.  This module provides a benchmark that runs
+ * sequential and random write and read tests against a scratch file, with configurable block size and
+ * flush policy, and reports throughput and latency percentiles, with a pass/fail against the rate the
+ * logger requires.  The core is independent of the Arduino environment so that it can also be built on
+ * a POSIX host to provide a reference for comparison.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include "StorageBenchmark.h"
+
+namespace bench {
+
+const uint32_t MaxBlocks = 65536;   ///< Maximum number of blocks in a test (bounds the latency buffer)
+const uint32_t RandomSeed = 0x57494231; ///< Fixed seed for random offsets, so that runs are repeatable
+
+/// Constructor for the benchmark.  No work is done until \a Start() is called.
+///
+/// \param medium   Interface to the scratch file to use (external owner)
+/// \param clock    Function returning a monotonic time in microseconds
+
+Benchmark::Benchmark(Medium *medium, Clock clock)
+: m_medium(medium), m_clock(clock), m_phase(PHASE_IDLE), m_nBlocks(0), m_block(0), m_seed(RandomSeed),
+  m_testStart(0)
+{
+}
+
+/// Set up for a new run with the parameters given, creating the scratch file and allocating the
+/// data block and latency buffers.  Any run in progress is abandoned first.
+///
+/// \param params   Parameters for the run
+/// \return True if the run was set up, otherwise False (see \a Error())
+
+bool Benchmark::Start(Parameters const& params)
+{
+    Stop();
+    m_params = params;
+    m_results.clear();
+    m_error.clear();
+
+    if (m_params.blockSize == 0 || m_params.fileSize < m_params.blockSize) {
+        m_error = "block size must be non-zero, and no larger than the file size";
+        return false;
+    }
+    m_nBlocks = m_params.fileSize / m_params.blockSize;
+    if (m_nBlocks > MaxBlocks) {
+        m_error = "too many blocks in file (increase block size or reduce file size)";
+        return false;
+    }
+    m_buffer.assign(m_params.blockSize, 0);
+    for (uint32_t i = 0; i < m_params.blockSize; ++i) m_buffer[i] = static_cast<uint8_t>(i * 31 + 7);
+    m_latency.clear();
+    m_latency.reserve(m_nBlocks);
+
+    if (!m_medium->Open()) {
+        m_error = "failed to create scratch file";
+        return false;
+    }
+    m_seed = RandomSeed;
+    beginPhase(PHASE_SEQ_WRITE);
+    return true;
+}
+
+/// Abandon the current run (if any), closing and removing the scratch file.  Results of tests that
+/// have already completed are kept.
+
+void Benchmark::Stop(void)
+{
+    if (Running()) {
+        m_medium->Close();
+        m_medium->Remove();
+    }
+    m_phase = PHASE_IDLE;
+}
+
+/// Run blocks of the current test until the time budget has been used or the run is complete.  At
+/// least one block is run on each call, so that progress is made even with a very small budget.
+///
+/// \param budget   Time (us) to spend on this step
+/// \return True if there is more work to do, otherwise False
+
+bool Benchmark::Step(uint32_t budget)
+{
+    if (!Running()) return false;
+    uint64_t deadline = m_clock() + budget;
+    do {
+        if (!runBlock()) return false;
+        if (m_block == m_nBlocks) {
+            endPhase();
+            if (!Running()) return false;
+        }
+    } while (m_clock() < deadline);
+    return true;
+}
+
+/// Determine whether all of the tests in the last run met the required rate.  This is only True if
+/// the run completed.
+///
+/// \return True if the run completed and all tests passed, otherwise False
+
+bool Benchmark::Passed(void) const
+{
+    if (m_phase != PHASE_DONE) return false;
+    for (size_t n = 0; n < m_results.size(); ++n) {
+        if (!m_results[n].pass) return false;
+    }
+    return true;
+}
+
+/// Start the test for the given phase, resetting the block count and latency buffer.
+///
+/// \param phase    Phase to start
+
+void Benchmark::beginPhase(Phase phase)
+{
+    m_phase = phase;
+    m_block = 0;
+    m_latency.clear();
+    m_testStart = m_clock();
+    if (phase == PHASE_SEQ_WRITE || phase == PHASE_SEQ_READ) {
+        m_medium->Seek(0);
+    }
+}
+
+/// Complete the current test: flush the medium for write tests (so that buffered data is included
+/// in the time), compute throughput and latency percentiles, and move on to the next phase (closing
+/// and removing the scratch file after the last).
+
+void Benchmark::endPhase(void)
+{
+    bool write = (m_phase == PHASE_SEQ_WRITE || m_phase == PHASE_RAND_WRITE);
+    if (write) m_medium->Flush();
+
+    Result r;
+    switch (m_phase) {
+        case PHASE_SEQ_WRITE:   r.name = "seqwrite"; break;
+        case PHASE_SEQ_READ:    r.name = "seqread"; break;
+        case PHASE_RAND_WRITE:  r.name = "randwrite"; break;
+        default:                r.name = "randread"; break;
+    }
+    r.write = write;
+    r.bytes = static_cast<uint64_t>(m_nBlocks) * m_params.blockSize;
+    r.elapsed = m_clock() - m_testStart;
+    r.rate = r.elapsed > 0 ? 1.0e6 * r.bytes / r.elapsed : 0.0;
+    std::sort(m_latency.begin(), m_latency.end());
+    size_t n = m_latency.size();
+    r.p50 = m_latency[n / 2];
+    r.p90 = m_latency[(n * 9) / 10];
+    r.p99 = m_latency[(n * 99) / 100];
+    r.max = m_latency[n - 1];
+    r.pass = !write || r.rate >= m_params.requiredRate;
+    m_results.push_back(r);
+
+    switch (m_phase) {
+        case PHASE_SEQ_WRITE:   beginPhase(PHASE_SEQ_READ); break;
+        case PHASE_SEQ_READ:    beginPhase(PHASE_RAND_WRITE); break;
+        case PHASE_RAND_WRITE:  beginPhase(PHASE_RAND_READ); break;
+        default:
+            m_medium->Close();
+            m_medium->Remove();
+            m_phase = PHASE_DONE;
+            break;
+    }
+}
+
+/// Run a single block of the current test, recording its latency.  For random tests, the block is
+/// positioned first (the seek isn't included in the latency, since it only sets the file position).
+///
+/// \return True if the block was transferred, otherwise False (and the run is abandoned)
+
+bool Benchmark::runBlock(void)
+{
+    if (m_phase == PHASE_RAND_WRITE || m_phase == PHASE_RAND_READ) {
+        if (!m_medium->Seek(nextRandom() * m_params.blockSize)) {
+            fail("failed to seek in scratch file");
+            return false;
+        }
+    }
+    uint64_t start = m_clock();
+    size_t n;
+    if (m_phase == PHASE_SEQ_WRITE || m_phase == PHASE_RAND_WRITE) {
+        n = m_medium->Write(m_buffer.data(), m_params.blockSize);
+        if (m_params.flushEvery > 0 && ((m_block + 1) % m_params.flushEvery) == 0) {
+            m_medium->Flush();
+        }
+    } else {
+        n = m_medium->Read(m_buffer.data(), m_params.blockSize);
+    }
+    m_latency.push_back(static_cast<uint32_t>(m_clock() - start));
+    if (n != m_params.blockSize) {
+        fail("short read or write on scratch file (medium full?)");
+        return false;
+    }
+    ++m_block;
+    return true;
+}
+
+/// Abandon the current run with the error message given, closing and removing the scratch file.
+///
+/// \param message  Description of the error
+
+void Benchmark::fail(const char *message)
+{
+    m_error = message;
+    Stop();
+}
+
+/// Generate the next block number for random tests, using a 32-bit xorshift generator.
+///
+/// \return Block number in [0, number of blocks)
+
+uint32_t Benchmark::nextRandom(void)
+{
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+    return m_seed % m_nBlocks;
+}
+
+}
@@ -0,0 +1,174 @@
+/*! \file StorageMetrics.cpp
+ *  \brief Telemetry for the logger's storage (SD card or eMMC) I/O
+ *
+ * The logger depends on its storage keeping up with the data rate, but until it fails there's no
+ * indication of how close to the limit the card is.  This module measures each class of storage
+ * operation (packet writes, flushes, log file open/close, console log writes, and file transfers),
+ * keeping latency histograms and byte/operation counts, the worst stall seen, and a projection of
+ * when the card will fill at the current write rate.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "StorageMetrics.h"
+
+namespace logger {
+
+/// Names for each of the classes of storage operation, in enum order, for reporting
+static const char *op_names[StorageOpCount] = {
+    "write", "flush", "open", "close", "syslog", "transfer"
+};
+
+/// Default constructor for the storage monitor.  The storage isn't known until \a Begin() is called,
+/// so there are no card usage estimates until then.
+
+StorageMonitor::StorageMonitor(void)
+: m_stall(0), m_stallOp(STORAGE_WRITE), m_stallTime(0), m_storage(nullptr), m_cardTotal(0), m_cardUsed(0),
+  m_lastSample(0), m_lastBytes(0), m_lastBusy(0), m_rate(0.0f), m_busy(0.0f)
+{
+    portMUX_INITIALIZE(&m_lock);
+    for (int op = 0; op < StorageOpCount; ++op) {
+        m_ops[op].count = 0;
+        m_ops[op].bytes = 0;
+        m_ops[op].total = 0;
+        m_ops[op].worst = 0;
+        for (int b = 0; b < StorageBuckets; ++b) m_ops[op].buckets[b] = 0;
+    }
+}
+
+/// Set the storage controller to interrogate for card capacity and usage, and take the first
+/// reading so that the status report has something to show straight away.
+///
+/// \param storage  Pointer to the storage controller in use (external owner)
+
+void StorageMonitor::Begin(mem::MemController *storage)
+{
+    m_storage = storage;
+    m_lastSample = esp_timer_get_time();
+    if (m_storage != nullptr) {
+        m_cardTotal = m_storage->TotalBytes();
+        m_cardUsed = m_storage->UsedBytes();
+    }
+}
+
+/// Add a single storage operation to the statistics for its class.  The bucket is the position of
+/// the most significant set bit in the duration (in microseconds), saturating at the last bucket.
+///
+/// \param op       Class of the operation
+/// \param start    Time at the start of the operation (as returned by \a Start())
+/// \param bytes    Number of bytes written or read by the operation
+
+void StorageMonitor::Stop(StorageOp op, uint32_t start, uint32_t bytes)
+{
+    uint32_t now = static_cast<uint32_t>(esp_timer_get_time());
+    uint32_t elapsed = now - start;
+    int bucket = 31 - __builtin_clz(elapsed | 1);
+    if (bucket >= StorageBuckets) bucket = StorageBuckets - 1;
+
+    portENTER_CRITICAL(&m_lock);
+    OpStats& s = m_ops[op];
+    ++s.count;
+    s.bytes += bytes;
+    s.total += elapsed;
+    ++s.buckets[bucket];
+    if (elapsed > s.worst) s.worst = elapsed;
+    if (elapsed > m_stall) {
+        m_stall = elapsed;
+        m_stallOp = op;
+        m_stallTime = esp_timer_get_time();
+    }
+    portEXIT_CRITICAL(&m_lock);
+}
+
+/// Update the write rate, percentage of time spent in storage operations, and card usage, if the
+/// sample period has elapsed since the last sample.  Reading the space used on the card can take
+/// some time on a FAT file system (depending on whether the free cluster count is cached), which is
+/// why it's only done once a period, from a background task.  Transfers are not included in the busy
+/// time, since they are mostly limited by the network rather than the storage.
+///
+/// \return True if a new sample was taken (i.e., a metrics report is due), otherwise False
+
+bool StorageMonitor::Sample(void)
+{
+    int64_t now = esp_timer_get_time();
+    if (now - m_lastSample < StorageSamplePeriod*1000000LL) return false;
+
+    uint64_t bytes = m_ops[STORAGE_WRITE].bytes + m_ops[STORAGE_SYSLOG].bytes;
+    uint64_t busy = 0;
+    for (int op = 0; op < StorageOpCount; ++op) {
+        if (op != STORAGE_TRANSFER) busy += m_ops[op].total;
+    }
+    float period = (now - m_lastSample) / 1.0e6f;
+    m_rate = (bytes - m_lastBytes) / period;
+    m_busy = 100.0f * (busy - m_lastBusy) / (now - m_lastSample);
+    m_lastBytes = bytes;
+    m_lastBusy = busy;
+    m_lastSample = now;
+
+    if (m_storage != nullptr) {
+        m_cardTotal = m_storage->TotalBytes();
+        m_cardUsed = m_storage->UsedBytes();
+    }
+    return true;
+}
+
+/// Generate a JSON document with the storage statistics.  For each class of operation that has been
+/// used, this reports the count, total bytes, mean and maximum latency (us), and the latency histogram
+/// (bucket N covering [2^N, 2^(N+1)) us, truncated after the last non-zero bucket).  The worst stall
+/// is reported with its class and the uptime (s) at which it happened.  The "card" element has the
+/// capacity and space used (bytes) at the last sample, and "full" is the projected time (hours) until
+/// the card fills at the write rate over the last sample period (omitted if nothing is being written).
+///
+/// \return JSON document with the storage summary
+
+DynamicJsonDocument StorageMonitor::Render(void) const
+{
+    DynamicJsonDocument doc(512 + 384*StorageOpCount);
+
+    for (int op = 0; op < StorageOpCount; ++op) {
+        OpStats const& s = m_ops[op];
+        if (s.count == 0) continue;
+        JsonObject entry = doc["ops"].createNestedObject(op_names[op]);
+        entry["count"] = s.count;
+        entry["bytes"] = s.bytes;
+        entry["mean"] = static_cast<uint32_t>(s.total / s.count);
+        entry["max"] = s.worst;
+        int last = StorageBuckets - 1;
+        while (last > 0 && s.buckets[last] == 0) --last;
+        JsonArray buckets = entry.createNestedArray("buckets");
+        for (int b = 0; b <= last; ++b) buckets.add(s.buckets[b]);
+    }
+    if (m_stall > 0) {
+        doc["stall"]["op"] = op_names[m_stallOp];
+        doc["stall"]["duration"] = m_stall;
+        doc["stall"]["uptime"] = static_cast<uint32_t>(m_stallTime / 1000000LL);
+    }
+    doc["rate"] = m_rate;
+    doc["busy"] = m_busy;
+    doc["card"]["total"] = m_cardTotal;
+    doc["card"]["used"] = m_cardUsed;
+    if (m_rate > 0.0f && m_cardTotal > m_cardUsed) {
+        doc["card"]["full"] = (m_cardTotal - m_cardUsed) / m_rate / 3600.0f;
+    }
+    return doc;
+}
+
+StorageMonitor StorageIO;   ///< Static parameter to use for storage telemetry
+
+}
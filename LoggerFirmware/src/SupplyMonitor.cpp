@@ -28,17 +28,23 @@
 #include "SupplyMonitor.h"
 #include "Configuration.h"
 #include "DataMetrics.h"
+#include "EventLoop.h"
 
 namespace logger {
 
+constexpr double to_volts = 11.76 / 1000.0; ///< Scaling for voltage divider, and scaled read in millivolts
+constexpr double trigger_threshold = 6.0;   ///< Volts (below which to trigger shutdown)
+
 /// If configured, bring up the power supply monitoring code, using the given pin.  The code
 /// checks the voltage on the supplied pin, and expects it to stay at least above the half-supply
-/// level, or it sounds the alarm.
+/// level, or it sounds the alarm.  The ADC calibration is read, the trigger threshold converted into
+/// raw ADC units, and the filter primed with an initial reading before the sampling timer is started.
 ///
 /// \param monitor_pin  GPIO pin number to use for monitoring
 
 SupplyMonitor::SupplyMonitor(uint8_t monitor_pin)
-: m_monitorPower(false), m_monitorPin(monitor_pin)
+: m_monitorPower(false), m_monitorPin(monitor_pin), m_timer(nullptr), m_threshold(0),
+  m_filtered(0), m_emergency(false), m_trippedAt(0)
 {
     if (!logger::LoggerConfig.GetConfigBinary(logger::Config::ConfigParam::CONFIG_POWMON_B, m_monitorPower)) {
         // Returns false if the key doesn't exist.  This usually means that
@@ -49,39 +55,112 @@ SupplyMonitor::SupplyMonitor(uint8_t monitor_pin)
     }
     if (m_monitorPower) {
         pinMode(m_monitorPin, INPUT);
+        // The Arduino core defaults to 11dB attenuation and 12-bit readings on the ADC
+        esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, 1100, &m_adcCal);
+        uint32_t lo = 0, hi = 4095;
+        while (lo < hi) {
+            uint32_t mid = (lo + hi) / 2;
+            if (toVolts(mid) < trigger_threshold)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        m_threshold = lo;
+        m_filtered = static_cast<uint32_t>(analogRead(m_monitorPin)) << SupplyFilterFraction;
+
+        esp_timer_create_args_t args = {};
+        args.callback = sampleCallback;
+        args.arg = this;
+        args.dispatch_method = ESP_TIMER_TASK;
+        args.name = "supply";
+        if (esp_timer_create(&args, &m_timer) != ESP_OK ||
+            esp_timer_start_periodic(m_timer, SupplySamplePeriod) != ESP_OK) {
+            Serial.println("ERR: failed to start supply voltage sampling timer.");
+        }
         EmergencyPower();
-        Serial.printf("DBG: monitor voltage level = %.2f V\n", logger::Metrics.SupplyVoltage());
+        Serial.printf("DBG: monitor voltage level = %.2f V (threshold %u counts)\n",
+            logger::Metrics.SupplyVoltage(), m_threshold);
+    }
+}
+
+/// Default destructor, stopping the sampling timer if it was started.
+
+SupplyMonitor::~SupplyMonitor(void)
+{
+    if (m_timer != nullptr) {
+        esp_timer_stop(m_timer);
+        esp_timer_delete(m_timer);
     }
 }
 
-/// Check the emergency power pin to see whether the main power supply is on.  The code assumes that the
-/// input voltage is fine so long as it scales to above a fixed threshold (defined at compile time, typically
-/// 6V, which is about the minimum required for the Switch-Mode Power Supply to stay up).  For hardware 2.5.1,
-/// the voltage divider ratio is 4.75/(4.75+51.1)=0.0850, so the scaling factor from measured to input is 11.76;
-/// the code therefore uses the internal conversion to millivolts (which can take advantage of any ADC
-/// calibration that might be stored in the system), and converts back to input voltage, rather than having a
-/// hard-coded ADC value; the conversion factor is specified as a constexpr for clarity.  Note that the ADC on
-/// the ESP32 is not particularly reliable or linear, so this is really just a ballpark check that hopefully
-/// won't fail too often.
-///    Calling this code also updates the DataMetrics supply voltage value, so that it can be logged with the
-/// rest of the metrics, and displayed in the logger's web interface (for example).
+/// Convert a raw ADC reading into input supply voltage.  The code assumes that the input voltage is fine
+/// so long as it scales to above a fixed threshold (defined at compile time, typically 6V, which is about the
+/// minimum required for the Switch-Mode Power Supply to stay up).  For hardware 2.5.1, the voltage divider
+/// ratio is 4.75/(4.75+51.1)=0.0850, so the scaling factor from measured to input is 11.76; the code therefore
+/// uses the ADC calibration to convert to millivolts (which can take advantage of any calibration that might
+/// be stored in the system), and converts back to input voltage, rather than having a hard-coded ADC value.
+/// Note that the ADC on the ESP32 is not particularly reliable or linear, so this is really just a ballpark
+/// check that hopefully won't fail too often.
+///
+/// \param raw Raw ADC reading
+/// \return Input supply voltage (V)
+
+double SupplyMonitor::toVolts(uint32_t raw) const
+{
+    return esp_adc_cal_raw_to_voltage(raw, &m_adcCal) * to_volts;
+}
+
+/// Callback for the sampling timer.  This runs in the high-resolution timer task, so it must be short.
+///
+/// \param arg Pointer to the \a SupplyMonitor that started the timer
+
+void SupplyMonitor::sampleCallback(void *arg)
+{
+    static_cast<SupplyMonitor*>(arg)->sample();
+}
+
+/// Take a raw reading of the monitoring pin, and add it into a first-order exponential filter kept in
+/// fixed point (with \a SupplyFilterFraction fractional bits), giving each new sample a weight of
+/// 1/2^\a SupplyFilterShift.  If the filtered value drops below the threshold, the emergency flag is set,
+/// and the supply event is posted to the main loop so that the shutdown starts straight away.
+
+void SupplyMonitor::sample(void)
+{
+    int32_t raw = static_cast<int32_t>(analogRead(m_monitorPin)) << SupplyFilterFraction;
+    int32_t filtered = static_cast<int32_t>(m_filtered);
+    filtered += (raw - filtered) >> SupplyFilterShift;
+    m_filtered = static_cast<uint32_t>(filtered);
+    if (!m_emergency && (m_filtered >> SupplyFilterFraction) < m_threshold) {
+        m_trippedAt = esp_timer_get_time();
+        m_emergency = true;
+        logger::Events.Post(logger::EVT_SUPPLY);
+    }
+}
+
+/// Check whether the filtered supply voltage has dropped below the threshold (as determined by the
+/// sampling timer).  This is now only a check of a flag, so it can be called as often as required.
+///     Calling this code also updates the DataMetrics supply voltage value from the filtered reading, so
+/// that it can be logged with the rest of the metrics, and displayed in the logger's web interface (for
+/// example).
 ///
 /// \return True if the module need to switch to emergency power, or False if the main power is on
 
 bool SupplyMonitor::EmergencyPower(void)
 {
-    if (m_monitorPower) {
-        constexpr double to_volts = 11.76 / 1000.0; // Scaling for voltage divider, and scaled read in millivolts
-        constexpr double trigger_threshold = 6.0; // Volts (below which to trigger shutdown)
-
-        double monitor_mvolts = analogReadMilliVolts(m_monitorPin);
-        double input_voltage = monitor_mvolts * to_volts;
-        logger::Metrics.SupplyVoltage(input_voltage);
-        if (input_voltage < trigger_threshold) {
-            return true;
-        }
-    }
-    return false;
+    if (!m_monitorPower) return false;
+    logger::Metrics.SupplyVoltage(toVolts(m_filtered >> SupplyFilterFraction));
+    return m_emergency;
+}
+
+/// Report how long it has been since the filtered supply voltage dropped below the threshold, so that the
+/// time taken to respond to a power failure can be recorded (for sizing the hold-up capacitance).
+///
+/// \return Time (us) since the supply dropped below the threshold, or zero if it hasn't
+
+uint32_t SupplyMonitor::SinceTrip(void) const
+{
+    if (!m_emergency) return 0;
+    return static_cast<uint32_t>(esp_timer_get_time() - m_trippedAt);
 }
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,196 @@
+/*! \file Trace.cpp
+ *  \brief Compact binary event trace for post-mortem timing analysis
+ *
+ * When data goes missing in the field, the console log is too coarse (and too expensive at high
+ * rates) to tell where the time went.  This module keeps a ring of fixed-size binary event records
+ * (timestamp, event ID, and two arguments) emitted from the key points in the data path, which can
+ * be dumped over serial or HTTP and converted on the host into a Chrome trace for visualisation.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "Trace.h"
+
+namespace logger {
+
+/// Default constructor for the trace.  The ring isn't allocated until tracing is turned on, so that
+/// the memory isn't used unless it's needed.
+
+Trace::Trace(void)
+: m_ring(nullptr), m_capacity(0), m_count(0), m_enabled(false), m_nNames(0)
+{
+    portMUX_INITIALIZE(&m_lock);
+}
+
+/// Default destructor, releasing the ring if it was allocated.
+
+Trace::~Trace(void)
+{
+    if (m_ring != nullptr) heap_caps_free(m_ring);
+}
+
+/// Register a name for use as an event argument, or find the index of a name that's already been
+/// registered (so that, e.g., objects that get re-created don't use up the table).
+///
+/// \param name Name to register (must be a static string, since only the pointer is stored)
+/// \return Index of the name, or 0xFFFF if there is no more space in the table
+
+uint16_t Trace::Name(const char *name)
+{
+    for (uint16_t n = 0; n < m_nNames; ++n) {
+        if (strcmp(m_names[n], name) == 0) return n;
+    }
+    if (m_nNames == MaxTraceNames) {
+        Serial.printf("ERR: no more trace names available for \"%s\".\n", name);
+        return 0xFFFF;
+    }
+    m_names[m_nNames] = name;
+    return m_nNames++;
+}
+
+/// Turn tracing on or off.  On first use, the ring is allocated in PSRAM if the module has it
+/// (for a longer history), and otherwise in internal RAM.  Turning tracing off leaves the ring
+/// intact so that it can be dumped.
+///
+/// \param on   Flag: True to start tracing, False to stop
+/// \return True if the state was changed as requested, otherwise False
+
+bool Trace::Enable(bool on)
+{
+    if (on && m_ring == nullptr) {
+        if (psramFound()) {
+            m_ring = static_cast<TraceRecord*>(heap_caps_malloc(TraceRecordsPSRAM*sizeof(TraceRecord), MALLOC_CAP_SPIRAM));
+            m_capacity = TraceRecordsPSRAM;
+        }
+        if (m_ring == nullptr) {
+            m_ring = static_cast<TraceRecord*>(heap_caps_malloc(TraceRecordsRAM*sizeof(TraceRecord), MALLOC_CAP_8BIT));
+            m_capacity = TraceRecordsRAM;
+        }
+        if (m_ring == nullptr) {
+            Serial.println("ERR: failed to allocate trace buffer.");
+            m_capacity = 0;
+            return false;
+        }
+        m_count = 0;
+    }
+    m_enabled = on;
+    return true;
+}
+
+/// Discard all of the records currently in the ring.
+
+void Trace::Clear(void)
+{
+    portENTER_CRITICAL_SAFE(&m_lock);
+    m_count = 0;
+    portEXIT_CRITICAL_SAFE(&m_lock);
+}
+
+/// Add an event record to the ring, overwriting the oldest record if the ring is full.
+///
+/// \param event    Event identifier
+/// \param arg0     First (short) argument
+/// \param arg1     Second (long) argument
+
+void Trace::record(TraceEvent event, uint16_t arg0, uint32_t arg1)
+{
+    // The time is read under the lock so that records from tasks on both cores go into the ring in
+    // time order (the converter takes any large step backwards as the 32-bit timer wrapping).
+    portENTER_CRITICAL_SAFE(&m_lock);
+    TraceRecord& r = m_ring[m_count % m_capacity];
+    r.timestamp = static_cast<uint32_t>(esp_timer_get_time());
+    r.event = static_cast<uint16_t>(event);
+    r.arg0 = arg0;
+    r.arg1 = arg1;
+    ++m_count;
+    portEXIT_CRITICAL_SAFE(&m_lock);
+}
+
+/// Write the binary dump of the trace (header, name table, and records oldest-first) to the stream
+/// given.  Tracing is suspended while the dump is written so that the records being sent aren't
+/// overwritten, and resumed afterwards if it was on.  Records are sent in blocks to avoid a separate
+/// write (and, for HTTP, a separate chunk) for each record.
+///
+/// \param output   Stream on which to write the dump
+/// \return Number of bytes written
+
+size_t Trace::Dump(Stream& output)
+{
+    bool was_enabled = m_enabled;
+    m_enabled = false;
+
+    uint32_t total = m_count;
+    uint32_t n_records = total < m_capacity ? total : m_capacity;
+    uint32_t lost = total - n_records;
+    uint16_t version = TraceFormatVersion;
+    uint16_t record_size = sizeof(TraceRecord);
+    uint32_t n_names = m_nNames;
+    size_t bytes = 0;
+
+    bytes += output.write((const uint8_t*)"WTRC", 4);
+    bytes += output.write((const uint8_t*)&version, sizeof(uint16_t));
+    bytes += output.write((const uint8_t*)&record_size, sizeof(uint16_t));
+    bytes += output.write((const uint8_t*)&n_names, sizeof(uint32_t));
+    for (uint32_t n = 0; n < n_names; ++n) {
+        uint16_t length = strlen(m_names[n]);
+        bytes += output.write((const uint8_t*)&length, sizeof(uint16_t));
+        bytes += output.write((const uint8_t*)m_names[n], length);
+    }
+    bytes += output.write((const uint8_t*)&n_records, sizeof(uint32_t));
+    bytes += output.write((const uint8_t*)&lost, sizeof(uint32_t));
+
+    const uint32_t block_size = 64;
+    TraceRecord block[block_size];
+    uint32_t n = 0;
+    while (n < n_records) {
+        uint32_t count = n_records - n < block_size ? n_records - n : block_size;
+        for (uint32_t i = 0; i < count; ++i) {
+            block[i] = m_ring[(lost + n + i) % m_capacity];
+        }
+        bytes += output.write((const uint8_t*)block, count*sizeof(TraceRecord));
+        n += count;
+    }
+
+    m_enabled = was_enabled;
+    return bytes;
+}
+
+/// Generate a JSON document with the state of the trace: whether it's on, the size of the ring,
+/// the number of records currently held, and the number lost to overwriting since it was cleared.
+///
+/// \return JSON document with the trace summary
+
+DynamicJsonDocument Trace::Render(void) const
+{
+    DynamicJsonDocument doc(256);
+    uint32_t held = m_count < m_capacity ? m_count : m_capacity;
+    doc["enabled"] = m_enabled;
+    doc["capacity"] = m_capacity;
+    doc["records"] = held;
+    doc["lost"] = m_count - held;
+    doc["names"] = m_nNames;
+    return doc;
+}
+
+Trace Tracer;   ///< Static parameter to use for event tracing
+
+}
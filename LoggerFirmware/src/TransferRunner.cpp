@@ -0,0 +1,153 @@
+/*! \file TransferRunner.cpp
+ *  \brief Send a log file over the serial port with the block transfer protocol, in the background
+ *
+ * This connects the portable block transfer sender to the logger's serial port and file system, and runs
+ * it in steps from the scheduler so that the logger keeps recording while a file is sent.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "esp_timer.h"
+#include "TransferRunner.h"
+
+namespace logger {
+
+/// Microsecond clock for the transfer time-outs, from the ESP32 high-resolution timer.
+///
+/// \return Time since boot (us)
+
+static uint64_t transfer_clock(void)
+{
+    return static_cast<uint64_t>(esp_timer_get_time());
+}
+
+/// Default constructor.  Nothing is opened until a transfer is started.
+
+TransferRunner::TransferRunner(void)
+: m_source(nullptr), m_sender(&m_link, transfer_clock), m_reported(true)
+{
+}
+
+/// Default destructor, abandoning any transfer in progress.
+
+TransferRunner::~TransferRunner(void)
+{
+    Stop();
+    delete m_source;
+}
+
+/// Start sending a file, replacing any previous transfer (and its counts).  The header frame goes out
+/// straight away; the rest is sent from \a Step().
+///
+/// \param filesystem   File system holding the file (i.e., the logging medium)
+/// \param filename     Name of the file to send
+/// \param filesize     Size of the file (bytes)
+/// \param hash         MD5 hash of the file, passed through to the receiver
+/// \return True if the transfer started, otherwise False
+
+bool TransferRunner::Start(fs::FS& filesystem, String const& filename, uint32_t filesize, const uint8_t *hash)
+{
+    Stop();
+    delete m_source;
+    m_source = nullptr;
+    File file = filesystem.open(filename, FILE_READ);
+    if (!file) {
+        Serial.printf("ERR: failed to open \"%s\" for block transfer.\n", filename.c_str());
+        return false;
+    }
+    m_filename = filename;
+    m_source = new FileSource(file);
+    m_reported = !m_sender.Start(m_source, filesize, hash, xfer::Parameters());
+    return !m_reported;
+}
+
+/// Run a step of the transfer, if one is in progress, and report on the console when it finishes (by
+/// which time the serial port is back to ordinary text).  This is intended to be called from the scheduler.
+///
+/// \return True if there is more work to do, otherwise False
+
+bool TransferRunner::Step(void)
+{
+    bool more = m_sender.Step(TransferStepBudget);
+    if (!more && !m_reported) {
+        delete m_source;
+        m_source = nullptr;
+        xfer::Statistics const& stats = m_sender.Stats();
+        if (m_sender.Complete()) {
+            Serial.printf("INFO: sent \"%s\" (%u B) in %.1f s with %u blocks re-sent.\n", m_filename.c_str(),
+                m_sender.Size(), stats.elapsed/1.0e6, stats.retransmits);
+        } else {
+            Serial.printf("ERR: block transfer of \"%s\" failed: %s.\n", m_filename.c_str(),
+                m_sender.Error().c_str());
+        }
+        m_reported = true;
+    }
+    return more;
+}
+
+/// Abandon any transfer in progress, telling the receiver.
+
+void TransferRunner::Stop(void)
+{
+    if (m_sender.Running()) {
+        m_sender.Stop();
+        m_reported = true;
+        delete m_source;
+        m_source = nullptr;
+    }
+}
+
+/// Generate a JSON document with the state of the transfer ("idle", "running", "complete", or "failed"
+/// with the error), the file being sent, and the counts: bytes acknowledged, frames sent, blocks re-sent,
+/// time-outs, acknowledgements with bad CRCs, and elapsed time (us).
+///
+/// \return JSON document with the transfer summary
+
+DynamicJsonDocument TransferRunner::Render(void) const
+{
+    DynamicJsonDocument doc(512);
+    if (m_filename.isEmpty()) {
+        doc["state"] = "idle";
+        return doc;
+    }
+    if (m_sender.Running()) {
+        doc["state"] = "running";
+    } else if (m_sender.Complete()) {
+        doc["state"] = "complete";
+    } else if (!m_sender.Error().empty()) {
+        doc["state"] = "failed";
+        doc["error"] = m_sender.Error().c_str();
+    } else {
+        doc["state"] = "idle";
+    }
+    xfer::Statistics const& stats = m_sender.Stats();
+    doc["file"] = m_filename;
+    doc["size"] = m_sender.Size();
+    doc["bytes"] = stats.bytes;
+    doc["frames"] = stats.frames;
+    doc["retransmits"] = stats.retransmits;
+    doc["timeouts"] = stats.timeouts;
+    doc["crcerrors"] = stats.crcErrors;
+    doc["elapsed"] = stats.elapsed;
+    return doc;
+}
+
+TransferRunner Transfer;    ///< Static parameter to use for block transfers over the serial port
+
+}
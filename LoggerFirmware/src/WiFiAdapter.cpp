@@ -23,6 +23,8 @@
  * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <algorithm>
+#include <climits>
 #include <functional>
 #include <queue>
 #include <vector>
@@ -32,14 +34,20 @@
 #include <ESPmDNS.h>
 #include <WebServer.h>
 #include <WifiClient.h>
+#include <lwip/sockets.h>
 #include <LittleFS.h>
 #include <ESP32-targz.h>
 
 #include "LogManager.h"
 #include "WiFiAdapter.h"
 #include "Configuration.h"
+#include "Trace.h"
+#include "StorageMetrics.h"
+#include "ArchiveStream.h"
+#include "LogCompressor.h"
 #include "MemController.h"
 #include "serial_number.h"
+#include "Status.h"
 
 #if defined(ARDUINO_ARCH_ESP32) || defined(ESP32)
 
@@ -72,13 +80,338 @@ private:
     WebServer *m_output;
 };
 
+const uint32_t ClientStallTimeout = 30000;  ///< Time (ms) without progress before a download client is dropped
+
+/// Send as much of the data as the client's connection can take without waiting (which may be none of it).
+/// \a WiFiClient::write() waits (for up to its time-out, several seconds) until the TCP window opens, which
+/// would hold up the loop for a slow client, so this goes to the socket directly.
+///
+/// \param client   Connection to send on
+/// \param data     Data to send
+/// \param size     Number of bytes to send
+/// \return Number of bytes sent, or -1 if the connection has failed
+
+static int sendNow(WiFiClient& client, const uint8_t *data, size_t size)
+{
+    int fd = client.fd();
+    if (fd < 0) return -1;
+    if (size == 0) return 0;
+    int n = send(fd, data, size, MSG_DONTWAIT);
+    if (n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    return n;
+}
+
+/// \class ArchiveClient
+/// \brief Output for an archive download, which keeps the client connection after the request handler returns
+///
+/// The archive is written from the scheduler in slices, long after the web-server has finished with the
+/// request, so this holds a reference to the client connection (which keeps it open after the server
+/// releases it), and does the chunked transfer framing if the response needs it.  Writes never wait: they
+/// take as much as the connection can accept, and the archive offers the rest again later.  With chunked
+/// framing, a chunk is started for whatever is offered, and its header and trailer are sent as the connection
+/// allows, so the framing stays correct whatever is accepted; once the archive is complete, \a Finish() sends
+/// the rest of the framing (and the last-chunk marker) in the same way.  A client that stops taking data for
+/// \a ClientStallTimeout is treated as disconnected.
+
+class ArchiveClient : public Print {
+public:
+    ArchiveClient(void)
+    : m_attached(false), m_chunked(false), m_failed(false), m_headerLength(0), m_headerSent(0), m_chunkLeft(0),
+      m_trailerLeft(0), m_endSent(0), m_lastProgress(0)
+    {}
+
+    void Attach(WiFiClient const& client, bool chunked)
+    {
+        m_client = client;
+        m_attached = true;
+        m_chunked = chunked;
+        m_failed = false;
+        m_headerLength = m_headerSent = 0;
+        m_chunkLeft = m_trailerLeft = 0;
+        m_endSent = 0;
+        m_lastProgress = millis();
+    }
+
+    void Release(void)
+    {
+        m_client.stop();
+        m_attached = false;
+    }
+
+    bool Attached(void) const { return m_attached; }
+
+    bool Finish(void)
+    {
+        if (!m_chunked) return true;
+        if (!framingDone()) return false;
+        m_endSent += sendSome(reinterpret_cast<const uint8_t*>("0\r\n\r\n") + m_endSent, 5 - m_endSent);
+        return m_endSent == 5;
+    }
+
+    bool Connected(void)
+    {
+        return !m_failed && m_client.connected() && millis() - m_lastProgress < ClientStallTimeout;
+    }
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t size) override {
+        if (!m_chunked) return sendSome(buf, size);
+        if (!framingDone()) return 0;
+        if (m_chunkLeft == 0) {
+            m_headerLength = snprintf(m_header, sizeof(m_header), "%X\r\n", size);
+            m_headerSent = 0;
+            m_chunkLeft = size;
+            m_trailerLeft = 2;
+            if (!framingDone()) return 0;
+        }
+        size_t sent = sendSome(buf, size < m_chunkLeft ? size : m_chunkLeft);
+        m_chunkLeft -= sent;
+        if (m_chunkLeft == 0) framingDone();
+        return sent;
+    }
+
+private:
+    WiFiClient  m_client;       ///< Connection to the client downloading the archive
+    bool        m_attached;     ///< Flag: True => holding a client connection
+    bool        m_chunked;      ///< Flag: True => use chunked transfer framing
+    bool        m_failed;       ///< Flag: True => the connection has failed
+    char        m_header[12];   ///< Header for the current chunk
+    size_t      m_headerLength; ///< Length of the chunk header
+    size_t      m_headerSent;   ///< Number of bytes of the chunk header sent
+    size_t      m_chunkLeft;    ///< Number of bytes of chunk data still to send
+    size_t      m_trailerLeft;  ///< Number of bytes of the chunk trailer (CRLF) still to send
+    size_t      m_endSent;      ///< Number of bytes of the last-chunk marker sent
+    uint32_t    m_lastProgress; ///< Time (ms) at which something was last sent
+
+    /// Send data without waiting, noting progress and failure.
+    size_t sendSome(const uint8_t *buf, size_t size)
+    {
+        int n = sendNow(m_client, buf, size);
+        if (n < 0) {
+            m_failed = true;
+            return 0;
+        }
+        if (n > 0) m_lastProgress = millis();
+        return n;
+    }
+
+    /// Send what remains of the current chunk's header, or its trailer (once the data is all sent).
+    /// \return True if nothing of the framing is left to send before more data, otherwise False
+    bool framingDone(void)
+    {
+        if (m_headerSent < m_headerLength) {
+            m_headerSent += sendSome(reinterpret_cast<const uint8_t*>(m_header) + m_headerSent, m_headerLength - m_headerSent);
+            if (m_headerSent < m_headerLength) return false;
+        }
+        if (m_chunkLeft == 0 && m_trailerLeft > 0) {
+            m_trailerLeft -= sendSome(reinterpret_cast<const uint8_t*>("\r\n") + 2 - m_trailerLeft, m_trailerLeft);
+            if (m_trailerLeft > 0) return false;
+        }
+        return true;
+    }
+};
+
+/// \class EventClients
+/// \brief Connections subscribed to the Server-Sent Event stream of status updates
+///
+/// Like the archive download, each subscription keeps a reference to its client connection after the
+/// web-server has finished with the request.  Every client gets the same (pre-serialised) event, sent
+/// without waiting; a client that has gone away, or that can't take the whole event straight away (which,
+/// since events are small compared to the TCP send buffer, means that it has stopped reading), is dropped,
+/// since a partial event would corrupt the stream.  The client can subscribe again.
+
+class EventClients {
+public:
+    static const int MaxClients = 4;    ///< Maximum number of subscriptions at any one time
+
+    EventClients(void)
+    : m_count(0)
+    {}
+
+    int Count(void) const { return m_count; }
+    bool Full(void) const { return m_count == MaxClients; }
+
+    void Add(WiFiClient const& client)
+    {
+        if (!Full()) m_clients[m_count++] = client;
+    }
+
+    void Send(String const& event)
+    {
+        int n = 0;
+        while (n < m_count) {
+            if (m_clients[n].connected() &&
+                sendNow(m_clients[n], reinterpret_cast<const uint8_t*>(event.c_str()), event.length()) == static_cast<int>(event.length())) {
+                ++n;
+            } else {
+                m_clients[n].stop();
+                m_clients[n] = m_clients[--m_count];
+                m_clients[m_count] = WiFiClient();
+            }
+        }
+    }
+
+    void Clear(void)
+    {
+        for (int n = 0; n < m_count; ++n) {
+            m_clients[n].stop();
+            m_clients[n] = WiFiClient();
+        }
+        m_count = 0;
+    }
+
+private:
+    WiFiClient  m_clients[MaxClients];  ///< Connections for the subscribed clients
+    int         m_count;                ///< Number of subscribed clients
+};
+
+/// \class TracingHandler
+/// \brief Request handler that records each HTTP request in the event trace
+///
+/// The WebServer doesn't have a hook that's called for every request, but it does offer each request
+/// to the registered handlers in turn until one accepts it.  This handler is registered first, records
+/// the request in the trace (identifying the endpoint by name), and then declines it so that the real
+/// handler gets to run.
+
+class TracingHandler : public RequestHandler {
+public:
+    TracingHandler(void)
+    {
+        for (int n = 0; n < EndpointCount; ++n) {
+            m_names[n] = logger::Tracer.Name(endpoints[n]);
+        }
+    }
+
+    bool canHandle(HTTPMethod method, String uri) override
+    {
+        if (logger::Tracer.Enabled()) {
+            // The endpoints are in order from most to least specific, so the first match is the right one
+            for (int n = 0; n < EndpointCount; ++n) {
+                if (uri.startsWith(endpoints[n])) {
+                    logger::Tracer.Emit(logger::TRACE_WIFI_REQUEST, m_names[n], static_cast<uint32_t>(method));
+                    break;
+                }
+            }
+        }
+        return false;
+    }
+
+private:
+    static const int EndpointCount = 7;             ///< Number of endpoints distinguished in the trace
+    static const char *endpoints[EndpointCount];    ///< Endpoint prefixes, most specific first
+    uint16_t m_names[EndpointCount];                ///< Trace name indices for the endpoints
+};
+
+const char *TracingHandler::endpoints[TracingHandler::EndpointCount] = {
+    "/heartbeat", "/command", "/archive", "/trace", "/events", "/logs", "/"
+};
+
+/// \class LogFileHandler
+/// \brief Request handler that serves log files with conditional and range requests
+///
+/// Log files are large, and are often downloaded over marginal WiFi, so this handler serves them in
+/// place of the static website so that an interrupted download can be resumed with a "Range" request,
+/// and a client that already has a file can skip it with "If-None-Match".  The ETag for a log file is
+/// the MD5 hash from the inventory, so it's strong (the same bytes always have the same tag, and any
+/// change gives a new one); files without a hash in the inventory (the file being written, and snapshots)
+/// are served without one.  If the file has been compressed in the background, and the client accepts
+/// gzip encoding, the compressed version is sent instead (with its own ETag).  Requests for files that
+/// don't exist are declined, and therefore handled by the static website as before.
+
+class LogFileHandler : public RequestHandler {
+public:
+    /// \brief Function type to look up the inventory hash of a file by name
+    typedef std::function<bool(String const&, logger::Manager::MD5Hash&)> DigestLookup;
+
+    LogFileHandler(fs::FS& filesystem, DigestLookup digest)
+    : m_fs(filesystem), m_digest(digest)
+    {}
+
+    bool canHandle(HTTPMethod method, String uri) override
+    {
+        if ((method != HTTP_GET && method != HTTP_HEAD) || !uri.startsWith("/logs/"))
+            return false;
+        return m_fs.exists(uri);
+    }
+
+    bool handle(WebServer& server, HTTPMethod method, String uri) override;
+
+private:
+    fs::FS          &m_fs;      ///< File system on which the log files are stored
+    DigestLookup    m_digest;   ///< Look-up for inventory hashes
+};
+
 class ExtendedWebServer : public WebServer {
 public:
     ExtendedWebServer(int port = 80)
-    : WebServer(port)
+    : WebServer(port), m_handedOver(false)
     {}
     ~ExtendedWebServer() {}
 
+    /// Send a file in response to the current request, with a strong ETag if one is given.  For GET (and
+    /// HEAD) requests, "If-None-Match" gives 304 Not Modified if the client has the file already, and a single
+    /// range ("bytes=N-M", "bytes=N-", or "bytes=-N") gives 206 Partial Content, unless an "If-Range" header
+    /// doesn't match the ETag.  Multiple ranges and malformed ranges get the whole file (which is allowed),
+    /// and a range that starts beyond the end of the file gets 416.  Other methods always get the whole file,
+    /// since range requests only apply to GET.
+    ///
+    /// \param f       File to send (open for reading)
+    /// \param etag    Quoted strong ETag for the file, or empty if there isn't one
+    /// \param method  HTTP method of the current request
+    /// \return Number of bytes of the file sent
+
+    size_t SendFile(File& f, String const& etag, HTTPMethod method)
+    {
+        size_t size = f.size();
+        size_t first = 0, last = size > 0 ? size - 1 : 0;
+        int code = 200;
+        bool conditional = method == HTTP_GET || method == HTTP_HEAD;
+
+        if (!etag.isEmpty()) sendHeader("ETag", etag);
+        if (conditional) {
+            sendHeader("Accept-Ranges", "bytes");
+            String if_none_match = header("If-None-Match");
+            if (!etag.isEmpty() && (if_none_match == "*" || if_none_match.indexOf(etag) >= 0)) {
+                send(304);
+                return 0;
+            }
+            String range = header("Range");
+            String if_range = header("If-Range");
+            if (range.startsWith("bytes=") && (if_range.isEmpty() || (!etag.isEmpty() && if_range == etag))) {
+                int rc = parseRange(range.c_str() + 6, size, first, last);
+                if (rc < 0) {
+                    sendHeader("Content-Range", String("bytes */") + String(static_cast<unsigned long>(size)));
+                    send(416);
+                    return 0;
+                }
+                if (rc > 0) {
+                    char content_range[64];
+                    snprintf(content_range, sizeof(content_range), "bytes %lu-%lu/%lu", static_cast<unsigned long>(first),
+                        static_cast<unsigned long>(last), static_cast<unsigned long>(size));
+                    sendHeader("Content-Range", content_range);
+                    code = 206;
+                }
+            }
+        }
+
+        size_t length = size > 0 ? last - first + 1 : 0;
+        setContentLength(length);
+        send(code, "application/octet-stream", "");
+        if (method == HTTP_HEAD || length == 0) return 0;
+
+        uint8_t buffer[1024];
+        size_t sent = 0;
+        if (first > 0) f.seek(first);
+        uint32_t start = logger::StorageIO.Start();
+        while (sent < length) {
+            size_t n = f.read(buffer, std::min(sizeof(buffer), length - sent));
+            if (n == 0 || _currentClient.write(buffer, n) != n) break;
+            sent += n;
+        }
+        logger::StorageIO.Stop(logger::STORAGE_TRANSFER, start, sent);
+        return sent;
+    }
+
     size_t StreamArchive(fs::FS *source, const char *path)
     {
         // First parse the path to get the list of files that need to be packaged and sent, so
@@ -95,19 +428,8 @@ public:
         setContentLength(CONTENT_LENGTH_UNKNOWN);
 
         // OK, so there's something to send, so we can build the headers then stream
-        String headers, module_id;
-        if (logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_MODULEID_S, module_id)) {
-            if (module_id.startsWith("TNODEID")) {
-                // This is the default configuration, if the user hasn't configured the module yet, but
-                // we don't want to pass it back as the filename, so ...
-                module_id = String("wibl-logs.tgz");
-            } else {
-                module_id += ".tgz";
-            }
-        } else {
-            module_id = String("wibl-logs.tgz");
-        }
-        sendHeader("Content-Disposition", String("attachment; filename=\"") + module_id + "\"");
+        String headers;
+        sendHeader("Content-Disposition", String("attachment; filename=\"") + archiveName(".tgz") + "\"");
         _prepareHeader(headers, 200, "application/tar+gzip", CONTENT_LENGTH_UNKNOWN);
         _currentClient.write(headers.c_str(), headers.length());
 
@@ -120,8 +442,182 @@ public:
         size_t compressed_size = TarGzPacker::compress(source, dirEntries, &op);
         return compressed_size;
     }
+
+    /// Parse a single byte range from a "Range" header (after the "bytes=" unit) against a file of the
+    /// given size.
+    ///
+    /// \param spec    Range specification from the header
+    /// \param size    Size of the file (bytes)
+    /// \param first   (Out) First byte of the range
+    /// \param last    (Out) Last byte of the range (inclusive)
+    /// \return 1 for a valid range, 0 if the header should be ignored, or -1 if the range can't be satisfied
+
+    static int parseRange(const char *spec, size_t size, size_t& first, size_t& last)
+    {
+        char *end;
+        if (strchr(spec, ',') != nullptr) return 0;
+        if (*spec == '-') {
+            unsigned long suffix = strtoul(spec + 1, &end, 10);
+            if (end == spec + 1 || *end != '\0') return 0;
+            if (suffix == 0 || size == 0) return -1;
+            first = suffix >= size ? 0 : size - suffix;
+            last = size - 1;
+            return 1;
+        }
+        unsigned long start = strtoul(spec, &end, 10);
+        if (end == spec || *end != '-') return 0;
+        const char *tail = end + 1;
+        unsigned long stop = ULONG_MAX;
+        if (*tail != '\0') {
+            stop = strtoul(tail, &end, 10);
+            if (end == tail || *end != '\0' || stop < start) return 0;
+        }
+        if (start >= size) return -1;
+        first = start;
+        last = stop < size ? stop : size - 1;
+        return 1;
+    }
+
+    bool StartArchive(logger::ArchiveStream& archive, uint64_t offset, String const& etag, ArchiveClient& output)
+    {
+        // The length is known in advance from the manifest, so the response can have a content
+        // length (which lets the client show progress), unless it's too big to represent.
+        uint64_t remaining = archive.Length() - offset;
+        size_t length = remaining < CONTENT_LENGTH_UNKNOWN ? static_cast<size_t>(remaining) : CONTENT_LENGTH_UNKNOWN;
+        setContentLength(length);
+
+        String headers;
+        int code = 200;
+        sendHeader("Content-Disposition", String("attachment; filename=\"") + archiveName(".tar") + "\"");
+        sendHeader("ETag", etag);
+        sendHeader("Accept-Ranges", "bytes");
+        if (offset > 0) {
+            char range[64];
+            snprintf(range, sizeof(range), "bytes %llu-%llu/%llu", static_cast<unsigned long long>(offset),
+                static_cast<unsigned long long>(archive.Length() - 1), static_cast<unsigned long long>(archive.Length()));
+            sendHeader("Content-Range", range);
+            code = 206;
+        }
+        _prepareHeader(headers, code, "application/x-tar", length);
+        _currentClient.write(headers.c_str(), headers.length());
+
+        // The archive is written from the scheduler after the request handler has returned, so the
+        // client connection is handed over to the output, and the server mustn't finalise the response.
+        output.Attach(_currentClient, _chunked);
+        _chunked = false;
+        return archive.Start(&output, offset);
+    }
+
+    size_t StreamTrace(void)
+    {
+        // Same issue as above with the content length, since we don't want to assemble the trace in
+        // memory just to find out how long it is.
+        setContentLength(CONTENT_LENGTH_UNKNOWN);
+
+        String headers;
+        sendHeader("Content-Disposition", "attachment; filename=\"wibl-trace.bin\"");
+        _prepareHeader(headers, 200, "application/octet-stream", CONTENT_LENGTH_UNKNOWN);
+        _currentClient.write(headers.c_str(), headers.length());
+
+        ChunkedStream op(this);
+        return logger::Tracer.Dump(op);
+    }
+
+    /// Start a Server-Sent Event stream on the current connection.  The stream never ends (as far as the
+    /// server is concerned), so the headers are written directly, without a content length or chunking, and
+    /// the connection is handed over to the caller; \a ReleaseClient() must be called after the server has
+    /// handled the request, so that it doesn't wait for the client to close before taking the next request.
+    ///
+    /// \return Reference to the client connection for the stream
+
+    WiFiClient StartEvents(void)
+    {
+        static const char headers[] = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+            "Cache-Control: no-cache\r\nConnection: keep-alive\r\n\r\n";
+        _currentClient.write(headers, sizeof(headers) - 1);
+        _chunked = false;
+        m_handedOver = true;
+        return _currentClient;
+    }
+
+    /// Let go of the current client connection if it has been handed over (see \a StartEvents()).  The
+    /// connection stays open for as long as the new owner keeps its reference.
+
+    void ReleaseClient(void)
+    {
+        if (!m_handedOver) return;
+        _currentClient = WiFiClient();
+        _currentStatus = HC_NONE;
+        m_handedOver = false;
+    }
+
+    void StreamJSON(int code, WiFiAdapter::Streamer source)
+    {
+        // Same issue as above with the content length, since the point is not to assemble the
+        // response in memory just to find out how long it is.
+        setContentLength(CONTENT_LENGTH_UNKNOWN);
+
+        String headers;
+        _prepareHeader(headers, code, "application/json", CONTENT_LENGTH_UNKNOWN);
+        _currentClient.write(headers.c_str(), headers.length());
+
+        ChunkedStream op(this);
+        source(op);
+        // Responses to commands are sent after the request handler has returned, so the server
+        // doesn't finalise the chunked transfer for us; an empty chunk marks the end.
+        sendContent("");
+    }
+
+private:
+    String archiveName(const char *extension)
+    {
+        String module_id;
+        if (logger::LoggerConfig.GetConfigString(logger::Config::ConfigParam::CONFIG_MODULEID_S, module_id)) {
+            if (module_id.startsWith("TNODEID")) {
+                // This is the default configuration, if the user hasn't configured the module yet, but
+                // we don't want to pass it back as the filename, so ...
+                module_id = String("wibl-logs");
+            }
+        } else {
+            module_id = String("wibl-logs");
+        }
+        return module_id + extension;
+    }
+
+    bool    m_handedOver;   ///< Flag: True => the current client connection belongs to an event stream
 };
 
+
+/// Serve a log file, with the compressed version if there is one and the client accepts gzip encoding, and
+/// an ETag from the inventory hash, if it's known.
+///
+/// \param server  Server handling the request
+/// \param method  HTTP method of the request (GET or HEAD)
+/// \param uri     Path of the file requested
+/// \return True if the request was handled, otherwise False
+
+bool LogFileHandler::handle(WebServer& server, HTTPMethod method, String uri)
+{
+    String name(uri);
+    String compressed = logger::LogCompressor::CompressedName(uri);
+    bool has_compressed = !uri.endsWith(logger::CompressedSuffix) && m_fs.exists(compressed);
+    if (has_compressed && server.header("Accept-Encoding").indexOf("gzip") >= 0) {
+        name = compressed;
+        // The WebServer only adds the encoding itself for content types that aren't binary
+        server.sendHeader("Content-Encoding", "gzip");
+    }
+    if (has_compressed) server.sendHeader("Vary", "Accept-Encoding");
+
+    File f = m_fs.open(name, FILE_READ);
+    if (!f || f.isDirectory()) return false;
+    logger::Manager::MD5Hash hash;
+    String etag;
+    if (m_digest(name, hash)) etag = String("\"") + hash.Value() + "\"";
+    // The handler is only registered with the extended server (see ESP32WiFiAdapter::start())
+    static_cast<ExtendedWebServer&>(server).SendFile(f, etag, method);
+    f.close();
+    return true;
+}
 class ConnectionStateMachine {
 public:
     ConnectionStateMachine(bool verbose = false)
@@ -381,7 +877,8 @@ public:
     /// Default constructor for the ESP32 adapter.  This brings up the parameter store to use
     /// for WiFi parameters, but takes no other action until the user explicitly starts the AccessPoint.
     ESP32WiFiAdapter(void)
-    : m_storage(nullptr), m_server(nullptr), m_messages(nullptr), m_statusCode(HTTPReturnCodes::OK)
+    : m_storage(nullptr), m_server(nullptr), m_messages(nullptr), m_statusCode(HTTPReturnCodes::OK),
+      m_streamed(false), m_logManager(nullptr), m_feed(nullptr), m_lastPush(0), m_lastEvent(0)
     {
         if ((m_storage = mem::MemControllerFactory::Create()) == nullptr) {
             return;
@@ -397,6 +894,7 @@ public:
         stop();
         delete m_storage; // Note that we're not stopping the interface, since it may still be required elsewhere
         delete m_messages;
+        delete m_feed;
     }
     
 private:
@@ -405,7 +903,15 @@ private:
     std::queue<String>  m_commands;     ///< Queue to handle commands sent by the user
     DynamicJsonDocument *m_messages;    ///< Accumulating message content to be send to the client
     HTTPReturnCodes     m_statusCode;   ///< Status code to return to the user with the transaction response
+    bool                m_streamed;     ///< Flag: True => response for this transaction has already been streamed
     ConnectionStateMachine m_state;     ///< Manager for connection state
+    logger::ArchiveStream m_archive;    ///< Archive of the log files being downloaded (if any)
+    ArchiveClient       m_archiveOut;   ///< Connection for the archive being downloaded
+    logger::Manager     *m_logManager;  ///< Log manager for file hashes (external owner), if set
+    logger::status::StatusFeed *m_feed; ///< Status summary for the event stream (made on first subscription)
+    EventClients        m_events;       ///< Clients subscribed to the status event stream
+    unsigned long       m_lastPush;     ///< Time (ms) the status summary was last refreshed for the event stream
+    unsigned long       m_lastEvent;    ///< Time (ms) that anything was last sent on the event stream
 
     /// @brief Handle HTTP requests to the /command endpoint
     ///
@@ -436,15 +942,149 @@ private:
         m_commands.push("status");
     }
     
+    /// @brief Provide an archive of all of the log files for download
+    ///
+    /// HTTP GET endpoint handler that starts a download of a tar archive of the log directory.  The
+    /// archive is written by \a runLoop() in slices from the scheduler, so that logging continues while
+    /// it's being downloaded.  A new manifest of the files is made for each download, unless the request
+    /// has a "Range: bytes=N-" header (and, if there's an "If-Range" header, it matches the ETag of the last
+    /// archive), in which case the last archive is resumed from offset N with a 206 response.  Requesting
+    /// "/archive?format=tgz" gives the compressed archive generated in one go in the handler, as before,
+    /// which blocks logging for the duration.
+    ///
+    /// @return N/A
     void transferLogs(void)
     {
-        size_t bytes_sent = m_server->StreamArchive(m_storage->ControllerPtr(), "/logs");
-        if (bytes_sent == 0) {
-            m_server->send(400, "application/json", "{\"error\":\"no logs found; this shouldn't happen since there should always be one on the go!\"}");
-        } else {
-            if (m_state.Verbose()) {
-                Serial.printf("DBG: transferred %d bytes of log data.\n", bytes_sent);
+        if (m_server->arg("format") == "tgz") {
+            size_t bytes_sent = m_server->StreamArchive(m_storage->ControllerPtr(), "/logs");
+            if (bytes_sent == 0) {
+                m_server->send(400, "application/json", "{\"error\":\"no logs found; this shouldn't happen since there should always be one on the go!\"}");
+            } else {
+                if (m_state.Verbose()) {
+                    Serial.printf("DBG: transferred %d bytes of log data.\n", bytes_sent);
+                }
             }
+            return;
+        }
+        if (m_archive.Active() || m_archiveOut.Attached()) {
+            if (m_archiveOut.Connected()) {
+                m_server->send(503, "application/json", "{\"error\":\"an archive download is already in progress\"}");
+                return;
+            }
+            // The last client has gone away, but that hasn't been noticed yet
+            m_archive.Stop();
+            m_archiveOut.Release();
+        }
+
+        fs::FS& logfs = m_storage->Controller();
+        uint64_t offset = 0;
+        bool resume = false;
+        String range = m_server->header("Range");
+        if (range.startsWith("bytes=") && m_archive.Load(logfs)) {
+            String if_range = m_server->header("If-Range");
+            char *end;
+            offset = strtoull(range.c_str() + 6, &end, 10);
+            // Only a single range to the end of the archive is supported; anything else gets the whole
+            // archive, which is allowed.
+            resume = *end == '-' && (end[1] == '\0' || strtoull(end + 1, nullptr, 10) >= m_archive.Length() - 1) &&
+                (if_range.isEmpty() || if_range == archiveTag(m_archive.Id()));
+        }
+        if (!resume) {
+            offset = 0;
+            if (!m_archive.Prepare(logfs, "/logs")) {
+                m_server->send(400, "application/json", "{\"error\":\"no logs found; this shouldn't happen since there should always be one on the go!\"}");
+                return;
+            }
+        } else if (offset >= m_archive.Length()) {
+            m_server->sendHeader("Content-Range", String("bytes */") + String(static_cast<unsigned long>(m_archive.Length())));
+            m_server->send(416, "application/json", "{\"error\":\"requested range is beyond the end of the archive\"}");
+            return;
+        }
+        if (!m_server->StartArchive(m_archive, offset, archiveTag(m_archive.Id()), m_archiveOut)) {
+            m_archiveOut.Release();
+            return;
+        }
+        if (m_state.Verbose()) {
+            Serial.printf("DBG: started archive %08x of %llu bytes at offset %llu.\n", m_archive.Id(),
+                static_cast<unsigned long long>(m_archive.Length()), static_cast<unsigned long long>(offset));
+        }
+    }
+
+    /// @brief Generate the ETag for an archive from its manifest identifier
+    ///
+    /// @param id   Manifest identifier for the archive
+    /// @return Quoted string for the ETag
+    static String archiveTag(uint32_t id)
+    {
+        char tag[16];
+        snprintf(tag, sizeof(tag), "\"%08x\"", id);
+        return String(tag);
+    }
+
+    /// @brief Provide the binary event trace for download
+    ///
+    /// HTTP GET endpoint handler that streams the binary dump of the event trace to the client, for
+    /// conversion to a Chrome trace on the host.  The dump is valid (but has no records) if tracing
+    /// has never been turned on.
+    ///
+    /// @return N/A
+    void transferTrace(void)
+    {
+        size_t bytes_sent = m_server->StreamTrace();
+        if (m_state.Verbose()) {
+            Serial.printf("DBG: transferred %d bytes of trace data.\n", bytes_sent);
+        }
+    }
+
+    /// @brief Subscribe to the stream of status updates
+    ///
+    /// HTTP GET endpoint handler that starts a Server-Sent Event stream for the client, beginning with the
+    /// whole of the status summary, and followed by updates with the parts that have changed (no more often
+    /// than \a StatusPushInterval) from \a runLoop().  This lets the web interface keep its status display up
+    /// to date without polling for the full status report.
+    ///
+    /// @return N/A
+    void subscribeEvents(void)
+    {
+        if (m_logManager == nullptr || m_events.Full()) {
+            m_server->send(503, "application/json", "{\"error\":\"no status event streams available\"}");
+            return;
+        }
+        if (m_feed == nullptr) m_feed = new logger::status::StatusFeed(m_logManager);
+        if (m_events.Count() == 0) {
+            // Nobody has been watching, so the last summary (if any) is stale
+            m_feed->Refresh();
+            m_lastPush = millis();
+        }
+        WiFiClient client = m_server->StartEvents();
+        String snapshot = m_feed->Snapshot();
+        client.write(snapshot.c_str(), snapshot.length());
+        m_events.Add(client);
+        m_lastEvent = millis();
+        if (m_state.Verbose()) {
+            Serial.printf("DBG: status event stream started, %d subscribed.\n", m_events.Count());
+        }
+    }
+
+    /// @brief Push status updates to the event stream subscribers
+    ///
+    /// Refresh the status summary if there are subscribers and it's been long enough since the last time,
+    /// and send the changes (if any) to all of them; if nothing has been sent for \a StatusKeepAlive, send
+    /// a comment instead, so that the clients (and any proxies) know the stream is still alive.
+    ///
+    /// @return N/A
+    void pushEvents(void)
+    {
+        if (m_events.Count() == 0) return;
+        unsigned long now = millis();
+        if (now - m_lastPush < logger::status::StatusPushInterval) return;
+        m_lastPush = now;
+        if (m_feed->Refresh()) {
+            m_events.Send(m_feed->Delta());
+            m_lastEvent = now;
+        } else if (now - m_lastEvent >= logger::status::StatusKeepAlive) {
+            m_events.Send(":\n\n");
+            m_lastEvent = now;
         }
     }
 
@@ -462,10 +1102,21 @@ private:
             Serial.println("ERR: failed to start web server.");
             return false;
         } else {
-            // Configure the endpoints served by the server
+            // Configure the endpoints served by the server (the tracing handler must be first to see all requests)
+            m_server->addHandler(new TracingHandler());
             m_server->on("/heartbeat", HTTPMethod::HTTP_GET, std::bind(&ESP32WiFiAdapter::heartbeat, this));
             m_server->on("/command", HTTPMethod::HTTP_POST, std::bind(&ESP32WiFiAdapter::handleCommand, this));
             m_server->on("/archive", HTTPMethod::HTTP_GET, std::bind(&ESP32WiFiAdapter::transferLogs, this));
+            m_server->on("/trace", HTTPMethod::HTTP_GET, std::bind(&ESP32WiFiAdapter::transferTrace, this));
+            m_server->on("/events", HTTPMethod::HTTP_GET, std::bind(&ESP32WiFiAdapter::subscribeEvents, this));
+            // The archive and log file downloads need to see the headers for conditional and resumed
+            // downloads, and whether the client can take the compressed version of a log file
+            static const char *archive_headers[] = { "Range", "If-Range", "If-None-Match", "Accept-Encoding" };
+            m_server->collectHeaders(archive_headers, 4);
+            m_server->addHandler(new LogFileHandler(m_storage->Controller(),
+                [this](String const& filename, logger::Manager::MD5Hash& hash) {
+                    return m_logManager != nullptr && m_logManager->LookupDigest(filename, hash);
+                }));
             m_server->serveStatic("/logs", m_storage->Controller(), "/logs/");
             m_server->serveStatic("/", LittleFS, "/website/"); // Note trailing '/' since this is a directory being served.
         }
@@ -479,6 +1130,9 @@ private:
     
     void stop(void)
     {
+        m_archive.Stop();
+        if (m_archiveOut.Attached()) m_archiveOut.Release();
+        m_events.Clear();
         delete m_server;
         m_server = nullptr;
     }
@@ -503,26 +1157,55 @@ private:
     /// Transfer a specific log file from the logger to the client in an efficient manner that doesn't include
     /// converting from binary to String, etc.  The filename must exist, and there must be a connected
     /// client ready to catch the output, otherwise the call will fail.  The transfer is pretty simple, relying on
-    /// efficient implementation of buffer in the libraries for fast transfer.
+    /// efficient implementation of buffer in the libraries for fast transfer.  If the file has been compressed,
+    /// and the client accepts gzip encoding, the compressed version is sent instead; the digest is still that of
+    /// the log file, since that's what the client has once it has decoded the transfer.  The response has the
+    /// same ETag as the file has from the "/logs" website, but since the command is a POST, range requests
+    /// don't apply; clients that need to resume a transfer should use the website instead.
     ///
     /// \param filename Name of the file to transfer to the client
     /// \return True if the transfer worked, otherwise false.
     
     bool sendLogFile(String const& filename, uint32_t filesize, logger::Manager::MD5Hash const& filehash)
     {
-        File f = m_storage->Controller().open(filename, FILE_READ);
+        File f;
+        String name(filename);
+        String compressed = logger::LogCompressor::CompressedName(filename);
+        if (m_server->header("Accept-Encoding").indexOf("gzip") >= 0 && m_storage->Controller().exists(compressed)) {
+            f = m_storage->Controller().open(compressed, FILE_READ);
+            if (f) {
+                name = compressed;
+                m_server->sendHeader("Content-Encoding", "gzip");
+            }
+        }
+        if (!f) f = m_storage->Controller().open(filename, FILE_READ);
         if (!f) {
             Serial.println("ERR: failed to open file for transfer.");
             return false;
         } else {
             String hash_digest = "md5=" + filehash.Value();
             m_server->sendHeader("Digest", hash_digest);
-            m_server->streamFile(f, "application/octet-stream");
+            logger::Manager::MD5Hash hash;
+            String etag;
+            if (m_logManager != nullptr && m_logManager->LookupDigest(name, hash))
+                etag = String("\"") + hash.Value() + "\"";
+            m_server->SendFile(f, etag, m_server->method());
             f.close();
         }
         return true;
     }
 
+    /// Set the log manager, which is used to look up the hashes of log files for their ETags.  Until this
+    /// is set, files are served without ETags.
+    ///
+    /// \param manager Pointer to the log manager (external owner)
+    /// \return N/A
+
+    void setLogManager(logger::Manager *manager)
+    {
+        m_logManager = manager;
+    }
+
     /// Accumulate the message given into the list of those to be sent to the client when the
     /// response is finally sent.  Note that the code doesn't add any formatting, so if you want
     /// newlines in the output message set, you need to add them explicitly to the \a message that
@@ -559,6 +1242,21 @@ private:
         *m_messages = message;
     }
 
+    /// Stream the response for the current transaction directly to the client, as a chunked transfer,
+    /// rather than accumulating it for transmission at the end of the transaction.  This is used for
+    /// responses that can be large (e.g., the status report with many log files), so that they don't
+    /// have to be assembled in memory first.  The current status code is used for the response, and any
+    /// messages accumulated for the transaction are discarded.
+    ///
+    /// \param source  Function to generate the response into the output given
+    /// \return N/A
+
+    void streamMessage(Streamer source)
+    {
+        m_server->StreamJSON(m_statusCode, source);
+        m_streamed = true;
+    }
+
     /// Configure the HTTP status code that the response should use.  By default, the status code used
     /// when the response is finally sent to the client is 200 OK.  However, if there is an error
     /// condition, then it might be useful to send something else, alerting the client.  Although you
@@ -575,16 +1273,20 @@ private:
 
     /// Send the accumulated messages for this transaction back to the client.  This takes the accumulated
     /// messages, and the status code, and sends back via the web-server, then resets the message buffer
-    /// to empty, and the status code to 200 OK.
+    /// to empty, and the status code to 200 OK.  If the response has already been streamed to the client,
+    /// only the reset is done.
     ///
     /// \return True if the message was send succesfully, otherwise false.
 
     bool transmitMessages(void)
     {
-        String message;
-        serializeJson(*m_messages, message);
-        //Serial.printf("DBG: WiFi transmitting response |%s|\n", message.c_str());
-        m_server->send(m_statusCode, "application/json", message);
+        if (!m_streamed) {
+            String message;
+            serializeJson(*m_messages, message);
+            //Serial.printf("DBG: WiFi transmitting response |%s|\n", message.c_str());
+            m_server->send(m_statusCode, "application/json", message);
+        }
+        m_streamed = false;
         m_messages->clear();
         m_statusCode = HTTPReturnCodes::OK; // "OK" by default
         return true;
@@ -593,15 +1295,32 @@ private:
     /// In order for the WiFi adapter to manage its internal state, it has to get a regular run loop call
     /// from the main logger.  In addition to passing on this time to the web server to handle client
     /// requests, this code also manages the ConnectionStateMachine, which allows the logger to execute the
-    /// client network join code, with suitable fall-back conditions.
+    /// client network join code, with suitable fall-back conditions, pushes status updates to any clients
+    /// subscribed to the event stream, and writes the next slice of any archive being downloaded.
     ///
-    /// \return N/A
+    /// \return True if there is more of an archive download to write, otherwise False
 
-    void runLoop(void)
+    bool runLoop(void)
     {
         m_state.StepState();
-        if (m_server != nullptr)
+        if (m_server != nullptr) {
             m_server->handleClient();
+            m_server->ReleaseClient();
+        }
+        pushEvents();
+        if (m_archive.Active()) {
+            if (m_archiveOut.Connected() && m_archive.Step()) return true;
+            m_archive.Stop();
+        }
+        if (m_archiveOut.Attached()) {
+            if (m_archive.Complete() && m_archiveOut.Connected() && !m_archiveOut.Finish()) return true;
+            if (m_state.Verbose()) {
+                Serial.printf("DBG: archive download %s at %llu of %llu bytes.\n", m_archive.Complete() ? "completed" : "stopped",
+                    static_cast<unsigned long long>(m_archive.Offset()), static_cast<unsigned long long>(m_archive.Length()));
+            }
+            m_archiveOut.Release();
+        }
+        return false;
     }
 };
 
@@ -627,6 +1346,12 @@ String WiFiAdapter::ReceivedString(void) { return readBuffer(); }
 bool WiFiAdapter::TransferFile(String const& filename, uint32_t filesize, logger::Manager::MD5Hash const& filehash)
     { return sendLogFile(filename, filesize, filehash); }
 
+/// Pass-through implementation to the sub-class code to set the log manager
+///
+/// \param manager Pointer to the log manager (external owner)
+/// \return N/A
+void WiFiAdapter::SetLogManager(logger::Manager *manager) { setLogManager(manager); }
+
 /// Pass-through implementation to the sub-class code to accumulate messages
 ///
 /// \param message  String for the message to send
@@ -639,6 +1364,12 @@ void WiFiAdapter::AddMessage(String const& message) { accumulateMessage(message)
 /// @return N/A
 void WiFiAdapter::SetMessage(DynamicJsonDocument const& message) { setMessage(message); }
 
+/// Pass-through implementation to the sub-class code to stream the response directly
+///
+/// @param source Function to generate the response into the output given
+/// @return N/A
+void WiFiAdapter::StreamMessage(Streamer source) { streamMessage(source); }
+
 /// Pass-through implementation to the sub-class code to set status code
 ///
 /// \param status_code  HTTP status code to set
@@ -691,8 +1422,8 @@ WiFiAdapter::WirelessMode WiFiAdapter::GetWirelessMode(void)
 
 /// Pass-through implementation to the sub-class to run the processing loop
 ///
-/// \return N/A
-void WiFiAdapter::RunLoop(void) { runLoop(); }
+/// \return True if there is more work to do (e.g., an archive download in progress)
+bool WiFiAdapter::RunLoop(void) { return runLoop(); }
 
 /// Create an implementation of the WiFiAdapter interface that's appropriate for the hardware in use
 /// in the current logger module.
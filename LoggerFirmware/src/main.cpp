@@ -40,10 +40,20 @@
 #include "Configuration.h"
 #include "HeapMonitor.h"
 #include "DataMetrics.h"
+#include "EventLoop.h"
+#include "Scheduler.h"
+#include "Profiler.h"
+#include "StorageMetrics.h"
+#include "Status.h"
+#include "BenchmarkRunner.h"
+#include "TransferRunner.h"
 
 /// Hardware version for the logger implementation (for NMEA2000 declaration)
 #define LOGGER_HARDWARE_VERSION "2.5.1"
 
+/// Receive buffer for the console port, enough to hold ~180 ms of input at 115200 baud while other tasks run
+const size_t ConsoleRxBufferSize = 2048;
+
 const unsigned long TransmitMessages[] PROGMEM={0}; ///< List of messages the logger transmits (null set)
 const unsigned long ReceiveMessages[] PROGMEM =
   {126992UL /*System Time */,
@@ -82,6 +92,7 @@ void setup()
     uint32_t heap_size = heap.HeapSize();
     uint32_t heap_free = heap.CurrentSize();
 
+    Serial.setRxBufferSize(ConsoleRxBufferSize);   // Must be set before the port starts
     Serial.begin(115200);
 
     Serial.printf("*\n*\n*\n* BOOTING WIBL DATA LOGGER, FIRMWARE VERSION %s\n*\n* For more information: http://wibl.ccom.unh.edu\n*\n*\n*\n", logger::FirmwareVersion());
@@ -140,6 +151,13 @@ void setup()
     Serial.printf("DBG: After log manager start, free heap = %d B, delta = %d B\n", heap.CurrentSize(), heap.DeltaSinceLast());
     logManager->AddInventory();
     Serial.printf("DBG: After inventory object start, free heap = %d B, delta = %d B\n", heap.CurrentSize(), heap.DeltaSinceLast());
+    bool compress_logs;
+    if (logger::LoggerConfig.GetConfigBinary(logger::Config::ConfigParam::CONFIG_COMPRESS_B, compress_logs)
+            && compress_logs) {
+        logManager->AddCompressor();
+        Serial.printf("DBG: After log compressor start, free heap = %d B, delta = %d B\n", heap.CurrentSize(), heap.DeltaSinceLast());
+    }
+    logger::StorageIO.Begin(memController);
     
     bool start_nmea_2000, start_nmea_0183, start_motion_sensor;
     if (logger::LoggerConfig.GetConfigBinary(logger::Config::ConfigParam::CONFIG_NMEA2000_B, start_nmea_2000)
@@ -205,6 +223,90 @@ void setup()
 
     Serial.printf("DBG: After voltage monitoring start, free heap = %d B, delta = %d B\n", heap.CurrentSize(), heap.DeltaSinceLast());
 
+    Serial.println("Configuring event notifications for main loop ...");
+    if (!logger::Events.Begin()) {
+        Serial.println("ERR: Event loop didn't start ... halting.");
+        LEDs->SetStatus(StatusLED::Status::sFATAL_ERROR);
+        while (1) {
+            LEDs->ProcessFlash(); /* Busy loop to make sure the LED flashes */
+            delay(100);
+        }
+    }
+    // The serial event callbacks run in the UART event tasks (not in interrupt context), so they
+    // can post directly to the loop.
+    Serial.onReceive([]() { logger::Events.Post(logger::EVT_SERIAL_RX); });
+    if (N0183Logger != nullptr) {
+        Serial1.onReceive([]() { logger::Events.Post(logger::EVT_UART_RX); });
+        Serial2.onReceive([]() { logger::Events.Post(logger::EVT_UART_RX); });
+        Serial1.onReceiveError([](hardwareSerial_error_t err) {
+            logger::Metrics.CountUARTError(1, err == UART_BUFFER_FULL_ERROR || err == UART_FIFO_OVF_ERROR);
+        });
+        Serial2.onReceiveError([](hardwareSerial_error_t err) {
+            logger::Metrics.CountUARTError(2, err == UART_BUFFER_FULL_ERROR || err == UART_FIFO_OVF_ERROR);
+        });
+    }
+
+    Serial.printf("DBG: After event loop start, free heap = %d B, delta = %d B\n", heap.CurrentSize(), heap.DeltaSinceLast());
+
+    // Each sub-system registers as a task with the scheduler, with a priority, a time budget (us) for
+    // each invocation, and the events that make it runnable.  The NMEA0183 and IMU loggers are also
+    // run on the housekeeping tick so that any data that arrived without a notification (e.g., less
+    // than the UART FIFO threshold) is not held up indefinitely.
+    Serial.println("Registering sub-systems with scheduler ...");
+    logger::HeapTags.Begin();
+    if (N2000Logger != nullptr) {
+        logger::Tasks.Register("nmea2000", logger::PRIORITY_INGEST, 2000, logger::EVT_CAN_RX,
+            []() { NMEA2000.ParseMessages(); logger::Metrics.SampleCAN(); return false; });
+    }
+    if (N0183Logger != nullptr) {
+        logger::Tasks.Register("nmea0183", logger::PRIORITY_INGEST, 2000, logger::EVT_UART_RX | logger::EVT_SERVICE,
+            []() { N0183Logger->ProcessMessages(); return false; });
+    }
+    if (IMULogger != nullptr) {
+        logger::Tasks.Register("imu", logger::PRIORITY_INGEST, 1000, logger::EVT_IMU_DRDY | logger::EVT_SERVICE,
+            []() { IMULogger->TransferData(); return false; });
+    }
+    logger::Tasks.Register("supply", logger::PRIORITY_CONTROL, 500, logger::EVT_SUPPLY,
+        []() {
+            if (supplyMonitor->EmergencyPower()) {
+                // Eek!  Power went out, so we need to stop logging ASAP (reporting comes after the data is safe)
+                CommandProcessor->EmergencyStop(supplyMonitor->SinceTrip());
+            }
+            return false;
+        });
+    logger::Tasks.Register("led", logger::PRIORITY_CONTROL, 200, logger::EVT_SERVICE,
+        []() { LEDs->ProcessFlash(); return false; });
+    logger::Tasks.Register("command", logger::PRIORITY_CONTROL, 5000, logger::EVT_SERIAL_RX | logger::EVT_SERVICE,
+        []() { return CommandProcessor->ProcessCommand(); });
+    logger::Tasks.Register("wireless", logger::PRIORITY_NETWORK, 20000, logger::EVT_SERVICE,
+        []() { return CommandProcessor->ProcessWireless(); });
+    logger::Tasks.Register("upload", logger::PRIORITY_BACKGROUND, 2000, logger::EVT_SERVICE,
+        []() { return CommandProcessor->ProcessUpload(); });
+    logger::Tasks.Register("heap", logger::PRIORITY_BACKGROUND, 2000, logger::EVT_SUPPLY,
+        []() { logger::HeapTags.Sample(); return false; });
+    logger::Tasks.Register("console", logger::PRIORITY_BACKGROUND, 5000, logger::EVT_SERVICE,
+        []() { return logManager->ServiceConsole(); });
+    logger::Tasks.Register("compress", logger::PRIORITY_BACKGROUND, 2000, logger::EVT_SERVICE,
+        []() { return logManager->ServiceCompression(); });
+    logger::Tasks.Register("ingest", logger::PRIORITY_BACKGROUND, 500, logger::EVT_SUPPLY,
+        []() { logger::Metrics.Sample(); return false; });
+    logger::Tasks.Register("storage", logger::PRIORITY_BACKGROUND, 2000, logger::EVT_SUPPLY,
+        []() {
+            // Once a sample period, record the performance metrics into the log file with the data,
+            // if configured to do so
+            bool record_metrics;
+            if (logger::StorageIO.Sample() &&
+                    logger::LoggerConfig.GetConfigBinary(logger::Config::ConfigParam::CONFIG_METRICS_B, record_metrics) &&
+                    record_metrics) {
+                logManager->RecordMetrics(logger::status::CurrentMetrics());
+            }
+            return false;
+        });
+    logger::Tasks.Register("benchmark", logger::PRIORITY_BACKGROUND, logger::BenchmarkStepBudget, logger::EVT_SERVICE,
+        []() { return logger::Bench.Step(); });
+    logger::Tasks.Register("transfer", logger::PRIORITY_CONTROL, logger::TransferStepBudget,
+        logger::EVT_SERIAL_RX | logger::EVT_SERVICE, []() { return logger::Transfer.Step(); });
+
     Serial.println("Setup complete, setting status for normal operations.");
     LEDs->SetStatus(StatusLED::Status::sNORMAL);
 
@@ -214,32 +316,18 @@ void setup()
 
 /// \brief General processing loop code for the logger.
 ///
-/// General processing loop.  The code needs to service all of the objects that need
-/// timely polling, including the NMEA2000 message stack, flashing the status LEDs,
-/// if required, and then checking for (and executing) any commands provided by the
-/// user either on the hardware Serial link or through the Bluetooth LE UART, if there's
-/// a client configured.
+/// General processing loop.  Rather than polling all of the objects on every pass, the loop
+/// blocks until one or more events have been posted (by the serial ports, the IMU interrupt, or
+/// the periodic timers for the NMEA2000 message stack, housekeeping, and supply monitoring), and
+/// then has the scheduler run the tasks registered for those events, in priority order.  The
+/// dispatch is profiled as a whole so that the maximum loop period can be reported.
 
 void loop()
 {
-    if (N2000Logger != nullptr) {
-        NMEA2000.ParseMessages();
-    }
-    if (N0183Logger != nullptr) {
-        N0183Logger->ProcessMessages();
-    }
-    if (IMULogger != nullptr) {
-        IMULogger->TransferData();
-    }
-    if (LEDs != nullptr) {
-        LEDs->ProcessFlash();
-    }
-    if (CommandProcessor != nullptr) {
-        CommandProcessor->ProcessCommand();
-    }
-    if (supplyMonitor->EmergencyPower()) {
-        // Eek!  Power went out, so we need to stop logging ASAP
-        Serial.printf("DBG: Supply voltage dropped to %f V\n", logger::Metrics.SupplyVoltage());
-        CommandProcessor->EmergencyStop();
-    }
+    static int loop_section = logger::Profile.Section("loop");
+
+    uint32_t events = logger::Events.Wait();
+    uint32_t start = logger::Profile.Start();
+    logger::Tasks.Dispatch(events);
+    logger::Profile.Stop(loop_section, start);
 }
@@ -31,6 +31,8 @@
 #include "N0183Logger.h"
 #include "IMULogger.h"
 #include "Configuration.h"
+#include "Trace.h"
+#include "StorageMetrics.h"
 
 /// Constructor for a serialisable buffer of data.  The buffer is allocated to the \a size_hint but
 /// can grow as new data is added if required.  Expanding a buffer is expensive, so it's wise to
@@ -245,11 +247,17 @@ Serialiser::Serialiser(File& file)
 
 bool Serialiser::rawProcess(uint32_t payload_id, Serialisable const& payload)
 {
-    m_file.write((const uint8_t*)&payload_id, sizeof(uint32_t));
-    m_file.write((const uint8_t*)&payload.m_nData, sizeof(uint32_t));
-    m_file.write((const uint8_t*)payload.m_buffer, sizeof(uint8_t)*payload.m_nData);
+    logger::Tracer.Emit(logger::TRACE_SD_WRITE_BEGIN, payload_id, payload.m_nData);
+    uint32_t start = logger::StorageIO.Start();
+    size_t written = m_file.write((const uint8_t*)&payload_id, sizeof(uint32_t));
+    written += m_file.write((const uint8_t*)&payload.m_nData, sizeof(uint32_t));
+    written += m_file.write((const uint8_t*)payload.m_buffer, sizeof(uint8_t)*payload.m_nData);
+    logger::StorageIO.Stop(logger::STORAGE_WRITE, start, written);
+    start = logger::StorageIO.Start();
     m_file.flush();
-    return true;
+    logger::StorageIO.Stop(logger::STORAGE_FLUSH, start);
+    logger::Tracer.Emit(logger::TRACE_SD_WRITE_END, payload_id, payload.m_nData);
+    return written == 2*sizeof(uint32_t) + payload.m_nData;
 }
 
 /// User-level method to write the buffer to file.  The payload ID number specified has to be
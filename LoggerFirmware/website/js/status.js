@@ -158,12 +158,70 @@ function emptyCurrentData() {
     return row;
 }
 
+let statusData = null;
+let statusEvents = null;
+
+function renderStats(tablePrefix, data) {
+    let fileCount, totalFileSize = 0;
+    if ('inventory' in data) {
+        fileCount = data.inventory.count;
+        totalFileSize = data.inventory.size;
+    } else {
+        fileCount = data.files.count;
+        for (let n = 0; n < data.files.count; ++n) {
+            if ('len' in data.files.detail[n] && isFinite(data.files.detail[n].len)) {
+                totalFileSize += data.files.detail[n].len;
+            }
+        }
+    }
+
+    let stats = document.getElementById(tablePrefix + '-stats');
+    stats.replaceChildren(assembleSummaryHeader("Status"));
+    stats.appendChild(assembleSummaryRow("Elapsed Time", translateTime(data.elapsed)));
+    stats.appendChild(assembleSummaryRow("Supply Voltage", roundVoltage(data.supply)));
+    stats.appendChild(assembleSummaryRow("Webserver Status Current", data.webserver.current));
+    stats.appendChild(assembleSummaryRow("Webserver Status Boot", data.webserver.boot));
+    stats.appendChild(assembleSummaryRow("Files on Logger", fileCount));
+    stats.appendChild(assembleSummaryRow("Total Size", translateSize(totalFileSize)));
+}
+
+function renderLatestData(tablePrefix, data) {
+    let nmea0183 = document.getElementById(tablePrefix + '-nmea0183');
+    if (nmea0183 !== null) {
+        nmea0183.replaceChildren(assembleDataHeader("Latest NMEA0183 Data"));
+        if (data.data.nmea0183.count === 0) {
+            nmea0183.appendChild(emptyCurrentData());
+        }
+        for (let n = 0; n < data.data.nmea0183.count; ++n) {
+            nmea0183.appendChild(assembleDataRow(
+                data.data.nmea0183.detail[n].name,
+                data.data.nmea0183.detail[n].tag,
+                data.data.nmea0183.detail[n].time + ' ' + data.data.nmea0183.detail[n].time_units,
+                data.data.nmea0183.detail[n].display));
+        }
+    }
+    
+    let nmea2000 = document.getElementById(tablePrefix + '-nmea2000');
+    if (nmea2000 !== null) {
+        nmea2000.replaceChildren(assembleDataHeader("Latest NMEA2000 Data"));
+        if (data.data.nmea2000.count === 0) {
+            nmea2000.appendChild(emptyCurrentData());
+        }
+        for (let n = 0; n < data.data.nmea2000.count; ++n) {
+            nmea2000.appendChild(assembleDataRow(
+                data.data.nmea2000.detail[n].name,
+                data.data.nmea2000.detail[n].tag,
+                data.data.nmea2000.detail[n].time + ' ' + data.data.nmea2000.detail[n].time_units,
+                data.data.nmea2000.detail[n].display));
+        }
+    }
+}
+
 function updateStatus(tablePrefix) {
     sendCommand('status').then((data) => {
+        statusData = data;
+
         const versionsTable = tablePrefix + '-versions';
-        const statsTable = tablePrefix + '-stats';
-        const n0183Table = tablePrefix + '-nmea0183';
-        const n2000Table = tablePrefix + '-nmea2000';
         const detailTable = tablePrefix + '-detail';
     
         let versions = document.getElementById(versionsTable);
@@ -174,52 +232,9 @@ function updateStatus(tablePrefix) {
         versions.appendChild(assembleSummaryRow("NMEA2000", data.version.nmea2000));
         versions.appendChild(assembleSummaryRow("IMU", data.version.imu));
         versions.appendChild(assembleSummaryRow("Serialiser", data.version.serialiser));
-    
-        let totalFileSize = 0;
-        for (let n = 0; n < data.files.count; ++n) {
-            if ('len' in data.files.detail[n] && isFinite(data.files.detail[n].len)) {
-                totalFileSize += data.files.detail[n].len;
-            }
-        }
-    
-        let stats = document.getElementById(statsTable);
-        stats.replaceChildren(assembleSummaryHeader("Status"));
-        stats.appendChild(assembleSummaryRow("Elapsed Time", translateTime(data.elapsed)));
-        stats.appendChild(assembleSummaryRow("Supply Voltage", roundVoltage(data.supply)));
-        stats.appendChild(assembleSummaryRow("Webserver Status Current", data.webserver.current));
-        stats.appendChild(assembleSummaryRow("Webserver Status Boot", data.webserver.boot));
-        stats.appendChild(assembleSummaryRow("Files on Logger", data.files.count));
-        stats.appendChild(assembleSummaryRow("Total Size", translateSize(totalFileSize)));
-    
-        let nmea0183 = document.getElementById(n0183Table);
-        if (nmea0183 !== null) {
-            nmea0183.replaceChildren(assembleDataHeader("Latest NMEA0183 Data"));
-            if (data.data.nmea0183.count === 0) {
-                nmea0183.appendChild(emptyCurrentData());
-            }
-            for (let n = 0; n < data.data.nmea0183.count; ++n) {
-                nmea0183.appendChild(assembleDataRow(
-                    data.data.nmea0183.detail[n].name,
-                    data.data.nmea0183.detail[n].tag,
-                    data.data.nmea0183.detail[n].time + ' ' + data.data.nmea0183.detail[n].time_units,
-                    data.data.nmea0183.detail[n].display));
-            }
-        }
-        
-        let nmea2000 = document.getElementById(n2000Table);
-        if (nmea2000 !== null) {
-            nmea2000.replaceChildren(assembleDataHeader("Latest NMEA2000 Data"));
-            if (data.data.nmea2000.count === 0) {
-                nmea2000.appendChild(emptyCurrentData());
-            }
-            for (let n = 0; n < data.data.nmea2000.count; ++n) {
-                nmea2000.appendChild(assembleDataRow(
-                    data.data.nmea2000.detail[n].name,
-                    data.data.nmea2000.detail[n].tag,
-                    data.data.nmea2000.detail[n].time + ' ' + data.data.nmea2000.detail[n].time_units,
-                    data.data.nmea2000.detail[n].display));
-            }
-        }
+
+        renderStats(tablePrefix, data);
+        renderLatestData(tablePrefix, data);
     
         let detail = document.getElementById(detailTable);
         if (detail !== null) {
@@ -241,9 +256,34 @@ function updateStatus(tablePrefix) {
                     );
             }
         }
+
+        subscribeStatus(tablePrefix);
     });
 }
 
+// The logger pushes the parts of the status that have changed (at most once a second) as Server-Sent
+// Events, so once the full status has been loaded, the display is kept up to date from those.  The file
+// list is only re-loaded in full when the number of files changes.
+function subscribeStatus(tablePrefix) {
+    if (statusEvents !== null || typeof(EventSource) === 'undefined') {
+        return;
+    }
+    statusEvents = new EventSource('http://' + location.host + '/events');
+    statusEvents.onmessage = (event) => {
+        const update = JSON.parse(event.data);
+        const fileCount = 'inventory' in statusData ? statusData.inventory.count : statusData.files.count;
+        Object.assign(statusData, update);
+        renderStats(tablePrefix, statusData);
+        if ('data' in update) {
+            renderLatestData(tablePrefix, statusData);
+        }
+        if ('inventory' in update && update.inventory.count !== fileCount &&
+            document.getElementById(tablePrefix + '-detail') !== null) {
+            updateStatus(tablePrefix);
+        }
+    };
+}
+
 function redirectCatalog() {
     sendCommand('snapshot catalog').then((data) => {
         let frame = document.getElementById('downloadFrame');
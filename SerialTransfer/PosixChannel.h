@@ -0,0 +1,151 @@
+/*! \file PosixChannel.h
+ * \brief Serial link and file adapters for the block transfer protocol on a POSIX host.
+ *
+ * The block transfer core talks to the link, and to the files at each end, through abstract
+ * interfaces; these are the implementations for a file descriptor (a serial port or pseudo-terminal)
+ * and for stdio files, shared by the receiver and the logger test double.
+ *
+ */
+/// Copyright 2024 Center for Coastal and Ocean Mapping & NOAA-UNH Joint
+/// Hydrographic Center, University of New Hampshire.
+///
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights to use,
+/// copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+/// and to permit persons to whom the Software is furnished to do so, subject to
+/// the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+/// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+/// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+/// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+/// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+/// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+/// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+/// OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef __POSIX_CHANNEL_H__
+#define __POSIX_CHANNEL_H__
+
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <termios.h>
+#include <time.h>
+#include "BlockTransfer.h"
+
+/// \class FdChannel
+/// \brief Serial link on a file descriptor (serial port or pseudo-terminal), set to non-blocking reads
+///
+/// Writes wait (with poll()) until the descriptor can take more data, so that a slow link pushes back
+/// on the sender rather than losing data.
+
+class FdChannel : public xfer::Channel {
+public:
+    FdChannel(int fd) : m_fd(fd) {}
+
+    size_t Read(uint8_t *data, size_t n)
+    {
+        ssize_t rc = read(m_fd, data, n);
+        return rc < 0 ? 0 : rc;
+    }
+
+    size_t Write(const uint8_t *data, size_t n)
+    {
+        size_t sent = 0;
+        while (sent < n) {
+            ssize_t rc = write(m_fd, data + sent, n - sent);
+            if (rc > 0) {
+                sent += rc;
+            } else if (rc < 0 && (errno == EAGAIN || errno == EINTR)) {
+                struct pollfd p = { m_fd, POLLOUT, 0 };
+                if (poll(&p, 1, 1000) <= 0) break;
+            } else {
+                break;
+            }
+        }
+        return sent;
+    }
+
+    /// Wait for data to arrive, for up to the given time.
+    ///
+    /// \param timeout  Longest time to wait (ms)
+
+    void Wait(int timeout)
+    {
+        struct pollfd p = { m_fd, POLLIN, 0 };
+        poll(&p, 1, timeout);
+    }
+
+private:
+    int m_fd;   ///< Descriptor for the link
+};
+
+/// \class FileSource
+/// \brief File being sent, from a stdio file
+
+class FileSource : public xfer::Source {
+public:
+    FileSource(FILE *f) : m_file(f) {}
+
+    size_t Read(uint32_t offset, uint8_t *data, size_t n)
+    {
+        if (fseek(m_file, offset, SEEK_SET) != 0) return 0;
+        return fread(data, 1, n, m_file);
+    }
+
+private:
+    FILE    *m_file;    ///< File being sent
+};
+
+/// \class FileSink
+/// \brief File being received, to a stdio file
+
+class FileSink : public xfer::Sink {
+public:
+    FileSink(FILE *f) : m_file(f) {}
+
+    bool Write(const uint8_t *data, size_t n) { return fwrite(data, 1, n, m_file) == n; }
+
+private:
+    FILE    *m_file;    ///< File being received
+};
+
+/// Put a terminal into raw mode (no echo, no line editing or character translation) at the given speed,
+/// so that binary frames pass through unchanged.
+///
+/// \param fd       Descriptor for the terminal
+/// \param speed    Line speed (a termios B-constant), or B0 to leave it unchanged
+/// \return True if the terminal was set up, otherwise False
+
+inline bool set_raw(int fd, speed_t speed)
+{
+    struct termios tio;
+    if (tcgetattr(fd, &tio) != 0) return false;
+    cfmakeraw(&tio);
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    if (speed != B0) {
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+    }
+    return tcsetattr(fd, TCSANOW, &tio) == 0;
+}
+
+/// Monotonic microsecond clock for the transfer.
+///
+/// \return Current monotonic time (us)
+
+inline uint64_t monotonic_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+}
+
+#endif
@@ -0,0 +1,282 @@
+/*! \file fake_logger.cpp
+ * \brief Test double for the logger's end of the block transfer protocol, on a pseudo-terminal.
+ *
+ * This makes a pseudo-terminal, reports the name of its device, and then acts like the logger's serial
+ * port: when it sees a "transfer block <n>" command, it sends a file (or generated data) with the block
+ * transfer protocol.  The link can be made unreliable, with frames corrupted or lost, acknowledgements
+ * lost, and debug messages mixed in, so that the receiver's recovery can be exercised without hardware.
+ *
+ */
+/// Copyright 2024 Center for Coastal and Ocean Mapping & NOAA-UNH Joint
+/// Hydrographic Center, University of New Hampshire.
+///
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights to use,
+/// copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+/// and to permit persons to whom the Software is furnished to do so, subject to
+/// the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+/// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+/// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+/// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+/// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+/// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+/// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+/// OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include "BlockTransfer.h"
+#include "PosixChannel.h"
+
+/// \struct Faults
+/// \brief Probabilities of each type of fault on the link
+
+struct Faults {
+    double  corrupt;    ///< Probability that a write to the receiver has a byte changed
+    double  loss;       ///< Probability that a write to the receiver (or a read from it) is lost
+    double  noise;      ///< Probability that a debug message is written before a write to the receiver
+
+    Faults(void) : corrupt(0.0), loss(0.0), noise(0.0) {}
+};
+
+/// \class FaultyChannel
+/// \brief Serial link that corrupts, loses, and adds to the data passing through it
+///
+/// Each frame is written in three parts (header, payload, and CRC), so a fault in any part spoils the
+/// whole frame, as a burst of noise on a real serial line would.
+
+class FaultyChannel : public xfer::Channel {
+public:
+    FaultyChannel(FdChannel *link, Faults const& faults, unsigned seed)
+    : m_link(link), m_faults(faults), m_seed(seed), m_corrupted(0), m_lost(0), m_noise(0)
+    {}
+
+    size_t Read(uint8_t *data, size_t n)
+    {
+        size_t got = m_link->Read(data, n);
+        if (got > 0 && chance(m_faults.loss)) {
+            ++m_lost;
+            return 0;
+        }
+        return got;
+    }
+
+    size_t Write(const uint8_t *data, size_t n)
+    {
+        if (chance(m_faults.noise)) {
+            static const char message[] = "DBG: log file rotated, heap free = 123456 B\n";
+            m_link->Write(reinterpret_cast<const uint8_t*>(message), sizeof(message) - 1);
+            ++m_noise;
+        }
+        if (chance(m_faults.loss)) {
+            ++m_lost;
+            return n;
+        }
+        if (n > 0 && chance(m_faults.corrupt)) {
+            std::string copy(reinterpret_cast<const char*>(data), n);
+            copy[rand_r(&m_seed) % n] ^= 0x5A;
+            ++m_corrupted;
+            return m_link->Write(reinterpret_cast<const uint8_t*>(copy.data()), n);
+        }
+        return m_link->Write(data, n);
+    }
+
+    uint32_t Corrupted(void) const { return m_corrupted; }
+    uint32_t Lost(void) const { return m_lost; }
+    uint32_t Noise(void) const { return m_noise; }
+
+private:
+    FdChannel   *m_link;        ///< Underlying link
+    Faults      m_faults;       ///< Probabilities of each fault
+    unsigned    m_seed;         ///< State for the random number generator
+    uint32_t    m_corrupted;    ///< Number of writes corrupted
+    uint32_t    m_lost;         ///< Number of reads and writes lost
+    uint32_t    m_noise;        ///< Number of debug messages added
+
+    bool chance(double p) { return p > 0.0 && rand_r(&m_seed) < p * RAND_MAX; }
+};
+
+/// \class GeneratedSource
+/// \brief File of generated data (a repeatable function of the offset), for testing without a file
+
+class GeneratedSource : public xfer::Source {
+public:
+    size_t Read(uint32_t offset, uint8_t *data, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t x = offset + i;
+            data[i] = static_cast<uint8_t>((x * 2654435761U) >> 24);
+        }
+        return n;
+    }
+};
+
+/// Report the syntax of the programme for the user.  Since the code is designed to be very
+/// simple, there is only basic processing (rather than something like Boost.program_options).
+
+void syntax(void)
+{
+    std::cout << "syntax: fake_logger [-f <file> | -s <size-B>] [-b <block-B>] [-w <window>] [-c <corrupt-prob>]\n"
+              << "                    [-l <loss-prob>] [-j <noise-prob>] [-r <seed>] [-1]\n";
+}
+
+/// Check the command line options are appropriate, and pick out the configuration options
+/// as required.
+///
+/// \param argc     Count of the number of arguments on the command line
+/// \param argv     Vector of the arguments making up the command line
+/// \param filename (Out) Reference for the space to store the name of the file to send (empty for generated data)
+/// \param size     (Out) Reference for the size of the generated data
+/// \param params   (Out) Reference for the transfer parameters (defaults are left if not specified)
+/// \param faults   (Out) Reference for the fault probabilities
+/// \param seed     (Out) Reference for the random number seed
+/// \param once     (Out) Reference for the flag to stop after one transfer
+/// \return True if the parse worked, otherwise false.
+
+bool check_options(int argc, char **argv, std::string& filename, uint32_t& size, xfer::Parameters& params,
+                   Faults& faults, unsigned& seed, bool& once)
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "f:s:b:w:c:l:j:r:1")) != -1) {
+        switch (ch) {
+            case 'f':
+                filename = std::string(optarg);
+                break;
+            case 's':
+                size = strtoul(optarg, nullptr, 0);
+                break;
+            case 'b':
+                params.blockSize = strtoul(optarg, nullptr, 0);
+                break;
+            case 'w':
+                params.window = strtoul(optarg, nullptr, 0);
+                break;
+            case 'c':
+                faults.corrupt = strtod(optarg, nullptr);
+                break;
+            case 'l':
+                faults.loss = strtod(optarg, nullptr);
+                break;
+            case 'j':
+                faults.noise = strtod(optarg, nullptr);
+                break;
+            case 'r':
+                seed = strtoul(optarg, nullptr, 0);
+                break;
+            case '1':
+                once = true;
+                break;
+            case '?':
+            default:
+                syntax();
+                return false;
+                break;
+        }
+    }
+    return true;
+}
+
+/// Send a file (or generated data) to the receiver with the block transfer protocol, reporting the
+/// outcome on stdout.
+///
+/// \param link     Link to the receiver
+/// \param filename Name of the file to send, or empty for generated data
+/// \param size     Size of the generated data (bytes)
+/// \param params   Parameters for the transfer
+/// \return True if the transfer completed, otherwise False
+
+bool send_file(FaultyChannel& link, std::string const& filename, uint32_t size, xfer::Parameters const& params)
+{
+    FILE *f = nullptr;
+    GeneratedSource generated;
+    xfer::Source *source = &generated;
+    if (!filename.empty()) {
+        if ((f = fopen(filename.c_str(), "rb")) == nullptr) {
+            std::cerr << "error: failed to open \"" << filename << "\".\n";
+            return false;
+        }
+        fseek(f, 0, SEEK_END);
+        size = ftell(f);
+        source = new FileSource(f);
+    }
+
+    xfer::Sender sender(&link, monotonic_clock);
+    bool ok = sender.Start(source, size, nullptr, params);
+    while (ok && sender.Step(20000))
+        usleep(200);
+    ok = sender.Complete();
+
+    xfer::Statistics const& stats = sender.Stats();
+    if (ok) {
+        printf("sent %u B in %.3f s (%.0f B/s)", size, stats.elapsed / 1.0e6,
+               stats.elapsed > 0 ? size * 1.0e6 / stats.elapsed : 0.0);
+    } else {
+        printf("failed: %s", sender.Error().c_str());
+    }
+    printf("; %u frames, %u re-sent, %u time-outs, %u CRC errors; faults: %u corrupted, %u lost, %u noise\n",
+           stats.frames, stats.retransmits, stats.timeouts, stats.crcErrors, link.Corrupted(), link.Lost(), link.Noise());
+    fflush(stdout);
+
+    if (f != nullptr) {
+        delete source;
+        fclose(f);
+    }
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    std::string filename;
+    uint32_t size = 1024*1024;
+    xfer::Parameters params;
+    Faults faults;
+    unsigned seed = 1;
+    bool once = false;
+    if (!check_options(argc, argv, filename, size, params, faults, seed, once))
+        return 1;
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        std::cerr << "error: failed to make pseudo-terminal.\n";
+        return 1;
+    }
+    set_raw(master, B0);
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    printf("%s\n", ptsname(master));
+    fflush(stdout);
+
+    FdChannel fd_link(master);
+    FaultyChannel link(&fd_link, faults, seed);
+    std::string line;
+    bool ok = true;
+    while (true) {
+        // Commands are read without faults, since the real command line has no protection either
+        uint8_t c;
+        if (fd_link.Read(&c, 1) == 0) {
+            fd_link.Wait(100);
+            continue;
+        }
+        if (c != '\n') {
+            if (c != '\r') line += static_cast<char>(c);
+            continue;
+        }
+        if (line.compare(0, 15, "transfer block ") == 0) {
+            ok = send_file(link, filename, size, params);
+            if (once) break;
+        }
+        line.clear();
+    }
+    close(master);
+    return ok ? 0 : 2;
+}
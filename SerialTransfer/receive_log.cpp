@@ -0,0 +1,190 @@
+/*! \file receive_log.cpp
+ * \brief Command line user interface for receiving a log file from the logger over a serial port.
+ *
+ * This opens the serial port, asks the logger for the log file with the "transfer block" command, and
+ * receives it with the block transfer protocol, writing it to the output file given.  Progress is
+ * reported on the terminal (stderr), since the serial port is carrying the data.
+ *
+ */
+/// Copyright 2024 Center for Coastal and Ocean Mapping & NOAA-UNH Joint
+/// Hydrographic Center, University of New Hampshire.
+///
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights to use,
+/// copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+/// and to permit persons to whom the Software is furnished to do so, subject to
+/// the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+/// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+/// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+/// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+/// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+/// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+/// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+/// OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <iostream>
+#include <string>
+#include "BlockTransfer.h"
+#include "PosixChannel.h"
+
+static volatile sig_atomic_t interrupted = 0;   ///< Flag: the user has asked to stop
+
+/// Signal handler for SIGINT, so that the transfer can be abandoned cleanly (telling the logger).
+
+static void on_interrupt(int)
+{
+    interrupted = 1;
+}
+
+/// Report the syntax of the programme for the user.  Since the code is designed to be very
+/// simple, there is only basic processing (rather than something like Boost.program_options).
+
+void syntax(void)
+{
+    std::cout << "syntax: receive_log -d <serial-device> -n <file-number> -o <output-file> [-b <baud-rate>] [-q]\n";
+}
+
+/// Convert a baud rate into the corresponding termios speed constant.
+///
+/// \param baud Line speed (bits/s)
+/// \return Speed constant, or B0 if the rate isn't supported
+
+speed_t baud_constant(unsigned long baud)
+{
+    switch (baud) {
+        case 9600:      return B9600;
+        case 19200:     return B19200;
+        case 38400:     return B38400;
+        case 57600:     return B57600;
+        case 115200:    return B115200;
+        case 230400:    return B230400;
+#ifdef B460800
+        case 460800:    return B460800;
+#endif
+#ifdef B921600
+        case 921600:    return B921600;
+#endif
+        default:        return B0;
+    }
+}
+
+/// Check the command line options are appropriate, and pick out the configuration options
+/// as required.
+///
+/// \param argc         Count of the number of arguments on the command line
+/// \param argv         Vector of the arguments making up the command line
+/// \param device       (Out) Reference for the space to store the serial device name
+/// \param filenumber   (Out) Reference for the log file number to request
+/// \param output       (Out) Reference for the space to store the output filename
+/// \param baud         (Out) Reference for the line speed (left as default if not specified)
+/// \param quiet        (Out) Reference for the flag to suppress progress reports
+/// \return True if the parse worked, otherwise false.
+
+bool check_options(int argc, char **argv, std::string& device, long& filenumber, std::string& output,
+                   unsigned long& baud, bool& quiet)
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "d:n:o:b:q")) != -1) {
+        switch (ch) {
+            case 'd':
+                device = std::string(optarg);
+                break;
+            case 'n':
+                filenumber = strtol(optarg, nullptr, 0);
+                break;
+            case 'o':
+                output = std::string(optarg);
+                break;
+            case 'b':
+                baud = strtoul(optarg, nullptr, 0);
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            case '?':
+            default:
+                syntax();
+                return false;
+                break;
+        }
+    }
+    if (device.empty() || output.empty() || filenumber < 0) {
+        syntax();
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    std::string device, output;
+    long filenumber = -1;
+    unsigned long baud = 115200;
+    bool quiet = false;
+    if (!check_options(argc, argv, device, filenumber, output, baud, quiet))
+        return 1;
+
+    speed_t speed = baud_constant(baud);
+    if (speed == B0) {
+        std::cerr << "error: baud rate " << baud << " is not supported.\n";
+        return 1;
+    }
+    int fd = open(device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0 || !set_raw(fd, speed)) {
+        std::cerr << "error: failed to open serial device \"" << device << "\".\n";
+        return 1;
+    }
+    FILE *f = fopen(output.c_str(), "wb");
+    if (f == nullptr) {
+        std::cerr << "error: failed to open output file \"" << output << "\".\n";
+        close(fd);
+        return 1;
+    }
+    signal(SIGINT, on_interrupt);
+
+    FdChannel link(fd);
+    FileSink sink(f);
+    xfer::Receiver receiver(&link, &sink, monotonic_clock);
+    std::string command = "transfer block " + std::to_string(filenumber) + "\n";
+    link.Write(reinterpret_cast<const uint8_t*>(command.data()), command.size());
+
+    uint64_t last_report = monotonic_clock();
+    while (receiver.Step(100000)) {
+        if (interrupted) receiver.Stop();
+        link.Wait(10);
+        uint64_t now = monotonic_clock();
+        if (!quiet && receiver.Started() && now - last_report > 1000000) {
+            xfer::Statistics const& stats = receiver.Stats();
+            fprintf(stderr, "\r%llu/%u B (%.0f B/s)", static_cast<unsigned long long>(stats.bytes), receiver.Size(),
+                    stats.elapsed > 0 ? stats.bytes * 1.0e6 / stats.elapsed : 0.0);
+            last_report = now;
+        }
+    }
+    fclose(f);
+    close(fd);
+    if (!quiet) fprintf(stderr, "\n");
+    if (!receiver.Complete()) {
+        std::cerr << "error: transfer failed: " << receiver.Error() << ".\n";
+        return 2;
+    }
+
+    xfer::Statistics const& stats = receiver.Stats();
+    printf("received %u B in %.3f s (%.0f B/s); %u CRC errors, %u bytes skipped\n", receiver.Size(),
+           stats.elapsed / 1.0e6, stats.elapsed > 0 ? stats.bytes * 1.0e6 / stats.elapsed : 0.0,
+           stats.crcErrors, stats.skipped);
+    printf("md5 ");
+    for (size_t n = 0; n < xfer::HashSize; ++n) printf("%02x", receiver.Hash()[n]);
+    printf("\n");
+    return 0;
+}
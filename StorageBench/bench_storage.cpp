@@ -0,0 +1,157 @@
+/*! \file bench_storage.cpp
+ * \brief Command line user interface for running the logger storage benchmark on a host.
+ *
+ * This runs the same benchmark core as the logger firmware's "benchmark" command against a scratch
+ * file on a POSIX file system, so that cards and eMMC devices can be checked in a card reader before
+ * they're installed in a logger.
+ *
+ */
+/// Copyright 2024 Center for Coastal and Ocean Mapping & NOAA-UNH Joint
+/// Hydrographic Center, University of New Hampshire.
+///
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights to use,
+/// copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+/// and to permit persons to whom the Software is furnished to do so, subject to
+/// the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+/// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+/// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+/// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+/// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+/// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+/// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+/// OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdio.h>
+#include <iostream>
+#include <string>
+#include "StorageBenchmark.h"
+
+/// \class PosixMedium
+/// \brief Scratch file for the benchmark on a POSIX file system
+///
+/// Flushes use fsync() so that the cost of forcing data to the device is included, as it is on the
+/// logger when the log file is flushed.
+
+class PosixMedium : public bench::Medium {
+public:
+    PosixMedium(std::string const& filename) : m_filename(filename), m_fd(-1) {}
+    ~PosixMedium(void) { Close(); }
+
+    bool Open(void) { m_fd = open(m_filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644); return m_fd >= 0; }
+    void Close(void) { if (m_fd >= 0) close(m_fd); m_fd = -1; }
+    void Remove(void) { unlink(m_filename.c_str()); }
+    bool Seek(uint32_t offset) { return lseek(m_fd, offset, SEEK_SET) == static_cast<off_t>(offset); }
+    size_t Write(const uint8_t *data, size_t n) { ssize_t rc = write(m_fd, data, n); return rc < 0 ? 0 : rc; }
+    size_t Read(uint8_t *data, size_t n) { ssize_t rc = read(m_fd, data, n); return rc < 0 ? 0 : rc; }
+    void Flush(void) { fsync(m_fd); }
+
+private:
+    std::string m_filename; ///< Name of the scratch file
+    int         m_fd;       ///< File descriptor for the scratch file, or -1 if closed
+};
+
+/// Monotonic microsecond clock for the benchmark.
+///
+/// \return Current monotonic time (us)
+
+uint64_t monotonic_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+}
+
+/// Report the syntax of the programme for the user.  Since the code is designed to be very
+/// simple, there is only basic processing (rather than something like Boost.program_options).
+
+void syntax(void)
+{
+    std::cout << "syntax: bench_storage -f <scratch-file> [-s <size-kB>] [-b <block-B>] [-F <flush-blocks>] [-r <rate-B/s>]\n";
+}
+
+/// Check the command line options are appropriate, and pick out the configuration options
+/// as required.
+///
+/// \param argc         Count of the number of arguments on the command line
+/// \param argv         Vector of the arguments making up the command line
+/// \param filename     (Out) Reference for the space to store the scratch filename
+/// \param params       (Out) Reference for the benchmark parameters (defaults are left if not specified)
+/// \return True if the parse worked, otherwise false.
+
+bool check_options(int argc, char **argv, std::string& filename, bench::Parameters& params)
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "f:s:b:F:r:")) != -1) {
+        switch (ch) {
+            case 'f':
+                filename = std::string(optarg);
+                break;
+            case 's':
+                params.fileSize = strtoul(optarg, nullptr, 0) * 1024;
+                break;
+            case 'b':
+                params.blockSize = strtoul(optarg, nullptr, 0);
+                break;
+            case 'F':
+                params.flushEvery = strtoul(optarg, nullptr, 0);
+                break;
+            case 'r':
+                params.requiredRate = strtoul(optarg, nullptr, 0);
+                break;
+            case '?':
+            default:
+                syntax();
+                return false;
+                break;
+        }
+    }
+    if (filename.empty()) {
+        syntax();
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    std::string filename;
+    bench::Parameters params;
+    if (!check_options(argc, argv, filename, params))
+        return 1;
+
+    PosixMedium medium(filename);
+    bench::Benchmark benchmark(&medium, monotonic_clock);
+    if (!benchmark.Start(params)) {
+        std::cerr << "error: failed to start benchmark: " << benchmark.Error() << ".\n";
+        return 1;
+    }
+    while (benchmark.Step(1000000))
+        ;
+    if (!benchmark.Complete()) {
+        std::cerr << "error: benchmark failed: " << benchmark.Error() << ".\n";
+        return 1;
+    }
+
+    printf("file %u B, block %u B, flush every %u blocks, required %u B/s\n",
+           params.fileSize, params.blockSize, params.flushEvery, params.requiredRate);
+    printf("%-10s %12s %10s %10s %10s %10s  %s\n", "test", "rate (B/s)", "p50 (us)", "p90 (us)", "p99 (us)", "max (us)", "result");
+    std::vector<bench::Result> const& results = benchmark.Results();
+    for (size_t n = 0; n < results.size(); ++n) {
+        printf("%-10s %12.0f %10u %10u %10u %10u  %s\n", results[n].name, results[n].rate,
+               results[n].p50, results[n].p90, results[n].p99, results[n].max,
+               results[n].write ? (results[n].pass ? "pass" : "FAIL") : "-");
+    }
+    printf("overall: %s\n", benchmark.Passed() ? "pass" : "FAIL");
+    return benchmark.Passed() ? 0 : 2;
+}
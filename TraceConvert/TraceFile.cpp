@@ -0,0 +1,234 @@
+/*!\file TraceFile.cpp
+ * \brief Read binary event trace dumps from the logger, and write them in Chrome trace format
+ *
+ * The logger firmware can record a ring of fixed-size binary event records to show where the time
+ * goes in its data path.  This code reads the dump of that ring (as sent over serial or HTTP) and
+ * converts it into the JSON format used by the Chrome about:tracing viewer.
+ *
+ */
+/// Copyright 2024 Center for Coastal and Ocean Mapping & NOAA-UNH Joint
+/// Hydrographic Center, University of New Hampshire.
+///
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights to use,
+/// copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+/// and to permit persons to whom the Software is furnished to do so, subject to
+/// the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+/// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+/// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+/// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+/// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+/// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+/// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+/// OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <cstring>
+#include <iterator>
+#include <sstream>
+#include "TraceFile.h"
+
+namespace nmea {
+namespace trace {
+
+/// Thread IDs used to separate the events into lanes in the viewer
+enum Lane {
+    LaneLoop = 1,       ///< Main loop (scheduled tasks, message handlers, and log writes)
+    LanePackets = 2,    ///< Packet arrivals
+    LaneWiFi = 3,       ///< Web server requests
+    LaneUpload = 4      ///< Upload transfers
+};
+
+/// Names for the packet sources (must match logger::TraceSource in the firmware)
+static const char *source_names[] = { "nmea2000", "nmea0183-1", "nmea0183-2", "imu" };
+
+/// Extract a little-endian unsigned integer of the given number of bytes from a buffer.
+///
+/// \param p        Pointer to the start of the integer in the buffer
+/// \param nbytes   Number of bytes in the integer
+/// \return Value of the integer
+
+static uint64_t get_le(const unsigned char *p, int nbytes)
+{
+    uint64_t rtn = 0;
+    for (int i = nbytes - 1; i >= 0; --i) rtn = (rtn << 8) | p[i];
+    return rtn;
+}
+
+/// Escape a string for inclusion in JSON output.  Names from the logger are simple identifiers and
+/// paths, so only quotes, backslashes, and control characters need attention.
+///
+/// \param s    String to escape
+/// \return Escaped version of the string
+
+static std::string escape(std::string const& s)
+{
+    std::string rtn;
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '"' || s[i] == '\\') {
+            rtn += '\\';
+            rtn += s[i];
+        } else if (static_cast<unsigned char>(s[i]) < 0x20) {
+            rtn += ' ';
+        } else {
+            rtn += s[i];
+        }
+    }
+    return rtn;
+}
+
+/// Read a trace dump from the stream given.  The whole stream is read into memory, and then searched
+/// for the "WTRC" magic that marks the start of the dump, so that text preceding the binary data (e.g.,
+/// from a serial capture) is ignored.  Timestamps are extended to 64 bits by counting wraps of the
+/// 32-bit microsecond counter used on the logger, which are only assumed when the counter drops by more
+/// than 2^31 us between records (so that records slightly out of order don't look like a wrap).
+///
+/// \param in   Stream to read from (should be opened in binary mode)
+/// \return True if the dump was read completely, otherwise False (see \a Error())
+
+bool TraceFile::Read(std::istream& in)
+{
+    std::vector<unsigned char> buffer((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    m_names.clear();
+    m_records.clear();
+    m_lost = 0;
+
+    size_t pos = 0;
+    while (pos + 4 <= buffer.size() && memcmp(&buffer[pos], "WTRC", 4) != 0) ++pos;
+    if (pos + 16 > buffer.size()) {
+        m_error = "no trace header found";
+        return false;
+    }
+    const unsigned char *p = &buffer[pos + 4];
+    const unsigned char *end = buffer.data() + buffer.size();
+
+    uint16_t version = static_cast<uint16_t>(get_le(p, 2)); p += 2;
+    uint16_t record_size = static_cast<uint16_t>(get_le(p, 2)); p += 2;
+    uint32_t n_names = static_cast<uint32_t>(get_le(p, 4)); p += 4;
+    if (version != 1 || record_size < 12) {
+        std::ostringstream msg;
+        msg << "unsupported trace format (version " << version << ", record size " << record_size << ")";
+        m_error = msg.str();
+        return false;
+    }
+    for (uint32_t n = 0; n < n_names; ++n) {
+        if (end - p < 2) { m_error = "truncated name table"; return false; }
+        uint16_t length = static_cast<uint16_t>(get_le(p, 2)); p += 2;
+        if (end - p < length) { m_error = "truncated name table"; return false; }
+        m_names.push_back(std::string(reinterpret_cast<const char*>(p), length));
+        p += length;
+    }
+    if (end - p < 8) { m_error = "truncated record header"; return false; }
+    uint32_t n_records = static_cast<uint32_t>(get_le(p, 4)); p += 4;
+    m_lost = static_cast<uint32_t>(get_le(p, 4)); p += 4;
+
+    int64_t previous = 0;
+    for (uint32_t n = 0; n < n_records; ++n) {
+        if (end - p < record_size) { m_error = "truncated records"; return false; }
+        Record r;
+        uint32_t stamp = static_cast<uint32_t>(get_le(p, 4));
+        if (n == 0) {
+            previous = stamp;
+        } else {
+            // The step from the previous record, modulo 2^32: a wrap of the timer shows up as a small
+            // forward step, and records slightly out of order (e.g., from another task) as a small
+            // backward step, so only drops of more than 2^31 us are taken as a wrap.
+            int32_t step = static_cast<int32_t>(stamp - static_cast<uint32_t>(previous));
+            previous += step;
+            if (previous < 0) previous = 0;
+        }
+        r.timestamp = static_cast<uint64_t>(previous);
+        r.event = static_cast<uint16_t>(get_le(p + 4, 2));
+        r.arg0 = static_cast<uint16_t>(get_le(p + 6, 2));
+        r.arg1 = static_cast<uint32_t>(get_le(p + 8, 4));
+        m_records.push_back(r);
+        p += record_size;
+    }
+    return true;
+}
+
+/// Look up a name from the trace's name table.
+///
+/// \param index    Index of the name, as recorded in the event
+/// \return Name from the table, or a placeholder if the index is out of range
+
+std::string TraceFile::name(uint16_t index) const
+{
+    if (index < m_names.size()) return m_names[index];
+    std::ostringstream rtn;
+    rtn << "name" << index;
+    return rtn.str();
+}
+
+/// Write the trace in the Chrome trace event format.  Scheduled tasks, message handlers, and writes to
+/// the log file are all run from the main loop, and nest properly, so they are written as duration events
+/// on the same lane; packet arrivals and web requests are written as instant events on their own lanes,
+/// and uploads as duration events on theirs.  Times are relative to the first record.
+///
+/// \param out  Stream on which to write the JSON
+
+void TraceFile::WriteChromeTrace(std::ostream& out) const
+{
+    uint64_t base = m_records.empty() ? 0 : m_records.front().timestamp;
+
+    out << "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"lost\":" << m_lost << "},\"traceEvents\":[\n";
+    out << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":1,\"args\":{\"name\":\"WIBL logger\"}},\n";
+    out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << LaneLoop << ",\"args\":{\"name\":\"loop\"}},\n";
+    out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << LanePackets << ",\"args\":{\"name\":\"packets\"}},\n";
+    out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << LaneWiFi << ",\"args\":{\"name\":\"wifi\"}},\n";
+    out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << LaneUpload << ",\"args\":{\"name\":\"upload\"}}";
+
+    for (size_t n = 0; n < m_records.size(); ++n) {
+        Record const& r = m_records[n];
+        std::ostringstream ev;
+        ev << "{\"pid\":1,\"ts\":" << (r.timestamp - base) << ",";
+        switch (r.event) {
+            case PacketRx:
+                ev << "\"ph\":\"i\",\"s\":\"t\",\"tid\":" << LanePackets << ",\"name\":\""
+                   << (r.arg0 < 4 ? source_names[r.arg0] : "unknown") << "\",\"args\":{\"id\":" << r.arg1 << "}";
+                break;
+            case HandlerBegin:
+            case HandlerEnd:
+                ev << "\"ph\":\"" << (r.event == HandlerBegin ? "B" : "E") << "\",\"tid\":" << LaneLoop
+                   << ",\"name\":\"pgn" << r.arg1 << "\"";
+                break;
+            case TaskBegin:
+            case TaskEnd:
+                ev << "\"ph\":\"" << (r.event == TaskBegin ? "B" : "E") << "\",\"tid\":" << LaneLoop
+                   << ",\"name\":\"" << escape(name(r.arg0)) << "\"";
+                if (r.event == TaskEnd) ev << ",\"args\":{\"more\":" << r.arg1 << "}";
+                break;
+            case SDWriteBegin:
+            case SDWriteEnd:
+                ev << "\"ph\":\"" << (r.event == SDWriteBegin ? "B" : "E") << "\",\"tid\":" << LaneLoop
+                   << ",\"name\":\"write\"";
+                if (r.event == SDWriteBegin) ev << ",\"args\":{\"packet\":" << r.arg0 << ",\"bytes\":" << r.arg1 << "}";
+                break;
+            case WiFiRequest:
+                ev << "\"ph\":\"i\",\"s\":\"t\",\"tid\":" << LaneWiFi << ",\"name\":\"" << escape(name(r.arg0))
+                   << "\",\"args\":{\"method\":" << r.arg1 << "}";
+                break;
+            case UploadBegin:
+            case UploadEnd:
+                ev << "\"ph\":\"" << (r.event == UploadBegin ? "B" : "E") << "\",\"tid\":" << LaneUpload
+                   << ",\"name\":\"upload\",\"args\":{\"file\":" << r.arg0 << ","
+                   << (r.event == UploadBegin ? "\"bytes\":" : "\"success\":") << r.arg1 << "}";
+                break;
+            default:
+                ev << "\"ph\":\"i\",\"s\":\"g\",\"tid\":" << LaneLoop << ",\"name\":\"event" << r.event
+                   << "\",\"args\":{\"arg0\":" << r.arg0 << ",\"arg1\":" << r.arg1 << "}";
+                break;
+        }
+        ev << "}";
+        out << ",\n" << ev.str();
+    }
+    out << "\n]}\n";
+}
+
+}
+}
@@ -0,0 +1,111 @@
+/*!\file TraceFile.h
+ * \brief Read binary event trace dumps from the logger, and write them in Chrome trace format
+ *
+ * The logger firmware can record a ring of fixed-size binary event records to show where the time
+ * goes in its data path.  This code reads the dump of that ring (as sent over serial or HTTP) and
+ * converts it into the JSON format used by the Chrome about:tracing viewer.
+ *
+ */
+/// Copyright 2024 Center for Coastal and Ocean Mapping & NOAA-UNH Joint
+/// Hydrographic Center, University of New Hampshire.
+///
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights to use,
+/// copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+/// and to permit persons to whom the Software is furnished to do so, subject to
+/// the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+/// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+/// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+/// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+/// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+/// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+/// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+/// OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef __TRACE_FILE_H__
+#define __TRACE_FILE_H__
+
+#include <stdint.h>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace nmea {
+namespace trace {
+
+/// \enum EventID
+/// \brief Identifiers for the events recorded by the logger (must match logger::TraceEvent in the firmware)
+
+enum EventID {
+    PacketRx = 1,       ///< Packet received (arg0: source; arg1: PGN or byte count)
+    HandlerBegin = 2,   ///< Start of NMEA2000 message handler (arg1: PGN)
+    HandlerEnd = 3,     ///< End of NMEA2000 message handler (arg1: PGN)
+    TaskBegin = 4,      ///< Start of scheduled task slice (arg0: name index)
+    TaskEnd = 5,        ///< End of scheduled task slice (arg0: name index; arg1: more work flag)
+    SDWriteBegin = 6,   ///< Start of write to log file (arg0: packet ID; arg1: payload bytes)
+    SDWriteEnd = 7,     ///< End of write to log file (arg0: packet ID; arg1: payload bytes)
+    WiFiRequest = 8,    ///< HTTP request received (arg0: name index of endpoint; arg1: HTTP method)
+    UploadBegin = 9,    ///< Start of upload chunk (arg0: file number; arg1: bytes)
+    UploadEnd = 10      ///< End of upload chunk (arg0: file number; arg1: success flag)
+};
+
+/// \struct Record
+/// \brief Single event record from the trace, with the timestamp extended to 64 bits
+
+struct Record {
+    uint64_t    timestamp;  ///< Time of the event (us since logger boot)
+    uint16_t    event;      ///< Event identifier (\a EventID)
+    uint16_t    arg0;       ///< First (short) argument
+    uint32_t    arg1;       ///< Second (long) argument
+};
+
+/// \class TraceFile
+/// \brief In-memory copy of a trace dump from the logger
+///
+/// The dump starts with the magic "WTRC", which is searched for so that a capture from the serial
+/// port that includes some text before the binary data can be used directly.  The logger's timestamps
+/// are 32-bit microsecond counts, which wrap after about 71 minutes, so they are extended to 64 bits
+/// on the assumption that successive records are less than 2^31 us (about 36 minutes) apart; small
+/// steps backwards are kept as such, rather than taken as a wrap.
+
+class TraceFile {
+public:
+    /// \brief Default constructor
+    TraceFile(void) : m_lost(0) {}
+
+    /// \brief Read a trace dump from the stream given
+    bool Read(std::istream& in);
+
+    /// \brief Write the trace in Chrome trace event (JSON) format
+    void WriteChromeTrace(std::ostream& out) const;
+
+    /// \brief Number of records in the trace
+    size_t Count(void) const { return m_records.size(); }
+    /// \brief Record from the trace, oldest first
+    Record const& Event(size_t n) const { return m_records[n]; }
+    /// \brief Number of records that the logger reported as lost to overwriting
+    uint32_t Lost(void) const { return m_lost; }
+    /// \brief Error message for the last failed read
+    std::string const& Error(void) const { return m_error; }
+
+private:
+    std::vector<std::string>    m_names;    ///< Name table from the dump
+    std::vector<Record>         m_records;  ///< Records from the dump, oldest first
+    uint32_t                    m_lost;     ///< Number of records lost to overwriting on the logger
+    std::string                 m_error;    ///< Description of the last error
+
+    /// \brief Look up a name by index, with a fallback for unknown indices
+    std::string name(uint16_t index) const;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,108 @@
+/*! \file trace2json.cpp
+ * \brief Command line user interface for converting logger event traces to Chrome trace format.
+ *
+ * This provides a very simple interface to convert the binary event trace dumped by the logger
+ * (with "trace dump" on the serial port, or from the /trace endpoint) into JSON that can be loaded
+ * into the Chrome about:tracing viewer, or Perfetto.
+ *
+ */
+/// Copyright 2024 Center for Coastal and Ocean Mapping & NOAA-UNH Joint
+/// Hydrographic Center, University of New Hampshire.
+///
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights to use,
+/// copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+/// and to permit persons to whom the Software is furnished to do so, subject to
+/// the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+/// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+/// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+/// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+/// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+/// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+/// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+/// OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <fstream>
+#include <iostream>
+#include "TraceFile.h"
+
+/// Report the syntax of the programme for the user.  Since the code is designed to be very
+/// simple, there is only basic processing (rather than something like Boost.program_options).
+
+void syntax(void)
+{
+    std::cout << "syntax: trace2json -i <trace-dump> [-o <json-file>]\n";
+}
+
+/// Check the command line options are appropriate, and pick out the configuration options
+/// as required.
+///
+/// \param argc         Count of the number of arguments on the command line
+/// \param argv         Vector of the arguments making up the command line
+/// \param input        (Out) Reference for the space to store the trace dump filename
+/// \param output       (Out) Reference for the space to store the JSON output filename (empty for stdout)
+/// \return True if the parse worked, otherwise false.
+
+bool check_options(int argc, char **argv, std::string& input, std::string& output)
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "i:o:")) != -1) {
+        switch (ch) {
+            case 'i':
+                input = std::string(optarg);
+                break;
+            case 'o':
+                output = std::string(optarg);
+                break;
+            case '?':
+            default:
+                syntax();
+                return false;
+                break;
+        }
+    }
+    if (input.empty()) {
+        syntax();
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    std::string input, output;
+    if (!check_options(argc, argv, input, output))
+        return 1;
+
+    std::ifstream in(input.c_str(), std::ios::in | std::ios::binary);
+    if (!in.good()) {
+        std::cerr << "error: failed to open \"" << input << "\" for input.\n";
+        return 1;
+    }
+    nmea::trace::TraceFile trace;
+    if (!trace.Read(in)) {
+        std::cerr << "error: failed to read trace from \"" << input << "\": " << trace.Error() << ".\n";
+        return 1;
+    }
+    std::cerr << "info: read " << trace.Count() << " records (" << trace.Lost() << " lost on the logger).\n";
+
+    if (output.empty()) {
+        trace.WriteChromeTrace(std::cout);
+    } else {
+        std::ofstream out(output.c_str());
+        if (!out.good()) {
+            std::cerr << "error: failed to open \"" << output << "\" for output.\n";
+            return 1;
+        }
+        trace.WriteChromeTrace(out);
+    }
+    return 0;
+}
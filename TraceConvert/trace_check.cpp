@@ -0,0 +1,125 @@
+/*! \file trace_check.cpp
+ * \brief Checks for the extension of logger trace timestamps to 64 bits.
+ *
+ * This builds synthetic trace dumps in memory, reads them with the converter, and checks that the
+ * timestamps come out as expected: monotonic records across a wrap of the logger's 32-bit microsecond
+ * counter, and records from different tasks that are slightly out of order (which must not be taken as
+ * a wrap, or every following event is pushed about 71 minutes into the future).
+ *
+ */
+/// Copyright 2024 Center for Coastal and Ocean Mapping & NOAA-UNH Joint
+/// Hydrographic Center, University of New Hampshire.
+///
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights to use,
+/// copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+/// and to permit persons to whom the Software is furnished to do so, subject to
+/// the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+/// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+/// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+/// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+/// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+/// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+/// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+/// OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <stdint.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "TraceFile.h"
+
+/// Append a little-endian integer to a buffer.
+///
+/// \param buffer   Buffer to append to
+/// \param value    Value to append
+/// \param nbytes   Number of bytes to use for the value
+
+void put_le(std::string& buffer, uint64_t value, int nbytes)
+{
+    for (int i = 0; i < nbytes; ++i) buffer += static_cast<char>((value >> (8*i)) & 0xFF);
+}
+
+/// Make a trace dump, in the format written by the logger, with one event per timestamp given.
+///
+/// \param stamps   32-bit timestamps (us) for the records, in the order stored
+/// \return Binary dump, preceded by some text as if captured from the serial port
+
+std::string make_dump(std::vector<uint32_t> const& stamps)
+{
+    std::string dump("INF: dumping trace.\n");
+    dump += "WTRC";
+    put_le(dump, 1, 2);     // Version
+    put_le(dump, 12, 2);    // Record size
+    put_le(dump, 1, 4);     // Names
+    put_le(dump, 4, 2);
+    dump += "loop";
+    put_le(dump, stamps.size(), 4);
+    put_le(dump, 0, 4);     // Lost records
+    for (size_t n = 0; n < stamps.size(); ++n) {
+        put_le(dump, stamps[n], 4);
+        put_le(dump, nmea::trace::PacketRx, 2);
+        put_le(dump, 0, 2);
+        put_le(dump, n, 4);
+    }
+    return dump;
+}
+
+/// Read a synthetic dump and check the extended timestamps against those expected.
+///
+/// \param name     Name of the check, for reporting
+/// \param stamps   32-bit timestamps (us) for the records, in the order stored
+/// \param expected Extended timestamps (us) that the converter should report
+/// \return True if the converter reports the expected timestamps, otherwise False
+
+bool check(const char *name, std::vector<uint32_t> const& stamps, std::vector<uint64_t> const& expected)
+{
+    std::istringstream in(make_dump(stamps));
+    nmea::trace::TraceFile trace;
+    if (!trace.Read(in)) {
+        std::cerr << "error: " << name << ": failed to read dump (" << trace.Error() << ").\n";
+        return false;
+    }
+    if (trace.Count() != expected.size()) {
+        std::cerr << "error: " << name << ": read " << trace.Count() << " records, expected "
+            << expected.size() << ".\n";
+        return false;
+    }
+    bool ok = true;
+    for (size_t n = 0; n < expected.size(); ++n) {
+        if (trace.Event(n).timestamp != expected[n]) {
+            std::cerr << "error: " << name << ": record " << n << " at " << trace.Event(n).timestamp
+                << " us, expected " << expected[n] << " us.\n";
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+int main(void)
+{
+    const uint64_t wrap = 0x100000000ULL;
+    bool ok = true;
+
+    ok &= check("in order", { 100, 200, 300 }, { 100, 200, 300 });
+    ok &= check("wrap", { 0xFFFFFF00U, 0xFFFFFFF0U, 0x10, 0x100 },
+        { 0xFFFFFF00U, 0xFFFFFFF0U, wrap + 0x10, wrap + 0x100 });
+    // Two emitters racing on different cores: each step backwards is a few microseconds, and the
+    // events after them must stay where they are.
+    ok &= check("out of order", { 1000, 1005, 1003, 1010, 1008, 2000 }, { 1000, 1005, 1003, 1010, 1008, 2000 });
+    ok &= check("out of order across wrap", { 0xFFFFFFF0U, 0x05, 0xFFFFFFFAU, 0x20 },
+        { 0xFFFFFFF0U, wrap + 0x05, 0xFFFFFFFAU, wrap + 0x20 });
+    ok &= check("out of order after wrap", { 0xFFFFFFF0U, 0x10, 0x08, 0x30 },
+        { 0xFFFFFFF0U, wrap + 0x10, wrap + 0x08, wrap + 0x30 });
+
+    if (!ok) return 1;
+    std::cout << "trace timestamp checks pass\n";
+    return 0;
+}
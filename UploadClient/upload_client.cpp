@@ -0,0 +1,703 @@
+/*! \file upload_client.cpp
+ * \brief Host test client for resumable uploads to the upload server.
+ *
+ * This plays the part of a logger sending a file to the upload server (wibl-monitor) through a resumable
+ * session, following the same steps as the firmware's UploadManager: open (or re-open) the session with
+ * upload/start, send the first range that the server reports as missing with upload/chunk, one chunk per
+ * request, and then upload/commit once nothing is missing.  Failures can be injected into the chunks, either
+ * by corrupting the data (so that the chunk fails the server's digest check, and has to be sent again), or by
+ * dropping the connection part-way through a chunk and forgetting the session (as a logger would after losing
+ * its WiFi connection, or rebooting), so that the upload has to be resumed from the ranges that the server
+ * reports as missing when the session is re-opened.
+ *
+ */
+/// Copyright 2024 Center for Coastal and Ocean Mapping & NOAA-UNH Joint
+/// Hydrographic Center, University of New Hampshire.
+///
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights to use,
+/// copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+/// and to permit persons to whom the Software is furnished to do so, subject to
+/// the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+/// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+/// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+/// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+/// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+/// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+/// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+/// OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+
+const int MaxFailures = 10;             ///< Consecutive failed requests before the upload is abandoned
+const int SocketTimeout = 30;           ///< Time (s) to wait for the server before giving up on a request
+const int64_t DefaultChunkSize = 65536; ///< Chunk size (bytes) if the server doesn't specify one (as on the logger)
+
+typedef std::vector<std::pair<int64_t, int64_t>> Ranges; ///< Byte ranges [start, end) of the file
+
+/// \struct Options
+/// \brief Configuration for the upload, from the command line
+
+struct Options {
+    std::string server;         ///< Name or address of the upload server
+    int         port;           ///< Port for the upload server
+    std::string logger;         ///< Logger unique identifier (for authorisation)
+    std::string password;       ///< Logger pre-shared password (for authorisation)
+    std::string caCert;         ///< CA certificate for the server's TLS certificate
+    std::string input;          ///< File to upload (or empty for random data)
+    size_t      size;           ///< Size of the random data to upload, if there's no input file (bytes)
+    unsigned    fileNumber;     ///< Log file number to report to the server
+    unsigned    corruptEvery;   ///< Corrupt every N-th chunk sent (0 => none)
+    unsigned    dropEvery;      ///< Drop the connection part-way through every N-th chunk sent (0 => none)
+    bool        quiet;          ///< Flag: True => only report the outcome
+
+    Options(void)
+    : port(8000), caCert("./certs/ca.crt"), size(1000000), fileNumber(1), corruptEvery(0), dropEvery(0),
+      quiet(false) {}
+};
+
+/// Report the syntax of the programme for the user.  Since the code is designed to be very
+/// simple, there is only basic processing (rather than something like Boost.program_options).
+
+void syntax(void)
+{
+    std::cout << "syntax: upload_client -s <server> -l <logger-id> -w <password> [-p <port>] [-c <ca-cert>]\n"
+              << "                     [-i <input-file> | -z <size>] [-n <file-number>] [-f <N>] [-d <N>] [-q]\n"
+              << "  -f <N>  corrupt every N-th chunk sent (fails the server's digest check)\n"
+              << "  -d <N>  drop the connection part-way through every N-th chunk sent, and resume\n";
+}
+
+/// Check the command line options are appropriate, and pick out the configuration options
+/// as required.
+///
+/// \param argc     Count of the number of arguments on the command line
+/// \param argv     Vector of the arguments making up the command line
+/// \param options  (Out) Configuration for the upload
+/// \return True if the parse worked, otherwise false.
+
+bool check_options(int argc, char **argv, Options& options)
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "s:p:l:w:c:i:z:n:f:d:q")) != -1) {
+        switch (ch) {
+            case 's':
+                options.server = std::string(optarg);
+                break;
+            case 'p':
+                options.port = static_cast<int>(strtol(optarg, nullptr, 0));
+                break;
+            case 'l':
+                options.logger = std::string(optarg);
+                break;
+            case 'w':
+                options.password = std::string(optarg);
+                break;
+            case 'c':
+                options.caCert = std::string(optarg);
+                break;
+            case 'i':
+                options.input = std::string(optarg);
+                break;
+            case 'z':
+                options.size = strtoul(optarg, nullptr, 0);
+                break;
+            case 'n':
+                options.fileNumber = static_cast<unsigned>(strtoul(optarg, nullptr, 0));
+                break;
+            case 'f':
+                options.corruptEvery = static_cast<unsigned>(strtoul(optarg, nullptr, 0));
+                break;
+            case 'd':
+                options.dropEvery = static_cast<unsigned>(strtoul(optarg, nullptr, 0));
+                break;
+            case 'q':
+                options.quiet = true;
+                break;
+            case '?':
+            default:
+                syntax();
+                return false;
+                break;
+        }
+    }
+    if (options.server.empty() || options.logger.empty() || options.password.empty() ||
+        options.port <= 0 || (options.input.empty() && options.size == 0)) {
+        syntax();
+        return false;
+    }
+    if (options.corruptEvery == 1 || options.dropEvery == 1) {
+        std::cerr << "error: failures can be injected at most every second chunk, or the upload can't finish.\n";
+        return false;
+    }
+    return true;
+}
+
+/// Compute the MD5 digest of a block of data, in the upper-case hex form used by the server.
+///
+/// \param data     Data to digest
+/// \return Hex string for the digest
+
+std::string md5_hex(std::string const& data)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    EVP_Digest(data.data(), data.size(), digest, &length, EVP_md5(), nullptr);
+    std::string rtn;
+    char hex[3];
+    for (unsigned int n = 0; n < length; ++n) {
+        snprintf(hex, sizeof(hex), "%02X", digest[n]);
+        rtn += hex;
+    }
+    return rtn;
+}
+
+/// Generate the value for an HTTP basic authorisation header.
+///
+/// \param logger   Logger unique identifier
+/// \param password Logger pre-shared password
+/// \return Header value
+
+std::string basic_auth(std::string const& logger, std::string const& password)
+{
+    std::string credentials(logger + ":" + password);
+    std::vector<unsigned char> encoded(4*((credentials.size() + 2)/3) + 1);
+    EVP_EncodeBlock(encoded.data(), reinterpret_cast<const unsigned char*>(credentials.data()),
+                    static_cast<int>(credentials.size()));
+    return "Basic " + std::string(reinterpret_cast<const char*>(encoded.data()));
+}
+
+/// Find the value for a key in the (compact, single-level) JSON responses from the server.
+///
+/// \param body     JSON response
+/// \param key      Key to find
+/// \return Position of the start of the value, or std::string::npos if the key isn't present
+
+size_t json_value(std::string const& body, std::string const& key)
+{
+    size_t pos = body.find("\"" + key + "\"");
+    if (pos == std::string::npos) return pos;
+    pos = body.find(':', pos + key.size() + 2);
+    if (pos == std::string::npos) return pos;
+    return body.find_first_not_of(" \t\r\n", pos + 1);
+}
+
+/// Extract a string value from a JSON response.
+///
+/// \param body     JSON response
+/// \param key      Key for the value
+/// \return Value, or an empty string if the key isn't present
+
+std::string json_string(std::string const& body, std::string const& key)
+{
+    size_t start = json_value(body, key);
+    if (start == std::string::npos || body[start] != '"') return std::string();
+    size_t end = body.find('"', start + 1);
+    if (end == std::string::npos) return std::string();
+    return body.substr(start + 1, end - start - 1);
+}
+
+/// Extract a numeric value from a JSON response.
+///
+/// \param body     JSON response
+/// \param key      Key for the value
+/// \param fallback Value to use if the key isn't present
+/// \return Value, or the fallback
+
+int64_t json_number(std::string const& body, std::string const& key, int64_t fallback)
+{
+    size_t start = json_value(body, key);
+    if (start == std::string::npos) return fallback;
+    return strtoll(body.c_str() + start, nullptr, 10);
+}
+
+/// Extract the list of missing ranges, [[start, end], ...], from a JSON response.
+///
+/// \param body     JSON response
+/// \param key      Key for the list
+/// \param ranges   (Out) Ranges in the list
+/// \return True if the list was present, otherwise False
+
+bool json_ranges(std::string const& body, std::string const& key, Ranges& ranges)
+{
+    size_t pos = json_value(body, key);
+    if (pos == std::string::npos || body[pos] != '[') return false;
+    ranges.clear();
+    const char *p = body.c_str() + pos + 1;
+    while (*p != '\0' && *p != ']') {
+        if (*p == '[') {
+            char *next;
+            int64_t start = strtoll(p + 1, &next, 10);
+            while (*next == ' ' || *next == ',') ++next;
+            int64_t end = strtoll(next, &next, 10);
+            ranges.push_back(std::make_pair(start, end));
+            p = strchr(next, ']');
+            if (p == nullptr) return false;
+        }
+        ++p;
+    }
+    return true;
+}
+
+/// \struct Response
+/// \brief Status and body of a response from the server
+
+struct Response {
+    int         status;     ///< HTTP status code (0 if there was no response)
+    std::string body;       ///< Body of the response (de-chunked, if required)
+
+    Response(void) : status(0) {}
+};
+
+/// \class Connection
+/// \brief TLS connection to the upload server, used for a single request
+///
+/// Each request is made on a new connection (with "Connection: close"), so that the response can be read
+/// to the end of the stream, and so that a dropped connection only affects the request that it carried.
+
+class Connection {
+public:
+    /// \brief Constructor, with the TLS context to use
+    Connection(SSL_CTX *context) : m_context(context), m_ssl(nullptr), m_fd(-1) {}
+    /// \brief Default destructor, closing the connection if it's open
+    ~Connection(void) { Close(); }
+
+    /// Connect to the server, and complete the TLS handshake (checking the server's certificate against the
+    /// CA certificate, and the host name given).
+    ///
+    /// \param host Name or address of the server
+    /// \param port Port for the server
+    /// \return True if the connection is ready for use, otherwise False
+
+    bool Open(std::string const& host, int port)
+    {
+        struct addrinfo hints, *addresses;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) return false;
+        for (struct addrinfo *a = addresses; a != nullptr && m_fd < 0; a = a->ai_next) {
+            m_fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (m_fd >= 0 && connect(m_fd, a->ai_addr, a->ai_addrlen) != 0) {
+                close(m_fd);
+                m_fd = -1;
+            }
+        }
+        freeaddrinfo(addresses);
+        if (m_fd < 0) return false;
+        struct timeval timeout = { SocketTimeout, 0 };
+        setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(m_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        m_ssl = SSL_new(m_context);
+        SSL_set_fd(m_ssl, m_fd);
+        SSL_set_tlsext_host_name(m_ssl, host.c_str());
+        SSL_set1_host(m_ssl, host.c_str());
+        if (SSL_connect(m_ssl) != 1) {
+            ERR_print_errors_fp(stderr);
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    /// Write data to the server.
+    ///
+    /// \param data     Data to write
+    /// \param length   Number of bytes to write
+    /// \return True if all of the data was written, otherwise False
+
+    bool Write(const char *data, size_t length)
+    {
+        while (length > 0) {
+            int n = SSL_write(m_ssl, data, static_cast<int>(length));
+            if (n <= 0) return false;
+            data += n;
+            length -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    /// Read everything that the server sends until it closes the connection.
+    ///
+    /// \param data (Out) Data read
+    /// \return True if the connection closed cleanly, otherwise False
+
+    bool ReadAll(std::string& data)
+    {
+        char buffer[4096];
+        int n;
+        data.clear();
+        while ((n = SSL_read(m_ssl, buffer, sizeof(buffer))) > 0) data.append(buffer, static_cast<size_t>(n));
+        int error = SSL_get_error(m_ssl, n);
+        // Some servers close the TCP connection without a TLS close_notify, which shows up as a system error
+        // with nothing pending; the response is complete in either case.
+        return error == SSL_ERROR_ZERO_RETURN || (error == SSL_ERROR_SYSCALL && !data.empty());
+    }
+
+    /// Close the connection (abruptly, if a request is part-way through).
+
+    void Close(void)
+    {
+        if (m_ssl != nullptr) {
+            SSL_free(m_ssl);
+            m_ssl = nullptr;
+        }
+        if (m_fd >= 0) {
+            close(m_fd);
+            m_fd = -1;
+        }
+    }
+
+private:
+    SSL_CTX *m_context; ///< TLS context (with the CA certificate)
+    SSL     *m_ssl;     ///< TLS connection, if open
+    int     m_fd;       ///< Socket for the connection, if open
+};
+
+/// Split a raw HTTP response into status code and body, undoing chunked transfer encoding if the server
+/// used it.
+///
+/// \param raw      Response as read from the connection
+/// \param response (Out) Status and body of the response
+/// \return True if the response could be parsed, otherwise False
+
+bool parse_response(std::string const& raw, Response& response)
+{
+    size_t header_end = raw.find("\r\n\r\n");
+    if (raw.compare(0, 5, "HTTP/") != 0 || header_end == std::string::npos) return false;
+    response.status = atoi(raw.c_str() + raw.find(' ') + 1);
+    std::string headers = raw.substr(0, header_end);
+    for (size_t n = 0; n < headers.size(); ++n) headers[n] = static_cast<char>(tolower(headers[n]));
+    std::string body = raw.substr(header_end + 4);
+    if (headers.find("transfer-encoding: chunked") == std::string::npos) {
+        response.body = body;
+        return true;
+    }
+    response.body.clear();
+    size_t pos = 0;
+    while (pos < body.size()) {
+        size_t length = strtoul(body.c_str() + pos, nullptr, 16);
+        size_t start = body.find("\r\n", pos);
+        if (start == std::string::npos) return false;
+        if (length == 0) break;
+        response.body += body.substr(start + 2, length);
+        pos = start + 2 + length + 2;
+    }
+    return true;
+}
+
+/// \class Uploader
+/// \brief Send a file to the upload server through a resumable session, with injected failures
+///
+/// The upload follows the same sequence as the firmware: each step is a single request, which opens the
+/// session if there isn't one, sends the next chunk that the server is missing, or commits the file once
+/// nothing is missing.  The list of missing ranges is replaced with the server's after each request, so
+/// that the client never has to work out for itself what the server has.
+
+class Uploader {
+public:
+    /// \brief Constructor, with the TLS context, configuration, and data to send
+    Uploader(SSL_CTX *context, Options const& options, std::string const& data)
+    : m_context(context), m_options(options), m_data(data), m_digest(md5_hex(data)), m_chunk(DefaultChunkSize),
+      m_failures(0), m_refused(false), m_chunks(0), m_corrupted(0), m_dropped(0), m_resumes(0), m_bytesSent(0)
+    {}
+
+    /// Run the upload to completion (or until there have been too many failures in a row).
+    ///
+    /// \return True if the server reported that the file was stored, otherwise False
+
+    bool Run(void)
+    {
+        State state;
+        do {
+            state = step();
+        } while (state == CONTINUE);
+        printf("upload %s: %zu B in %u chunks (%llu B sent); %u corrupted, %u dropped, %u resumes\n",
+               state == COMPLETE ? "complete" : "failed", m_data.size(), m_chunks,
+               static_cast<unsigned long long>(m_bytesSent), m_corrupted, m_dropped, m_resumes);
+        return state == COMPLETE;
+    }
+
+private:
+    /// \enum State
+    /// \brief Outcome of a single step of the upload
+    enum State {
+        CONTINUE,   ///< More to do
+        COMPLETE,   ///< Server has stored the file
+        FAILED      ///< Too many failures in a row
+    };
+
+    SSL_CTX         *m_context;     ///< TLS context for connections
+    Options const&  m_options;      ///< Configuration for the upload
+    std::string     m_data;         ///< Contents of the file being sent
+    std::string     m_digest;       ///< MD5 digest of the whole file
+    std::string     m_session;      ///< Server's session identifier (empty => no session)
+    int64_t         m_chunk;        ///< Maximum chunk size for the session (bytes)
+    Ranges          m_missing;      ///< Byte ranges that the server is still missing
+    int             m_failures;     ///< Number of failed requests in a row
+    bool            m_refused;      ///< Flag: True => the server refused the logger's credentials
+    unsigned        m_chunks;       ///< Number of chunks sent (including those with injected failures)
+    unsigned        m_corrupted;    ///< Number of chunks corrupted
+    unsigned        m_dropped;      ///< Number of chunks dropped part-way through
+    unsigned        m_resumes;      ///< Number of times a session was re-opened part-way through
+    uint64_t        m_bytesSent;    ///< Total bytes of chunk data sent
+
+    /// Run a single step of the upload: open the session, send a chunk, or commit the file.
+    ///
+    /// \return State of the upload
+
+    State step(void)
+    {
+        bool ok;
+        if (m_session.empty()) {
+            ok = startSession();
+        } else if (m_missing.empty()) {
+            State state;
+            ok = commitSession(state);
+            if (ok && state != CONTINUE) return state;
+        } else {
+            ok = sendChunk();
+        }
+        if (m_refused) {
+            std::cerr << "error: server refused the logger's credentials; abandoning upload.\n";
+            return FAILED;
+        }
+        if (ok) {
+            m_failures = 0;
+        } else if (++m_failures >= MaxFailures) {
+            std::cerr << "error: " << m_failures << " failed requests in a row; abandoning upload.\n";
+            return FAILED;
+        }
+        return CONTINUE;
+    }
+
+    /// Make a request to the server, optionally dropping the connection part-way through the body.
+    ///
+    /// \param path     Path (and query) for the request
+    /// \param body     Body of the request
+    /// \param digest   MD5 digest for the Digest header (or empty for none)
+    /// \param response (Out) Response from the server
+    /// \param drop     Flag: True => close the connection half-way through the body, without waiting for a response
+    /// \return True if there was a response from the server, otherwise False
+
+    bool request(std::string const& path, std::string const& body, std::string const& digest, Response& response,
+                 bool drop = false)
+    {
+        Connection connection(m_context);
+        if (!connection.Open(m_options.server, m_options.port)) {
+            std::cerr << "error: failed to connect to " << m_options.server << ":" << m_options.port << ".\n";
+            return false;
+        }
+        std::ostringstream header;
+        header << "POST /" << path << " HTTP/1.1\r\n"
+               << "Host: " << m_options.server << ":" << m_options.port << "\r\n"
+               << "Authorization: " << basic_auth(m_options.logger, m_options.password) << "\r\n"
+               << "Content-Type: application/octet-stream\r\n"
+               << "Content-Length: " << body.size() << "\r\n";
+        if (!digest.empty()) header << "Digest: md5=" << digest << "\r\n";
+        header << "Connection: close\r\n\r\n";
+        std::string head(header.str());
+        size_t length = drop ? body.size()/2 : body.size();
+        if (!connection.Write(head.data(), head.size()) || !connection.Write(body.data(), length)) return false;
+        if (drop) return false;
+
+        std::string raw;
+        connection.ReadAll(raw);
+        if (!parse_response(raw, response)) {
+            std::cerr << "error: no valid response from server for /" << path << ".\n";
+            return false;
+        }
+        if (response.status == 401) m_refused = true;
+        return true;
+    }
+
+    /// Open an upload session with the server for the file, or re-open the one that the server already has
+    /// for it (in which case the missing ranges say where to resume).
+    ///
+    /// \return True if the session is open, otherwise False
+
+    bool startSession(void)
+    {
+        std::ostringstream start;
+        start << "{\"file\":" << m_options.fileNumber << ",\"size\":" << m_data.size()
+              << ",\"md5\":\"" << m_digest << "\"}";
+        Response response;
+        if (!request("upload/start", start.str(), std::string(), response)) return false;
+        if (response.status != 200 || json_string(response.body, "session").empty() ||
+            !json_ranges(response.body, "missing", m_missing)) {
+            std::cerr << "error: failed to open upload session (status " << response.status << ").\n";
+            return false;
+        }
+        m_session = json_string(response.body, "session");
+        m_chunk = json_number(response.body, "chunk", DefaultChunkSize);
+        if (m_chunk <= 0) m_chunk = DefaultChunkSize;
+        int64_t missing = 0;
+        for (size_t n = 0; n < m_missing.size(); ++n) missing += m_missing[n].second - m_missing[n].first;
+        if (missing < static_cast<int64_t>(m_data.size())) ++m_resumes;
+        if (!m_options.quiet) {
+            printf("session %s open with chunk size %lld; %zu range(s), %lld B missing\n", m_session.c_str(),
+                   static_cast<long long>(m_chunk), m_missing.size(), static_cast<long long>(missing));
+        }
+        return true;
+    }
+
+    /// Send the next chunk that the server is missing, injecting a failure if this is one of the chunks chosen.
+    /// A corrupted chunk is still answered by the server (which reports it as a failure, and leaves the range
+    /// missing); a dropped chunk also forgets the session, so that the next step has to re-open it and resume.
+    ///
+    /// \return True if the server accepted the chunk, otherwise False
+
+    bool sendChunk(void)
+    {
+        int64_t offset = m_missing.front().first;
+        int64_t length = m_missing.front().second - offset;
+        if (length > m_chunk) length = m_chunk;
+        std::string chunk(m_data.substr(static_cast<size_t>(offset), static_cast<size_t>(length)));
+        std::string digest(md5_hex(chunk));
+
+        ++m_chunks;
+        bool corrupt = m_options.corruptEvery > 0 && m_chunks % m_options.corruptEvery == 0;
+        bool drop = !corrupt && m_options.dropEvery > 0 && m_chunks % m_options.dropEvery == 0;
+        if (corrupt) {
+            chunk[0] = static_cast<char>(chunk[0] ^ 0xFF);
+            ++m_corrupted;
+        }
+        std::string path("upload/chunk?session=" + m_session + "&offset=" + std::to_string(offset));
+        Response response;
+        bool answered = request(path, chunk, digest, response, drop);
+        m_bytesSent += drop ? chunk.size()/2 : chunk.size();
+        if (drop) {
+            ++m_dropped;
+            if (!m_options.quiet) printf("chunk at %lld dropped; forgetting session\n", static_cast<long long>(offset));
+            m_session.clear();
+            m_missing.clear();
+            return false;
+        }
+        if (!answered) return false;
+        if (response.status == 404) {
+            // The session has expired on the server, so it has to be opened again
+            m_session.clear();
+            return false;
+        }
+        if (response.status != 200 || !json_ranges(response.body, "missing", m_missing)) {
+            std::cerr << "error: chunk at " << offset << " rejected (status " << response.status << ").\n";
+            return false;
+        }
+        std::string status(json_string(response.body, "status"));
+        if (status != "success") {
+            if (!m_options.quiet) {
+                printf("chunk at %lld reported as %s%s\n", static_cast<long long>(offset), status.c_str(),
+                       corrupt ? " (corrupted)" : "");
+            }
+            return false;
+        }
+        if (corrupt) {
+            std::cerr << "error: server accepted corrupted chunk at " << offset << ".\n";
+            return false;
+        }
+        return true;
+    }
+
+    /// Commit the upload once the server has all of the file.  If the server still has ranges missing, they
+    /// are sent before trying again; if the whole file fails its digest check, the session is dropped so
+    /// that the file is sent again from the start.
+    ///
+    /// \param state    (Out) State of the upload after the commit
+    /// \return True if the server answered the commit, otherwise False
+
+    bool commitSession(State& state)
+    {
+        state = CONTINUE;
+        Response response;
+        if (!request("upload/commit?session=" + m_session, std::string(), std::string(), response)) return false;
+        if (response.status == 404) {
+            m_session.clear();
+            return false;
+        }
+        std::string status(json_string(response.body, "status"));
+        if (response.status != 200) {
+            std::cerr << "error: commit failed (status " << response.status << ").\n";
+            return false;
+        }
+        if (status == "success") {
+            state = COMPLETE;
+        } else if (status == "incomplete") {
+            json_ranges(response.body, "missing", m_missing);
+        } else {
+            std::cerr << "error: server reported \"" << status << "\" for the whole file.\n";
+            m_session.clear();
+            return false;
+        }
+        return true;
+    }
+};
+
+/// Read the whole of a file into memory.
+///
+/// \param filename Name of the file to read
+/// \param data     (Out) Contents of the file
+/// \return True if the file was read, otherwise False
+
+bool read_file(std::string const& filename, std::string& data)
+{
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if (!in) return false;
+    std::ostringstream contents;
+    contents << in.rdbuf();
+    data = contents.str();
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!check_options(argc, argv, options))
+        return 1;
+
+    std::string data;
+    if (!options.input.empty()) {
+        if (!read_file(options.input, data) || data.empty()) {
+            std::cerr << "error: failed to read input file \"" << options.input << "\".\n";
+            return 1;
+        }
+    } else {
+        std::mt19937 generator(options.size);
+        data.resize(options.size);
+        for (size_t n = 0; n < data.size(); ++n) data[n] = static_cast<char>(generator() & 0xFF);
+    }
+
+    SSL_CTX *context = SSL_CTX_new(TLS_client_method());
+    if (context == nullptr || SSL_CTX_load_verify_locations(context, options.caCert.c_str(), nullptr) != 1) {
+        std::cerr << "error: failed to load CA certificate \"" << options.caCert << "\".\n";
+        return 1;
+    }
+    SSL_CTX_set_verify(context, SSL_VERIFY_PEER, nullptr);
+
+    Uploader uploader(context, options, data);
+    bool complete = uploader.Run();
+    SSL_CTX_free(context);
+    return complete ? 0 : 2;
+}
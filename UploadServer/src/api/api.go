@@ -82,3 +82,20 @@ type Status struct {
 type TransferResult struct {
 	Status string `json:"status"`
 }
+
+// An UploadRequest opens (or re-opens) a session for a resumable upload of a file in chunks.
+type UploadRequest struct {
+	File     uint   `json:"file"`
+	Size     int64  `json:"size"`
+	MD5      string `json:"md5"`
+	Encoding string `json:"encoding,omitempty"`
+}
+
+// An UploadResult reports the state of a resumable upload session after each request, with the
+// byte ranges [start, end) that the server still needs (only the first few are listed).
+type UploadResult struct {
+	Status  string     `json:"status"`
+	Session string     `json:"session,omitempty"`
+	Chunk   int64      `json:"chunk,omitempty"`
+	Missing [][2]int64 `json:"missing"`
+}
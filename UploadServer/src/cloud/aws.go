@@ -1,10 +1,10 @@
 package cloud
 
 import (
-	"bytes"
 	"context"
 	"encoding/json"
 	"errors"
+	"io"
 
 	"ccom.unh.edu/wibl-monitor/src/support"
 	"github.com/aws/aws-sdk-go-v2/aws"
@@ -79,12 +79,12 @@ func (c AWSInterface) DestinationExists(meta ObjectDescription) (bool, error) {
 	return exists, err
 }
 
-func (c AWSInterface) UploadFile(meta ObjectDescription, data []byte) error {
+func (c AWSInterface) UploadFile(meta ObjectDescription, data io.ReadSeeker) error {
 	support.Debugf("AWS-S3: transferring %s to bucket %s (%d bytes).\n", meta.Filename, meta.Destination, meta.FileSize)
 	_, err := c.S3Client.PutObject(context.TODO(), &s3.PutObjectInput{
 		Bucket: aws.String(meta.Destination),
 		Key:    aws.String(meta.Filename),
-		Body:   bytes.NewReader(data),
+		Body:   data,
 	})
 	if err != nil {
 		support.Errorf("Couldn't upload data to %v:%v. Here's why: %v\n",
@@ -1,6 +1,8 @@
 package cloud
 
 import (
+	"io"
+
 	"ccom.unh.edu/wibl-monitor/src/support"
 )
 
@@ -13,6 +15,6 @@ type ObjectDescription struct {
 type CloudInterface interface {
 	Configure(config *support.Config) error
 	DestinationExists(meta ObjectDescription) (bool, error)
-	UploadFile(meta ObjectDescription, data []byte) error
+	UploadFile(meta ObjectDescription, data io.ReadSeeker) error
 	PublishNotification(topic string, meta ObjectDescription) error
 }
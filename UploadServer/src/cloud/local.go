@@ -2,6 +2,7 @@ package cloud
 
 import (
 	"errors"
+	"io"
 
 	"ccom.unh.edu/wibl-monitor/src/support"
 )
@@ -29,12 +30,12 @@ func (dbg LocalInterface) DestinationExists(meta ObjectDescription) (bool, error
 	return true, nil
 }
 
-func (dbg LocalInterface) UploadFile(meta ObjectDescription, data []byte) error {
+func (dbg LocalInterface) UploadFile(meta ObjectDescription, data io.ReadSeeker) error {
 	if !dbg.Configured() {
 		return errors.New("interface not configured")
 	}
 	support.Debugf("DBGINT: request to upload to %q with key %q for data of length %d\n",
-		meta.Destination, meta.Filename, len(data))
+		meta.Destination, meta.Filename, meta.FileSize)
 	return nil
 }
 
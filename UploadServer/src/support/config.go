@@ -67,6 +67,16 @@ type CertParam struct {
 	CACertFile string `json:"ca_cert"`
 }
 
+// An UploadParam provides the parameters for resumable uploads: where to spool the chunks as they
+// arrive, the chunk size to ask loggers to use, and how long an idle session is kept (hours).  The
+// response delay (ms) holds back the reply to each chunk, to simulate a slow server when testing loggers.
+type UploadParam struct {
+	SpoolDir        string `json:"spool_dir"`
+	ChunkSize       int64  `json:"chunk_size"`
+	SessionLifetime int    `json:"session_lifetime"`
+	ResponseDelay   int    `json:"response_delay"`
+}
+
 // A LoggingParam provides all parameters required to configure logging.
 type LoggingParam struct {
 	Level           string `json:"level"`
@@ -87,6 +97,7 @@ type Config struct {
 	DB      DBParam      `json:"db"`
 	Cert    CertParam    `json:"cert"`
 	Logging LoggingParam `json:"logging"`
+	Upload  UploadParam  `json:"upload"`
 }
 
 // Generate a new Config object from a given JSON file.  Errors are returned
@@ -128,5 +139,8 @@ func NewDefaultConfig() *Config {
 	config.Logging.MaxBackups = 5
 	config.Logging.MaxAge = 1
 	config.Logging.CompressRotated = true
+	config.Upload.SpoolDir = "./spool"
+	config.Upload.ChunkSize = 64 * 1024
+	config.Upload.SessionLifetime = 24
 	return config
 }
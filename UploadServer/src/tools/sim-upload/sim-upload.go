@@ -25,19 +25,19 @@ func generate_data(pkt_size int) []byte {
 	return data
 }
 
-func generate_url(server string, port int) string {
-	return fmt.Sprintf("https://%s:%d/update", server, port)
+func generate_url(server string, port int, endpoint string) string {
+	return fmt.Sprintf("https://%s:%d/%s", server, port, endpoint)
 }
 
 func auth_token(ident string, password string) string {
 	return "Basic " + base64.StdEncoding.EncodeToString([]byte(ident+":"+password))
 }
 
-func simulate_upload(url string, data []byte, ident string, password string) error {
+func generate_client() (*http.Client, error) {
 	caCert, err := os.ReadFile("./certs/ca.crt")
 	if err != nil {
 		fmt.Printf("ERR: failed to read CA certificate for transport (%v).\n", err)
-		return err
+		return nil, err
 	}
 	caCertPool := x509.NewCertPool()
 	caCertPool.AppendCertsFromPEM(caCert)
@@ -49,6 +49,14 @@ func simulate_upload(url string, data []byte, ident string, password string) err
 			},
 		},
 	}
+	return client, nil
+}
+
+func simulate_upload(url string, data []byte, ident string, password string) error {
+	client, err := generate_client()
+	if err != nil {
+		return err
+	}
 	request, err := http.NewRequest("POST", url, bytes.NewBuffer(data))
 	if err != nil {
 		fmt.Printf("ERR: failed to geneate POST request structure (%v).\n", err)
@@ -91,6 +99,102 @@ func simulate_upload(url string, data []byte, ident string, password string) err
 	return nil
 }
 
+// Send a request as part of a resumable upload, and decode the server's report on the session.
+func upload_request(client *http.Client, url string, body []byte, digest string, ident string, password string) (api.UploadResult, error) {
+	var result api.UploadResult
+	request, err := http.NewRequest("POST", url, bytes.NewBuffer(body))
+	if err != nil {
+		return result, err
+	}
+	if len(digest) > 0 {
+		request.Header.Add("Digest", "md5="+digest)
+	}
+	request.Header.Add("Authorization", auth_token(ident, password))
+	request.Header.Set("Content-Type", "application/octet-stream")
+	request.ContentLength = (int64)(len(body))
+
+	response, err := client.Do(request)
+	if err != nil {
+		return result, err
+	}
+	defer response.Body.Close()
+	if response.StatusCode != http.StatusOK {
+		return result, fmt.Errorf("server responded with status %d", response.StatusCode)
+	}
+	err = json.NewDecoder(response.Body).Decode(&result)
+	return result, err
+}
+
+// Simulate a logger sending a file in chunks through a resumable upload session.  To exercise the
+// recovery paths, every fail-th chunk is sent with a corrupted body (so that it fails its digest) and
+// the client doesn't wait to see whether it was accepted; once all of the chunks have been sent once,
+// the session is re-opened (as a logger would after losing its connection) and the ranges that the
+// server reports as missing are re-sent until there are none left, and then the upload is committed.
+func simulate_resumable(server string, port int, data []byte, ident string, password string, fail int) error {
+	client, err := generate_client()
+	if err != nil {
+		return err
+	}
+	md5hash := fmt.Sprintf("%X", md5.Sum(data))
+	start, _ := json.Marshal(api.UploadRequest{File: 1, Size: int64(len(data)), MD5: md5hash})
+	session, err := upload_request(client, generate_url(server, port, "upload/start"), start, "", ident, password)
+	if err != nil {
+		fmt.Printf("ERR: failed to open upload session (%v).\n", err)
+		return err
+	}
+	fmt.Printf("INF: session %s open with chunk size %d.\n", session.Session, session.Chunk)
+
+	send := func(offset int64, corrupt bool) (api.UploadResult, error) {
+		end := offset + session.Chunk
+		if end > int64(len(data)) {
+			end = int64(len(data))
+		}
+		chunk := data[offset:end]
+		digest := fmt.Sprintf("%X", md5.Sum(chunk))
+		if corrupt {
+			chunk = append([]byte{chunk[0] ^ 0xFF}, chunk[1:]...)
+		}
+		url := generate_url(server, port, fmt.Sprintf("upload/chunk?session=%s&offset=%d", session.Session, offset))
+		return upload_request(client, url, chunk, digest, ident, password)
+	}
+
+	n := 0
+	for offset := int64(0); offset < int64(len(data)); offset += session.Chunk {
+		n++
+		if _, err := send(offset, fail > 0 && n%fail == 0); err != nil {
+			fmt.Printf("ERR: failed to send chunk at %d (%v).\n", offset, err)
+			return err
+		}
+	}
+
+	for attempt := 0; attempt < 10; attempt++ {
+		state, err := upload_request(client, generate_url(server, port, "upload/start"), start, "", ident, password)
+		if err != nil {
+			return err
+		}
+		if len(state.Missing) == 0 {
+			break
+		}
+		fmt.Printf("INF: resuming session %s with %d range(s) missing.\n", state.Session, len(state.Missing))
+		for _, r := range state.Missing {
+			for offset := r[0]; offset < r[1]; offset += session.Chunk {
+				if _, err := send(offset, false); err != nil {
+					return err
+				}
+			}
+		}
+	}
+
+	url := generate_url(server, port, "upload/commit?session="+session.Session)
+	result, err := upload_request(client, url, nil, "", ident, password)
+	if err != nil {
+		fmt.Printf("ERR: failed to commit upload session (%v).\n", err)
+		return err
+	}
+	fmt.Printf("INF: server reported %q for resumable upload.\n", result.Status)
+	return nil
+}
+
 func main() {
 	log.SetFlags(log.Lmicroseconds | log.Ldate)
 	fs := flag.NewFlagSet("uploader", flag.ExitOnError)
@@ -99,6 +203,8 @@ func main() {
 	pktSize := fs.Int("size", 100000, "Packet size to pass")
 	server := fs.String("server", "", "Upload server name/address")
 	port := fs.Int("port", 80, "Upload server port")
+	resumable := fs.Bool("resumable", false, "Use a resumable upload session rather than a single transfer")
+	fail := fs.Int("fail", 0, "Corrupt every N-th chunk of a resumable upload (0 for none)")
 
 	var err error
 	if err = fs.Parse(os.Args[1:]); err != nil {
@@ -110,11 +216,14 @@ func main() {
 		os.Exit(1)
 	}
 
-	server_url := generate_url(*server, *port)
-
 	packet := generate_data(*pktSize)
 
-	if err := simulate_upload(server_url, packet, *loggerID, *loggerPass); err != nil {
+	if *resumable {
+		err = simulate_resumable(*server, *port, packet, *loggerID, *loggerPass, *fail)
+	} else {
+		err = simulate_upload(generate_url(*server, *port, "update"), packet, *loggerID, *loggerPass)
+	}
+	if err != nil {
 		fmt.Printf("ERR: failed to upload to server (%v).\n", err)
 	}
 }
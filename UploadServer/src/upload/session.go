@@ -0,0 +1,305 @@
+/*! @file session.go
+ * @brief Resumable upload sessions for files sent from loggers in chunks
+ *
+ * Rather than sending a whole log file in a single request (which has to be re-sent from the start
+ * if the connection drops, and which the server has to hold in memory), a logger can open an upload
+ * session for a file, send it in chunks with offsets and per-chunk digests, and then commit it, at
+ * which point the whole-file digest is checked.  The chunks are written into a spool file on disk as
+ * they arrive, and the session keeps track of which byte ranges have been received, so that a logger
+ * that loses its connection (or restarts) can find out what's missing and carry on from there.
+ *
+ * Copyright (c) 2024, University of New Hampshire, Center for Coastal and Ocean Mapping.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+ * OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF
+ * OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+package upload
+
+import (
+	"crypto/md5"
+	"crypto/rand"
+	"errors"
+	"fmt"
+	"io"
+	"os"
+	"path/filepath"
+	"sort"
+	"strings"
+	"sync"
+	"time"
+)
+
+const (
+	DefaultChunkSize   = 64 * 1024 // Default size of chunk that loggers are asked to send
+	MaxMissingReported = 16        // Maximum number of missing ranges reported in a response
+)
+
+var (
+	ErrUnknownSession = errors.New("unknown upload session")
+	ErrBadRange       = errors.New("chunk is outside of the file")
+	ErrBadDigest      = errors.New("digest does not match contents")
+	ErrIncomplete     = errors.New("file is not complete")
+)
+
+// A Range is a half-open interval [Start, End) of bytes in a file.
+type Range struct {
+	Start int64
+	End   int64
+}
+
+// A Session tracks a single file being uploaded in chunks by a logger.
+type Session struct {
+	ID       string    // Identifier for the session (sent to the logger)
+	Logger   string    // Identifier of the logger sending the file
+	FileID   uint      // Logger's file number
+	Size     int64     // Total size of the file (bytes)
+	MD5      string    // Digest of the whole file (upper-case hex)
+	Encoding string    // Content encoding of the file (e.g., "gzip"), or empty
+	updated  time.Time // Time of the last activity on the session
+	spool    string    // Path of the spool file receiving the chunks
+	received []Range   // Ranges received so far, sorted and merged
+	mutex    sync.Mutex
+}
+
+// A Manager holds all of the sessions in progress, and the spool directory for them.
+type Manager struct {
+	directory string
+	chunk     int64
+	lifetime  time.Duration
+	sessions  map[string]*Session
+	mutex     sync.Mutex
+}
+
+// Generate a new session manager, spooling into the directory given (which is created if
+// required).  Zero values for the chunk size and lifetime give the defaults.
+func NewManager(directory string, chunk int64, lifetime time.Duration) (*Manager, error) {
+	if len(directory) == 0 {
+		directory = filepath.Join(os.TempDir(), "wibl-uploads")
+	}
+	if chunk <= 0 {
+		chunk = DefaultChunkSize
+	}
+	if lifetime <= 0 {
+		lifetime = 24 * time.Hour
+	}
+	if err := os.MkdirAll(directory, 0700); err != nil {
+		return nil, err
+	}
+	m := &Manager{
+		directory: directory,
+		chunk:     chunk,
+		lifetime:  lifetime,
+		sessions:  make(map[string]*Session),
+	}
+	return m, nil
+}
+
+// Provide the chunk size that loggers should use.
+func (m *Manager) ChunkSize() int64 {
+	return m.chunk
+}
+
+// Open a session for a file from a logger.  If there's already a session for the same file (same
+// number, size, and digest), it's returned as is so that the logger can resume; otherwise, a new
+// session is started with an empty spool file.
+func (m *Manager) Open(logger string, file uint, size int64, digest string, encoding string) (*Session, error) {
+	if size <= 0 {
+		return nil, ErrBadRange
+	}
+	digest = strings.ToUpper(digest)
+
+	m.mutex.Lock()
+	defer m.mutex.Unlock()
+	m.expire()
+	for _, s := range m.sessions {
+		if s.Logger == logger && s.FileID == file && s.Size == size && s.MD5 == digest && s.Encoding == encoding {
+			s.touch()
+			return s, nil
+		}
+	}
+
+	id, err := newID()
+	if err != nil {
+		return nil, err
+	}
+	s := &Session{
+		ID:       id,
+		Logger:   logger,
+		FileID:   file,
+		Size:     size,
+		MD5:      digest,
+		Encoding: encoding,
+		updated:  time.Now(),
+		spool:    filepath.Join(m.directory, id),
+	}
+	f, err := os.Create(s.spool)
+	if err != nil {
+		return nil, err
+	}
+	f.Close()
+	m.sessions[id] = s
+	return s, nil
+}
+
+// Find a session for the logger given.  Sessions belonging to other loggers aren't found.
+func (m *Manager) Find(logger string, id string) (*Session, error) {
+	m.mutex.Lock()
+	defer m.mutex.Unlock()
+	s, ok := m.sessions[id]
+	if !ok || s.Logger != logger {
+		return nil, ErrUnknownSession
+	}
+	return s, nil
+}
+
+// Remove a session, and its spool file.
+func (m *Manager) Remove(s *Session) {
+	m.mutex.Lock()
+	delete(m.sessions, s.ID)
+	m.mutex.Unlock()
+	os.Remove(s.spool)
+}
+
+// Remove any sessions that haven't been used for longer than the session lifetime (the caller
+// must hold the manager's lock).
+func (m *Manager) expire() {
+	limit := time.Now().Add(-m.lifetime)
+	for id, s := range m.sessions {
+		s.mutex.Lock()
+		stale := s.updated.Before(limit)
+		s.mutex.Unlock()
+		if stale {
+			delete(m.sessions, id)
+			os.Remove(s.spool)
+		}
+	}
+}
+
+func (s *Session) touch() {
+	s.mutex.Lock()
+	s.updated = time.Now()
+	s.mutex.Unlock()
+}
+
+// Write a chunk of the file at the offset given, checking the digest of the chunk (upper- or
+// lower-case hex MD5) first.  Chunks can arrive in any order, and can overlap ones already
+// received (e.g., if the logger didn't see the response to a chunk before its connection dropped).
+func (s *Session) WriteChunk(offset int64, data []byte, digest string) error {
+	if offset < 0 || offset+int64(len(data)) > s.Size || len(data) == 0 {
+		return ErrBadRange
+	}
+	if !strings.EqualFold(fmt.Sprintf("%X", md5.Sum(data)), digest) {
+		return ErrBadDigest
+	}
+
+	s.mutex.Lock()
+	defer s.mutex.Unlock()
+	f, err := os.OpenFile(s.spool, os.O_WRONLY, 0600)
+	if err != nil {
+		return err
+	}
+	if _, err = f.WriteAt(data, offset); err != nil {
+		f.Close()
+		return err
+	}
+	if err = f.Close(); err != nil {
+		return err
+	}
+	s.received = merge(s.received, Range{Start: offset, End: offset + int64(len(data))})
+	s.updated = time.Now()
+	return nil
+}
+
+// Report the ranges of the file that haven't been received yet, up to the maximum number that's
+// reported in a response.
+func (s *Session) Missing() []Range {
+	s.mutex.Lock()
+	defer s.mutex.Unlock()
+	missing := make([]Range, 0)
+	next := int64(0)
+	for _, r := range s.received {
+		if r.Start > next {
+			missing = append(missing, Range{Start: next, End: r.Start})
+		}
+		next = r.End
+	}
+	if next < s.Size {
+		missing = append(missing, Range{Start: next, End: s.Size})
+	}
+	if len(missing) > MaxMissingReported {
+		missing = missing[:MaxMissingReported]
+	}
+	return missing
+}
+
+// Check that the whole file has been received, and that it matches the digest given when the session
+// was opened.  If so, the spool file is returned, open for reading from the start; the caller needs to
+// close it, and remove the session when it's finished with it.
+func (s *Session) Commit() (*os.File, error) {
+	if len(s.Missing()) > 0 {
+		return nil, ErrIncomplete
+	}
+	s.mutex.Lock()
+	defer s.mutex.Unlock()
+	f, err := os.Open(s.spool)
+	if err != nil {
+		return nil, err
+	}
+	hash := md5.New()
+	if _, err = io.Copy(hash, f); err != nil {
+		f.Close()
+		return nil, err
+	}
+	if fmt.Sprintf("%X", hash.Sum(nil)) != s.MD5 {
+		f.Close()
+		// The file's not going to get any better, so start again
+		s.received = nil
+		return nil, ErrBadDigest
+	}
+	if _, err = f.Seek(0, io.SeekStart); err != nil {
+		f.Close()
+		return nil, err
+	}
+	return f, nil
+}
+
+// Add a range into a sorted list of non-overlapping ranges, merging any that overlap or abut.
+func merge(ranges []Range, r Range) []Range {
+	ranges = append(ranges, r)
+	sort.Slice(ranges, func(i, j int) bool { return ranges[i].Start < ranges[j].Start })
+	merged := ranges[:1]
+	for _, next := range ranges[1:] {
+		last := &merged[len(merged)-1]
+		if next.Start <= last.End {
+			if next.End > last.End {
+				last.End = next.End
+			}
+		} else {
+			merged = append(merged, next)
+		}
+	}
+	return merged
+}
+
+// Generate a random identifier for a session.
+func newID() (string, error) {
+	b := make([]byte, 16)
+	if _, err := rand.Read(b); err != nil {
+		return "", err
+	}
+	return fmt.Sprintf("%x", b), nil
+}
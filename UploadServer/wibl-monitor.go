@@ -35,9 +35,11 @@
 
 /*
 Wibl-monitor demonstrates the server end of the WIBL logger upload protocol.
-The code generates an HTTP server with two end-points:
+The code generates an HTTP server with end-points:
   - checkin, which is used by loggers to report status information (and check the server is accessible)
   - update, which is used by loggers to transfer files for processing
+  - upload/start, upload/chunk, and upload/commit, which are used by loggers to transfer files in
+    chunks that can be resumed if the connection is lost
 
 Usage:
 
@@ -54,6 +56,8 @@ bringing it up on a non-constrained port (see support/config.go for details).
 package main
 
 import (
+	"bytes"
+	"compress/gzip"
 	"crypto/md5"
 	"encoding/json"
 	"flag"
@@ -61,17 +65,21 @@ import (
 	"io"
 	"net/http"
 	"os"
+	"path/filepath"
+	"strconv"
 	"strings"
 	"time"
 
 	"ccom.unh.edu/wibl-monitor/src/api"
 	"ccom.unh.edu/wibl-monitor/src/cloud"
 	"ccom.unh.edu/wibl-monitor/src/support"
+	"ccom.unh.edu/wibl-monitor/src/upload"
 
 	"github.com/google/uuid"
 )
 
 var server_config *support.Config
+var uploads *upload.Manager
 
 func main() {
 	fs := flag.NewFlagSet("monitor", flag.ExitOnError)
@@ -109,11 +117,21 @@ func main() {
 		os.Exit(1)
 	}
 
+	uploads, err = upload.NewManager(server_config.Upload.SpoolDir, server_config.Upload.ChunkSize,
+		time.Duration(server_config.Upload.SessionLifetime)*time.Hour)
+	if err != nil {
+		support.Errorf("failed to set up spool directory for resumable uploads (%v)\n", err)
+		os.Exit(1)
+	}
+
 	mux := http.NewServeMux()
 	mux.HandleFunc("/", syntax)
 	mux.HandleFunc("/robots.txt", robots)
 	mux.HandleFunc("/checkin", support.BasicAuth(status_updates, db))
 	mux.HandleFunc("/update", support.BasicAuth(file_transfer, db))
+	mux.HandleFunc("/upload/start", support.BasicAuth(upload_start, db))
+	mux.HandleFunc("/upload/chunk", support.BasicAuth(upload_chunk, db))
+	mux.HandleFunc("/upload/commit", support.BasicAuth(upload_commit, db))
 
 	srv := &http.Server{
 		Addr:         address,
@@ -134,6 +152,9 @@ func main() {
 func syntax(w http.ResponseWriter, r *http.Request) {
 	fmt.Fprintf(w, "checkin\n")
 	fmt.Fprintf(w, "update\n")
+	fmt.Fprintf(w, "upload/start\n")
+	fmt.Fprintf(w, "upload/chunk\n")
+	fmt.Fprintf(w, "upload/commit\n")
 	support.LogAccess(r, http.StatusOK)
 }
 
@@ -177,13 +198,66 @@ func status_updates(w http.ResponseWriter, r *http.Request) {
 	support.LogAccess(r, http.StatusOK)
 }
 
+// Decompress a gzip-encoded file body from the logger.
+func decompress(body []byte) ([]byte, error) {
+	reader, err := gzip.NewReader(bytes.NewReader(body))
+	if err != nil {
+		return nil, err
+	}
+	defer reader.Close()
+	return io.ReadAll(reader)
+}
+
+// Send a file from a logger on to the cloud service configured, and publish a notification that
+// it's arrived.  The files from the logger have a standard name ("wibl-raw.X") and therefore we need
+// to adjust the name here to make sure that we don't stamp all over another logger's output when we
+// upload to the S3 bucket.  On failure, the HTTP status to report is returned with the error.
+func store_file(data io.ReadSeeker, size int) (int, error) {
+	file_uuid, err := uuid.NewUUID()
+	if err != nil {
+		return http.StatusBadRequest, fmt.Errorf("failed to generate file UUID: %v", err)
+	}
+
+	var service cloud.CloudInterface
+	switch server_config.Cloud.Provider {
+	case "debug":
+		service = new(cloud.LocalInterface)
+	case "aws":
+		service = new(cloud.AWSInterface)
+	default:
+		return http.StatusInternalServerError, fmt.Errorf("cloud provider not known (configuration issue)")
+	}
+
+	if err := service.Configure(server_config); err != nil {
+		return http.StatusInternalServerError, fmt.Errorf("failed to configure cloud interface: %v", err)
+	}
+	meta := cloud.ObjectDescription{
+		Destination: server_config.AWS.UploadBucket,
+		Filename:    file_uuid.String() + ".wibl",
+		FileSize:    size,
+	}
+	if exists, err := service.DestinationExists(meta); err != nil {
+		return http.StatusInternalServerError, fmt.Errorf("BucketExists failed: %v", err)
+	} else if !exists {
+		return http.StatusInternalServerError, fmt.Errorf("upload bucket does not exist - check config")
+	}
+	if err = service.UploadFile(meta, data); err != nil {
+		return http.StatusInternalServerError, fmt.Errorf("upload to bucket %v failed: %v", server_config.AWS.UploadBucket, err)
+	}
+	if err = service.PublishNotification(server_config.AWS.SNSTopic, meta); err != nil {
+		return http.StatusInternalServerError, fmt.Errorf("failed to notify SNS topic of converted file: %v", err)
+	}
+	return http.StatusOK, nil
+}
+
 // Accept a file transfer from the logger client (which should contain a binary-encoded body
 // with the WIBL raw file).  The client must specify the Content-Length header, the Digest header
 // (with the MD5 hash of the contents of the body of the request), and the Authentication header
 // with type "Basic" and the upload token specified by the server's operator when the logger was
-// configured as a (very simple, and not terribly secure, identification mechanism).  The server
-// responds with a JSON body containing only a "status" tag with either "success" or "failure" as
-// appropriate.
+// configured as a (very simple, and not terribly secure, identification mechanism).  If the logger
+// has compressed the file, it sets the Content-Encoding header to "gzip"; the digest is then of the
+// compressed body, and the file is decompressed before being sent on.  The server responds with a
+// JSON body containing only a "status" tag with either "success" or "failure" as appropriate.
 func file_transfer(w http.ResponseWriter, r *http.Request) {
 	var body []byte
 	var err error
@@ -220,63 +294,20 @@ func file_transfer(w http.ResponseWriter, r *http.Request) {
 		result.Status = "failure"
 	} else {
 		support.Infof("TRANS: successful recomputation of MD5 hash for transmitted contents.\n")
-		result.Status = "success"
-		// The files from the logger have a standard name ("wibl-raw.X") and therefore we need to adjust
-		// the name here to make sure that we don't stamp all over another logger's output when we upload
-		// to the S3 bucket.
-		file_uuid, err := uuid.NewUUID()
-		if err != nil {
-			support.LogAccess(r, http.StatusBadRequest)
-			support.Errorf("TRANS: Failed to generate file UUID: %v", err)
-			w.WriteHeader(http.StatusBadRequest)
-			return
-		}
-
-		var service cloud.CloudInterface
-		switch server_config.Cloud.Provider {
-		case "debug":
-			service = new(cloud.LocalInterface)
-		case "aws":
-			service = new(cloud.AWSInterface)
-		default:
-			support.LogAccess(r, http.StatusInternalServerError)
-			support.Errorf("TRANS: cloud provider not known (configuration issue).\n")
-			w.WriteHeader(http.StatusInternalServerError)
-			return
+		if strings.EqualFold(r.Header.Get("Content-Encoding"), "gzip") {
+			if body, err = decompress(body); err != nil {
+				support.LogAccess(r, http.StatusBadRequest)
+				support.Errorf("TRANS: failed to decompress file from logger: %v\n", err)
+				w.WriteHeader(http.StatusBadRequest)
+				return
+			}
+			support.Debugf("TRANS: File from logger decompressed to %d bytes.\n", len(body))
 		}
-
-		if err := service.Configure(server_config); err != nil {
-			support.LogAccess(r, http.StatusInternalServerError)
-			support.Errorf("TRANS: failed to configure cloud interface.")
-			w.WriteHeader(http.StatusInternalServerError)
-			return
-		}
-		meta := cloud.ObjectDescription{
-			Destination: server_config.AWS.UploadBucket,
-			Filename:    file_uuid.String() + ".wibl",
-			FileSize:    len(body),
-		}
-		if exists, err := service.DestinationExists(meta); err != nil {
-			support.LogAccess(r, http.StatusInternalServerError)
-			support.Errorf("TRANS: BucketExists failed: %v", err)
-			w.WriteHeader(http.StatusInternalServerError)
-			return
-		} else if !exists {
-			support.LogAccess(r, http.StatusInternalServerError)
-			support.Errorf("TRANS: Upload bucket does not exist - check config: %v", err)
-			w.WriteHeader(http.StatusInternalServerError)
-			return
-		}
-		if err = service.UploadFile(meta, body); err != nil {
-			support.LogAccess(r, http.StatusInternalServerError)
-			support.Errorf("TRANS: Upload to bucket %v failed: %v", server_config.AWS.UploadBucket, err)
-			w.WriteHeader(http.StatusInternalServerError)
-			return
-		}
-		if err = service.PublishNotification(server_config.AWS.SNSTopic, meta); err != nil {
-			support.LogAccess(r, http.StatusInternalServerError)
-			support.Errorf("TRANS: Failed to notify SNS topic of converted file: %v", err)
-			w.WriteHeader(http.StatusInternalServerError)
+		result.Status = "success"
+		if status, err := store_file(bytes.NewReader(body), len(body)); err != nil {
+			support.LogAccess(r, status)
+			support.Errorf("TRANS: %v\n", err)
+			w.WriteHeader(status)
 			return
 		}
 	}
@@ -292,3 +323,192 @@ func file_transfer(w http.ResponseWriter, r *http.Request) {
 	w.Write(result_string)
 	support.LogAccess(r, http.StatusOK)
 }
+
+// Convert the ranges that a session is still missing into the form used in the API.
+func missing_ranges(s *upload.Session) [][2]int64 {
+	missing := make([][2]int64, 0)
+	for _, m := range s.Missing() {
+		missing = append(missing, [2]int64{m.Start, m.End})
+	}
+	return missing
+}
+
+// Send the state of a resumable upload back to the logger.
+func send_upload_result(w http.ResponseWriter, r *http.Request, result api.UploadResult) {
+	result_string, err := json.Marshal(result)
+	if err != nil {
+		support.LogAccess(r, http.StatusInternalServerError)
+		support.Errorf("UPLOAD: failed to marshal response as JSON: %s\n", err)
+		w.WriteHeader(http.StatusInternalServerError)
+		return
+	}
+	support.Debugf("UPLOAD: sending |%s| to logger as response.\n", result_string)
+	w.Header().Set("Content-Type", "application/json")
+	w.Write(result_string)
+	support.LogAccess(r, http.StatusOK)
+}
+
+// Find the upload session named in the request's "session" query parameter, which must belong to the
+// logger making the request.  If there isn't one, the response is sent here, and nil is returned.
+func find_session(w http.ResponseWriter, r *http.Request) *upload.Session {
+	logger, _, _ := r.BasicAuth()
+	s, err := uploads.Find(logger, r.URL.Query().Get("session"))
+	if err != nil {
+		support.LogAccess(r, http.StatusNotFound)
+		support.Errorf("UPLOAD: %v for logger %s.\n", err, logger)
+		w.WriteHeader(http.StatusNotFound)
+		return nil
+	}
+	return s
+}
+
+// Decompress a gzip-encoded file from a logger into a temporary file alongside it.  The result is
+// positioned at the start, and the caller needs to close and remove it when finished.
+func decompress_file(f *os.File) (*os.File, int64, error) {
+	reader, err := gzip.NewReader(f)
+	if err != nil {
+		return nil, 0, err
+	}
+	defer reader.Close()
+	out, err := os.CreateTemp(filepath.Dir(f.Name()), "inflate-*")
+	if err != nil {
+		return nil, 0, err
+	}
+	size, err := io.Copy(out, reader)
+	if err == nil {
+		_, err = out.Seek(0, io.SeekStart)
+	}
+	if err != nil {
+		out.Close()
+		os.Remove(out.Name())
+		return nil, 0, err
+	}
+	return out, size, nil
+}
+
+// Open (or re-open) a resumable upload session for a file from the logger.  The body of the request is
+// an UploadRequest with the logger's file number, the size and MD5 digest of the whole file as it will be
+// sent, and the content encoding ("gzip" if the logger is sending its compressed copy).  If the logger
+// already has a session for the same file (e.g., because it lost its connection part-way through) the
+// same session is returned, so the response's list of missing ranges tells the logger where to resume.
+func upload_start(w http.ResponseWriter, r *http.Request) {
+	var request api.UploadRequest
+
+	body, err := io.ReadAll(io.LimitReader(r.Body, 4096))
+	r.Body.Close()
+	if err == nil {
+		err = json.Unmarshal(body, &request)
+	}
+	if err != nil {
+		support.LogAccess(r, http.StatusBadRequest)
+		support.Errorf("UPLOAD: failed to read upload request: %s\n", err)
+		w.WriteHeader(http.StatusBadRequest)
+		return
+	}
+	logger, _, _ := r.BasicAuth()
+	s, err := uploads.Open(logger, request.File, request.Size, request.MD5, request.Encoding)
+	if err != nil {
+		support.LogAccess(r, http.StatusBadRequest)
+		support.Errorf("UPLOAD: failed to open session for file %d from logger %s: %v\n", request.File, logger, err)
+		w.WriteHeader(http.StatusBadRequest)
+		return
+	}
+	support.Infof("UPLOAD: session %s for file %d (%d bytes) from logger %s.\n", s.ID, s.FileID, s.Size, logger)
+	send_upload_result(w, r, api.UploadResult{Status: "open", Session: s.ID, Chunk: uploads.ChunkSize(), Missing: missing_ranges(s)})
+}
+
+// Accept a chunk of a file for a resumable upload session.  The request names the session and the offset
+// of the chunk in the file as query parameters ("session" and "offset"), and must have a Digest header with
+// the MD5 of the chunk (as for a whole-file transfer).  Chunks that fail their digest are not written; in
+// either case, the response gives the status of the chunk and the ranges still missing.
+func upload_chunk(w http.ResponseWriter, r *http.Request) {
+	s := find_session(w, r)
+	if s == nil {
+		return
+	}
+	offset, err := strconv.ParseInt(r.URL.Query().Get("offset"), 10, 64)
+	var data []byte
+	if err == nil {
+		data, err = io.ReadAll(http.MaxBytesReader(w, r.Body, uploads.ChunkSize()))
+		r.Body.Close()
+	}
+	if err != nil {
+		support.LogAccess(r, http.StatusBadRequest)
+		support.Errorf("UPLOAD: failed to read chunk for session %s: %v\n", s.ID, err)
+		w.WriteHeader(http.StatusBadRequest)
+		return
+	}
+	digest := r.Header.Get("Digest")
+	if n := strings.Index(digest, "="); n >= 0 {
+		digest = digest[n+1:]
+	}
+	if delay := server_config.Upload.ResponseDelay; delay > 0 {
+		// Simulating a slow server, for testing that loggers carry on logging while uploading
+		time.Sleep(time.Duration(delay) * time.Millisecond)
+	}
+
+	result := api.UploadResult{Status: "success", Session: s.ID}
+	if err = s.WriteChunk(offset, data, digest); err != nil {
+		if err != upload.ErrBadDigest {
+			support.LogAccess(r, http.StatusBadRequest)
+			support.Errorf("UPLOAD: failed to write chunk at %d for session %s: %v\n", offset, s.ID, err)
+			w.WriteHeader(http.StatusBadRequest)
+			return
+		}
+		support.Errorf("UPLOAD: chunk at %d for session %s failed digest check.\n", offset, s.ID)
+		result.Status = "failure"
+	}
+	result.Missing = missing_ranges(s)
+	send_upload_result(w, r, result)
+}
+
+// Complete a resumable upload session once all of the chunks have been sent.  The whole file is checked
+// against the digest given when the session was opened, decompressed if required, and then sent on to the
+// cloud service exactly as for a whole-file transfer.  The response status is "success" when the file has
+// been stored (at which point the session is removed), "incomplete" if there are still ranges missing, or
+// "failure" if the file doesn't match its digest (in which case the logger has to send it again).
+func upload_commit(w http.ResponseWriter, r *http.Request) {
+	s := find_session(w, r)
+	if s == nil {
+		return
+	}
+	result := api.UploadResult{Status: "success", Session: s.ID}
+	f, err := s.Commit()
+	if err != nil {
+		if err == upload.ErrIncomplete {
+			result.Status = "incomplete"
+		} else {
+			support.Errorf("UPLOAD: failed to commit session %s: %v\n", s.ID, err)
+			result.Status = "failure"
+		}
+		result.Missing = missing_ranges(s)
+		send_upload_result(w, r, result)
+		return
+	}
+	defer f.Close()
+
+	var data *os.File = f
+	size := s.Size
+	if strings.EqualFold(s.Encoding, "gzip") {
+		if data, size, err = decompress_file(f); err != nil {
+			support.LogAccess(r, http.StatusBadRequest)
+			support.Errorf("UPLOAD: failed to decompress file for session %s: %v\n", s.ID, err)
+			w.WriteHeader(http.StatusBadRequest)
+			uploads.Remove(s)
+			return
+		}
+		defer os.Remove(data.Name())
+		defer data.Close()
+		support.Debugf("UPLOAD: file for session %s decompressed to %d bytes.\n", s.ID, size)
+	}
+	if status, err := store_file(data, int(size)); err != nil {
+		support.LogAccess(r, status)
+		support.Errorf("UPLOAD: %v\n", err)
+		w.WriteHeader(status)
+		return
+	}
+	support.Infof("UPLOAD: session %s complete for file %d from logger %s.\n", s.ID, s.FileID, s.Logger)
+	uploads.Remove(s)
+	result.Missing = make([][2]int64, 0)
+	send_upload_result(w, r, result)
+}
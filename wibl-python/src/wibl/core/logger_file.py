@@ -96,6 +96,8 @@ class PacketTypes(Enum):
     RawIMU = 17
     ## Setup information JSON string for the current logger configuration
     Setup = 18
+    ## Performance metrics JSON string for the logger (storage, ingest, etc.)
+    Metrics = 19
 
 ## Convert from Kelvin to degrees Celsius
 #
@@ -1844,6 +1846,86 @@ class Setup(DataPacket):
         rtn = super().__str__() + f' {self.name()}: json = |{self.setup}|'
         return rtn
 
+## Implement a packet to store performance metrics for a logger
+#
+# The WIBL logger can periodically serialise a JSON-formatted dictionary of performance metrics (e.g., storage
+# latency and throughput) so that the behaviour of the logger can be reviewed alongside the data.  This packet
+# encapsulates that string; the dictionary includes 'elapsed', the logger's elapsed time (ms) when it was written.
+class Metrics(DataPacket):
+    ## Initialise the packet using either a bytes buffer from a file, or keywords ab initio
+    #
+    # If the keywords include "buffer", the code assumes that the contents of the buffer are a serialised
+    # version of the packet, and attempts to unpack it.  Otherwise, the code assumes that the keywords contain
+    # information required to initialise the packet, and attempts to pull them from the dictionary.
+    #
+    # \param self   Reference for the object
+    # \param kwargs Named arguments to initialise parameters, or "buffer" to unpack from binary data
+    def __init__(self, **kwargs):
+        if 'buffer' in kwargs:
+            self.buffer_constructor(kwargs['buffer'])
+        else:
+            self.data_constructor(**kwargs)
+
+    ## Construct for a serialised buffer of bytes
+    #
+    # The serialisation is a length word followed by a serialised JSON dictionary as a simple C-style string.
+    #
+    # \param self   Reference for the object
+    # \param buffer Binary buffer with serialised information for the packet
+    def buffer_constructor(self, buffer: bytes) -> None:
+        base = 0
+        metrics_len, = struct.unpack_from('<I', buffer, base)
+        base += 4
+        metrics, = struct.unpack_from(f'<{metrics_len}s', buffer, base)
+        self.metrics = json.loads(metrics)
+        super().__init__(0, 0.0, self.metrics.get('elapsed', 0))
+
+    ## Initialise the packet from keyword arguments
+    #
+    # For this packet, valid keywords are:
+    #   'metrics':  Dict containing JSON-serialisable metrics information
+    #
+    # \param self       Reference for the object
+    # \param **kwargs   Keyword dictionary with parameters for the packet
+    def data_constructor(self, **kwargs) -> None:
+        try:
+            self.metrics = kwargs['metrics']
+            super().__init__(0, 0.0, self.metrics.get('elapsed', 0))
+        except KeyError as e:
+            raise SpecificationError('Bad packet parameters') from e
+
+    ## Encode the current packet for serialisation
+    #
+    # \param self   Reference for the object
+    # \return Bytes array with the binary representation of the packet-specific parameters
+    def payload(self) -> bytes:
+        stringified = json.dumps(self.metrics).encode('UTF-8')
+        stringified_len = len(stringified)
+        buffer = struct.pack(f'<I{stringified_len}s', stringified_len, stringified)
+        return buffer
+
+    ## Provide the recognition ID for the packet, as used in the binary file
+    #
+    # \param self   Reference for the object
+    # \returns Integer identification number for the packet
+    def id(self) -> int:
+        return PacketTypes.Metrics.value
+
+    ## Provide the fixed-text string name for this data packet
+    #
+    # \param self   Reference for the object
+    # \return String with the name of the object
+    def name(self) -> str:
+        return 'Metrics'
+
+    ## Implement the printable interface for this class, allowing it to be streamed
+    #
+    # \param self   Reference for the object
+    # \return String representation of the object
+    def __str__(self) -> str:
+        rtn = super().__str__() + f' {self.name()}: json = |{self.metrics}|'
+        return rtn
+
 ## Translate packets out of the binary file, reconstituing as an appropriate class
 #
 # This provides the primary interface for the user to the binary data generated by the logger.  Calling the next_packet
@@ -1927,9 +2009,11 @@ class PacketFactory:
                 rtn = RawIMU(buffer=buffer)
             elif pkt_id == PacketTypes.Setup.value:
                 rtn = Setup(buffer=buffer)
+            elif pkt_id == PacketTypes.Metrics.value:
+                rtn = Metrics(buffer=buffer)
             else:
-                print(f"Unknown packet number {self.packets_read} with ID {pkt_id} and name "
-                      f"'{PacketTypes(pkt_id).name}' in input stream; ignored.")
+                # Note that the ID can't be converted to a PacketTypes name here, since it isn't one we know
+                print(f"Unknown packet number {self.packets_read} with ID {pkt_id} in input stream; ignored.")
                 rtn = None
         except struct.error as e:
             if self.strict_mode:
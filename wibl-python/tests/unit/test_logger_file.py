@@ -1,3 +1,5 @@
+import io
+import struct
 import unittest
 
 import xmlrunner
@@ -21,6 +23,16 @@ class TestLoggerFile(unittest.TestCase):
         self.assertAlmostEqual(171.88733854, lf.angle_to_degs(3))
         self.assertAlmostEqual(401.07045659, lf.angle_to_degs(7))
 
+    def test_metrics_packet(self):
+        metrics = {'elapsed': 60000, 'storage': {'rate': 1024.0, 'busy': 1.5}}
+        pkt = lf.Metrics(metrics=metrics)
+        payload = pkt.payload()
+        stream = io.BytesIO(struct.pack('<II', pkt.id(), len(payload)) + payload)
+        decoded = lf.PacketFactory(stream).next_packet()
+        self.assertIsInstance(decoded, lf.Metrics)
+        self.assertEqual(metrics, decoded.metrics)
+        self.assertEqual(60000, decoded.elapsed)
+
 
 if __name__ == '__main__':
     unittest.main(